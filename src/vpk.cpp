@@ -1,12 +1,16 @@
 // Guts of VPK loader
 #include <memory>
+#include <chrono>
 #include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
 
 #include "vpk.hpp"
 
 using namespace vpklib;
 
-constexpr size_t MAX_TOKEN_STRING = 512;
+constexpr size_t MAX_TOKEN_STRING = MAX_NAME_COMPONENT + 1;
 
 namespace vpklib {
 	namespace util {
@@ -25,36 +29,38 @@ namespace vpklib {
 
 			template<class T>
 			T read() {
+				if(pos + sizeof(T) > size)
+					throw std::out_of_range("read past the end of the buffer");
 				const T* dat = reinterpret_cast<const T*>(data + pos);
 				pos += sizeof(T);
 				return (*dat);
 			}
 
-			void read_string(char* buffer) {
-				while(data[pos] != 0) {
+			// Reads a NUL terminated string into a buffer of capacity bytes, terminator included
+			void read_string(char* buffer, size_t capacity) {
+				for(size_t i = 0; i < capacity; i++) {
 					if(pos >= size)
-						break;
-					(*buffer) = data[pos];
-					buffer++;
-					pos++;
+						throw std::out_of_range("string runs past the end of the buffer");
+					buffer[i] = data[pos++];
+					if(!buffer[i])
+						return;
 				}
-				pos++;
-				*buffer = 0;
+				throw std::out_of_range("string too long for the buffer");
 			}
 
 			size_t read_bytes(char* buffer, size_t num) {
-				if(num + pos >= size)
+				if(num + pos > size)
 					return 0;
 
-				std::memcpy(buffer, data, num);
+				std::memcpy(buffer, data + pos, num);
 				pos += num;
 				return num;
 			}
 
 			void set_pos(std::uint64_t pos) {
-				if(pos >= size)
-					throw std::out_of_range("set_pos called with value >= size");
-				pos = pos;
+				if(pos > size)
+					throw std::out_of_range("set_pos called with value > size");
+				this->pos = pos;
 			}
 
 			auto get_pos() {
@@ -75,17 +81,34 @@ namespace vpklib {
 
 		};
 
+		// pread() until the full range is read, retrying on short reads. Adds the number of calls made to calls
+		static bool pread_all(int fd, void* buffer, std::size_t size, std::uint64_t offset, std::uint64_t& calls) {
+			auto p = static_cast<char*>(buffer);
+			while(size > 0) {
+				calls++;
+				auto n = pread(fd, p, size, offset);
+				if(n < 0 && errno == EINTR)
+					continue;
+				if(n <= 0)
+					return false;
+				p += n;
+				size -= n;
+				offset += n;
+			}
+			return true;
+		}
+
+		static std::uint64_t nanoseconds_since(std::chrono::steady_clock::time_point start) {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		}
+
 	}
 }
 
 //---------------------------------------------------------------------------//
 
 vpk_archive::~vpk_archive() {
-	for(int i = 0; i < m_maxPakIndex; i++) {
-		if(m_fileHandles[i]) {
-			fclose(m_fileHandles[i]);
-		}
-	}
+	reset();
 }
 
 // Read VPK from memory
@@ -93,9 +116,6 @@ bool vpk_archive::read(const void* mem, size_t size) {
 
 	util::ReadContext stream(static_cast<const char*>(mem), size);
 
-	// Total size of file data contained within the _dir vpk
-	size_t dirFileDataSize = 0;
-
 	try
 	{
 		auto header = stream.read<vpk::Header>();
@@ -114,10 +134,15 @@ bool vpk_archive::read(const void* mem, size_t size) {
 		
 		auto sectionMD5Size = 0ull;
 		auto signatureSectionSize = 0ull;
+		auto otherMD5Size = 0ull;
+		// Total size of file data contained within the _dir vpk
+		auto fileDataSize = 0ull;
 		
 		if(header.version == 2) {
 			auto headerext = stream.read<vpk2::HeaderExt>();
+			fileDataSize = headerext.file_data_section_size;
 			sectionMD5Size = headerext.archive_md5_section_size;
+			otherMD5Size = headerext.other_md5_section_size;
 			signatureSectionSize = headerext.signature_section_size;
 		}
 
@@ -125,16 +150,20 @@ bool vpk_archive::read(const void* mem, size_t size) {
 		while(true) {
 			char extension[MAX_TOKEN_STRING];
 			*extension = 0;
-			stream.read_string(extension);
+			stream.read_string(extension, sizeof(extension));
 
 			if(!*extension)
 				break;
 
+			// Like directories, a single space stands for no extension
+			if (*extension == ' ' && !*(extension+1))
+				*extension = 0;
+
 			// Layer 2: Directory
 			while(true) {
 				char directory[MAX_TOKEN_STRING];
 				*directory = 0;
-				stream.read_string(directory);
+				stream.read_string(directory, sizeof(directory));
 
 				if(!*directory)
 					break;
@@ -143,11 +172,16 @@ bool vpk_archive::read(const void* mem, size_t size) {
 				if (*directory == ' ' && !*(directory+1))
 					*directory = 0;
 
+				vpk_directory_group group;
+				group.extension = extension;
+				group.directory = directory;
+				group.first = m_files.size();
+
 				// Layer 3: File name
 				while(true) {
 					char filename[MAX_TOKEN_STRING];
 					*filename = 0;
-					stream.read_string(filename);
+					stream.read_string(filename, sizeof(filename));
 
 					if(!*filename)
 						break;
@@ -166,7 +200,6 @@ bool vpk_archive::read(const void* mem, size_t size) {
 					// and the data is in _dir.vpk
 					if(dirent.archive_index == 0x7FFF) {
 						file->offset = dirent.entry_offset + headerSize + header.tree_size;
-						dirFileDataSize += file->length;
 					}
 					else {
 						// Wrap this in an else so we don't mistakenly create 0x7FFF handles
@@ -186,19 +219,34 @@ bool vpk_archive::read(const void* mem, size_t size) {
 					if (*directory)
 						fullName.append("/");
 					fullName.append(filename);
-					fullName.append(".");
-					fullName.append(extension);
-					m_handles.insert({fullName, key});
+					if(*extension) {
+						fullName.append(".");
+						fullName.append(extension);
+					}
+					m_index.insert(path_hash(fullName), key);
 
 					// Add to our shit dict
 					m_fileNames.push_back(fullName);
 				}
+
+				group.count = m_files.size() - group.first;
+				if(group.count)
+					m_groups.push_back(std::move(group));
 			}
 		}
+		rebuild_filter();
 		
+		m_treeSize = header.tree_size;
+		m_dataOffset = headerSize + header.tree_size;
+		// VPK1 has no sections after the file data
+		m_dataSize = version == 2 ? fileDataSize : size - std::min<std::uint64_t>(size, m_dataOffset);
+
 		// skip the file data stored in this VPK so we can read actually useful stuff
-		if(dirFileDataSize)
-			stream.set_pos(dirFileDataSize);
+		if(version == 2) {
+			m_archiveMD5Offset = m_dataOffset + fileDataSize;
+			m_archiveMD5Size = sectionMD5Size;
+			stream.set_pos(m_archiveMD5Offset);
+		}
 		
 		// Step 2: Post-dir tree and file data structures
 		
@@ -210,7 +258,8 @@ bool vpk_archive::read(const void* mem, size_t size) {
 		}
 		
 		// Read single OtherMD5Section
-		if(version == 2) {
+		if(version == 2 && otherMD5Size >= sizeof(vpk2::OtherMD5Section)) {
+			m_hasOtherMD5Section = true;
 			m_otherMD5Section = stream.read<vpk2::OtherMD5Section>();
 		}
 		
@@ -232,7 +281,18 @@ bool vpk_archive::read(const void* mem, size_t size) {
 		return false;
 	}
 	
-	m_fileHandles = std::make_unique<FILE*[]>(m_maxPakIndex+1);
+	m_fileHandles = std::make_unique<std::atomic<FILE*>[]>(m_maxPakIndex+1);
+
+	// Keep the per-archive counters from before a reload
+	if(m_maxPakIndex + 1u > m_archiveIoCount) {
+		auto counters = std::make_unique<ArchiveCounters[]>(m_maxPakIndex + 1);
+		for(std::size_t i = 0; i < m_archiveIoCount; i++) {
+			counters[i].reads.store(m_archiveIo[i].reads.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			counters[i].bytes.store(m_archiveIo[i].bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+		m_archiveIo = std::move(counters);
+		m_archiveIoCount = m_maxPakIndex + 1;
+	}
 	return true;
 
 }
@@ -247,45 +307,168 @@ vpk_archive* vpk_archive::read_from_disk(const std::filesystem::path& path) {
 
 	auto archive = new vpk_archive();
 	archive->m_baseArchiveName = basename;
-	archive->m_dirHandle = fopen(path.string().c_str(), "r");
-
-	if(!archive->m_dirHandle) {
-		delete archive;
-		return nullptr;
+	if(archive->load(path)) {
+		return archive;
 	}
 
-	fseek(archive->m_dirHandle, 0, SEEK_END);
-	auto size = ftell(archive->m_dirHandle);
+	delete archive;
+	return nullptr;
+}
+
+bool vpk_archive::load(const std::filesystem::path& path) {
+	const auto start = std::chrono::steady_clock::now();
+	m_io.syscalls.fetch_add(1, std::memory_order_relaxed);
+	m_dirHandle = fopen(path.string().c_str(), "r");
+	if(!m_dirHandle)
+		return false;
+	m_io.opens.fetch_add(1, std::memory_order_relaxed);
 
-	fseek(archive->m_dirHandle, 0, SEEK_SET);
-	auto data = std::make_unique<char*>(new char[size]);
-	fread(*data.get(), size, 1, archive->m_dirHandle);
+	fseek(m_dirHandle, 0, SEEK_END);
+	auto size = ftell(m_dirHandle);
 
-	if(archive->read(*data, size)) {
-		return archive;
+	fseek(m_dirHandle, 0, SEEK_SET);
+	auto data = std::make_unique<char[]>(size);
+	m_io.syscalls.fetch_add(1, std::memory_order_relaxed);
+	if(fread(data.get(), size, 1, m_dirHandle) != 1)
+		return false;
+
+	const bool ok = read(data.get(), size);
+	m_io.parse_ns.fetch_add(util::nanoseconds_since(start), std::memory_order_relaxed);
+	return ok;
+}
+
+void vpk_archive::reset() {
+	if(m_fileHandles) {
+		for(int i = 0; i <= m_maxPakIndex; i++) {
+			if(m_fileHandles[i])
+				fclose(m_fileHandles[i]);
+		}
 	}
+	m_fileHandles.reset();
+	if(m_dirHandle)
+		fclose(m_dirHandle);
+	m_dirHandle = nullptr;
+	m_maxPakIndex = 0;
+
+	m_dirty = false;
+	m_index.clear();
+	m_filter.clear();
+	m_fileNames.clear();
+	m_groups.clear();
+	m_files.clear();
+
+	m_archiveSectionEntries.clear();
+	m_hasOtherMD5Section = false;
+	m_signatureSection = {};
+
+	m_verifyOnRead.store(false, std::memory_order_relaxed);
+	m_chunkRefs.clear();
+	m_chunkStates.reset();
+
+	if(m_trace)
+		m_trace->clear();
+}
 
-	delete archive;
-	return nullptr;
+void vpk_archive::rebuild_filter() {
+	m_filter.reset(m_fileNames.size());
+	for(vpk_file_handle h = 0; h < m_fileNames.size(); h++) {
+		if(!m_files[h]->removed)
+			m_filter.insert(path_hash(m_fileNames[h]));
+	}
 }
 
 // Find file by name in the archive
 vpk_file_handle vpk_archive::find_file(const std::string& name) {
-	// TODO: Force the name to use POSIX style slashes?
-	auto it = m_handles.find(name);
-	if(it != m_handles.end()) {
-		return it->second;
-	}
-	else {
+	return lookup(name, false);
+}
+
+vpk_file_handle vpk_archive::find_file_nocase(std::string_view name) const {
+	return lookup(name, true);
+}
+
+vpk_file_handle vpk_archive::lookup(std::string_view name, bool ignoreCase) const {
+	m_lookups.fetch_add(1, std::memory_order_relaxed);
+	const auto hash = path_hash(name);
+	if(!m_filter.may_contain(hash)) {
+		m_filtered.fetch_add(1, std::memory_order_relaxed);
 		return INVALID_HANDLE;
 	}
+
+	auto handle = m_index.find(hash, [&](std::uint64_t h) {
+		return ignoreCase ? path_equal_nocase(m_fileNames[h], name) : m_fileNames[h] == name;
+	});
+	if(handle == INVALID_HANDLE)
+		m_falsePositives.fetch_add(1, std::memory_order_relaxed);
+	return handle;
+}
+
+vpk_lookup_stats vpk_archive::get_lookup_stats() const {
+	vpk_lookup_stats stats;
+	stats.lookups = m_lookups.load(std::memory_order_relaxed);
+	stats.filtered = m_filtered.load(std::memory_order_relaxed);
+	stats.false_positives = m_falsePositives.load(std::memory_order_relaxed);
+	stats.filter_bytes = m_filter.size_bytes();
+	return stats;
+}
+
+void vpk_archive::reset_lookup_stats() {
+	m_lookups.store(0, std::memory_order_relaxed);
+	m_filtered.store(0, std::memory_order_relaxed);
+	m_falsePositives.store(0, std::memory_order_relaxed);
+}
+
+vpk_io_stats vpk_archive::get_io_stats() const {
+	constexpr auto relaxed = std::memory_order_relaxed;
+	vpk_io_stats stats;
+
+	// A lookup is counted before its outcome, so under concurrent lookups the misses may be ahead for a moment
+	stats.lookups = m_lookups.load(relaxed);
+	stats.lookup_misses = std::min(stats.lookups, m_filtered.load(relaxed) + m_falsePositives.load(relaxed));
+	stats.lookup_hits = stats.lookups - stats.lookup_misses;
+
+	stats.file_reads = m_io.file_reads.load(relaxed);
+	stats.preload_only_reads = m_io.preload_only_reads.load(relaxed);
+	stats.pending_reads = m_io.pending_reads.load(relaxed);
+	stats.preload_bytes = m_io.preload_bytes.load(relaxed);
+	stats.syscalls = m_io.syscalls.load(relaxed);
+	stats.opens = m_io.opens.load(relaxed);
+	stats.handle_cache_hits = m_io.handle_cache_hits.load(relaxed);
+	stats.chunk_cache_hits = m_io.chunk_cache_hits.load(relaxed);
+	stats.chunk_hashes = m_io.chunk_hashes.load(relaxed);
+	stats.read_seconds = m_io.read_ns.load(relaxed) / 1e9;
+	stats.parse_seconds = m_io.parse_ns.load(relaxed) / 1e9;
+
+	for(std::size_t i = 0; i <= m_archiveIoCount; i++) {
+		const auto& counters = i < m_archiveIoCount ? m_archiveIo[i] : m_dirIo;
+		vpk_archive_io_stats a;
+		a.archive_index = i < m_archiveIoCount ? static_cast<std::int32_t>(i) : 0x7FFF;
+		a.reads = counters.reads.load(relaxed);
+		a.bytes = counters.bytes.load(relaxed);
+		stats.bytes_read += a.bytes;
+		if(a.reads)
+			stats.archives.push_back(a);
+	}
+	return stats;
+}
+
+void vpk_archive::reset_io_stats() {
+	reset_lookup_stats();
+	for(auto* counter : {&m_io.file_reads, &m_io.preload_only_reads, &m_io.pending_reads, &m_io.preload_bytes,
+		&m_io.syscalls, &m_io.opens, &m_io.handle_cache_hits, &m_io.chunk_cache_hits, &m_io.chunk_hashes,
+		&m_io.read_ns, &m_io.parse_ns})
+		counter->store(0, std::memory_order_relaxed);
+	for(std::size_t i = 0; i <= m_archiveIoCount; i++) {
+		auto& counters = i < m_archiveIoCount ? m_archiveIo[i] : m_dirIo;
+		counters.reads.store(0, std::memory_order_relaxed);
+		counters.bytes.store(0, std::memory_order_relaxed);
+	}
 }
 
 size_t vpk_archive::get_file_size(const std::string& name) {
 	return get_file_size(find_file(name));
 }
 
-size_t vpk_archive::get_file_size(vpk_file_handle handle) {
+size_t vpk_archive::get_file_size(vpk_file_handle handle) const {
 	if(handle == INVALID_HANDLE)
 		return 0;
 	const auto& file = m_files[handle];
@@ -296,7 +479,7 @@ size_t vpk_archive::get_file_preload_size(const std::string& name) {
 	return get_file_preload_size(find_file(name));
 }
 
-size_t vpk_archive::get_file_preload_size(vpk_file_handle handle) {
+size_t vpk_archive::get_file_preload_size(vpk_file_handle handle) const {
 	if(handle == INVALID_HANDLE)
 		return 0;
 	return m_files[handle]->preload_size;
@@ -329,48 +512,136 @@ std::tuple<void*, std::size_t> vpk_archive::get_file_data(vpk_file_handle handle
 	if(handle == INVALID_HANDLE)
 		return std::make_tuple(nullptr,0);
 
-	const auto& file = m_files[handle];
 	const auto fileSize = static_cast<std::size_t>(get_file_size(handle));
-	const auto preloadSize = get_file_preload_size(handle);
-	const auto totalSize = preloadSize + file->length;
-	auto data = static_cast<char*>(malloc(fileSize));
+	auto data = static_cast<char*>(malloc(fileSize ? fileSize : 1));
+
+	if(read_file_range(handle, 0, data, fileSize) != fileSize) {
+		free(data);
+		return std::make_tuple(nullptr, 0);
+	}
+
+	return std::make_tuple(data, fileSize);
+}
+
+size_t vpk_archive::get_file_data(vpk_file_handle handle, void* buffer, size_t bufferSize) {
+	return read_file_range(handle, 0, buffer, bufferSize);
+}
+
+size_t vpk_archive::get_file_data(const std::string& name, void* buffer, size_t bufferSize) {
+	return get_file_data(find_file(name), buffer, bufferSize);
+}
+
+FILE* vpk_archive::get_archive_handle(std::int32_t archiveIndex) {
+	// Handle the case where the data is in the _dir PAK
+	if(archiveIndex == 0x7FFF) {
+		m_io.handle_cache_hits.fetch_add(1, std::memory_order_relaxed);
+		return m_dirHandle;
+	}
+	if(archiveIndex < 0 || archiveIndex > m_maxPakIndex)
+		return nullptr;
+
+	auto handle = m_fileHandles[archiveIndex].load(std::memory_order_acquire);
+	if(handle) {
+		m_io.handle_cache_hits.fetch_add(1, std::memory_order_relaxed);
+		return handle;
+	}
 
 	// If handle is not open already, open it
-	if(!(m_fileHandles)[file->archive_index] && file->archive_index != 0x7FFF) {
+	std::lock_guard<std::mutex> lock(m_fileHandlesLock);
+	handle = m_fileHandles[archiveIndex].load(std::memory_order_relaxed);
+	if(!handle) {
 		char num[16] = {};
-		snprintf(num, sizeof(num), "_%03d.vpk", file->archive_index);
+		snprintf(num, sizeof(num), "_%03d.vpk", archiveIndex);
 		auto apath = m_baseArchiveName + num;
-		m_fileHandles[file->archive_index] = fopen(apath.c_str(), "r");
+		m_io.syscalls.fetch_add(1, std::memory_order_relaxed);
+		handle = fopen(apath.c_str(), "r");
+		if(handle)
+			m_io.opens.fetch_add(1, std::memory_order_relaxed);
+		m_fileHandles[archiveIndex].store(handle, std::memory_order_release);
 	}
+	else
+		m_io.handle_cache_hits.fetch_add(1, std::memory_order_relaxed);
+	return handle;
+}
 
-	// Handle the case where the data is in the _dir PAK
-	FILE* archHandle = nullptr;
-	if(file->archive_index == 0x7FFF) { 
-		archHandle = m_dirHandle;
+size_t vpk_archive::read_file_range(vpk_file_handle handle, std::uint64_t offset, void* buffer, size_t size) {
+	if(handle == INVALID_HANDLE || handle >= m_files.size())
+		return 0;
+
+	const auto& file = m_files[handle];
+	const std::uint64_t totalSize = file->preload_size + file->length;
+	if(offset >= totalSize)
+		return 0;
+	if(size > totalSize - offset)
+		size = totalSize - offset;
+
+	if(m_trace)
+		m_trace->record(handle, offset, size);
+	m_io.file_reads.fetch_add(1, std::memory_order_relaxed);
+
+	auto out = static_cast<char*>(buffer);
+	size_t copied = 0;
+
+	// Changed but not saved yet
+	if(file->pending_data) {
+		m_io.pending_reads.fetch_add(1, std::memory_order_relaxed);
+		std::memcpy(out, file->pending_data.get() + offset, size);
+		return size;
 	}
-	else {
-		archHandle = m_fileHandles[file->archive_index];
+
+	// Serve whatever we can out of the preload data first
+	if(offset < file->preload_size) {
+		copied = std::min<size_t>(size, file->preload_size - offset);
+		std::memcpy(out, file->preload_data.get() + offset, copied);
+		m_io.preload_bytes.fetch_add(copied, std::memory_order_relaxed);
+		if(copied == size)
+			m_io.preload_only_reads.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	if(!archHandle) {
-		return std::make_tuple(nullptr, 0);
+	if(copied < size) {
+		const auto bodyOffset = offset + copied - file->preload_size;
+		if(m_verifyOnRead.load(std::memory_order_relaxed)
+			&& !check_chunks(file->archive_index, file->offset + bodyOffset, size - copied))
+			return copied;
+		if(!read_archive_range(file->archive_index, file->offset + bodyOffset, out + copied, size - copied))
+			return copied;
+		copied = size;
 	}
+	return copied;
+}
 
-	// Read preload data into the buffer
-	get_file_preload_data(handle, data, preloadSize);
+vpk_archive::ArchiveCounters* vpk_archive::archive_counters(std::int32_t archiveIndex) {
+	if(archiveIndex == 0x7FFF)
+		return &m_dirIo;
+	if(archiveIndex < 0 || static_cast<std::size_t>(archiveIndex) >= m_archiveIoCount)
+		return nullptr;
+	return &m_archiveIo[archiveIndex];
+}
 
-	// Now run a fread to grab the rest of the data
-	fseek(archHandle, file->offset, SEEK_SET);
-	fread(data + preloadSize, file->length, 1, archHandle);
+bool vpk_archive::read_archive_range(std::int32_t archiveIndex, std::uint64_t offset, void* buffer, size_t size) {
+	auto archHandle = get_archive_handle(archiveIndex);
+	if(!archHandle)
+		return false;
 
-	return std::make_tuple(data, totalSize);
+	// pread doesn't touch the shared file position, so concurrent readers are fine
+	const auto start = std::chrono::steady_clock::now();
+	std::uint64_t calls = 0;
+	const bool ok = util::pread_all(fileno(archHandle), buffer, size, offset, calls);
+	m_io.read_ns.fetch_add(util::nanoseconds_since(start), std::memory_order_relaxed);
+	m_io.syscalls.fetch_add(calls, std::memory_order_relaxed);
+	if(auto counters = archive_counters(archiveIndex)) {
+		counters->reads.fetch_add(1, std::memory_order_relaxed);
+		if(ok)
+			counters->bytes.fetch_add(size, std::memory_order_relaxed);
+	}
+	return ok;
 }
 
 vpk_search vpk_archive::get_all_files() {
 	return vpk_search(0, m_files.size(), this);
 }
 
-std::string vpk_archive::get_file_name(vpk_file_handle handle) {
+std::string vpk_archive::get_file_name(vpk_file_handle handle) const {
 	if(handle == INVALID_HANDLE || handle >= m_fileNames.size())
 		return "";
 	return m_fileNames[handle];
@@ -443,7 +714,7 @@ std::uint16_t vpk_archive::get_file_archive_index(const std::string& name) {
 	return get_file_archive_index(find_file(name));
 }
 
-std::uint16_t vpk_archive::get_file_archive_index(vpk_file_handle handle) {
+std::uint16_t vpk_archive::get_file_archive_index(vpk_file_handle handle) const {
 	if(handle == INVALID_HANDLE)
 		return 0;
 	const auto& file = m_files[handle];
@@ -454,9 +725,19 @@ std::uint32_t vpk_archive::get_file_crc32(const std::string& name) {
 	return get_file_crc32(find_file(name));
 }
 
-std::uint32_t vpk_archive::get_file_crc32(vpk_file_handle handle) {
+std::uint32_t vpk_archive::get_file_crc32(vpk_file_handle handle) const {
 	if(handle == INVALID_HANDLE)
 		return 0;
 	const auto& file = m_files[handle];
 	return file->crc;
 }
+
+std::uint64_t vpk_archive::get_file_offset(const std::string& name) {
+	return get_file_offset(find_file(name));
+}
+
+std::uint64_t vpk_archive::get_file_offset(vpk_file_handle handle) const {
+	if(handle == INVALID_HANDLE)
+		return 0;
+	return m_files[handle]->offset;
+}
@@ -1,17 +1,27 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 #include <filesystem>
 #include <tuple>
 
+#include "vpk_bloom.hpp"
+#include "vpk_path_hash.hpp"
+#include "vpk_trace.hpp"
+
 namespace vpklib
 {
 	constexpr std::uint32_t VPK_SIGNATURE = 0x55AA1234;
 	constexpr std::uint16_t DIRECTORY_TERMINATOR = 0xFFFF;
 
+	// Longest extension, directory or file name the tree can hold. Readers keep each in a 512 byte buffer
+	constexpr std::size_t MAX_NAME_COMPONENT = 511;
+
 	using md5_t = char[16];
 	using byte = char;
 
@@ -107,6 +117,150 @@ namespace vpklib
 		};
 	}
 
+	/**
+	 * @brief A run of files sharing an extension and directory.
+	 * The directory tree is stored extension -> directory -> file, so every group covers a contiguous range of handles.
+	 */
+	struct vpk_directory_group
+	{
+		std::string extension;
+		std::string directory;	// Empty for files in the root
+		vpk_file_handle first;
+		vpk_file_handle count;
+	};
+
+	/**
+	 * @brief Options for vpk_archive::verify
+	 */
+	struct vpk_verify_options
+	{
+		unsigned threads = 0;				// 0 for all cores
+		std::size_t buffer_size = 1 << 20;	// Read size, one buffer per thread
+		std::uint64_t max_bytes_per_second = 0;	// Read rate limit shared by all threads, 0 for none
+		std::string checkpoint;				// If set, progress is saved to this file and a rerun resumes from it
+		double checkpoint_interval = 5;		// Seconds between checkpoint writes
+	};
+
+	struct vpk_verify_failure
+	{
+		vpk_file_handle handle;
+		std::uint32_t expected;	// CRC stored in the directory entry
+		std::uint32_t actual;	// CRC of the data, 0 on read error
+		bool read_error;
+	};
+
+	struct vpk_verify_result
+	{
+		std::uint64_t files = 0;	// Files checked
+		std::uint64_t bytes = 0;	// Bytes hashed, including preload data
+		double seconds = 0;			// Totals include the runs a checkpoint was resumed from
+		std::uint64_t resumed = 0;	// Files a checkpoint already had results for
+		std::vector<vpk_verify_failure> failures; // Sorted by handle
+
+		bool ok() const { return failures.empty(); };
+	};
+
+	struct vpk_md5_result
+	{
+		bool has_checksums = false;	// VPK1 archives have none
+		bool tree_ok = true;		// OtherMD5Section::tree_checksum
+		bool section_ok = true;		// OtherMD5Section::archive_md5_section_checksum
+		std::uint64_t chunks = 0;	// Chunks checked
+		std::uint64_t bytes = 0;	// Bytes hashed
+		double seconds = 0;			// Totals include the runs a checkpoint was resumed from
+		std::uint64_t resumed = 0;	// Chunks a checkpoint already had results for
+		std::vector<std::size_t> failed_chunks;		// Indices into get_archive_md5_entries()
+		std::vector<std::size_t> unreadable_chunks;
+
+		bool ok() const { return tree_ok && section_ok && failed_chunks.empty() && unreadable_chunks.empty(); };
+	};
+
+	/**
+	 * @brief Options for vpk_archive::save
+	 */
+	struct vpk_update_options
+	{
+		std::uint64_t max_archive_size = 200 << 20;	// Start a new _NNN.vpk rather than grow the last one past this
+		std::uint32_t md5_chunk_size = 1 << 20;		// Granularity of the MD5 entries added for new data
+	};
+
+	/**
+	 * @brief Options for vpk_archive::compact
+	 */
+	struct vpk_compact_options
+	{
+		std::uint64_t max_archive_size = 200 << 20;	// Largest _NNN.vpk to produce
+		std::uint32_t md5_chunk_size = 1 << 20;		// Granularity of the rebuilt archive MD5 section
+		unsigned threads = 0;						// 0 for all cores
+		std::vector<vpk_file_handle> order;			// Files to lay out first, in this order (ex: from an access trace).
+													// Everything else follows, grouped by directory
+	};
+
+	struct vpk_compact_result
+	{
+		bool ok = false;
+		std::string error;					// Set when !ok
+		std::uint64_t bytes_before = 0;		// Total size of the _NNN archives
+		std::uint64_t bytes_after = 0;
+		std::uint64_t live_bytes = 0;		// Data still referenced by the index
+		double fragmentation_before = 0;	// Fraction of distinct data ranges with dead space before them, in physical order
+		double fragmentation_after = 0;
+		std::uint32_t archives_after = 0;
+		double seconds = 0;
+	};
+
+	/**
+	 * @brief Name lookup counters, see vpk_archive::get_lookup_stats
+	 */
+	struct vpk_lookup_stats
+	{
+		std::uint64_t lookups = 0;
+		std::uint64_t filtered = 0;			// Misses rejected by the Bloom filter alone
+		std::uint64_t false_positives = 0;	// Misses that got past the filter and needed the full lookup
+		std::size_t filter_bytes = 0;
+
+		/**
+		 * @brief Fraction of misses the filter failed to reject
+		 */
+		double false_positive_rate() const {
+			const auto misses = filtered + false_positives;
+			return misses ? static_cast<double>(false_positives) / misses : 0.0;
+		}
+	};
+
+	/**
+	 * @brief Read counters for one archive file, see vpk_io_stats
+	 */
+	struct vpk_archive_io_stats
+	{
+		std::int32_t archive_index = 0;	// 0x7FFF for data stored in the _dir
+		std::uint64_t reads = 0;		// Read requests, each one or more pread calls
+		std::uint64_t bytes = 0;
+	};
+
+	/**
+	 * @brief I/O and cache counters, see vpk_archive::get_io_stats
+	 */
+	struct vpk_io_stats
+	{
+		std::uint64_t lookups = 0;				// find_file and find_file_nocase calls
+		std::uint64_t lookup_hits = 0;
+		std::uint64_t lookup_misses = 0;
+		std::uint64_t file_reads = 0;			// read_file_range calls, which get_file_data and the read pipeline go through
+		std::uint64_t preload_only_reads = 0;	// File reads served from preload data alone, without I/O
+		std::uint64_t pending_reads = 0;		// File reads served from changes not saved yet
+		std::uint64_t preload_bytes = 0;		// Bytes copied out of preload data
+		std::uint64_t bytes_read = 0;			// Bytes read from the archive files, the sum of archives[].bytes
+		std::uint64_t syscalls = 0;				// pread calls (short read retries included), opens and the read of the _dir
+		std::uint64_t opens = 0;				// Archive files opened, the _dir included
+		std::uint64_t handle_cache_hits = 0;	// Reads that found their archive file already open
+		std::uint64_t chunk_cache_hits = 0;		// Verify-on-read chunk checks answered by an earlier hash
+		std::uint64_t chunk_hashes = 0;			// Verify-on-read chunks hashed
+		double read_seconds = 0;				// Time spent in pread, summed over threads
+		double parse_seconds = 0;				// Time spent reading and parsing the _dir, reloads included
+		std::vector<vpk_archive_io_stats> archives;	// Archives read from, by index, the _dir last
+	};
+
 	std::uint32_t get_vpk_version(const std::filesystem::path &path);
 	std::uint32_t get_vpk_version(const void* mem);
 
@@ -131,26 +285,113 @@ namespace vpklib
 			std::uint32_t length = 0;
 
 			bool dirty = false;
+			bool removed = false;
+			std::unique_ptr<byte[]> pending_data; // New contents of a dirty file, length bytes, until save()
 		};
 
 		bool m_dirty = false;
 		std::string m_baseArchiveName;
 
-		std::unordered_map<std::string, vpk_file_handle> m_handles;
+		path_index m_index;		// Folded name hash -> handle, serves exact and case-insensitive lookups alike
+		blocked_bloom m_filter;	// Over the same hashes, so most misses never reach m_index
+		mutable std::atomic<std::uint64_t> m_lookups = 0;
+		mutable std::atomic<std::uint64_t> m_filtered = 0;
+		mutable std::atomic<std::uint64_t> m_falsePositives = 0;
 		std::vector<std::string> m_fileNames; // TODO: Make this less garbage
+		std::vector<vpk_directory_group> m_groups;
 		std::vector<std::unique_ptr<File>> m_files;
 
-		FILE* m_dirHandle;
-		std::unique_ptr<FILE*[]> m_fileHandles; // List of all open file handles to the individual archives
+		// Counters behind get_io_stats, all relaxed. They outlive the reload done by save() and compact()
+		struct IoCounters
+		{
+			std::atomic<std::uint64_t> file_reads = 0;
+			std::atomic<std::uint64_t> preload_only_reads = 0;
+			std::atomic<std::uint64_t> pending_reads = 0;
+			std::atomic<std::uint64_t> preload_bytes = 0;
+			std::atomic<std::uint64_t> syscalls = 0;
+			std::atomic<std::uint64_t> opens = 0;
+			std::atomic<std::uint64_t> handle_cache_hits = 0;
+			std::atomic<std::uint64_t> chunk_cache_hits = 0;
+			std::atomic<std::uint64_t> chunk_hashes = 0;
+			std::atomic<std::uint64_t> read_ns = 0;
+			std::atomic<std::uint64_t> parse_ns = 0;
+		};
+		struct ArchiveCounters
+		{
+			std::atomic<std::uint64_t> reads = 0;
+			std::atomic<std::uint64_t> bytes = 0;
+		};
+		mutable IoCounters m_io;
+		ArchiveCounters m_dirIo;
+		std::unique_ptr<ArchiveCounters[]> m_archiveIo;	// By archive index. Only grows, so archives compacted away keep their counts
+		std::size_t m_archiveIoCount = 0;
+
+		FILE* m_dirHandle = nullptr;
+		std::unique_ptr<std::atomic<FILE*>[]> m_fileHandles; // List of all open file handles to the individual archives, opened lazily
+		std::mutex m_fileHandlesLock; // Serializes opening of m_fileHandles
 		std::uint16_t m_maxPakIndex = 0;
 
+		// Layout of the _dir file, kept around for the integrity checks
+		std::uint32_t m_treeSize = 0;
+		std::uint64_t m_dataOffset = 0;		// Start of file data stored in _dir, right after the tree
+		std::uint64_t m_dataSize = 0;		// Size of the file data stored in _dir
+		std::uint64_t m_archiveMD5Offset = 0;
+		std::uint64_t m_archiveMD5Size = 0;
+
 		std::vector<vpk2::ArchiveMD5SectionEntry> m_archiveSectionEntries;
+		bool m_hasOtherMD5Section = false;
 		vpk2::OtherMD5Section m_otherMD5Section;
 		vpk2::SignatureSection m_signatureSection;
 
+		// Verify-on-read: the MD5 chunks sorted by position, and what is known about each of them
+		struct ChunkRef
+		{
+			std::uint16_t archive_index;
+			std::uint64_t begin;	// Absolute offset in the archive file
+			std::uint32_t count;
+			std::size_t entry;		// Index into m_archiveSectionEntries
+		};
+		enum ChunkState : std::uint8_t { CHUNK_UNKNOWN, CHUNK_HASHING, CHUNK_GOOD, CHUNK_BAD };
+
+		std::atomic<bool> m_verifyOnRead = false;
+		std::vector<ChunkRef> m_chunkRefs;
+		std::unique_ptr<std::atomic<std::uint8_t>[]> m_chunkStates; // Indexed like m_archiveSectionEntries
+
+		std::unique_ptr<access_trace> m_trace; // Set while an access trace is being recorded
+
 	private:
 		bool read(const void* mem, size_t size);
 
+		// Opens and parses the _dir file. The archive must be empty (fresh or reset)
+		bool load(const std::filesystem::path& path);
+
+		// Drops everything read from disk and closes all handles, ready for load()
+		void reset();
+
+		// Resizes the name filter for the current file count and fills it again
+		void rebuild_filter();
+
+		// Shared by find_file and find_file_nocase
+		vpk_file_handle lookup(std::string_view name, bool ignoreCase) const;
+
+		// Writes a new _dir.vpk from m_files and the given MD5 section, publishes it with a rename and reloads.
+		// The rename is the commit point: committed (if not null) says whether it happened, even when false is
+		// returned because the reload failed. Shared by save() and compact()
+		bool publish(const std::string& md5Section, std::string* error, bool* committed = nullptr);
+
+		// Returns the counters for an archive index (0x7FFF for _dir), or null if it's out of range
+		ArchiveCounters* archive_counters(std::int32_t archiveIndex);
+
+		// Returns the handle of the archive the data is stored in, opening it if needed. Thread safe.
+		FILE* get_archive_handle(std::int32_t archiveIndex);
+
+		// Reads raw bytes from one of the archive files (0x7FFF for _dir). Thread safe.
+		bool read_archive_range(std::int32_t archiveIndex, std::uint64_t offset, void* buffer, size_t size);
+
+		// Makes sure every MD5 chunk overlapping the range has been validated, hashing the ones that weren't yet.
+		// Returns false if one of them is corrupt or can't be read. Thread safe.
+		bool check_chunks(std::int32_t archiveIndex, std::uint64_t offset, std::uint64_t size);
+
 	public:
 		~vpk_archive();
 	
@@ -174,6 +415,35 @@ namespace vpklib
 		 */
 		vpk_file_handle find_file(const std::string& name);
 
+		/**
+		 * @brief Finds a file ignoring ASCII case and slash direction, like the Source engine does.
+		 * Costs the same as find_file: names are indexed by a folded hash at load time and the query is
+		 * folded on the fly, without allocating. If several files only differ in case, the first one wins.
+		 * @param name Name of the file to look for, ex: Materials\Foo\Bar.VTF
+		 * @return vpk_file_handle INVALID_HANDLE if there is no such file
+		 */
+		vpk_file_handle find_file_nocase(std::string_view name) const;
+
+		/**
+		 * @brief Returns lookup counters for find_file since the archive was opened or the last reset_lookup_stats
+		 */
+		vpk_lookup_stats get_lookup_stats() const;
+		void reset_lookup_stats();
+
+		/**
+		 * @brief Returns a snapshot of the I/O and cache counters since the archive was opened or the last
+		 * reset_io_stats. The counters are relaxed atomics bumped on every lookup and read, so this can be
+		 * called while other threads are reading; the snapshot is then only approximately consistent.
+		 * Reads done by compact() through copy_file_range aren't counted.
+		 * @return vpk_io_stats
+		 */
+		vpk_io_stats get_io_stats() const;
+
+		/**
+		 * @brief Zeroes the I/O counters and the lookup counters (see reset_lookup_stats)
+		 */
+		void reset_io_stats();
+
 		/**
 		 * @brief Returns the base archive name
 		 * ex: myarchive in myarchive_dir.vpk
@@ -187,7 +457,7 @@ namespace vpklib
 		 * @return size_t Size in bytes of the file, including any preload data
 		 */
 		size_t get_file_size(const std::string& name);
-		size_t get_file_size(vpk_file_handle handle);
+		size_t get_file_size(vpk_file_handle handle) const;
 
 		/**
 		 * @brief Returns the size of the preload data associated with the specified file 
@@ -195,7 +465,7 @@ namespace vpklib
 		 * @return size_t Size of the preload data in bytes
 		 */
 		size_t get_file_preload_size(const std::string& name);
-		size_t get_file_preload_size(vpk_file_handle handle);
+		size_t get_file_preload_size(vpk_file_handle handle) const;
 
 		/**
 		 * @brief Returns the file preload data associated with the file
@@ -237,12 +507,35 @@ namespace vpklib
 		size_t get_file_data(vpk_file_handle handle, void* buffer, size_t bufferSize);
 		size_t get_file_data(const std::string& name, void* buffer, size_t bufferSize);
 
+		/**
+		 * @brief Copies a range of the file's data into the specified buffer.
+		 * Offsets are relative to the start of the file, including any preload data. Safe to call from multiple threads.
+		 * @param handle Handle to the file
+		 * @param offset Offset into the file to start reading at
+		 * @param buffer Target buffer
+		 * @param size Number of bytes to read
+		 * @return size_t Number of bytes copied. Less than size if the range crosses the end of the file or on read error
+		 */
+		size_t read_file_range(vpk_file_handle handle, std::uint64_t offset, void* buffer, size_t size);
+
 		/**
 		 * @brief Returns the number of files in this archive 
 		 * @return size_t 
 		 */
 		size_t get_file_count() const { return m_fileNames.size(); };
 
+		/**
+		 * @brief Returns the name table, indexed by handle
+		 * @return const std::vector<std::string>&
+		 */
+		const std::vector<std::string>& get_file_names() const { return m_fileNames; };
+
+		/**
+		 * @brief Returns the extension/directory groups of the tree, in handle order
+		 * @return const std::vector<vpk_directory_group>&
+		 */
+		const std::vector<vpk_directory_group>& get_directory_groups() const { return m_groups; };
+
 		/**
 		 * @brief Returns a generalized search that encompasses all files in the archive 
 		 * @return VPK2Search 
@@ -254,7 +547,7 @@ namespace vpklib
 		 * @param handle 
 		 * @return std::string 
 		 */
-		std::string get_file_name(vpk_file_handle handle);
+		std::string get_file_name(vpk_file_handle handle) const;
 
 		/**
 		 * @brief Finds all files in a directory
@@ -295,7 +588,16 @@ namespace vpklib
 		 * @return uint16_t Index
 		 */
 		std::uint16_t get_file_archive_index(const std::string& name);
-		std::uint16_t get_file_archive_index(vpk_file_handle handle);
+		std::uint16_t get_file_archive_index(vpk_file_handle handle) const;
+
+		/**
+		 * @brief Returns the offset of the file's non-preload data within the archive it is stored in.
+		 * Sorting by (archive index, offset) gives the physical read order.
+		 * @param name Path or handle to file
+		 * @return std::uint64_t Offset in bytes
+		 */
+		std::uint64_t get_file_offset(const std::string& name);
+		std::uint64_t get_file_offset(vpk_file_handle handle) const;
 		
 		/**
 		 * @brief Returns the file's CRC. NOTE: This returns the reported CRC 
@@ -303,7 +605,153 @@ namespace vpklib
 		 * @return std::uint32_t CRC32
 		 */
 		std::uint32_t get_file_crc32(const std::string& name);
-		std::uint32_t get_file_crc32(vpk_file_handle handle);
+		std::uint32_t get_file_crc32(vpk_file_handle handle) const;
+
+		/**
+		 * @brief Checks the CRC32 of each file's data (preload + body) against its directory entry.
+		 * Files are read in physical order, spread across threads.
+		 * With options.checkpoint set, progress is saved periodically and an interrupted scan picks up where it
+		 * stopped. The checkpoint is removed once the scan completes.
+		 * @param handles Files to check. The overload without handles checks every file
+		 * @param options Threading and buffer options
+		 * @return vpk_verify_result Mismatches, read errors and throughput
+		 */
+		vpk_verify_result verify(const vpk_verify_options& options = {});
+		vpk_verify_result verify(std::vector<vpk_file_handle> handles, const vpk_verify_options& options = {});
+
+		/**
+		 * @brief Returns the archive MD5 section, the list of checksummed chunks of the _NNN archives
+		 * @return const std::vector<vpk2::ArchiveMD5SectionEntry>& Empty for VPK1
+		 */
+		const std::vector<vpk2::ArchiveMD5SectionEntry>& get_archive_md5_entries() const { return m_archiveSectionEntries; };
+
+		/**
+		 * @brief Validates the VPK2 MD5 sections: every chunk listed in the archive MD5 section, the
+		 * tree checksum and the checksum of the archive MD5 section itself.
+		 * Chunks are hashed in parallel, several at once per thread with a multi-buffer MD5.
+		 * Checkpointing works as for verify(); only the chunk scan is resumed, the tree and section checks always run.
+		 * @param options Threading and buffer options
+		 * @return vpk_md5_result
+		 */
+		vpk_md5_result verify_md5(const vpk_verify_options& options = {});
+
+		/**
+		 * @brief Adds a file or replaces the contents of an existing one. The data is copied and held in memory
+		 * until save(). find_file and the data getters see the change right away, the name table and directory
+		 * groups are rebuilt by save().
+		 * @param name Path inside the archive
+		 * @param data New contents
+		 * @param size Size of the contents
+		 * @param error If not null, receives a description of the problem on failure
+		 * @return bool False if the name can't be stored in a VPK or the file is too large
+		 */
+		bool set_file_data(const std::string& name, const void* data, std::size_t size, std::string* error = nullptr);
+
+		/**
+		 * @brief Removes a file. Its handle reads as an empty file until save()
+		 * @param name Path inside the archive
+		 * @return bool False if there is no such file
+		 */
+		bool remove_file(const std::string& name);
+
+		/**
+		 * @brief Returns true if there are changes that haven't been saved
+		 */
+		bool is_dirty() const { return m_dirty; };
+
+		/**
+		 * @brief Writes pending changes in place.
+		 * New data is appended to the last _NNN.vpk (or new ones past options.max_archive_size) and MD5 entries
+		 * are added for just that data. Then the tree and MD5 sections are rebuilt into a new _dir.vpk, which
+		 * replaces the old one with an atomic rename, so readers see either the old or the new archive. Data of
+		 * replaced and removed files is left behind as dead space (see compact). The signature section is dropped.
+		 * Afterwards the archive is reloaded from disk, so handles may change. Not safe to call while other threads are reading.
+		 * @param options Archive size and MD5 chunking for the new data
+		 * @param error If not null, receives a description of the problem on failure
+		 * @return bool False on failure, in which case the archive on disk is unchanged
+		 */
+		bool save(const vpk_update_options& options = {}, std::string* error = nullptr);
+
+		/**
+		 * @brief Rewrites the _NNN archives so they hold only live data, in layout order.
+		 * Live ranges come from the index (ranges shared by several entries are copied once). The new archives are
+		 * filled in parallel with copy_file_range, falling back to read/write where the filesystem can't, then
+		 * the archive MD5 section is rebuilt and everything is published like save(). Data stored in _dir is kept
+		 * as is. There must be no unsaved changes.
+		 * The new archives get indices the current _dir doesn't reference (starting at 0 when those are free,
+		 * past the last archive otherwise), so the rename of the new _dir.vpk is the only commit point: until
+		 * then readers and a crash see the old archive intact. The old archives are deleted after the rename, so
+		 * other processes still using the old _dir can only read the archives they already had open.
+		 * The archive is reloaded afterwards, so file handles from before may no longer be valid.
+		 * @param options Layout order, archive size and threading
+		 * @return vpk_compact_result Sizes and fragmentation before and after
+		 */
+		vpk_compact_result compact(const vpk_compact_options& options = {});
+
+		/**
+		 * @brief Enables or disables verify-on-read for VPK2 archives.
+		 * While enabled, read_file_range and everything built on it (get_file_data, the read pipeline) first check
+		 * the archive MD5 chunks the read touches, and fail the read if one of them doesn't match. Results are
+		 * cached per chunk, so each chunk is hashed at most once for the lifetime of the archive.
+		 * Data not covered by any chunk is returned unchecked. Has no effect on VPK1 archives.
+		 * Must not be called while other threads are reading.
+		 * @param enable True to enable
+		 */
+		void set_verify_on_read(bool enable);
+		bool get_verify_on_read() const { return m_verifyOnRead.load(std::memory_order_relaxed); };
+
+		/**
+		 * @brief Returns the verify-on-read status of a chunk
+		 * @param entry Index into get_archive_md5_entries()
+		 * @return int 1 if validated, -1 if corrupt, 0 if not checked yet (or verify-on-read was never enabled)
+		 */
+		int get_chunk_status(std::size_t entry) const;
+
+		/**
+		 * @brief Starts recording an access trace, replacing any trace in progress.
+		 * Every read_file_range (and so get_file_data and the read pipeline) appends a record to a lock-free
+		 * ring buffer, which keeps the most recent capacity reads. Saving or compacting the archive renumbers
+		 * its files, so the records up to that point are dropped. Must not be called while other threads are reading.
+		 * @param capacity Number of records to keep, rounded up to a power of two
+		 */
+		void start_trace(std::size_t capacity = 1 << 16);
+
+		/**
+		 * @brief Stops recording and discards the trace. Must not be called while other threads are reading
+		 */
+		void stop_trace();
+
+		/**
+		 * @brief Returns the recorded reads, oldest first. Can be called while reads are going on
+		 */
+		std::vector<vpk_trace_record> get_trace() const;
+
+		/**
+		 * @brief Returns how many reads were recorded but no longer fit in the ring buffer
+		 */
+		std::uint64_t get_trace_dropped() const;
+
+		/**
+		 * @brief Writes the recorded reads to a text file, one "timestamp_ns offset length name" line
+		 * (tab separated) per read, oldest first. Names are used so the trace stays meaningful for other
+		 * builds of the archive.
+		 * @param path File to write
+		 * @param error If not null, receives a description of the problem on failure
+		 * @return bool False if the file can't be written
+		 */
+		bool write_trace(const std::filesystem::path& path, std::string* error = nullptr) const;
+
+		/**
+		 * @brief Loads a trace written by write_trace and returns this archive's files in the order they
+		 * were first read. Meant as the layout order for compact(), so files loaded together end up together.
+		 * @param path Trace file
+		 * @param order Receives the files, each once. Files never read are left out
+		 * @param unknown If not null, receives the number of traced names this archive doesn't contain
+		 * @param error If not null, receives a description of the problem on failure
+		 * @return bool False if the file can't be read or isn't a trace
+		 */
+		bool read_trace_order(const std::filesystem::path& path, std::vector<vpk_file_handle>& order,
+			std::size_t* unknown = nullptr, std::string* error = nullptr);
 
 	};
 
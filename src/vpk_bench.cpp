@@ -0,0 +1,463 @@
+// Benchmarks of the libvpk hot paths. Results are printed as JSON so runs can be compared across releases
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_corpus.hpp"
+#include "vpk_crc.hpp"
+#include "vpk_md5.hpp"
+#include "vpk_pipeline.hpp"
+#include "vpk_thread.hpp"
+
+#include "argparse.hpp"
+
+namespace {
+
+	using clock = std::chrono::steady_clock;
+
+	double seconds_since(clock::time_point start) {
+		return std::chrono::duration<double>(clock::now() - start).count();
+	}
+
+	const double MIB = 1024.0 * 1024.0;
+
+	// One benchmark's results, as a flat JSON object
+	struct bench_result
+	{
+		std::string name;
+		std::vector<std::pair<std::string, double>> metrics;
+
+		explicit bench_result(std::string name) : name(std::move(name)) {}
+
+		bench_result& add(const char* key, double value) {
+			metrics.push_back({key, value});
+			return *this;
+		}
+	};
+
+	std::string json_string(const std::string& s) {
+		std::string out = "\"";
+		for(unsigned char c : s) {
+			if(c == '"' || c == '\\') {
+				out += '\\';
+				out += static_cast<char>(c);
+			}
+			else if(c < 0x20) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				out += buf;
+			}
+			else
+				out += static_cast<char>(c);
+		}
+		return out + "\"";
+	}
+
+	// Counts come out exact, measurements with 6 significant digits
+	std::string json_number(double value) {
+		if(!std::isfinite(value))
+			value = 0;
+		char buf[64];
+		if(value == std::floor(value) && std::fabs(value) < 9007199254740992.0)
+			snprintf(buf, sizeof(buf), "%.0f", value);
+		else
+			snprintf(buf, sizeof(buf), "%.6g", value);
+		return buf;
+	}
+
+	// Every file the archive set is made of: the _dir.vpk and the _NNN.vpk files its entries point at
+	std::vector<std::string> archive_files(vpklib::vpk_archive* archive) {
+		std::set<std::uint16_t> indices;
+		for(vpklib::vpk_file_handle h = 0; h < archive->get_file_count(); h++)
+			indices.insert(archive->get_file_archive_index(h));
+
+		std::vector<std::string> files = {archive->base_archive_name() + "_dir.vpk"};
+		for(auto index : indices) {
+			if(index == 0x7FFF)
+				continue;
+			char suffix[16];
+			snprintf(suffix, sizeof(suffix), "_%03u.vpk", index);
+			files.push_back(archive->base_archive_name() + suffix);
+		}
+		return files;
+	}
+
+	// Asks the kernel to drop the archive set from the page cache. Returns false if it couldn't for some file
+	bool drop_cache(const std::vector<std::string>& files) {
+		bool ok = true;
+		for(const auto& path : files) {
+			int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			if(fd < 0) {
+				ok = false;
+				continue;
+			}
+			ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0 && ok;
+			close(fd);
+		}
+		return ok;
+	}
+
+	// Runs fn until at least minSeconds have passed and minRuns are done, returns the median run time
+	template<class F>
+	double median_time(double minSeconds, int minRuns, F&& fn) {
+		std::vector<double> times;
+		const auto start = clock::now();
+		while(static_cast<int>(times.size()) < minRuns || seconds_since(start) < minSeconds) {
+			const auto t = clock::now();
+			fn();
+			times.push_back(seconds_since(t));
+		}
+		std::sort(times.begin(), times.end());
+		return times[times.size() / 2];
+	}
+
+	bench_result bench_parse(const std::string& path, double minSeconds) {
+		std::uint64_t files = 0;
+		const auto seconds = median_time(minSeconds, 3, [&]() {
+			std::unique_ptr<vpklib::vpk_archive> archive(vpklib::vpk_archive::read_from_disk(path));
+			files = archive ? archive->get_file_count() : 0;
+		});
+		const auto dirBytes = std::filesystem::file_size(path);
+		bench_result r{"tree_parse"};
+		r.add("seconds", seconds)
+			.add("files_per_second", files / seconds)
+			.add("dir_mib_per_second", dirBytes / MIB / seconds);
+		return r;
+	}
+
+	// Lookups of every name in a shuffled order, repeated until count lookups are done
+	template<class Lookup>
+	bench_result bench_lookups(const char* name, vpklib::vpk_archive* archive, const std::vector<std::string>& names,
+		std::uint64_t count, bool expectHit, Lookup&& lookup) {
+		archive->reset_lookup_stats();
+		std::uint64_t found = 0;
+		const auto start = clock::now();
+		for(std::uint64_t i = 0; i < count; i++)
+			found += lookup(names[i % names.size()]) != vpklib::INVALID_HANDLE;
+		const auto seconds = seconds_since(start);
+		const auto stats = archive->get_lookup_stats();
+
+		bench_result r{name};
+		r.add("lookups", count)
+			.add("ns_per_lookup", seconds * 1e9 / count)
+			.add("found_ratio", static_cast<double>(found) / count);
+		if(!expectHit)
+			r.add("filter_false_positive_rate", stats.false_positive_rate());
+		return r;
+	}
+
+	// get_file_data over a sample of the files in one size range
+	bench_result bench_file_data(vpklib::vpk_archive* archive, const std::vector<std::string>& files, const char* name,
+		const std::vector<vpklib::vpk_file_handle>& sample, bool cold) {
+		std::uint64_t largest = 0;
+		for(auto h : sample)
+			largest = std::max<std::uint64_t>(largest, archive->get_file_size(h));
+		std::vector<char> buffer(largest);
+
+		auto pass = [&]() {
+			std::uint64_t bytes = 0;
+			for(auto h : sample)
+				bytes += archive->get_file_data(h, buffer.data(), buffer.size());
+			return bytes;
+		};
+
+		// Warm: one pass to fill the cache first. Cold: evict the archives right before
+		std::uint64_t bytes = 0;
+		if(cold)
+			drop_cache(files);
+		else
+			pass();
+		const auto start = clock::now();
+		bytes = pass();
+		const auto seconds = seconds_since(start);
+
+		bench_result r{std::string("get_file_data_") + name + (cold ? "_cold" : "_warm")};
+		r.add("files", sample.size())
+			.add("bytes", bytes)
+			.add("us_per_file", seconds * 1e6 / sample.size())
+			.add("mib_per_second", bytes / MIB / seconds);
+		return r;
+	}
+
+	// Everything written out below outDir with the read pipeline, as vpktool -x does
+	bench_result bench_extract(vpklib::vpk_archive* archive, const std::filesystem::path& outDir, bool& ok) {
+		const auto start = clock::now();
+		std::vector<vpklib::vpk_file_handle> handles;
+		for(vpklib::vpk_file_handle h = 0; h < archive->get_file_count(); h++)
+			handles.push_back(h);
+		vpklib::vpk_read_pipeline::sort_physical(archive, handles);
+
+		std::vector<std::string> paths;
+		std::set<std::filesystem::path> dirs;
+		paths.reserve(handles.size());
+		for(auto h : handles) {
+			auto path = outDir / archive->get_file_name(h);
+			dirs.insert(path.parent_path());
+			paths.push_back(path.string());
+		}
+		std::error_code ec;
+		for(const auto& dir : dirs)
+			std::filesystem::create_directories(dir, ec);
+
+		std::vector<int> fds(handles.size(), -1);
+		std::uint64_t bytes = 0;
+		vpklib::vpk_read_pipeline pipeline;
+		ok = pipeline.run(archive, handles, [&](unsigned, const vpklib::vpk_chunk& chunk) -> bool {
+			auto& fd = fds[chunk.item];
+			if(chunk.offset == 0)
+				fd = open(paths[chunk.item].c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+			if(fd < 0 || write(fd, chunk.data, chunk.size) != static_cast<ssize_t>(chunk.size))
+				return false;
+			if(chunk.last) {
+				close(fd);
+				fd = -1;
+			}
+			return true;
+		});
+		for(auto fd : fds) {
+			if(fd >= 0)
+				close(fd);
+		}
+		const auto seconds = seconds_since(start);
+		for(auto h : handles)
+			bytes += archive->get_file_size(h);
+
+		bench_result r{"extract"};
+		r.add("files", handles.size())
+			.add("bytes", bytes)
+			.add("seconds", seconds)
+			.add("mib_per_second", bytes / MIB / seconds);
+		return r;
+	}
+
+}
+
+int main(int argc, const char** argv)
+{
+	argparse::ArgumentParser parser("vpk_bench");
+
+	parser.add_argument("-o", "--output")
+		.help("Write the JSON results to this file instead of stdout")
+		.nargs(1);
+	parser.add_argument("--lookups")
+		.help("Number of find_file calls per lookup benchmark")
+		.default_value(1000000)
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("--samples")
+		.help("Files read per get_file_data size range")
+		.default_value(256)
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("--min-time")
+		.help("Minimum seconds to repeat the tree parse for")
+		.default_value(0.5)
+		.scan<'g', double>()
+		.nargs(1);
+	parser.add_argument("--no-cold")
+		.help("Skip the cold cache runs, which evict the archives from the page cache")
+		.implicit_value(true)
+		.default_value(false);
+	parser.add_argument("--no-extract")
+		.help("Skip the extraction benchmark")
+		.implicit_value(true)
+		.default_value(false);
+	parser.add_argument("--outdir")
+		.help("Scratch directory for the extraction benchmark, removed afterwards (default: under the system temp directory)")
+		.nargs(1);
+	parser.add_argument("--generate")
+		.help("Benchmark a synthetic archive of this many files instead, generated under the system temp directory and removed afterwards")
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("--seed")
+		.help("Seed for --generate")
+		.default_value(1)
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("archive")
+		.help("_dir.vpk of the archive to benchmark")
+		.nargs(0, 1);
+
+	parser.parse_args(argc, argv);
+
+	// Removes the generated corpus on every way out, after the archive is closed
+	struct scratch_dir
+	{
+		std::filesystem::path path;
+		~scratch_dir() {
+			std::error_code ec;
+			if(!path.empty())
+				std::filesystem::remove_all(path, ec);
+		}
+	} corpusDir;
+
+	std::string path;
+	vpklib::vpk_corpus_options corpus;
+	const bool generated = parser.is_used("--generate");
+	if(generated) {
+		corpus.file_count = std::max(parser.get<int>("--generate"), 1);
+		corpus.seed = static_cast<std::uint64_t>(parser.get<int>("--seed"));
+		corpusDir.path = std::filesystem::temp_directory_path() / ("vpk_bench_corpus_" + std::to_string(getpid()));
+		path = (corpusDir.path / "pak01_dir.vpk").string();
+		auto result = vpklib::generate_corpus(path, corpus);
+		if(!result.ok) {
+			fprintf(stderr, "ERROR: Failed to generate a corpus in '%s': %s\n", corpusDir.path.c_str(), result.error.c_str());
+			return 1;
+		}
+	}
+	else if(parser.is_used("archive"))
+		path = parser.get<std::string>("archive");
+	else {
+		fprintf(stderr, "ERROR: Either an archive or --generate is required\n");
+		return 1;
+	}
+
+	std::unique_ptr<vpklib::vpk_archive> archive(vpklib::vpk_archive::read_from_disk(path));
+	if(!archive) {
+		fprintf(stderr, "ERROR: Failed to open archive '%s'\n", path.c_str());
+		return 1;
+	}
+	if(!archive->get_file_count()) {
+		fprintf(stderr, "ERROR: Archive '%s' has no files\n", path.c_str());
+		return 1;
+	}
+
+	const auto files = archive_files(archive.get());
+	const bool cold = !parser.get<bool>("--no-cold");
+	std::vector<bench_result> results;
+	std::mt19937_64 rng(1);
+
+	results.push_back(bench_parse(path, parser.get<double>("--min-time")));
+
+	// Lookups, in a fixed shuffled order. Misses differ from a real name in the last character
+	std::vector<std::string> names = archive->get_file_names();
+	std::shuffle(names.begin(), names.end(), rng);
+	std::vector<std::string> missing = names;
+	for(auto& name : missing)
+		name += '~';
+	const std::uint64_t lookups = std::max(parser.get<int>("--lookups"), 1);
+	results.push_back(bench_lookups("find_file_hit", archive.get(), names, lookups, true,
+		[&](const std::string& n) { return archive->find_file(n); }));
+	results.push_back(bench_lookups("find_file_miss", archive.get(), missing, lookups, false,
+		[&](const std::string& n) { return archive->find_file(n); }));
+	results.push_back(bench_lookups("find_file_nocase_hit", archive.get(), names, lookups, true,
+		[&](const std::string& n) { return archive->find_file_nocase(n); }));
+
+	// get_file_data by size range, the same random sample for the warm and cold runs
+	struct size_range
+	{
+		const char* name;
+		std::uint64_t min, max;
+	};
+	const size_range ranges[] = {
+		{"lt_1k", 0, 1 << 10},
+		{"1k_64k", 1 << 10, 64 << 10},
+		{"64k_1m", 64 << 10, 1 << 20},
+		{"ge_1m", 1 << 20, ~0ull},
+	};
+	const auto samples = static_cast<std::size_t>(std::max(parser.get<int>("--samples"), 1));
+	for(const auto& range : ranges) {
+		std::vector<vpklib::vpk_file_handle> sample;
+		for(vpklib::vpk_file_handle h = 0; h < archive->get_file_count(); h++) {
+			const auto size = archive->get_file_size(h);
+			if(size >= range.min && size < range.max)
+				sample.push_back(h);
+		}
+		if(sample.empty())
+			continue;
+		std::shuffle(sample.begin(), sample.end(), rng);
+		sample.resize(std::min(sample.size(), samples));
+
+		results.push_back(bench_file_data(archive.get(), files, range.name, sample, false));
+		if(cold)
+			results.push_back(bench_file_data(archive.get(), files, range.name, sample, true));
+	}
+
+	if(!parser.get<bool>("--no-extract")) {
+		std::filesystem::path outDir = parser.is_used("--outdir") ? std::filesystem::path(parser.get<std::string>("--outdir"))
+			: std::filesystem::temp_directory_path() / ("vpk_bench_" + std::to_string(getpid()));
+		bool ok = false;
+		results.push_back(bench_extract(archive.get(), outDir, ok));
+		std::error_code ec;
+		std::filesystem::remove_all(outDir, ec);
+		if(!ok) {
+			fprintf(stderr, "ERROR: Extraction to '%s' failed\n", outDir.c_str());
+			return 1;
+		}
+	}
+
+	// Verification, warm then (if enabled) cold
+	for(int pass = 0; pass < (cold ? 2 : 1); pass++) {
+		const char* suffix = pass ? "_cold" : "_warm";
+		if(pass)
+			drop_cache(files);
+		auto crc = archive->verify();
+		results.push_back(bench_result{std::string("verify_crc") + suffix});
+		results.back().add("files", crc.files)
+			.add("bytes", crc.bytes)
+			.add("seconds", crc.seconds)
+			.add("mib_per_second", crc.seconds > 0 ? crc.bytes / MIB / crc.seconds : 0)
+			.add("failures", crc.failures.size());
+
+		if(archive->get_version() != 2 || archive->get_archive_md5_entries().empty())
+			continue;
+		if(pass)
+			drop_cache(files);
+		auto md5 = archive->verify_md5();
+		results.push_back(bench_result{std::string("verify_md5") + suffix});
+		results.back().add("chunks", md5.chunks)
+			.add("bytes", md5.bytes)
+			.add("seconds", md5.seconds)
+			.add("mib_per_second", md5.seconds > 0 ? md5.bytes / MIB / md5.seconds : 0)
+			.add("failures", md5.failed_chunks.size() + md5.unreadable_chunks.size());
+	}
+
+	std::uint64_t totalBytes = 0;
+	for(vpklib::vpk_file_handle h = 0; h < archive->get_file_count(); h++)
+		totalBytes += archive->get_file_size(h);
+
+	std::string json = "{\n";
+	json += "  \"benchmark\": \"vpk_bench\",\n";
+	json += "  \"format\": 1,\n";
+	json += "  \"archive\": " + json_string(path) + ",\n";
+	if(generated)
+		json += "  \"corpus_seed\": " + std::to_string(corpus.seed) + ",\n";
+	json += "  \"version\": " + std::to_string(archive->get_version()) + ",\n";
+	json += "  \"files\": " + std::to_string(archive->get_file_count()) + ",\n";
+	json += "  \"bytes\": " + std::to_string(totalBytes) + ",\n";
+	json += "  \"threads\": " + std::to_string(vpklib::hardware_threads()) + ",\n";
+	json += "  \"crc32_kernel\": " + json_string(vpklib::crc32_kernel_name()) + ",\n";
+	json += "  \"md5_kernel\": " + json_string(vpklib::md5_kernel_name()) + ",\n";
+	json += "  \"results\": [\n";
+	for(std::size_t i = 0; i < results.size(); i++) {
+		json += "    {\"name\": " + json_string(results[i].name);
+		for(const auto& [key, value] : results[i].metrics)
+			json += ", " + json_string(key) + ": " + json_number(value);
+		json += i + 1 < results.size() ? "},\n" : "}\n";
+	}
+	json += "  ]\n}\n";
+
+	if(parser.is_used("--output")) {
+		const auto outPath = parser.get<std::string>("--output");
+		FILE* out = fopen(outPath.c_str(), "w");
+		if(!out || fwrite(json.data(), 1, json.size(), out) != json.size() || fclose(out) != 0) {
+			fprintf(stderr, "ERROR: Failed to write '%s'\n", outPath.c_str());
+			return 1;
+		}
+	}
+	else
+		fwrite(json.data(), 1, json.size(), stdout);
+	return 0;
+}
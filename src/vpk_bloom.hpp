@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace vpklib
+{
+	/**
+	 * @brief Split block Bloom filter over 64-bit hashes.
+	 * Every key maps to one 32 byte block and sets one bit in each of its eight words, so a lookup reads a
+	 * single cache line and a miss is usually rejected after the first word that lacks its bit.
+	 * At 12 bits per key the false positive rate is around 0.3%. An empty (never sized) filter lets
+	 * everything through.
+	 */
+	class blocked_bloom
+	{
+	private:
+		struct alignas(32) Block
+		{
+			std::uint32_t words[8];
+		};
+
+		// Odd multipliers picking one bit per word, from Parquet's split block filter
+		static constexpr std::uint32_t SALT[8] = {
+			0x47b6137bu, 0x44974d91u, 0x8824ad5bu, 0xa2b7289du, 0x705495c7u, 0x2df1424bu, 0x9efc4947u, 0x5c6bfb31u,
+		};
+
+		std::vector<Block> m_blocks;
+		std::size_t m_count = 0;
+		std::size_t m_capacity = 0;
+
+		// High half of the hash picks the block, the low half the bits inside it
+		std::size_t block_index(std::uint64_t hash) const {
+			return static_cast<std::size_t>(((hash >> 32) * m_blocks.size()) >> 32);
+		}
+
+	public:
+		/**
+		 * @brief Clears the filter and sizes it for a number of keys
+		 * @param expected Keys that will be inserted
+		 * @param bitsPerKey Filter bits per key, more means fewer false positives
+		 */
+		void reset(std::size_t expected, unsigned bitsPerKey = 12) {
+			m_capacity = std::max<std::size_t>(expected, 64);
+			m_blocks.assign((m_capacity * bitsPerKey + 255) / 256, Block{});
+			m_count = 0;
+		}
+
+		void clear() {
+			m_blocks.clear();
+			m_count = m_capacity = 0;
+		}
+
+		void insert(std::uint64_t hash) {
+			m_count++;
+			if(m_blocks.empty())
+				return; // Never sized, overfull() asks for a rebuild
+			auto& b = m_blocks[block_index(hash)];
+			const auto key = static_cast<std::uint32_t>(hash);
+			for(int i = 0; i < 8; i++)
+				b.words[i] |= 1u << ((key * SALT[i]) >> 27);
+		}
+
+		/**
+		 * @brief Returns false if the key was definitely never inserted
+		 */
+		bool may_contain(std::uint64_t hash) const {
+			if(m_blocks.empty())
+				return true;
+			const auto& b = m_blocks[block_index(hash)];
+			const auto key = static_cast<std::uint32_t>(hash);
+			for(int i = 0; i < 8; i++) {
+				if(!(b.words[i] & (1u << ((key * SALT[i]) >> 27))))
+					return false;
+			}
+			return true;
+		}
+
+		/**
+		 * @brief Returns true once more keys went in than the filter was sized for, and it should be rebuilt
+		 */
+		bool overfull() const { return m_count > m_capacity; };
+
+		std::size_t size_bytes() const { return m_blocks.size() * sizeof(Block); };
+	};
+}
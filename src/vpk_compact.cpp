@@ -0,0 +1,324 @@
+// Archive compaction
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <mutex>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_md5.hpp"
+#include "vpk_thread.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	std::string archive_path(const std::string& base, std::uint32_t index) {
+		char num[16] = {};
+		snprintf(num, sizeof(num), "_%03u.vpk", index);
+		return base + num;
+	}
+
+	// Copies a range between two files without moving either file position. Uses copy_file_range,
+	// which lets the kernel (or the filesystem, for reflinks) do the work, and falls back to pread/pwrite
+	bool copy_range(int in, std::uint64_t inOffset, int out, std::uint64_t outOffset, std::uint64_t size) {
+		while(size > 0) {
+			loff_t inOff = inOffset, outOff = outOffset;
+			auto n = copy_file_range(in, &inOff, out, &outOff, size, 0);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				break;
+			inOffset += n;
+			outOffset += n;
+			size -= n;
+		}
+
+		char buffer[1 << 16];
+		while(size > 0) {
+			auto want = static_cast<std::size_t>(std::min<std::uint64_t>(size, sizeof(buffer)));
+			auto n = pread(in, buffer, want, inOffset);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			for(ssize_t done = 0; done < n;) {
+				auto w = pwrite(out, buffer + done, n - done, outOffset + done);
+				if(w < 0 && errno == EINTR)
+					continue;
+				if(w <= 0)
+					return false;
+				done += w;
+			}
+			inOffset += n;
+			outOffset += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	// A distinct piece of archive data, possibly shared by several files
+	struct live_range
+	{
+		std::uint16_t archive_index;
+		std::uint32_t offset;
+		std::uint32_t length;
+
+		auto key() const { return std::make_tuple(archive_index, offset, length); }
+	};
+
+}
+
+vpk_compact_result vpk_archive::compact(const vpk_compact_options& options) {
+	const auto start = std::chrono::steady_clock::now();
+
+	vpk_compact_result result;
+	auto fail = [&](std::string error) {
+		result.ok = false;
+		result.error = std::move(error);
+		return result;
+	};
+	if(m_dirty)
+		return fail("the archive has unsaved changes");
+
+	const std::uint64_t maxArchive = std::clamp<std::uint64_t>(options.max_archive_size, 1, 0xFFFFFFFFull);
+	const std::uint32_t chunkSize = std::max<std::uint32_t>(options.md5_chunk_size, 4096);
+
+	// Layout order: the requested files first, then the rest by directory and name
+	std::vector<vpk_file_handle> order;
+	std::vector<bool> placed(m_files.size(), false);
+	for(auto h : options.order) {
+		if(h < m_files.size() && !placed[h]) {
+			order.push_back(h);
+			placed[h] = true;
+		}
+	}
+	std::vector<vpk_file_handle> rest;
+	for(vpk_file_handle h = 0; h < m_files.size(); h++) {
+		if(!placed[h])
+			rest.push_back(h);
+	}
+	auto dirOf = [&](vpk_file_handle h) {
+		const auto& name = m_fileNames[h];
+		const auto slash = name.rfind('/');
+		return std::string_view(name).substr(0, slash == std::string::npos ? 0 : slash);
+	};
+	std::stable_sort(rest.begin(), rest.end(), [&](auto a, auto b) {
+		return std::make_pair(dirOf(a), std::string_view(m_fileNames[a])) < std::make_pair(dirOf(b), std::string_view(m_fileNames[b]));
+	});
+	order.insert(order.end(), rest.begin(), rest.end());
+
+	// Share of the distinct data ranges that have dead space in front of them, going through the archives in
+	// physical order. Ranges shared by several files count once
+	auto fragmentation = [&]() {
+		std::vector<live_range> ranges;
+		for(const auto& f : m_files) {
+			if(f->archive_index != 0x7FFF && f->length)
+				ranges.push_back({static_cast<std::uint16_t>(f->archive_index), f->offset, f->length});
+		}
+		std::sort(ranges.begin(), ranges.end(), [](const live_range& a, const live_range& b) { return a.key() < b.key(); });
+		ranges.erase(std::unique(ranges.begin(), ranges.end(), [](const live_range& a, const live_range& b) { return a.key() == b.key(); }), ranges.end());
+
+		std::size_t gaps = 0;
+		std::uint64_t end = 0;
+		for(std::size_t i = 0; i < ranges.size(); i++) {
+			if(i == 0 || ranges[i].archive_index != ranges[i - 1].archive_index)
+				end = 0;
+			if(ranges[i].offset > end)
+				gaps++;
+			end = std::max<std::uint64_t>(end, static_cast<std::uint64_t>(ranges[i].offset) + ranges[i].length);
+		}
+		return ranges.empty() ? 0.0 : static_cast<double>(gaps) / ranges.size();
+	};
+	result.fragmentation_before = fragmentation();
+
+	for(std::uint32_t i = 0; i <= m_maxPakIndex; i++) {
+		std::error_code ec;
+		auto size = std::filesystem::file_size(archive_path(m_baseArchiveName, i), ec);
+		if(!ec)
+			result.bytes_before += size;
+	}
+
+	// Assign every distinct live range its new place
+	struct placement
+	{
+		live_range from;
+		std::uint32_t archive_index;
+		std::uint32_t offset;
+	};
+	std::vector<placement> copies;
+	std::map<std::tuple<std::uint16_t, std::uint32_t, std::uint32_t>, std::size_t> seen;
+	std::vector<std::size_t> fileCopy(m_files.size(), SIZE_MAX);
+
+	std::uint32_t archiveIndex = 0;
+	std::uint64_t used = 0;
+	for(auto h : order) {
+		const auto& f = m_files[h];
+		if(f->archive_index == 0x7FFF || !f->length)
+			continue;
+		const live_range range = {static_cast<std::uint16_t>(f->archive_index), f->offset, f->length};
+		auto [it, inserted] = seen.insert({range.key(), copies.size()});
+		if(inserted) {
+			if(used && used + f->length > maxArchive) {
+				archiveIndex++;
+				used = 0;
+			}
+			if(archiveIndex >= 0x7FFF)
+				return fail("too many archives, raise the maximum archive size");
+			copies.push_back({range, archiveIndex, static_cast<std::uint32_t>(used)});
+			used += f->length;
+			result.live_bytes += f->length;
+		}
+		fileCopy[h] = it->second;
+	}
+	const std::uint32_t archiveCount = used ? archiveIndex + 1 : archiveIndex;
+
+	// The new archives go where the current _dir doesn't look, so nothing it references is touched before the
+	// new _dir is published. That's 0 onwards if the old archives start past the new ones, else after the last one
+	std::uint32_t oldMin = 0x7FFF, oldMax = 0;
+	auto reference = [&](std::int32_t index) {
+		if(index == 0x7FFF)
+			return;
+		oldMin = std::min<std::uint32_t>(oldMin, index);
+		oldMax = std::max<std::uint32_t>(oldMax, index);
+	};
+	for(const auto& f : m_files)
+		reference(f->archive_index);
+	for(const auto& e : m_archiveSectionEntries)
+		reference(e.archive_index);
+	const std::uint32_t first = archiveCount <= oldMin ? 0 : oldMax + 1;
+	if(first + archiveCount >= 0x7FFF)
+		return fail("too many archives, raise the maximum archive size");
+	auto newPath = [&](std::uint32_t i) { return archive_path(m_baseArchiveName, first + i); };
+
+	// Copy into the new archives, spread over threads
+	std::vector<int> outputs(archiveCount, -1);
+	auto closeOutputs = [&](bool remove) {
+		for(std::uint32_t i = 0; i < archiveCount; i++) {
+			if(outputs[i] >= 0)
+				close(outputs[i]);
+			outputs[i] = -1;
+			if(remove)
+				unlink(newPath(i).c_str());
+		}
+	};
+	for(std::uint32_t i = 0; i < archiveCount; i++) {
+		outputs[i] = open(newPath(i).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if(outputs[i] < 0) {
+			closeOutputs(true);
+			return fail("failed to create '" + newPath(i) + "': " + strerror(errno));
+		}
+	}
+
+	std::mutex errorLock;
+	std::string firstError;
+	parallel_for(copies.size(), [&](std::size_t c) {
+		const auto& copy = copies[c];
+		auto in = get_archive_handle(copy.from.archive_index);
+		if(!in || !copy_range(fileno(in), copy.from.offset, outputs[copy.archive_index], copy.offset, copy.from.length)) {
+			std::lock_guard<std::mutex> lock(errorLock);
+			if(firstError.empty())
+				firstError = "failed to copy data out of '" + archive_path(m_baseArchiveName, copy.from.archive_index) + "'";
+		}
+	}, options.threads);
+	if(!firstError.empty()) {
+		closeOutputs(true);
+		return fail(firstError);
+	}
+
+	// Rebuild the MD5 section: entries for _dir data stay, the archives are hashed anew
+	std::vector<vpk2::ArchiveMD5SectionEntry> entries;
+	for(const auto& e : m_archiveSectionEntries) {
+		if(e.archive_index == 0x7FFF)
+			entries.push_back(e);
+	}
+	const auto kept = entries.size();
+	if(version == 2) {
+		std::vector<std::uint64_t> sizes(archiveCount, 0);
+		for(const auto& copy : copies)
+			sizes[copy.archive_index] = std::max<std::uint64_t>(sizes[copy.archive_index], copy.offset + copy.from.length);
+		for(std::uint32_t i = 0; i < archiveCount; i++) {
+			for(std::uint64_t offset = 0; offset < sizes[i]; offset += chunkSize) {
+				vpk2::ArchiveMD5SectionEntry e = {};
+				e.archive_index = first + i;
+				e.start_offset = static_cast<std::uint32_t>(offset);
+				e.count = static_cast<std::uint32_t>(std::min<std::uint64_t>(chunkSize, sizes[i] - offset));
+				entries.push_back(e);
+			}
+		}
+
+		parallel_for(entries.size() - kept, [&](std::size_t i) {
+			auto& e = entries[kept + i];
+			auto buffer = std::make_unique<byte[]>(e.count);
+			if(pread(outputs[e.archive_index - first], buffer.get(), e.count, e.start_offset) != static_cast<ssize_t>(e.count)) {
+				std::lock_guard<std::mutex> lock(errorLock);
+				if(firstError.empty())
+					firstError = "failed to read back '" + archive_path(m_baseArchiveName, e.archive_index) + "'";
+				return;
+			}
+			md5::hash(buffer.get(), e.count, reinterpret_cast<std::uint8_t*>(e.checksum));
+		}, options.threads, 4);
+	}
+
+	for(std::uint32_t i = 0; i < archiveCount && firstError.empty(); i++) {
+		if(fsync(outputs[i]) != 0)
+			firstError = "failed to write '" + newPath(i) + "'";
+	}
+	if(!firstError.empty()) {
+		closeOutputs(true);
+		return fail(firstError);
+	}
+	closeOutputs(false);
+
+	// Point the index at the new copies and publish. Empty files would otherwise keep pointing at archives that
+	// are about to be deleted, so they move to the start of the _dir data, which always exists
+	std::vector<std::pair<std::int32_t, std::uint32_t>> oldPlaces(m_files.size());
+	for(vpk_file_handle h = 0; h < m_files.size(); h++) {
+		auto& f = m_files[h];
+		oldPlaces[h] = {f->archive_index, f->offset};
+		if(fileCopy[h] != SIZE_MAX) {
+			f->archive_index = first + copies[fileCopy[h]].archive_index;
+			f->offset = copies[fileCopy[h]].offset;
+		}
+		else if(!f->length && f->archive_index != 0x7FFF) {
+			f->archive_index = 0x7FFF;
+			f->offset = static_cast<std::uint32_t>(m_dataOffset);
+		}
+	}
+
+	// Once the new _dir is in place the old archives are no longer referenced. Until then they stay, and
+	// a failure only leaves the unreferenced new ones to clean up
+	const auto md5Section = std::string(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(entries[0]));
+	std::string error;
+	bool committed = false;
+	const bool published = publish(md5Section, &error, &committed);
+	if(!committed) {
+		for(vpk_file_handle h = 0; h < m_files.size(); h++)
+			std::tie(m_files[h]->archive_index, m_files[h]->offset) = oldPlaces[h];
+		closeOutputs(true);
+		return fail(error);
+	}
+	for(std::uint32_t i = oldMin; i <= oldMax && oldMin != 0x7FFF; i++) {
+		if(i < first || i >= first + archiveCount)
+			unlink(archive_path(m_baseArchiveName, i).c_str());
+	}
+	if(!published)
+		return fail(error);
+
+	for(std::uint32_t i = 0; i < archiveCount; i++) {
+		std::error_code ec;
+		auto size = std::filesystem::file_size(newPath(i), ec);
+		if(!ec)
+			result.bytes_after += size;
+	}
+
+	result.fragmentation_after = fragmentation();
+	result.archives_after = archiveCount;
+	result.ok = true;
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
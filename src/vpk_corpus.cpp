@@ -0,0 +1,437 @@
+// Synthetic archive generation
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vpk_corpus.hpp"
+#include "vpk_crc.hpp"
+#include "vpk_md5.hpp"
+#include "vpk_thread.hpp"
+#include "vpk_tree.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	constexpr std::uint64_t BATCH_BYTES = 64 << 20;		// File data generated in parallel at a time
+	constexpr std::size_t WRITE_BUFFER = 8 << 20;
+
+	// Independent streams drawn from the same seed
+	constexpr std::uint64_t DIR_STREAM = 1;
+	constexpr std::uint64_t FILE_STREAM = 2;
+
+	const std::vector<std::pair<std::string, std::uint32_t>> DEFAULT_EXTENSIONS = {
+		{"vtf", 30}, {"vmt", 30}, {"mdl", 5}, {"vvd", 5}, {"vtx", 5}, {"phy", 3},
+		{"wav", 10}, {"pcf", 3}, {"txt", 3}, {"res", 3}, {"", 3},
+	};
+
+	const char* const TOP_DIRECTORIES[] = {"materials", "models", "sound", "particles", "scripts", "resource", "maps"};
+
+	// splitmix64. Fully specified, unlike the standard distributions, so every platform draws the same numbers
+	struct rng
+	{
+		std::uint64_t state;
+
+		rng(std::uint64_t seed, std::uint64_t index, std::uint64_t stream)
+			: state(seed ^ (index * 0xD1B54A32D192ED03ull) ^ (stream * 0x8CB92BA72F3D8DD7ull)) {
+			next();
+		}
+
+		std::uint64_t next() {
+			std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return z ^ (z >> 31);
+		}
+
+		// In [0, 1)
+		double uniform() { return (next() >> 11) * 0x1.0p-53; }
+
+		// In [0, n)
+		std::uint64_t below(std::uint64_t n) { return n ? next() % n : 0; }
+
+		// Standard normal, Box-Muller
+		double normal() {
+			const double u1 = 1.0 - uniform();
+			const double u2 = uniform();
+			return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+		}
+	};
+
+	void fill_contents(std::uint64_t seed, char* p, std::uint64_t size) {
+		rng r(seed, 0, 0);
+		for(; size >= 8; p += 8, size -= 8) {
+			const auto v = r.next();
+			std::memcpy(p, &v, 8);
+		}
+		if(size) {
+			const auto v = r.next();
+			std::memcpy(p, &v, size);
+		}
+	}
+
+	struct file_info
+	{
+		std::uint64_t size;
+		std::uint64_t content_seed;
+		std::uint64_t preload_offset;	// Into the preload store
+		std::uint32_t directory;
+		std::uint32_t offset;			// In its archive, or in the _dir data for embedded files
+		std::uint32_t crc;
+		std::uint16_t extension;
+		std::uint16_t preload;
+		std::uint16_t archive_index;
+		bool embedded;
+	};
+
+	bool write_all(int fd, const void* data, std::size_t size) {
+		auto p = static_cast<const char*>(data);
+		while(size > 0) {
+			auto n = ::write(fd, p, size);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	std::string archive_path(const std::string& base, std::uint32_t index) {
+		char suffix[16];
+		snprintf(suffix, sizeof(suffix), "_%03u.vpk", index);
+		return base + suffix;
+	}
+
+	// Hashes archive data in md5_chunk_size pieces as it's written, like the VPK2 archive MD5 section wants
+	class chunk_hasher
+	{
+	public:
+		chunk_hasher(std::uint32_t chunkSize, std::string& section) : m_chunkSize(chunkSize), m_section(section) {}
+
+		void start(std::uint32_t archiveIndex) {
+			m_archive = archiveIndex;
+			m_start = 0;
+			m_filled = 0;
+			m_ctx = md5();
+		}
+
+		void update(const char* p, std::size_t size) {
+			while(size) {
+				const auto take = std::min<std::size_t>(size, m_chunkSize - m_filled);
+				m_ctx.update(p, take);
+				m_filled += take;
+				p += take;
+				size -= take;
+				if(m_filled == m_chunkSize)
+					finish();
+			}
+		}
+
+		// Closes a partial last chunk
+		void finish() {
+			if(!m_filled)
+				return;
+			vpk2::ArchiveMD5SectionEntry entry = {};
+			entry.archive_index = m_archive;
+			entry.start_offset = static_cast<std::uint32_t>(m_start);
+			entry.count = static_cast<std::uint32_t>(m_filled);
+			m_ctx.final(reinterpret_cast<std::uint8_t*>(entry.checksum));
+			m_section.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+			m_start += m_filled;
+			m_filled = 0;
+			m_ctx = md5();
+		}
+
+	private:
+		std::uint32_t m_chunkSize;
+		std::string& m_section;
+		std::uint32_t m_archive = 0;
+		std::uint64_t m_start = 0;
+		std::uint64_t m_filled = 0;
+		md5 m_ctx;
+	};
+
+}
+
+bool vpklib::parse_extension_mix(const std::string& text, std::vector<std::pair<std::string, std::uint32_t>>& out, std::string* error) {
+	auto fail = [&](const std::string& message) {
+		if(error)
+			*error = message;
+		return false;
+	};
+
+	out.clear();
+	std::size_t start = 0;
+	while(start <= text.size()) {
+		auto end = text.find(',', start);
+		if(end == std::string::npos)
+			end = text.size();
+		const auto item = text.substr(start, end - start);
+		start = end + 1;
+
+		const auto colon = item.find(':');
+		auto extension = item.substr(0, colon);
+		if(!extension.empty() && extension[0] == '.')
+			extension.erase(0, 1);
+		if(extension.find_first_of("/\\. ") != std::string::npos)
+			return fail("invalid extension '" + extension + "'");
+
+		std::uint32_t weight = 1;
+		if(colon != std::string::npos) {
+			const auto value = item.substr(colon + 1);
+			char* endp = nullptr;
+			const auto parsed = std::strtoul(value.c_str(), &endp, 10);
+			if(value.empty() || *endp || !parsed || parsed > 1000000)
+				return fail("invalid weight '" + value + "' for extension '" + extension + "'");
+			weight = static_cast<std::uint32_t>(parsed);
+		}
+		out.push_back({extension, weight});
+	}
+	return true;
+}
+
+vpk_corpus_result vpklib::generate_corpus(const std::filesystem::path& dirPath, const vpk_corpus_options& options) {
+	const auto start = std::chrono::steady_clock::now();
+
+	vpk_corpus_result result;
+	auto fail = [&](std::string error) {
+		result.ok = false;
+		result.error = std::move(error);
+		return result;
+	};
+
+	if(options.version != 1 && options.version != 2)
+		return fail("unsupported VPK version " + std::to_string(options.version));
+	if(!options.md5_chunk_size)
+		return fail("MD5 chunk size must not be 0");
+	if(options.preload_max > 0xFFFF)
+		return fail("preload_max can be at most 65535");
+	if(options.size_min > options.size_max || options.size_max > 0xFFFFFFFFull)
+		return fail("invalid file size range");
+	if(options.max_archive_size > 0xFFFFFFFFull)
+		return fail("archives can be at most 4 GiB");
+
+	const auto& extensions = options.extensions.empty() ? DEFAULT_EXTENSIONS : options.extensions;
+	std::vector<std::uint64_t> cumulative;
+	std::uint64_t weightTotal = 0;
+	for(const auto& [ext, weight] : extensions)
+		cumulative.push_back(weightTotal += weight);
+	if(!weightTotal)
+		return fail("extension weights add up to 0");
+
+	// Directories, then every file's metadata. Each depends only on the seed and its own index
+	const auto maxDepth = std::max<std::uint32_t>(options.max_depth, 1);
+	const auto dirCount = std::max<std::uint64_t>(1, (options.file_count + std::max<std::uint32_t>(options.files_per_directory, 1) - 1)
+		/ std::max<std::uint32_t>(options.files_per_directory, 1));
+	std::vector<std::string> directories(dirCount);
+	parallel_for(dirCount, [&](std::size_t i) {
+		rng r(options.seed, i, DIR_STREAM);
+		auto& dir = directories[i];
+		dir = TOP_DIRECTORIES[r.below(std::size(TOP_DIRECTORIES))];
+		const auto depth = 1 + r.below(maxDepth);
+		for(std::uint64_t level = 1; level < depth; level++) {
+			char component[16];
+			snprintf(component, sizeof(component), "/d%02x", static_cast<unsigned>(r.below(256)));
+			dir += component;
+		}
+	}, options.threads, 1024);
+
+	std::vector<file_info> files(options.file_count);
+	parallel_for(files.size(), [&](std::size_t i) {
+		rng r(options.seed, i, FILE_STREAM);
+		auto& f = files[i];
+		const auto pick = r.below(weightTotal);
+		f.extension = static_cast<std::uint16_t>(std::upper_bound(cumulative.begin(), cumulative.end(), pick) - cumulative.begin());
+		f.directory = static_cast<std::uint32_t>(r.below(dirCount));
+
+		const double normal = r.normal();
+		switch(options.distribution) {
+			case vpk_corpus_options::size_distribution::fixed:
+				f.size = options.size_median;
+				break;
+			case vpk_corpus_options::size_distribution::uniform:
+				f.size = options.size_min + r.below(options.size_max - options.size_min + 1);
+				break;
+			case vpk_corpus_options::size_distribution::lognormal: {
+				const double size = options.size_median ? std::exp(std::log(double(options.size_median)) + options.size_sigma * normal) : 0;
+				f.size = static_cast<std::uint64_t>(std::clamp(size, double(options.size_min), double(options.size_max)));
+				break;
+			}
+		}
+
+		// Drawn unconditionally so changing one ratio doesn't reshuffle everything else
+		const double embedDraw = r.uniform();
+		const double preloadDraw = r.uniform();
+		const auto preloadSize = 1 + r.below(std::max<std::uint32_t>(options.preload_max, 1));
+		f.content_seed = r.next();
+
+		f.embedded = f.size <= options.embedded_max && embedDraw < options.embedded_ratio;
+		f.preload = 0;
+		if(!f.embedded && options.preload_max && preloadDraw < options.preload_ratio)
+			f.preload = static_cast<std::uint16_t>(std::min<std::uint64_t>(f.size, preloadSize));
+	}, options.threads, 1024);
+
+	// Layout: archive data back to back in index order, embedded data in the _dir after the tree
+	std::uint32_t archiveIndex = 0;
+	std::uint64_t used = 0;
+	std::uint64_t embeddedSize = 0;
+	std::uint64_t preloadSize = 0;
+	const auto maxArchive = std::max<std::uint64_t>(options.max_archive_size, 1);
+	for(auto& f : files) {
+		f.preload_offset = preloadSize;
+		preloadSize += f.preload;
+		result.bytes += f.size;
+		if(f.preload) {
+			result.preload_files++;
+			result.preload_bytes += f.preload;
+		}
+		if(f.embedded) {
+			if(embeddedSize + f.size > 0xFFFFFFFFull)
+				return fail("too much embedded data, lower the embedded ratio");
+			f.archive_index = 0x7FFF;
+			f.offset = static_cast<std::uint32_t>(embeddedSize);
+			embeddedSize += f.size;
+			result.embedded_files++;
+			result.embedded_bytes += f.size;
+			continue;
+		}
+		const auto dataSize = f.size - f.preload;
+		if(dataSize && used && used + dataSize > maxArchive) {
+			archiveIndex++;
+			used = 0;
+		}
+		if(archiveIndex >= 0x7FFF)
+			return fail("too many archives, raise the maximum archive size");
+		f.archive_index = static_cast<std::uint16_t>(archiveIndex);
+		f.offset = static_cast<std::uint32_t>(used);
+		used += dataSize;
+	}
+	const std::uint32_t archiveCount = used ? archiveIndex + 1 : archiveIndex;
+
+	auto base = dirPath.string();
+	if(base.size() < 8 || base.compare(base.size() - 8, 8, "_dir.vpk") != 0)
+		return fail("output must be named like name_dir.vpk");
+	base.resize(base.size() - 8);
+	if(dirPath.has_parent_path()) {
+		std::error_code ec;
+		std::filesystem::create_directories(dirPath.parent_path(), ec);
+	}
+
+	// Data, generated in parallel a batch at a time and written in order
+	std::string preloadStore(preloadSize, '\0');
+	std::string embeddedData(embeddedSize, '\0');
+	std::string md5Section;
+	chunk_hasher hasher(options.md5_chunk_size, md5Section);
+	std::string out;
+	out.reserve(WRITE_BUFFER);
+	int fd = -1;
+	std::int64_t openArchive = -1;
+	auto flush = [&]() {
+		bool ok = write_all(fd, out.data(), out.size());
+		out.clear();
+		return ok;
+	};
+	auto close_archive = [&]() {
+		bool ok = fd < 0 || (flush() && close(fd) == 0);
+		fd = -1;
+		if(options.version == 2)
+			hasher.finish();
+		return ok;
+	};
+
+	for(std::size_t first = 0; first < files.size();) {
+		std::size_t last = first;
+		std::uint64_t bytes = 0;
+		while(last < files.size() && (last == first || bytes + files[last].size <= BATCH_BYTES))
+			bytes += files[last++].size;
+
+		std::vector<std::string> data(last - first);
+		parallel_for(data.size(), [&](std::size_t i) {
+			auto& f = files[first + i];
+			auto& d = data[i];
+			d.resize(f.size);
+			fill_contents(f.content_seed, d.data(), f.size);
+			f.crc = crc32(d.data(), d.size());
+			std::memcpy(preloadStore.data() + f.preload_offset, d.data(), f.preload);
+			if(f.embedded)
+				std::memcpy(embeddedData.data() + f.offset, d.data(), f.size);
+		}, options.threads, 1);
+
+		for(std::size_t i = 0; i < data.size(); i++) {
+			const auto& f = files[first + i];
+			const auto dataSize = f.size - f.preload;
+			if(f.embedded || !dataSize)
+				continue;
+			if(openArchive != f.archive_index) {
+				if(!close_archive())
+					return fail("failed to write '" + archive_path(base, static_cast<std::uint32_t>(openArchive)) + "'");
+				openArchive = f.archive_index;
+				fd = open(archive_path(base, f.archive_index).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+				if(fd < 0)
+					return fail("failed to create '" + archive_path(base, f.archive_index) + "': " + strerror(errno));
+				hasher.start(f.archive_index);
+			}
+			const char* p = data[i].data() + f.preload;
+			if(options.version == 2)
+				hasher.update(p, dataSize);
+			out.append(p, dataSize);
+			if(out.size() >= WRITE_BUFFER && !flush())
+				return fail("failed to write '" + archive_path(base, f.archive_index) + "'");
+		}
+		first = last;
+	}
+	if(!close_archive())
+		return fail("failed to write '" + archive_path(base, static_cast<std::uint32_t>(openArchive)) + "'");
+
+	// The tree, sorted the way serialize wants it
+	std::vector<tree::name_parts> parts(files.size());
+	parallel_for(files.size(), [&](std::size_t i) {
+		char name[24];
+		snprintf(name, sizeof(name), "f%08llx", static_cast<unsigned long long>(i));
+		parts[i].extension = extensions[files[i].extension].first;
+		parts[i].directory = directories[files[i].directory];
+		parts[i].file = name;
+	}, options.threads, 1024);
+
+	std::vector<std::size_t> order(files.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return parts[a] < parts[b]; });
+
+	std::vector<tree::node> nodes;
+	nodes.reserve(files.size());
+	for(auto i : order) {
+		const auto& f = files[i];
+		tree::node n = {&parts[i], {}, preloadStore.data() + f.preload_offset};
+		n.entry.crc = f.crc;
+		n.entry.preload_bytes = f.preload;
+		n.entry.archive_index = f.archive_index;
+		n.entry.entry_offset = f.offset;
+		n.entry.entry_length = static_cast<std::uint32_t>(f.size - f.preload);
+		nodes.push_back(n);
+	}
+	const auto dir = tree::build_dir(options.version, tree::serialize(nodes), embeddedData, md5Section);
+
+	const auto dirTmp = dirPath.string() + ".tmp";
+	fd = open(dirTmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	bool ok = fd >= 0 && write_all(fd, dir.data(), dir.size());
+	ok = fd >= 0 && close(fd) == 0 && ok;
+	if(!ok || rename(dirTmp.c_str(), dirPath.c_str()) != 0) {
+		unlink(dirTmp.c_str());
+		return fail("failed to write '" + dirPath.string() + "'");
+	}
+
+	result.ok = true;
+	result.files = files.size();
+	result.archives = archiveCount;
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vpklib
+{
+	struct vpk_corpus_options
+	{
+		enum class size_distribution : std::uint8_t
+		{
+			fixed,		// Every file is size_median bytes
+			uniform,	// Evenly spread over [size_min, size_max]
+			lognormal,	// Median size_median, spread size_sigma, clamped to [size_min, size_max]
+		};
+
+		std::uint32_t version = 2;						// 1 or 2
+		std::uint64_t seed = 1;							// Same seed and options, same archive
+		std::uint64_t file_count = 10000;
+
+		size_distribution distribution = size_distribution::lognormal;
+		std::uint64_t size_min = 0;
+		std::uint64_t size_median = 8 << 10;
+		double size_sigma = 1.5;
+		std::uint64_t size_max = 16 << 20;
+
+		std::uint32_t max_depth = 4;					// Directory levels, at least 1
+		std::uint32_t files_per_directory = 32;			// Average, sets the number of directories
+		std::vector<std::pair<std::string, std::uint32_t>> extensions;	// Extension and weight, empty for a mix like game content
+
+		double preload_ratio = 0.1;						// Share of files with preload data
+		std::uint32_t preload_max = 1024;				// Most preload bytes for one file (at most 65535)
+		double embedded_ratio = 0.01;					// Share of files stored in the _dir (archive index 0x7FFF)
+		std::uint64_t embedded_max = 64 << 10;			// Only files up to this size are embedded
+
+		std::uint32_t md5_chunk_size = 1 << 20;			// VPK2 archive MD5 section granularity
+		std::uint64_t max_archive_size = 200 << 20;
+		unsigned threads = 0;							// 0 for all cores
+	};
+
+	struct vpk_corpus_result
+	{
+		bool ok = false;
+		std::string error;					// Set when !ok
+		std::uint64_t files = 0;
+		std::uint64_t bytes = 0;			// Total file size
+		std::uint32_t archives = 0;			// Number of _NNN archives
+		std::uint64_t preload_files = 0;
+		std::uint64_t preload_bytes = 0;
+		std::uint64_t embedded_files = 0;
+		std::uint64_t embedded_bytes = 0;
+		double seconds = 0;
+	};
+
+	/**
+	 * @brief Writes a synthetic archive set for tests and benchmarks.
+	 *
+	 * Everything about a file (name, size, preload, placement, contents) comes from a generator seeded with the
+	 * seed and the file's index, so the output is byte-identical for the same options no matter the thread count.
+	 * Names are <dir>/f<index>.<ext>, with directories of 1 to max_depth levels under a handful of game-like top
+	 * level folders. Contents are pseudo-random, so they don't compress or deduplicate. Data goes to the
+	 * _NNN archives in index order. The _dir.vpk is written last.
+	 * @param dirPath Path of the _dir.vpk to create, ex: corpus/pak01_dir.vpk
+	 * @param options Shape of the corpus
+	 * @return vpk_corpus_result
+	 */
+	vpk_corpus_result generate_corpus(const std::filesystem::path& dirPath, const vpk_corpus_options& options = {});
+
+	/**
+	 * @brief Parses an extension mix such as "vtf:40,vmt:30,mdl:10,wav:20" for vpk_corpus_options::extensions
+	 * @param text Comma separated extension:weight pairs. A weight may be left out, it defaults to 1
+	 * @param out Receives the mix
+	 * @param error If not null, receives a description of the problem on failure
+	 * @return bool False if the text is malformed
+	 */
+	bool parse_extension_mix(const std::string& text, std::vector<std::pair<std::string, std::uint32_t>>& out, std::string* error = nullptr);
+}
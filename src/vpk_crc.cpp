@@ -0,0 +1,210 @@
+// CRC32 kernels
+#include <array>
+#include <bit>
+#include <cstring>
+
+#include "vpk_crc.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VPK_HAVE_PCLMUL 1
+#include <immintrin.h>
+#endif
+
+using namespace vpklib;
+
+namespace {
+
+	// Table k advances the CRC by k+1 bytes at once
+	using crc_tables = std::array<std::array<std::uint32_t, 256>, 16>;
+
+	constexpr crc_tables make_tables() {
+		crc_tables t = {};
+		for(std::uint32_t i = 0; i < 256; i++) {
+			std::uint32_t c = i;
+			for(int k = 0; k < 8; k++)
+				c = (c & 1) ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+			t[0][i] = c;
+		}
+		for(std::size_t k = 1; k < 16; k++) {
+			for(std::uint32_t i = 0; i < 256; i++)
+				t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+		}
+		return t;
+	}
+
+	constexpr crc_tables TABLES = make_tables();
+
+	inline std::uint32_t load32(const unsigned char* p) {
+		std::uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return v;
+	}
+
+	// Operates on the raw (non-inverted) CRC register
+	std::uint32_t slice16(std::uint32_t crc, const unsigned char* p, std::size_t size) {
+		const auto& t = TABLES;
+		if constexpr(std::endian::native == std::endian::little) {
+			while(size >= 16) {
+				std::uint32_t a = load32(p) ^ crc;
+				std::uint32_t b = load32(p + 4);
+				std::uint32_t c = load32(p + 8);
+				std::uint32_t d = load32(p + 12);
+				crc = t[15][a & 0xFF] ^ t[14][(a >> 8) & 0xFF] ^ t[13][(a >> 16) & 0xFF] ^ t[12][a >> 24]
+					^ t[11][b & 0xFF] ^ t[10][(b >> 8) & 0xFF] ^ t[9][(b >> 16) & 0xFF] ^ t[8][b >> 24]
+					^ t[7][c & 0xFF] ^ t[6][(c >> 8) & 0xFF] ^ t[5][(c >> 16) & 0xFF] ^ t[4][c >> 24]
+					^ t[3][d & 0xFF] ^ t[2][(d >> 8) & 0xFF] ^ t[1][(d >> 16) & 0xFF] ^ t[0][d >> 24];
+				p += 16;
+				size -= 16;
+			}
+		}
+		while(size--)
+			crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+		return crc;
+	}
+
+#ifdef VPK_HAVE_PCLMUL
+
+	// Folds 128 bits of state forward and adds in the next block
+	__attribute__((target("pclmul,sse4.1")))
+	inline __m128i fold(__m128i x, __m128i k, __m128i next) {
+		auto lo = _mm_clmulepi64_si128(x, k, 0x00);
+		auto hi = _mm_clmulepi64_si128(x, k, 0x11);
+		return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+	}
+
+	// Carry-less multiplication folding, after Intel's "Fast CRC Computation for Generic Polynomials
+	// Using PCLMULQDQ Instruction". Folds 64 bytes per iteration into four 128-bit accumulators, then
+	// reduces with a Barrett step. size must be a multiple of 16 and at least 64.
+	__attribute__((target("pclmul,sse4.1")))
+	std::uint32_t fold_pclmul(std::uint32_t crc, const unsigned char* p, std::size_t size) {
+		const __m128i k1k2 = _mm_set_epi64x(0x00000001c6e41596, 0x0000000154442bd4);
+		const __m128i k3k4 = _mm_set_epi64x(0x00000000ccaa009e, 0x00000001751997d0);
+		const __m128i k5 = _mm_set_epi64x(0, 0x0000000163cd6124);
+		const __m128i poly = _mm_set_epi64x(0x00000001f7011641, 0x00000001db710641);
+		const __m128i mask32 = _mm_set_epi32(0, 0, 0, -1);
+
+		auto load = [](const unsigned char* q) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(q)); };
+
+		__m128i x1 = _mm_xor_si128(load(p), _mm_cvtsi32_si128(static_cast<int>(crc)));
+		__m128i x2 = load(p + 16);
+		__m128i x3 = load(p + 32);
+		__m128i x4 = load(p + 48);
+		p += 64;
+		size -= 64;
+
+		while(size >= 64) {
+			x1 = fold(x1, k1k2, load(p));
+			x2 = fold(x2, k1k2, load(p + 16));
+			x3 = fold(x3, k1k2, load(p + 32));
+			x4 = fold(x4, k1k2, load(p + 48));
+			p += 64;
+			size -= 64;
+		}
+
+		// Fold the four accumulators into one
+		x1 = fold(x1, k3k4, x2);
+		x1 = fold(x1, k3k4, x3);
+		x1 = fold(x1, k3k4, x4);
+
+		while(size >= 16) {
+			x1 = fold(x1, k3k4, load(p));
+			p += 16;
+			size -= 16;
+		}
+
+		// 128 -> 64 bits
+		__m128i t = _mm_clmulepi64_si128(k3k4, x1, 0x01);
+		x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+
+		// 64 -> 32 bits
+		t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5, 0x00);
+		x1 = _mm_xor_si128(_mm_srli_si128(x1, 4), t);
+
+		// Barrett reduction
+		t = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+		t = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), poly, 0x00);
+		x1 = _mm_xor_si128(x1, t);
+		return static_cast<std::uint32_t>(_mm_extract_epi32(x1, 1));
+	}
+
+	bool have_pclmul() {
+		static const bool supported = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+		return supported;
+	}
+
+#endif
+
+	// GF(2) matrix helpers for crc32_combine. A matrix is 32 columns of 32 bits
+	std::uint32_t gf2_times(const std::uint32_t* mat, std::uint32_t vec) {
+		std::uint32_t sum = 0;
+		for(; vec; vec >>= 1, mat++) {
+			if(vec & 1)
+				sum ^= *mat;
+		}
+		return sum;
+	}
+
+	void gf2_square(std::uint32_t* square, const std::uint32_t* mat) {
+		for(int n = 0; n < 32; n++)
+			square[n] = gf2_times(mat, mat[n]);
+	}
+
+}
+
+std::uint32_t vpklib::crc32_portable(const void* data, std::size_t size, std::uint32_t crc) {
+	return ~slice16(~crc, static_cast<const unsigned char*>(data), size);
+}
+
+std::uint32_t vpklib::crc32(const void* data, std::size_t size, std::uint32_t crc) {
+	auto p = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+#ifdef VPK_HAVE_PCLMUL
+	// Below a few blocks the setup cost isn't worth it
+	if(size >= 128 && have_pclmul()) {
+		const auto folded = size & ~static_cast<std::size_t>(15);
+		crc = fold_pclmul(crc, p, folded);
+		p += folded;
+		size -= folded;
+	}
+#endif
+	return ~slice16(crc, p, size);
+}
+
+std::uint32_t vpklib::crc32_combine(std::uint32_t crc1, std::uint32_t crc2, std::uint64_t size2) {
+	if(!size2)
+		return crc1;
+
+	// Operator that advances the CRC register by one zero bit, then squared up to one zero byte
+	std::uint32_t even[32], odd[32];
+	odd[0] = 0xEDB88320u;
+	for(int n = 1; n < 32; n++)
+		odd[n] = 1u << (n - 1);
+	gf2_square(even, odd);
+	gf2_square(odd, even);
+
+	// Apply size2 zero bytes to crc1, squaring the operator for each bit of the length
+	while(true) {
+		gf2_square(even, odd);
+		if(size2 & 1)
+			crc1 = gf2_times(even, crc1);
+		size2 >>= 1;
+		if(!size2)
+			break;
+
+		gf2_square(odd, even);
+		if(size2 & 1)
+			crc1 = gf2_times(odd, crc1);
+		size2 >>= 1;
+		if(!size2)
+			break;
+	}
+	return crc1 ^ crc2;
+}
+
+const char* vpklib::crc32_kernel_name() {
+#ifdef VPK_HAVE_PCLMUL
+	if(have_pclmul())
+		return "pclmul";
+#endif
+	return "slice-by-16";
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vpklib
+{
+	/**
+	 * @brief Computes a CRC32 (IEEE 802.3, same as zlib) over a buffer.
+	 * Uses a PCLMULQDQ folding kernel when the CPU has it, slice-by-16 tables otherwise.
+	 * @param data Data to checksum
+	 * @param size Size of the data in bytes
+	 * @param crc CRC of the preceding data, for checksumming in pieces. 0 to start
+	 * @return std::uint32_t Updated CRC
+	 */
+	std::uint32_t crc32(const void* data, std::size_t size, std::uint32_t crc = 0);
+
+	/**
+	 * @brief Combines the CRCs of two adjacent pieces of data into the CRC of both, like zlib's crc32_combine
+	 * @param crc1 CRC of the first piece
+	 * @param crc2 CRC of the second piece
+	 * @param size2 Size of the second piece in bytes
+	 * @return std::uint32_t CRC of the concatenation
+	 */
+	std::uint32_t crc32_combine(std::uint32_t crc1, std::uint32_t crc2, std::uint64_t size2);
+
+	/**
+	 * @brief Portable slice-by-16 implementation, exposed so it can be checked against the accelerated one
+	 */
+	std::uint32_t crc32_portable(const void* data, std::size_t size, std::uint32_t crc = 0);
+
+	/**
+	 * @brief Returns the name of the kernel crc32() dispatches to
+	 */
+	const char* crc32_kernel_name();
+}
@@ -0,0 +1,250 @@
+// Archive comparison
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <memory>
+
+#include "vpk_diff.hpp"
+#include "vpk_path_hash.hpp"
+#include "vpk_thread.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	constexpr std::size_t COMPARE_BUFFER = 1 << 20;
+	constexpr const char SNAPSHOT_HEADER[] = "# vpkindex 1";
+
+	// Handles that are live (not removed pending a save)
+	std::vector<vpk_file_handle> live_files(vpk_archive& archive) {
+		const auto& names = archive.get_file_names();
+		std::vector<vpk_file_handle> handles;
+		handles.reserve(names.size());
+		for(vpk_file_handle h = 0; h < names.size(); h++) {
+			if(!archive.is_dirty() || archive.find_file(names[h]) == h)
+				handles.push_back(h);
+		}
+		return handles;
+	}
+
+	bool same_data(vpk_archive& a, vpk_file_handle ha, vpk_archive& b, vpk_file_handle hb, std::uint64_t size, bool& readError) {
+		auto bufA = std::make_unique<byte[]>(std::min<std::uint64_t>(size, COMPARE_BUFFER));
+		auto bufB = std::make_unique<byte[]>(std::min<std::uint64_t>(size, COMPARE_BUFFER));
+		for(std::uint64_t offset = 0; offset < size;) {
+			const auto n = static_cast<std::size_t>(std::min<std::uint64_t>(size - offset, COMPARE_BUFFER));
+			if(a.read_file_range(ha, offset, bufA.get(), n) != n || b.read_file_range(hb, offset, bufB.get(), n) != n) {
+				readError = true;
+				return false;
+			}
+			if(std::memcmp(bufA.get(), bufB.get(), n))
+				return false;
+			offset += n;
+		}
+		return true;
+	}
+
+	// Compares the bodies of an ambiguous pair, setting the flag on a read error
+	using compare_fn = std::function<bool(const vpk_diff_entry& e, bool& readError)>;
+
+	// Shared by diff_archives and diff_snapshot. The old side is its live slots and accessors for them. Without
+	// a compare function, ambiguous pairs count as changed.
+	template<class Name, class Size, class Crc>
+	vpk_diff_result diff_core(const std::vector<vpk_file_handle>& oldFiles, std::size_t oldSlots, Name&& nameOf, Size&& sizeOf,
+		Crc&& crcOf, vpk_archive& newArchive, const vpk_diff_options& options, const compare_fn& same) {
+		const auto start = std::chrono::steady_clock::now();
+		vpk_diff_result result;
+
+		const auto& newNames = newArchive.get_file_names();
+		const auto newFiles = live_files(newArchive);
+
+		// Name hash index of the old side. Exact names, the hash just happens to be the folded one
+		path_index index;
+		index.reset(oldFiles.size());
+		for(auto h : oldFiles)
+			index.insert(path_hash(nameOf(h)), h);
+
+		std::vector<bool> matched(oldSlots, false);
+		std::vector<vpk_diff_entry> ambiguous;
+		auto record = [&](vpk_diff_entry e) {
+			switch(e.type) {
+				case vpk_diff_entry::kind::added:
+					result.added++;
+					result.added_bytes += e.new_size;
+					break;
+				case vpk_diff_entry::kind::removed:
+					result.removed++;
+					result.removed_bytes += e.old_size;
+					break;
+				case vpk_diff_entry::kind::changed:
+					result.changed++;
+					result.changed_old_bytes += e.old_size;
+					result.changed_new_bytes += e.new_size;
+					break;
+			}
+			result.entries.push_back(std::move(e));
+		};
+
+		for(auto h : newFiles) {
+			const auto& name = newNames[h];
+			const auto old = index.find(path_hash(name), [&](std::uint64_t o) { return nameOf(o) == name; });
+
+			vpk_diff_entry e;
+			e.name = name;
+			e.new_handle = h;
+			e.new_size = newArchive.get_file_size(h);
+			if(old == INVALID_HANDLE) {
+				e.type = vpk_diff_entry::kind::added;
+				record(std::move(e));
+				continue;
+			}
+
+			matched[old] = true;
+			e.old_handle = old;
+			e.old_size = sizeOf(old);
+			e.type = vpk_diff_entry::kind::changed;
+			const auto oldCrc = crcOf(old);
+			const auto newCrc = newArchive.get_file_crc32(h);
+			if(e.old_size != e.new_size)
+				record(std::move(e));
+			else if(e.new_size && (!oldCrc || !newCrc)) {
+				// No CRC to go by
+				if(same && options.compare_ambiguous)
+					ambiguous.push_back(std::move(e));
+				else
+					record(std::move(e));
+			}
+			else if(oldCrc != newCrc)
+				record(std::move(e));
+			else
+				result.unchanged++;
+		}
+
+		for(auto h : oldFiles) {
+			if(matched[h])
+				continue;
+			vpk_diff_entry e;
+			e.type = vpk_diff_entry::kind::removed;
+			e.name = nameOf(h);
+			e.old_handle = h;
+			e.old_size = sizeOf(h);
+			record(std::move(e));
+		}
+
+		// Metadata couldn't tell, compare the data itself
+		std::vector<std::uint8_t> differs(ambiguous.size(), 0);
+		std::atomic<bool> readError = false;
+		parallel_for(ambiguous.size(), [&](std::size_t i) {
+			bool failed = false;
+			differs[i] = !same(ambiguous[i], failed);
+			if(failed)
+				readError.store(true, std::memory_order_relaxed);
+		}, options.threads, 1);
+		if(readError) {
+			result.error = "failed to read file data";
+			return result;
+		}
+		for(std::size_t i = 0; i < ambiguous.size(); i++) {
+			result.bodies_compared++;
+			result.bytes_compared += ambiguous[i].new_size * 2;
+			if(differs[i])
+				record(std::move(ambiguous[i]));
+			else
+				result.unchanged++;
+		}
+
+		std::sort(result.entries.begin(), result.entries.end(), [](const auto& a, const auto& b) { return a.name < b.name; });
+		result.ok = true;
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return result;
+	}
+
+}
+
+vpk_diff_result vpklib::diff_archives(vpk_archive& oldArchive, vpk_archive& newArchive, const vpk_diff_options& options) {
+	const auto& oldNames = oldArchive.get_file_names();
+	return diff_core(live_files(oldArchive), oldNames.size(),
+		[&](vpk_file_handle h) -> const std::string& { return oldNames[h]; },
+		[&](vpk_file_handle h) { return oldArchive.get_file_size(h); },
+		[&](vpk_file_handle h) { return oldArchive.get_file_crc32(h); },
+		newArchive, options,
+		[&](const vpk_diff_entry& e, bool& readError) {
+			return same_data(oldArchive, e.old_handle, newArchive, e.new_handle, e.new_size, readError);
+		});
+}
+
+vpk_diff_result vpklib::diff_snapshot(const std::vector<vpk_snapshot_entry>& oldSnapshot, vpk_archive& newArchive, const vpk_diff_options& options) {
+	std::vector<vpk_file_handle> oldFiles(oldSnapshot.size());
+	for(std::size_t i = 0; i < oldFiles.size(); i++)
+		oldFiles[i] = i;
+	return diff_core(oldFiles, oldSnapshot.size(),
+		[&](vpk_file_handle i) -> const std::string& { return oldSnapshot[i].name; },
+		[&](vpk_file_handle i) { return oldSnapshot[i].size; },
+		[&](vpk_file_handle i) { return oldSnapshot[i].crc; },
+		newArchive, options, nullptr);
+}
+
+bool vpklib::write_snapshot(vpk_archive& archive, const std::filesystem::path& path, std::string* error) {
+	const auto tmp = path.string() + ".tmp";
+	std::ofstream out(tmp, std::ios::trunc);
+	if(!out) {
+		if(error)
+			*error = "failed to create '" + tmp + "': " + strerror(errno);
+		return false;
+	}
+
+	const auto& names = archive.get_file_names();
+	out << SNAPSHOT_HEADER << "\n# crc32\tsize\tname\n";
+	char crc[16];
+	for(auto h : live_files(archive)) {
+		snprintf(crc, sizeof(crc), "%08x", archive.get_file_crc32(h));
+		out << crc << '\t' << archive.get_file_size(h) << '\t' << names[h] << '\n';
+	}
+
+	out.close();
+	if(!out || std::rename(tmp.c_str(), path.c_str()) != 0) {
+		std::remove(tmp.c_str());
+		if(error)
+			*error = "failed to write '" + path.string() + "'";
+		return false;
+	}
+	return true;
+}
+
+bool vpklib::read_snapshot(const std::filesystem::path& path, std::vector<vpk_snapshot_entry>& out, std::string* error) {
+	std::ifstream in(path);
+	std::string line;
+	if(!in || !std::getline(in, line) || line.rfind(SNAPSHOT_HEADER, 0) != 0) {
+		if(error)
+			*error = "'" + path.string() + "' is not an index snapshot";
+		return false;
+	}
+
+	out.clear();
+	for(std::size_t lineNumber = 2; std::getline(in, line); lineNumber++) {
+		if(!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		// crc32, size, then the name which may itself contain tabs
+		vpk_snapshot_entry e;
+		char* end = line.data();
+		e.crc = static_cast<std::uint32_t>(std::strtoul(end, &end, 16));
+		bool valid = *end == '\t';
+		if(valid) {
+			e.size = std::strtoull(end + 1, &end, 10);
+			valid = *end == '\t';
+		}
+		if(!valid) {
+			if(error)
+				*error = "malformed record on line " + std::to_string(lineNumber) + " of '" + path.string() + "'";
+			return false;
+		}
+		e.name.assign(end + 1, line.data() + line.size());
+		out.push_back(std::move(e));
+	}
+	return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "vpk.hpp"
+
+namespace vpklib
+{
+	struct vpk_diff_options
+	{
+		unsigned threads = 0;				// For body comparisons, 0 for all cores
+		bool compare_ambiguous = true;		// Read both bodies when the metadata can't decide (see vpk_diff)
+	};
+
+	struct vpk_diff_entry
+	{
+		enum class kind : std::uint8_t
+		{
+			added,
+			removed,
+			changed,
+		};
+
+		kind type;
+		std::string name;
+		vpk_file_handle old_handle = INVALID_HANDLE;	// INVALID_HANDLE for added files. An index into the snapshot for diff_snapshot
+		vpk_file_handle new_handle = INVALID_HANDLE;	// INVALID_HANDLE for removed files
+		std::uint64_t old_size = 0;
+		std::uint64_t new_size = 0;
+	};
+
+	struct vpk_diff_result
+	{
+		bool ok = false;
+		std::string error;						// Set when !ok
+		std::vector<vpk_diff_entry> entries;	// Sorted by name
+
+		std::uint64_t added = 0;
+		std::uint64_t removed = 0;
+		std::uint64_t changed = 0;
+		std::uint64_t unchanged = 0;
+
+		std::uint64_t added_bytes = 0;			// Size of the added files
+		std::uint64_t removed_bytes = 0;		// Size of the removed files
+		std::uint64_t changed_old_bytes = 0;	// Size of the changed files before
+		std::uint64_t changed_new_bytes = 0;	// and after
+
+		std::uint64_t bodies_compared = 0;		// Pairs whose data had to be read
+		std::uint64_t bytes_compared = 0;
+		double seconds = 0;
+	};
+
+	/**
+	 * @brief Compares two versions of an archive.
+	 *
+	 * Works on the parsed trees: every name in the new archive is looked up in a hash index of the old one,
+	 * and a pair with a different size or CRC32 is changed. Equal sizes and CRCs mean unchanged, unless a
+	 * non-empty file has no CRC recorded (0) on either side. Only those ambiguous pairs have their data read
+	 * and compared, so the cost is proportional to the number of files, not their size.
+	 * @param oldArchive Previous version
+	 * @param newArchive Current version
+	 * @param options Threading and whether to resolve ambiguous pairs (they count as changed otherwise)
+	 * @return vpk_diff_result Differences and totals
+	 */
+	vpk_diff_result diff_archives(vpk_archive& oldArchive, vpk_archive& newArchive, const vpk_diff_options& options = {});
+
+	/**
+	 * @brief One file as recorded in an index snapshot
+	 */
+	struct vpk_snapshot_entry
+	{
+		std::string name;
+		std::uint64_t size = 0;
+		std::uint32_t crc = 0;
+	};
+
+	/**
+	 * @brief Saves the name, size and CRC32 of every file, which is all diff_snapshot needs of a previous version.
+	 * The file is text, one "crc32<TAB>size<TAB>name" line per file, written under a temporary name and renamed into place
+	 * @param archive Archive to record
+	 * @param path Snapshot file to write
+	 * @param error If not null, receives a description of the problem on failure
+	 * @return bool False if the file can't be written
+	 */
+	bool write_snapshot(vpk_archive& archive, const std::filesystem::path& path, std::string* error = nullptr);
+
+	/**
+	 * @brief Loads a snapshot written by write_snapshot
+	 * @param path Snapshot file
+	 * @param out Receives the files in file order
+	 * @param error If not null, receives a description of the problem on failure
+	 * @return bool False if the file can't be read or isn't a snapshot
+	 */
+	bool read_snapshot(const std::filesystem::path& path, std::vector<vpk_snapshot_entry>& out, std::string* error = nullptr);
+
+	/**
+	 * @brief Compares a snapshot of a previous version with an archive, like diff_archives.
+	 * There is no old data to read, so ambiguous pairs (no CRC recorded) always count as changed.
+	 * @param oldSnapshot Previous version, from read_snapshot
+	 * @param newArchive Current version
+	 * @param options Threading options
+	 * @return vpk_diff_result Differences and totals. old_handle indexes oldSnapshot
+	 */
+	vpk_diff_result diff_snapshot(const std::vector<vpk_snapshot_entry>& oldSnapshot, vpk_archive& newArchive, const vpk_diff_options& options = {});
+}
@@ -0,0 +1,200 @@
+// Generates synthetic archives for tests and benchmarks
+
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#include "vpk_corpus.hpp"
+
+#include "argparse.hpp"
+
+// Sizes with an optional K/M/G suffix. 0 is allowed
+static bool parse_size(const std::string& text, std::uint64_t& out) {
+	char* end = nullptr;
+	auto value = strtod(text.c_str(), &end);
+	if(end == text.c_str())
+		return false;
+	switch(*end) {
+		case 'g': case 'G': value *= 1024;
+		[[fallthrough]];
+		case 'm': case 'M': value *= 1024;
+		[[fallthrough]];
+		case 'k': case 'K': value *= 1024; end++;
+		default: break;
+	}
+	if(*end || value < 0)
+		return false;
+	out = static_cast<std::uint64_t>(value);
+	return true;
+}
+
+int main(int argc, const char** argv)
+{
+	argparse::ArgumentParser parser("vpk_gen");
+
+	parser.add_argument("--vpk-version")
+		.help("VPK version to write, 1 or 2")
+		.default_value(2)
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("--seed")
+		.help("Seed for everything generated. The same seed and options always give the same archive")
+		.default_value(std::string("1"))
+		.nargs(1);
+	parser.add_argument("-n", "--files")
+		.help("Number of files")
+		.default_value(std::string("10000"))
+		.nargs(1);
+	parser.add_argument("--size-dist")
+		.help("File size distribution: fixed (--size-median), uniform (--size-min to --size-max) or lognormal")
+		.default_value(std::string("lognormal"))
+		.nargs(1);
+	parser.add_argument("--size-min")
+		.help("Smallest file (K/M/G suffixes allowed)")
+		.default_value(std::string("0"))
+		.nargs(1);
+	parser.add_argument("--size-median")
+		.help("Median file size for lognormal, the size for fixed")
+		.default_value(std::string("8K"))
+		.nargs(1);
+	parser.add_argument("--size-sigma")
+		.help("Spread of the lognormal distribution")
+		.default_value(1.5)
+		.scan<'g', double>()
+		.nargs(1);
+	parser.add_argument("--size-max")
+		.help("Largest file")
+		.default_value(std::string("16M"))
+		.nargs(1);
+	parser.add_argument("--depth")
+		.help("Most directory levels")
+		.default_value(4)
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("--files-per-dir")
+		.help("Average number of files per directory")
+		.default_value(32)
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("--extensions")
+		.help("Extension mix as ext:weight pairs, ex: vtf:40,vmt:30,mdl:10,wav:20. An empty extension means none")
+		.nargs(1);
+	parser.add_argument("--preload-ratio")
+		.help("Share of files with preload data in the _dir")
+		.default_value(0.1)
+		.scan<'g', double>()
+		.nargs(1);
+	parser.add_argument("--preload-max")
+		.help("Most preload bytes for one file")
+		.default_value(1024)
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("--embedded-ratio")
+		.help("Share of files stored entirely in the _dir (archive index 0x7FFF)")
+		.default_value(0.01)
+		.scan<'g', double>()
+		.nargs(1);
+	parser.add_argument("--chunk-size")
+		.help("VPK2 archive MD5 chunk size")
+		.default_value(std::string("1M"))
+		.nargs(1);
+	parser.add_argument("--max-archive-size")
+		.help("Largest _NNN.vpk to write")
+		.default_value(std::string("200M"))
+		.nargs(1);
+	parser.add_argument("--threads")
+		.help("Threads to generate with, 0 for all cores")
+		.default_value(0)
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("archive")
+		.help("_dir.vpk to create, ex: corpus/pak01_dir.vpk");
+
+	parser.parse_args(argc, argv);
+
+	vpklib::vpk_corpus_options options;
+	options.version = parser.get<int>("--vpk-version");
+	options.size_sigma = parser.get<double>("--size-sigma");
+	options.max_depth = std::max(parser.get<int>("--depth"), 1);
+	options.files_per_directory = std::max(parser.get<int>("--files-per-dir"), 1);
+	options.preload_ratio = parser.get<double>("--preload-ratio");
+	options.embedded_ratio = parser.get<double>("--embedded-ratio");
+	options.threads = std::max(parser.get<int>("--threads"), 0);
+
+	const int preloadMax = parser.get<int>("--preload-max");
+	if(preloadMax < 0 || preloadMax > 0xFFFF) {
+		fprintf(stderr, "ERROR: --preload-max must be between 0 and 65535\n");
+		return 1;
+	}
+	options.preload_max = preloadMax;
+
+	struct size_arg
+	{
+		const char* name;
+		std::uint64_t* out;
+	};
+	std::uint64_t chunkSize = 0;
+	const size_arg sizes[] = {
+		{"--files", &options.file_count},
+		{"--size-min", &options.size_min},
+		{"--size-median", &options.size_median},
+		{"--size-max", &options.size_max},
+		{"--chunk-size", &chunkSize},
+		{"--max-archive-size", &options.max_archive_size},
+	};
+	for(const auto& arg : sizes) {
+		auto text = parser.get<std::string>(arg.name);
+		if(!parse_size(text, *arg.out)) {
+			fprintf(stderr, "ERROR: Invalid value '%s' for %s\n", text.c_str(), arg.name);
+			return 1;
+		}
+	}
+	if(!chunkSize || chunkSize > 0xFFFFFFFFull) {
+		fprintf(stderr, "ERROR: Invalid chunk size\n");
+		return 1;
+	}
+	options.md5_chunk_size = static_cast<std::uint32_t>(chunkSize);
+
+	const auto seed = parser.get<std::string>("--seed");
+	char* seedEnd = nullptr;
+	options.seed = std::strtoull(seed.c_str(), &seedEnd, 0);
+	if(seed.empty() || *seedEnd) {
+		fprintf(stderr, "ERROR: Invalid seed '%s'\n", seed.c_str());
+		return 1;
+	}
+
+	const auto dist = parser.get<std::string>("--size-dist");
+	if(dist == "fixed")
+		options.distribution = vpklib::vpk_corpus_options::size_distribution::fixed;
+	else if(dist == "uniform")
+		options.distribution = vpklib::vpk_corpus_options::size_distribution::uniform;
+	else if(dist == "lognormal")
+		options.distribution = vpklib::vpk_corpus_options::size_distribution::lognormal;
+	else {
+		fprintf(stderr, "ERROR: Unknown size distribution '%s'\n", dist.c_str());
+		return 1;
+	}
+
+	if(parser.is_used("--extensions")) {
+		std::string error;
+		if(!vpklib::parse_extension_mix(parser.get<std::string>("--extensions"), options.extensions, &error)) {
+			fprintf(stderr, "ERROR: Invalid extension mix: %s\n", error.c_str());
+			return 1;
+		}
+	}
+
+	const auto path = parser.get<std::string>("archive");
+	auto result = vpklib::generate_corpus(path, options);
+	if(!result.ok) {
+		fprintf(stderr, "ERROR: Failed to generate '%s': %s\n", path.c_str(), result.error.c_str());
+		return 1;
+	}
+
+	const double mib = 1024.0 * 1024.0;
+	printf("Generated %llu files, %.1f MiB in %u archives in %.2f seconds\n", static_cast<unsigned long long>(result.files),
+		result.bytes / mib, result.archives, result.seconds);
+	printf("%llu files with preload data (%.1f MiB), %llu stored in the _dir (%.1f MiB)\n",
+		static_cast<unsigned long long>(result.preload_files), result.preload_bytes / mib,
+		static_cast<unsigned long long>(result.embedded_files), result.embedded_bytes / mib);
+	return 0;
+}
@@ -0,0 +1,827 @@
+// Glob/regex path matching compiled to a DFA
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <map>
+#include <stdexcept>
+
+#include "vpk_match.hpp"
+#include "vpk_thread.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	using charset = std::bitset<256>;
+
+	// Regexes we can't compile throw this and go to std::regex instead
+	struct unsupported_error : std::runtime_error
+	{
+		using std::runtime_error::runtime_error;
+	};
+
+	// Upper bound on DFA size before we give up on the union and build per-pattern DFAs
+	constexpr std::size_t MAX_DFA_STATES = 8192;
+
+	// Largest {m,n} we're willing to expand
+	constexpr int MAX_REPEAT = 256;
+
+	constexpr int INFINITE = -1;
+
+	charset single(unsigned char c) {
+		charset s;
+		s.set(c);
+		return s;
+	}
+
+	charset all_but(std::initializer_list<unsigned char> chars) {
+		charset s;
+		s.set();
+		for(auto c : chars)
+			s.reset(c);
+		return s;
+	}
+
+}
+
+//---------------------------------------------------------------------------//
+// Syntax tree
+
+struct vpk_path_matcher::Node
+{
+	enum type_t
+	{
+		SET,
+		CONCAT,
+		ALT,
+		REPEAT,
+	};
+
+	type_t type;
+	charset set;
+	std::vector<std::shared_ptr<Node>> children;
+	int min = 0;
+	int max = 0;
+
+	static std::shared_ptr<Node> make_set(const charset& s) {
+		auto n = std::make_shared<Node>();
+		n->type = SET;
+		n->set = s;
+		return n;
+	}
+
+	static std::shared_ptr<Node> make(type_t type, std::vector<std::shared_ptr<Node>> children = {}) {
+		auto n = std::make_shared<Node>();
+		n->type = type;
+		n->children = std::move(children);
+		return n;
+	}
+
+	static std::shared_ptr<Node> make_repeat(std::shared_ptr<Node> child, int min, int max) {
+		auto n = make(REPEAT, {std::move(child)});
+		n->min = min;
+		n->max = max;
+		return n;
+	}
+
+	// Single literal character, or -1
+	int literal() const {
+		if(type != SET || set.count() != 1)
+			return -1;
+		for(int i = 0; i < 256; i++) {
+			if(set.test(i))
+				return i;
+		}
+		return -1;
+	}
+};
+
+namespace {
+
+	using node_ptr = std::shared_ptr<vpk_path_matcher::Node>;
+	using Node = vpk_path_matcher::Node;
+
+	// Parses glob syntax
+	class glob_parser
+	{
+	private:
+		const std::string& m_text;
+		std::size_t m_pos = 0;
+
+		bool at_end() const { return m_pos >= m_text.size(); };
+		char peek() const { return m_text[m_pos]; };
+
+		charset parse_class() {
+			// Opening '[' already consumed
+			bool negate = false;
+			if(!at_end() && (peek() == '!' || peek() == '^')) {
+				negate = true;
+				m_pos++;
+			}
+			charset s;
+			bool first = true;
+			while(true) {
+				if(at_end())
+					throw std::invalid_argument("unterminated character class");
+				unsigned char c = m_text[m_pos++];
+				if(c == ']' && !first)
+					break;
+				first = false;
+				if(c == '\\' && !at_end())
+					c = m_text[m_pos++];
+				if(m_pos + 1 < m_text.size() && peek() == '-' && m_text[m_pos + 1] != ']') {
+					unsigned char hi = m_text[m_pos + 1];
+					m_pos += 2;
+					if(hi < c)
+						throw std::invalid_argument("invalid range in character class");
+					for(int i = c; i <= hi; i++)
+						s.set(i);
+				}
+				else {
+					s.set(c);
+				}
+			}
+			if(negate)
+				s.flip();
+			// Classes never match the separator, same as * and ?
+			s.reset('/');
+			return s;
+		}
+
+		// Parses until end of input, or an unnested ',' or '}' when inside braces
+		node_ptr parse_sequence(bool inBraces) {
+			std::vector<node_ptr> items;
+			while(!at_end()) {
+				char c = peek();
+				if(inBraces && (c == ',' || c == '}'))
+					break;
+				m_pos++;
+				switch(c) {
+				case '*':
+					if(!at_end() && peek() == '*') {
+						m_pos++;
+						auto any = Node::make_repeat(Node::make_set(all_but({})), 0, INFINITE);
+						if(!at_end() && peek() == '/') {
+							// '**/' matches zero or more whole directories
+							m_pos++;
+							items.push_back(Node::make_repeat(Node::make(Node::CONCAT, {any, Node::make_set(single('/'))}), 0, 1));
+						}
+						else {
+							items.push_back(any);
+						}
+					}
+					else {
+						items.push_back(Node::make_repeat(Node::make_set(all_but({'/'})), 0, INFINITE));
+					}
+					break;
+				case '?':
+					items.push_back(Node::make_set(all_but({'/'})));
+					break;
+				case '[':
+					items.push_back(Node::make_set(parse_class()));
+					break;
+				case '{': {
+					std::vector<node_ptr> alts;
+					while(true) {
+						alts.push_back(parse_sequence(true));
+						if(at_end())
+							throw std::invalid_argument("unterminated '{'");
+						if(m_text[m_pos++] == '}')
+							break;
+					}
+					items.push_back(Node::make(Node::ALT, std::move(alts)));
+					break;
+				}
+				case '\\':
+					if(at_end())
+						throw std::invalid_argument("trailing '\\'");
+					items.push_back(Node::make_set(single(m_text[m_pos++])));
+					break;
+				default:
+					items.push_back(Node::make_set(single(c)));
+					break;
+				}
+			}
+			return Node::make(Node::CONCAT, std::move(items));
+		}
+
+	public:
+		explicit glob_parser(const std::string& text) : m_text(text) {};
+
+		node_ptr parse() {
+			auto n = parse_sequence(false);
+			if(!at_end())
+				throw std::invalid_argument("unexpected '}'");
+			return n;
+		}
+	};
+
+	// Parses the supported subset of ECMAScript regex
+	class regex_parser
+	{
+	private:
+		const std::string& m_text;
+		std::size_t m_pos = 0;
+
+		bool at_end() const { return m_pos >= m_text.size(); };
+		char peek() const { return m_text[m_pos]; };
+
+		static charset digits() {
+			charset s;
+			for(int c = '0'; c <= '9'; c++)
+				s.set(c);
+			return s;
+		}
+
+		static charset word() {
+			charset s = digits();
+			for(int c = 'a'; c <= 'z'; c++)
+				s.set(c);
+			for(int c = 'A'; c <= 'Z'; c++)
+				s.set(c);
+			s.set('_');
+			return s;
+		}
+
+		static charset space() {
+			charset s;
+			for(char c : {' ', '\t', '\n', '\r', '\f', '\v'})
+				s.set(static_cast<unsigned char>(c));
+			return s;
+		}
+
+		// Escape after the '\', as a set
+		charset parse_escape() {
+			if(at_end())
+				throw std::invalid_argument("trailing '\\'");
+			char c = m_text[m_pos++];
+			switch(c) {
+			case 'd': return digits();
+			case 'D': return ~digits();
+			case 'w': return word();
+			case 'W': return ~word();
+			case 's': return space();
+			case 'S': return ~space();
+			case 'n': return single('\n');
+			case 't': return single('\t');
+			case 'r': return single('\r');
+			case 'f': return single('\f');
+			case 'v': return single('\v');
+			default:
+				// Word boundaries, backreferences, \x, \u, \c... leave those to std::regex
+				if(std::isalnum(static_cast<unsigned char>(c)))
+					throw unsupported_error("escape");
+				return single(c);
+			}
+		}
+
+		charset parse_class() {
+			bool negate = false;
+			if(!at_end() && peek() == '^') {
+				negate = true;
+				m_pos++;
+			}
+			charset s;
+			while(true) {
+				if(at_end())
+					throw std::invalid_argument("unterminated character class");
+				char c = m_text[m_pos++];
+				if(c == ']')
+					break;
+
+				charset item;
+				int lo = -1;
+				if(c == '\\') {
+					item = parse_escape();
+					if(item.count() == 1) {
+						for(int i = 0; i < 256; i++) {
+							if(item.test(i))
+								lo = i;
+						}
+					}
+				}
+				else if(c == '[') {
+					// [:alpha:] and friends
+					throw unsupported_error("class");
+				}
+				else {
+					lo = static_cast<unsigned char>(c);
+					item = single(c);
+				}
+
+				if(lo >= 0 && m_pos + 1 < m_text.size() && peek() == '-' && m_text[m_pos + 1] != ']') {
+					m_pos++;
+					char hc = m_text[m_pos++];
+					int hi = static_cast<unsigned char>(hc);
+					if(hc == '\\') {
+						auto esc = parse_escape();
+						if(esc.count() != 1)
+							throw std::invalid_argument("invalid range in character class");
+						for(int i = 0; i < 256; i++) {
+							if(esc.test(i))
+								hi = i;
+						}
+					}
+					if(hi < lo)
+						throw std::invalid_argument("invalid range in character class");
+					for(int i = lo; i <= hi; i++)
+						s.set(i);
+				}
+				else {
+					s |= item;
+				}
+			}
+			return negate ? ~s : s;
+		}
+
+		int parse_int() {
+			if(at_end() || !std::isdigit(static_cast<unsigned char>(peek())))
+				throw unsupported_error("brace");
+			int v = 0;
+			while(!at_end() && std::isdigit(static_cast<unsigned char>(peek()))) {
+				v = v * 10 + (m_text[m_pos++] - '0');
+				if(v > MAX_REPEAT)
+					throw unsupported_error("repeat count");
+			}
+			return v;
+		}
+
+		node_ptr parse_atom() {
+			char c = m_text[m_pos++];
+			switch(c) {
+			case '(': {
+				if(!at_end() && peek() == '?') {
+					if(m_pos + 1 < m_text.size() && m_text[m_pos + 1] == ':')
+						m_pos += 2;
+					else
+						throw unsupported_error("lookaround");
+				}
+				auto n = parse_alt();
+				if(at_end() || m_text[m_pos++] != ')')
+					throw std::invalid_argument("mismatched '('");
+				return n;
+			}
+			case '[':
+				return Node::make_set(parse_class());
+			case '.':
+				return Node::make_set(all_but({'\n', '\r'}));
+			case '\\':
+				return Node::make_set(parse_escape());
+			case '^':
+			case '$':
+				// Only meaningful at the ends, which parse() strips
+				throw unsupported_error("anchor");
+			case '*':
+			case '+':
+			case '?':
+				throw std::invalid_argument("nothing to repeat");
+			case '{':
+			case ')':
+				throw unsupported_error("brace");
+			default:
+				return Node::make_set(single(c));
+			}
+		}
+
+		node_ptr parse_repeat() {
+			auto atom = parse_atom();
+			while(!at_end()) {
+				int min, max;
+				char c = peek();
+				if(c == '*') {
+					min = 0;
+					max = INFINITE;
+					m_pos++;
+				}
+				else if(c == '+') {
+					min = 1;
+					max = INFINITE;
+					m_pos++;
+				}
+				else if(c == '?') {
+					min = 0;
+					max = 1;
+					m_pos++;
+				}
+				else if(c == '{') {
+					m_pos++;
+					min = max = parse_int();
+					if(!at_end() && peek() == ',') {
+						m_pos++;
+						max = (!at_end() && peek() == '}') ? INFINITE : parse_int();
+					}
+					if(at_end() || m_text[m_pos++] != '}')
+						throw unsupported_error("brace");
+					if(max != INFINITE && max < min)
+						throw std::invalid_argument("invalid repeat range");
+				}
+				else {
+					break;
+				}
+				// Lazy quantifiers match the same set of whole strings
+				if(!at_end() && peek() == '?')
+					m_pos++;
+				atom = Node::make_repeat(atom, min, max);
+			}
+			return atom;
+		}
+
+		node_ptr parse_concat() {
+			std::vector<node_ptr> items;
+			while(!at_end() && peek() != '|' && peek() != ')')
+				items.push_back(parse_repeat());
+			return Node::make(Node::CONCAT, std::move(items));
+		}
+
+		node_ptr parse_alt() {
+			std::vector<node_ptr> alts;
+			alts.push_back(parse_concat());
+			while(!at_end() && peek() == '|') {
+				m_pos++;
+				alts.push_back(parse_concat());
+			}
+			return alts.size() == 1 ? alts[0] : Node::make(Node::ALT, std::move(alts));
+		}
+
+	public:
+		explicit regex_parser(const std::string& text) : m_text(text) {};
+
+		node_ptr parse() {
+			auto n = parse_alt();
+			if(!at_end())
+				throw std::invalid_argument("mismatched ')'");
+			return n;
+		}
+	};
+
+	// Leading and trailing literal characters of a pattern
+	void literal_affixes(const node_ptr& root, std::string& prefix, std::string& suffix) {
+		prefix.clear();
+		suffix.clear();
+		if(root->type == Node::SET) {
+			if(root->literal() >= 0)
+				prefix = suffix = std::string(1, static_cast<char>(root->literal()));
+			return;
+		}
+		if(root->type != Node::CONCAT)
+			return;
+		for(const auto& n : root->children) {
+			int c = n->literal();
+			if(c < 0)
+				break;
+			prefix.push_back(static_cast<char>(c));
+		}
+		for(auto it = root->children.rbegin(); it != root->children.rend(); ++it) {
+			int c = (*it)->literal();
+			if(c < 0)
+				break;
+			suffix.insert(suffix.begin(), static_cast<char>(c));
+		}
+	}
+
+	// Thompson NFA
+	struct Nfa
+	{
+		enum type_t
+		{
+			SET,
+			SPLIT,	// Epsilon to out, and to out1 if set
+			MATCH,
+		};
+
+		struct State
+		{
+			type_t type;
+			int set = -1;
+			int out = -1;
+			int out1 = -1;
+		};
+
+		struct Fragment
+		{
+			int start;
+			std::vector<std::pair<int, int>> outs; // (state, which out) left dangling
+		};
+
+		std::vector<State> states;
+		std::vector<charset> sets;
+
+		int add(type_t type) {
+			states.push_back({type});
+			return static_cast<int>(states.size()) - 1;
+		}
+
+		void patch(const std::vector<std::pair<int, int>>& outs, int target) {
+			for(auto [s, which] : outs)
+				(which ? states[s].out1 : states[s].out) = target;
+		}
+
+		Fragment build(const node_ptr& n) {
+			switch(n->type) {
+			case Node::SET: {
+				int s = add(SET);
+				states[s].set = static_cast<int>(sets.size());
+				sets.push_back(n->set);
+				return {s, {{s, 0}}};
+			}
+			case Node::CONCAT: {
+				if(n->children.empty()) {
+					int s = add(SPLIT);
+					return {s, {{s, 0}}};
+				}
+				auto frag = build(n->children[0]);
+				for(std::size_t i = 1; i < n->children.size(); i++) {
+					auto next = build(n->children[i]);
+					patch(frag.outs, next.start);
+					frag.outs = std::move(next.outs);
+				}
+				return frag;
+			}
+			case Node::ALT: {
+				auto frag = build(n->children[0]);
+				for(std::size_t i = 1; i < n->children.size(); i++) {
+					auto other = build(n->children[i]);
+					int s = add(SPLIT);
+					states[s].out = frag.start;
+					states[s].out1 = other.start;
+					frag.start = s;
+					frag.outs.insert(frag.outs.end(), other.outs.begin(), other.outs.end());
+				}
+				return frag;
+			}
+			case Node::REPEAT:
+			default: {
+				const auto& child = n->children[0];
+				// Mandatory copies
+				int start = add(SPLIT);
+				std::vector<std::pair<int, int>> outs = {{start, 0}};
+				for(int i = 0; i < n->min; i++) {
+					auto c = build(child);
+					patch(outs, c.start);
+					outs = std::move(c.outs);
+				}
+				if(n->max == INFINITE) {
+					auto c = build(child);
+					int loop = add(SPLIT);
+					states[loop].out = c.start;
+					patch(outs, loop);
+					patch(c.outs, loop);
+					outs = {{loop, 1}};
+				}
+				else {
+					// Optional copies
+					std::vector<std::pair<int, int>> skipped;
+					for(int i = n->min; i < n->max; i++) {
+						auto c = build(child);
+						int opt = add(SPLIT);
+						states[opt].out = c.start;
+						patch(outs, opt);
+						skipped.push_back({opt, 1});
+						outs = std::move(c.outs);
+					}
+					outs.insert(outs.end(), skipped.begin(), skipped.end());
+				}
+				return {start, std::move(outs)};
+			}
+			}
+		}
+
+		// Adds s and everything reachable through epsilon moves to the set
+		void closure(int s, std::vector<char>& seen, std::vector<int>& out) const {
+			if(s < 0 || seen[s])
+				return;
+			seen[s] = 1;
+			if(states[s].type == SPLIT) {
+				closure(states[s].out, seen, out);
+				closure(states[s].out1, seen, out);
+			}
+			else {
+				out.push_back(s);
+			}
+		}
+	};
+
+}
+
+//---------------------------------------------------------------------------//
+// DFA
+
+struct vpk_path_matcher::Dfa
+{
+	std::uint8_t classes[256];	// Byte -> equivalence class
+	std::size_t classCount = 0;
+	std::vector<std::int32_t> table; // state * classCount + class -> state. State 0 is dead
+	std::vector<char> accept;
+
+	bool match(std::string_view s) const {
+		std::int32_t state = 1;
+		for(unsigned char c : s) {
+			state = table[state * classCount + classes[c]];
+			if(!state)
+				return false;
+		}
+		return accept[state];
+	}
+
+	// Subset construction. Returns null if the DFA would get too large
+	static std::unique_ptr<Dfa> build(const std::vector<node_ptr>& patterns) {
+		Nfa nfa;
+		int match = nfa.add(Nfa::MATCH);
+		int start = -1;
+		for(const auto& p : patterns) {
+			auto frag = nfa.build(p);
+			nfa.patch(frag.outs, match);
+			if(start < 0) {
+				start = frag.start;
+			}
+			else {
+				int s = nfa.add(Nfa::SPLIT);
+				nfa.states[s].out = start;
+				nfa.states[s].out1 = frag.start;
+				start = s;
+			}
+		}
+
+		auto dfa = std::make_unique<Dfa>();
+
+		// Bytes that every set treats the same way share a class
+		std::map<std::vector<bool>, std::uint8_t> signatures;
+		for(int c = 0; c < 256; c++) {
+			std::vector<bool> sig(nfa.sets.size());
+			for(std::size_t i = 0; i < nfa.sets.size(); i++)
+				sig[i] = nfa.sets[i].test(c);
+			auto it = signatures.find(sig);
+			if(it == signatures.end())
+				it = signatures.insert({sig, static_cast<std::uint8_t>(signatures.size())}).first;
+			dfa->classes[c] = it->second;
+		}
+		dfa->classCount = signatures.size();
+
+		std::vector<int> representative(dfa->classCount);
+		for(int c = 255; c >= 0; c--)
+			representative[dfa->classes[c]] = c;
+
+		std::map<std::vector<int>, std::int32_t> ids;
+		std::vector<std::vector<int>> pending;
+
+		auto intern = [&](std::vector<int> set) -> std::int32_t {
+			std::sort(set.begin(), set.end());
+			auto it = ids.find(set);
+			if(it != ids.end())
+				return it->second;
+			auto id = static_cast<std::int32_t>(ids.size());
+			ids.insert({set, id});
+			dfa->accept.push_back(std::find(set.begin(), set.end(), match) != set.end());
+			dfa->table.resize(dfa->table.size() + dfa->classCount, 0);
+			pending.push_back(std::move(set));
+			return id;
+		};
+
+		intern({}); // Dead state
+		std::vector<char> seen(nfa.states.size());
+		std::vector<int> startSet;
+		nfa.closure(start, seen, startSet);
+		intern(startSet);
+
+		for(std::size_t id = 1; id < pending.size(); id++) {
+			if(pending.size() > MAX_DFA_STATES)
+				return nullptr;
+			for(std::size_t cls = 0; cls < dfa->classCount; cls++) {
+				std::fill(seen.begin(), seen.end(), 0);
+				std::vector<int> next;
+				for(int s : pending[id]) {
+					const auto& st = nfa.states[s];
+					if(st.type == Nfa::SET && nfa.sets[st.set].test(representative[cls]))
+						nfa.closure(st.out, seen, next);
+				}
+				// Copy out first, intern() may grow pending
+				auto target = intern(std::move(next));
+				dfa->table[id * dfa->classCount + cls] = target;
+			}
+		}
+		return dfa;
+	}
+};
+
+//---------------------------------------------------------------------------//
+
+vpk_path_matcher::vpk_path_matcher() = default;
+vpk_path_matcher::~vpk_path_matcher() = default;
+
+bool vpk_path_matcher::add_pattern(const std::string& pattern, syntax type, std::string* error) {
+	Pattern p;
+	try {
+		if(type == syntax::glob) {
+			p.ast = glob_parser(pattern).parse();
+		}
+		else {
+			try {
+				// Full-string matching makes anchors at the ends redundant
+				std::string body = pattern;
+				if(!body.empty() && body.front() == '^')
+					body.erase(0, 1);
+				if(!body.empty() && body.back() == '$' && (body.size() < 2 || body[body.size() - 2] != '\\'))
+					body.pop_back();
+				p.ast = regex_parser(body).parse();
+				if(!Dfa::build({p.ast}))
+					throw unsupported_error("too many states");
+			}
+			catch(std::exception&) {
+				// Either outside the subset or invalid, std::regex has the final say on which
+				p.ast = nullptr;
+				p.regex = std::make_unique<std::regex>(pattern, std::regex_constants::ECMAScript);
+			}
+		}
+		if(p.ast && !Dfa::build({p.ast}))
+			throw std::invalid_argument("pattern too complex");
+	}
+	catch(std::exception& e) {
+		if(error)
+			*error = e.what();
+		return false;
+	}
+
+	if(p.ast)
+		literal_affixes(p.ast, p.prefix, p.suffix);
+	m_patterns.push_back(std::move(p));
+	build();
+	return true;
+}
+
+void vpk_path_matcher::build() {
+	std::vector<node_ptr> asts;
+	for(const auto& p : m_patterns) {
+		if(p.ast)
+			asts.push_back(p.ast);
+	}
+
+	m_dfas.clear();
+	if(asts.empty())
+		return;
+
+	if(auto dfa = Dfa::build(asts)) {
+		m_dfas.push_back(std::move(dfa));
+		return;
+	}
+
+	// The union blew up, build each one on its own. add_pattern made sure each of these fits
+	for(const auto& ast : asts)
+		m_dfas.push_back(Dfa::build({ast}));
+}
+
+bool vpk_path_matcher::matches(std::string_view name) const {
+	if(m_patterns.empty())
+		return true;
+	for(const auto& dfa : m_dfas) {
+		if(dfa->match(name))
+			return true;
+	}
+	for(const auto& p : m_patterns) {
+		if(p.regex && std::regex_match(name.begin(), name.end(), *p.regex))
+			return true;
+	}
+	return false;
+}
+
+bool vpk_path_matcher::group_may_match(const vpk_directory_group& group) const {
+	// Every name in the group is "<directory>/<file>.<extension>", or "<directory>/<file>" without an extension
+	const std::string head = group.directory.empty() ? "" : group.directory + "/";
+	const std::string tail = group.extension.empty() ? "" : "." + group.extension;
+
+	for(const auto& p : m_patterns) {
+		bool prefixOk = p.prefix.size() <= head.size() ? head.starts_with(p.prefix) : p.prefix.starts_with(head);
+		bool suffixOk = p.suffix.size() <= tail.size() ? tail.ends_with(p.suffix) : p.suffix.ends_with(tail);
+		if(prefixOk && suffixOk)
+			return true;
+	}
+	return false;
+}
+
+std::vector<vpk_file_handle> vpk_path_matcher::select(const vpk_archive* archive, unsigned threads) const {
+	std::vector<vpk_file_handle> result;
+	const auto& names = archive->get_file_names();
+
+	if(m_patterns.empty()) {
+		result.resize(names.size());
+		for(std::size_t i = 0; i < names.size(); i++)
+			result[i] = i;
+		return result;
+	}
+
+	const auto& groups = archive->get_directory_groups();
+	std::vector<std::vector<vpk_file_handle>> perGroup(groups.size());
+
+	parallel_for(groups.size(), [&](std::size_t g) {
+		const auto& group = groups[g];
+		if(!group_may_match(group))
+			return;
+		for(auto h = group.first; h < group.first + group.count; h++) {
+			if(matches(names[h]))
+				perGroup[g].push_back(h);
+		}
+	}, threads, 4);
+
+	for(auto& v : perGroup)
+		result.insert(result.end(), v.begin(), v.end());
+	return result;
+}
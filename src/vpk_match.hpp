@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "vpk.hpp"
+
+namespace vpklib
+{
+	/**
+	 * @brief Matches file paths against a set of glob or regex patterns.
+	 * Patterns are compiled together into a single DFA, so matching a name costs one table lookup per byte
+	 * no matter how many patterns there are. Regexes outside of the supported subset (backreferences,
+	 * lookaround, anchors in the middle of the pattern, ...) fall back to std::regex.
+	 * A name matches if it fully matches any of the patterns. A matcher with no patterns matches everything.
+	 *
+	 * Glob syntax: `*` and `?` match within a single path component, `**` matches across components and
+	 * `**` followed by a slash also matches zero directories. `[abc]`, `[a-z]`, `[!abc]` are character classes,
+	 * `{x,y}` is alternation and `\` escapes the next character.
+	 *
+	 * Regex subset: literals, `.`, classes, `\d \w \s` and their negations, groups, `|`, and the
+	 * `* + ? {m} {m,} {m,n}` quantifiers (lazy variants are accepted). `^` and `$` are only allowed at the ends.
+	 */
+	class vpk_path_matcher
+	{
+	public:
+		enum class syntax
+		{
+			glob,
+			regex,
+		};
+
+		vpk_path_matcher();
+		~vpk_path_matcher();
+
+		/**
+		 * @brief Adds a pattern to the set
+		 * @param pattern Pattern text
+		 * @param type Pattern syntax
+		 * @param error If not null, receives a description of the problem when the pattern is invalid
+		 * @return bool False if the pattern is invalid
+		 */
+		bool add_pattern(const std::string& pattern, syntax type, std::string* error = nullptr);
+
+		/**
+		 * @brief Returns true if no patterns have been added
+		 */
+		bool empty() const { return m_patterns.empty(); };
+
+		/**
+		 * @brief Tests a single name
+		 * @param name Full path of the file
+		 * @return bool True if it matches any pattern
+		 */
+		bool matches(std::string_view name) const;
+
+		/**
+		 * @brief Returns every file in the archive that matches, in handle order.
+		 * Whole extension/directory groups are skipped using the patterns' literal prefixes and suffixes,
+		 * the remaining names are matched in parallel.
+		 * @param archive Archive to search
+		 * @param threads Thread count, 0 for all cores
+		 * @return std::vector<vpk_file_handle> Matching handles
+		 */
+		std::vector<vpk_file_handle> select(const vpk_archive* archive, unsigned threads = 0) const;
+
+		// Compiled form, only defined in vpk_match.cpp
+		struct Node;
+		struct Dfa;
+
+	private:
+		struct Pattern
+		{
+			std::shared_ptr<Node> ast;			// Null if this one falls back to std::regex
+			std::unique_ptr<std::regex> regex;
+			std::string prefix;					// Literal every match starts with
+			std::string suffix;					// Literal every match ends with
+		};
+
+		std::vector<Pattern> m_patterns;
+		std::vector<std::unique_ptr<Dfa>> m_dfas;	// Usually one for the union of every pattern
+
+		bool group_may_match(const vpk_directory_group& group) const;
+		void build();
+	};
+}
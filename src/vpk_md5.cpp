@@ -0,0 +1,252 @@
+// MD5, scalar and multi-buffer
+#include <algorithm>
+#include <cstring>
+
+#include "vpk_md5.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	constexpr std::uint32_t K[64] = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+	};
+
+	constexpr int S[64] = {
+		7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+		5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+		4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+		6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+	};
+
+	constexpr std::uint32_t INIT[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+
+	inline std::uint32_t load32(const std::uint8_t* p) {
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+	}
+
+	inline void store32(std::uint8_t* p, std::uint32_t v) {
+		p[0] = v;
+		p[1] = v >> 8;
+		p[2] = v >> 16;
+		p[3] = v >> 24;
+	}
+
+	// The 64 MD5 steps. V is either std::uint32_t or a GCC vector of them, one MD5 per lane
+	template<class V>
+	__attribute__((always_inline)) inline void rounds(V state[4], const V m[16]) {
+		V a = state[0], b = state[1], c = state[2], d = state[3];
+#pragma GCC unroll 64
+		for(int i = 0; i < 64; i++) {
+			V f;
+			int g;
+			if(i < 16) {
+				f = (b & c) | (~b & d);
+				g = i;
+			}
+			else if(i < 32) {
+				f = (d & b) | (~d & c);
+				g = (5 * i + 1) % 16;
+			}
+			else if(i < 48) {
+				f = b ^ c ^ d;
+				g = (3 * i + 5) % 16;
+			}
+			else {
+				f = c ^ (b | ~d);
+				g = (7 * i) % 16;
+			}
+			f = f + a + K[i] + m[g];
+			a = d;
+			d = c;
+			c = b;
+			b = b + ((f << S[i]) | (f >> (32 - S[i])));
+		}
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+	}
+
+	void block(std::uint32_t state[4], const std::uint8_t* p) {
+		std::uint32_t m[16];
+		for(int i = 0; i < 16; i++)
+			m[i] = load32(p + i * 4);
+		rounds(state, m);
+	}
+
+	// Builds the padded final block(s) for a message, returns how many there are (1 or 2)
+	std::size_t pad_tail(const std::uint8_t* tail, std::size_t tailSize, std::uint64_t totalSize, std::uint8_t out[128]) {
+		std::memset(out, 0, 128);
+		std::memcpy(out, tail, tailSize);
+		out[tailSize] = 0x80;
+		const std::size_t blocks = tailSize + 9 <= 64 ? 1 : 2;
+		const std::uint64_t bits = totalSize * 8;
+		for(int i = 0; i < 8; i++)
+			out[blocks * 64 - 8 + i] = static_cast<std::uint8_t>(bits >> (8 * i));
+		return blocks;
+	}
+
+	// Runs up to LANES jobs side by side. Every lane walks its full blocks then its padded tail
+	template<class V, int LANES>
+	__attribute__((always_inline)) inline void multi_lanes(const md5_job* jobs, int count) {
+		static const std::uint8_t zeros[64] = {};
+
+		const std::uint8_t* data[LANES];
+		std::size_t full[LANES];
+		std::size_t total[LANES];
+		std::uint8_t tails[LANES][128];
+
+		std::size_t steps = 0;
+		for(int l = 0; l < LANES; l++) {
+			if(l < count) {
+				data[l] = static_cast<const std::uint8_t*>(jobs[l].data);
+				full[l] = jobs[l].size / 64;
+				total[l] = full[l] + pad_tail(data[l] + full[l] * 64, jobs[l].size % 64, jobs[l].size, tails[l]);
+			}
+			else {
+				data[l] = zeros;
+				full[l] = total[l] = 0;
+			}
+			steps = std::max(steps, total[l]);
+		}
+
+		V state[4];
+		for(int i = 0; i < 4; i++) {
+			for(int l = 0; l < LANES; l++)
+				state[i][l] = INIT[i];
+		}
+
+		for(std::size_t s = 0; s < steps; s++) {
+			const std::uint8_t* p[LANES];
+			for(int l = 0; l < LANES; l++) {
+				if(s < full[l])
+					p[l] = data[l] + s * 64;
+				else if(s < total[l])
+					p[l] = tails[l] + (s - full[l]) * 64;
+				else
+					p[l] = zeros;
+			}
+
+			// Transpose: word w of every lane's block into one vector
+			V m[16];
+			for(int w = 0; w < 16; w++) {
+				for(int l = 0; l < LANES; l++)
+					m[w][l] = load32(p[l] + w * 4);
+			}
+			rounds(state, m);
+
+			for(int l = 0; l < count; l++) {
+				if(total[l] == s + 1) {
+					for(int i = 0; i < 4; i++)
+						store32(jobs[l].digest + i * 4, state[i][l]);
+				}
+			}
+		}
+	}
+
+	typedef std::uint32_t v4u __attribute__((vector_size(16)));
+	typedef std::uint32_t v8u __attribute__((vector_size(32)));
+
+	void multi_x4(const md5_job* jobs, std::size_t count) {
+		for(std::size_t i = 0; i < count; i += 4)
+			multi_lanes<v4u, 4>(jobs + i, static_cast<int>(std::min<std::size_t>(4, count - i)));
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define VPK_HAVE_AVX2 1
+
+	__attribute__((target("avx2")))
+	void multi_x8(const md5_job* jobs, std::size_t count) {
+		for(std::size_t i = 0; i < count; i += 8)
+			multi_lanes<v8u, 8>(jobs + i, static_cast<int>(std::min<std::size_t>(8, count - i)));
+	}
+
+	bool have_avx2() {
+		static const bool supported = __builtin_cpu_supports("avx2");
+		return supported;
+	}
+
+#endif
+
+}
+
+//---------------------------------------------------------------------------//
+
+md5::md5() {
+	std::memcpy(m_state, INIT, sizeof(m_state));
+}
+
+void md5::update(const void* data, std::size_t size) {
+	auto p = static_cast<const std::uint8_t*>(data);
+	m_length += size;
+
+	if(m_used) {
+		auto n = std::min(size, 64 - m_used);
+		std::memcpy(m_buffer + m_used, p, n);
+		m_used += n;
+		p += n;
+		size -= n;
+		if(m_used < 64)
+			return;
+		block(m_state, m_buffer);
+		m_used = 0;
+	}
+
+	while(size >= 64) {
+		block(m_state, p);
+		p += 64;
+		size -= 64;
+	}
+
+	std::memcpy(m_buffer, p, size);
+	m_used = size;
+}
+
+void md5::final(std::uint8_t digest[16]) {
+	std::uint8_t tail[128];
+	auto blocks = pad_tail(m_buffer, m_used, m_length, tail);
+	for(std::size_t i = 0; i < blocks; i++)
+		block(m_state, tail + i * 64);
+	for(int i = 0; i < 4; i++)
+		store32(digest + i * 4, m_state[i]);
+}
+
+void md5::hash(const void* data, std::size_t size, std::uint8_t digest[16]) {
+	md5 ctx;
+	ctx.update(data, size);
+	ctx.final(digest);
+}
+
+void vpklib::md5_multi(const md5_job* jobs, std::size_t count) {
+#ifdef VPK_HAVE_AVX2
+	if(have_avx2()) {
+		multi_x8(jobs, count);
+		return;
+	}
+#endif
+	multi_x4(jobs, count);
+}
+
+std::size_t vpklib::md5_lanes() {
+#ifdef VPK_HAVE_AVX2
+	if(have_avx2())
+		return 8;
+#endif
+	return 4;
+}
+
+const char* vpklib::md5_kernel_name() {
+#ifdef VPK_HAVE_AVX2
+	if(have_avx2())
+		return "avx2 x8";
+#endif
+	return "simd x4";
+}
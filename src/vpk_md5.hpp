@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vpklib
+{
+	/**
+	 * @brief Incremental MD5
+	 */
+	class md5
+	{
+	private:
+		std::uint32_t m_state[4];
+		std::uint64_t m_length = 0;
+		std::uint8_t m_buffer[64];
+		std::size_t m_used = 0;
+
+	public:
+		md5();
+
+		void update(const void* data, std::size_t size);
+
+		/**
+		 * @brief Finishes the hash. The object must not be updated afterwards
+		 * @param digest Receives the 16 byte digest
+		 */
+		void final(std::uint8_t digest[16]);
+
+		/**
+		 * @brief Hashes a single buffer
+		 */
+		static void hash(const void* data, std::size_t size, std::uint8_t digest[16]);
+	};
+
+	/**
+	 * @brief One buffer to hash with md5_multi
+	 */
+	struct md5_job
+	{
+		const void* data;
+		std::size_t size;
+		std::uint8_t* digest; // 16 bytes
+	};
+
+	/**
+	 * @brief Hashes several independent buffers at once.
+	 * Each SIMD lane runs a separate MD5, so a group of buffers costs about as much as one of them.
+	 * Lanes go idle once their buffer is done, so similarly sized buffers work best.
+	 * @param jobs Buffers to hash
+	 * @param count Number of jobs
+	 */
+	void md5_multi(const md5_job* jobs, std::size_t count);
+
+	/**
+	 * @brief Number of buffers md5_multi hashes at once on this CPU
+	 */
+	std::size_t md5_lanes();
+
+	/**
+	 * @brief Returns the name of the kernel md5_multi dispatches to
+	 */
+	const char* md5_kernel_name();
+}
@@ -0,0 +1,157 @@
+// Merged index over several archives
+#include <algorithm>
+
+#include "vpk_overlay.hpp"
+
+using namespace vpklib;
+
+bool vpk_overlay::mount(vpk_archive* archive, int priority) {
+	if(!archive)
+		return false;
+	auto slot = m_mounts.size();
+	for(std::size_t i = 0; i < m_mounts.size(); i++) {
+		if(m_mounts[i].archive == archive)
+			return false;
+		if(!m_mounts[i].archive && slot == m_mounts.size())
+			slot = i;
+	}
+	const Mount mount = {archive, priority, m_sequence++};
+	if(slot == m_mounts.size())
+		m_mounts.push_back(mount);
+	else
+		m_mounts[slot] = mount;
+
+	const auto mountIndex = static_cast<std::uint32_t>(slot);
+	for(vpk_file_handle h = 0; h < archive->get_file_count(); h++) {
+		auto name = archive->get_file_name(h);
+		if(archive->find_file(name) != h)
+			continue; // Removed, waiting for save()
+		const auto hash = path_hash(name);
+		const auto p = find_path(name, hash);
+		if(p != SIZE_MAX) {
+			if(mount.beats(m_mounts[m_paths[p].winner.mount]))
+				m_paths[p].winner = {mountIndex, h};
+			continue;
+		}
+
+		std::size_t index = m_paths.size();
+		if(!m_freePaths.empty()) {
+			index = m_freePaths.back();
+			m_freePaths.pop_back();
+		}
+		else {
+			m_paths.emplace_back();
+		}
+		m_paths[index] = {std::move(name), hash, {mountIndex, h}};
+		m_index.insert(hash, index);
+		m_filter.insert(hash);
+		m_count++;
+	}
+	if(m_filter.overfull())
+		rebuild_filter();
+	return true;
+}
+
+bool vpk_overlay::unmount(vpk_archive* archive) {
+	auto found = std::find_if(m_mounts.begin(), m_mounts.end(), [&](const Mount& m) { return m.archive == archive; });
+	if(!archive || found == m_mounts.end())
+		return false;
+	const auto slot = static_cast<std::uint32_t>(found - m_mounts.begin());
+	found->archive = nullptr;
+
+	// Remaining mounts, best first, to re-resolve the paths this one was winning
+	std::vector<std::uint32_t> order;
+	for(std::uint32_t i = 0; i < m_mounts.size(); i++) {
+		if(m_mounts[i].archive)
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&](auto a, auto b) { return m_mounts[a].beats(m_mounts[b]); });
+
+	for(vpk_file_handle h = 0; h < archive->get_file_count(); h++) {
+		const auto name = archive->get_file_name(h);
+		const auto p = find_path(name, path_hash(name));
+		if(p == SIZE_MAX || m_paths[p].winner.mount != slot)
+			continue;
+		auto& path = m_paths[p];
+		bool replaced = false;
+		for(auto m : order) {
+			auto handle = m_mounts[m].archive->find_file_nocase(path.name);
+			if(handle != INVALID_HANDLE) {
+				path.winner = {m, handle};
+				replaced = true;
+				break;
+			}
+		}
+		if(!replaced) {
+			m_index.erase(path.hash, p);
+			path.name = {};
+			m_freePaths.push_back(p);
+			m_count--;
+			m_stale++;
+		}
+	}
+
+	// Bloom filters can't forget, so rebuild once enough removed paths would still get through
+	if(m_stale > m_count / 4)
+		rebuild_filter();
+
+	while(!m_mounts.empty() && !m_mounts.back().archive)
+		m_mounts.pop_back();
+	return true;
+}
+
+std::size_t vpk_overlay::find_path(std::string_view name, std::uint64_t hash) const {
+	return m_index.find(hash, [&](std::uint64_t p) { return path_equal_nocase(m_paths[p].name, name); });
+}
+
+vpk_overlay_entry vpk_overlay::find_file(std::string_view name) const {
+	m_lookups.fetch_add(1, std::memory_order_relaxed);
+	const auto hash = path_hash(name);
+	if(!m_filter.may_contain(hash)) {
+		m_filtered.fetch_add(1, std::memory_order_relaxed);
+		return {};
+	}
+
+	const auto p = find_path(name, hash);
+	if(p == SIZE_MAX) {
+		m_falsePositives.fetch_add(1, std::memory_order_relaxed);
+		return {};
+	}
+	vpk_overlay_entry entry;
+	entry.archive = m_mounts[m_paths[p].winner.mount].archive;
+	entry.handle = m_paths[p].winner.handle;
+	return entry;
+}
+
+std::vector<vpk_archive*> vpk_overlay::get_mounts() const {
+	std::vector<const Mount*> mounts;
+	for(const auto& m : m_mounts) {
+		if(m.archive)
+			mounts.push_back(&m);
+	}
+	std::sort(mounts.begin(), mounts.end(), [](auto a, auto b) { return a->beats(*b); });
+
+	std::vector<vpk_archive*> archives;
+	for(auto m : mounts)
+		archives.push_back(m->archive);
+	return archives;
+}
+
+vpk_lookup_stats vpk_overlay::get_lookup_stats() const {
+	vpk_lookup_stats stats;
+	stats.lookups = m_lookups.load(std::memory_order_relaxed);
+	stats.filtered = m_filtered.load(std::memory_order_relaxed);
+	stats.false_positives = m_falsePositives.load(std::memory_order_relaxed);
+	stats.filter_bytes = m_filter.size_bytes();
+	return stats;
+}
+
+void vpk_overlay::rebuild_filter() {
+	// Room to grow, so a series of mounts doesn't rebuild every time
+	m_filter.reset(m_count * 2);
+	for(const auto& path : m_paths) {
+		if(!path.name.empty())
+			m_filter.insert(path.hash);
+	}
+	m_stale = 0;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "vpk.hpp"
+
+namespace vpklib
+{
+	/**
+	 * @brief Where a path resolves to in an overlay
+	 */
+	struct vpk_overlay_entry
+	{
+		vpk_archive* archive = nullptr;	// Null if no mounted archive has the file
+		vpk_file_handle handle = INVALID_HANDLE;
+
+		explicit operator bool() const { return archive != nullptr; };
+	};
+
+	/**
+	 * @brief Priority-ordered search path over several archives, like the Source engine's (base game, DLC, mods).
+	 *
+	 * One hash index maps every path to the archive that wins it, so a lookup is a single hash probe no matter
+	 * how many archives are mounted. Paths are matched like the engine does, ignoring ASCII case and slash
+	 * direction (see find_file_nocase). Higher priority wins, and among equal priorities the archive mounted last.
+	 * Mounting only touches the new archive's paths. Unmounting only touches the paths the archive was winning,
+	 * which fall back to the best remaining archive. A Bloom filter over the merged paths rejects most misses
+	 * before the hash map is touched.
+	 *
+	 * Archives are not owned and must outlive their mount. Lookups may run concurrently with each other but
+	 * not with mount/unmount. Remount an archive after save() or compact(), which renumber its files.
+	 */
+	class vpk_overlay
+	{
+	public:
+		/**
+		 * @brief Adds an archive to the search path
+		 * @param archive Archive to mount
+		 * @param priority Higher wins
+		 * @return bool False if the archive is already mounted
+		 */
+		bool mount(vpk_archive* archive, int priority = 0);
+
+		/**
+		 * @brief Removes an archive from the search path
+		 * @return bool False if it wasn't mounted
+		 */
+		bool unmount(vpk_archive* archive);
+
+		/**
+		 * @brief Finds the archive and handle a path resolves to
+		 * @param name Path, in any case and with either kind of slash
+		 * @return vpk_overlay_entry Empty if no mounted archive has the file
+		 */
+		vpk_overlay_entry find_file(std::string_view name) const;
+
+		/**
+		 * @brief Returns the mounted archives, winning order first
+		 */
+		std::vector<vpk_archive*> get_mounts() const;
+
+		/**
+		 * @brief Returns lookup counters for find_file, including how well the Bloom filter does
+		 */
+		vpk_lookup_stats get_lookup_stats() const;
+
+		/**
+		 * @brief Returns the number of distinct paths across all mounted archives
+		 */
+		std::size_t get_file_count() const { return m_count; };
+
+	private:
+		struct Mount
+		{
+			vpk_archive* archive;
+			int priority;
+			std::uint64_t sequence;	// Mount order, breaks priority ties
+
+			bool beats(const Mount& other) const {
+				return priority != other.priority ? priority > other.priority : sequence > other.sequence;
+			}
+		};
+
+		struct Winner
+		{
+			std::uint32_t mount;	// Index into m_mounts
+			vpk_file_handle handle;
+		};
+
+		std::vector<Mount> m_mounts;	// Unmounted slots have a null archive and are reused
+		std::uint64_t m_sequence = 0;
+		struct Path
+		{
+			std::string name;	// As spelled by the first archive that had it, empty when the slot is free
+			std::uint64_t hash;
+			Winner winner;
+		};
+
+		std::vector<Path> m_paths;
+		std::vector<std::size_t> m_freePaths;	// Slots in m_paths to reuse
+		std::size_t m_count = 0;
+		path_index m_index;		// path_hash -> index into m_paths
+
+		blocked_bloom m_filter;		// Over the paths in m_index, plus stale ones removed since the last rebuild
+		std::size_t m_stale = 0;
+		mutable std::atomic<std::uint64_t> m_lookups = 0;
+		mutable std::atomic<std::uint64_t> m_filtered = 0;
+		mutable std::atomic<std::uint64_t> m_falsePositives = 0;
+
+		void rebuild_filter();
+
+		// Index into m_paths of a path, or ~0 if it isn't there
+		std::size_t find_path(std::string_view name, std::uint64_t hash) const;
+	};
+}
@@ -0,0 +1,658 @@
+// Binary archive patches
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vpk_patch.hpp"
+#include "vpk_crc.hpp"
+#include "vpk_diff.hpp"
+#include "vpk_thread.hpp"
+#include "vpk_tree.hpp"
+#include "vpk_xxhash.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	// Patch file, little endian:
+	//   patch_header
+	//   entry_count times: entry_header, the name (name_length bytes), the payload (payload_size bytes)
+	// ADD and REPLACE payloads are the new file. A DELTA payload is the block size (uint32), then ops to the end:
+	//   COPY     uint8 op, uint64 offset in the old file, uint32 length
+	//   LITERAL  uint8 op, uint32 length, the bytes
+	// REMOVE has no payload.
+	constexpr char MAGIC[8] = {'V', 'P', 'K', 'P', 'A', 'T', 'C', 'H'};
+	constexpr std::uint32_t VERSION = 1;
+
+#pragma pack(1)
+	struct patch_header
+	{
+		char magic[8];
+		std::uint32_t version;
+		std::uint32_t entry_count;
+	};
+
+	struct entry_header
+	{
+		std::uint8_t op;
+		std::uint8_t reserved[3];
+		std::uint32_t name_length;
+		std::uint64_t base_size;	// What the target must hold, unused for ADD
+		std::uint32_t base_crc;
+		std::uint32_t crc;			// What it holds afterwards, unused for REMOVE
+		std::uint64_t size;
+		std::uint64_t payload_size;
+	};
+#pragma pack()
+
+	enum : std::uint8_t
+	{
+		OP_ADD = 1,
+		OP_REPLACE,
+		OP_DELTA,
+		OP_REMOVE,
+	};
+
+	enum : std::uint8_t
+	{
+		DELTA_COPY = 1,
+		DELTA_LITERAL,
+	};
+
+	constexpr std::uint32_t NO_BLOCK = ~0u;
+	constexpr std::uint64_t MAX_OP_LENGTH = std::numeric_limits<std::uint32_t>::max();
+
+	bool pread_all(int fd, void* buffer, std::size_t size, std::uint64_t offset) {
+		auto p = static_cast<char*>(buffer);
+		while(size > 0) {
+			auto n = pread(fd, p, size, offset);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			p += n;
+			size -= n;
+			offset += n;
+		}
+		return true;
+	}
+
+	bool write_all(int fd, const void* data, std::size_t size) {
+		auto p = static_cast<const char*>(data);
+		while(size > 0) {
+			auto n = ::write(fd, p, size);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	template<class T>
+	void put(std::string& out, const T& value) {
+		out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	template<class T>
+	T get(const char* p) {
+		T value;
+		std::memcpy(&value, p, sizeof(value));
+		return value;
+	}
+
+	bool read_whole(vpk_archive& archive, vpk_file_handle handle, std::string& out, std::uint64_t size) {
+		out.resize(size);
+		return archive.read_file_range(handle, 0, out.data(), size) == size;
+	}
+
+	// About the square root of the size, like rsync: fewer, longer blocks for big files keep the index small
+	std::uint32_t pick_block_size(std::uint64_t size) {
+		const auto root = static_cast<std::uint64_t>(std::sqrt(static_cast<double>(size)));
+		return static_cast<std::uint32_t>(std::clamp<std::uint64_t>(std::bit_ceil(std::max<std::uint64_t>(root, 1)), 512, 64 << 10));
+	}
+
+	// rsync's rolling checksum over a window of n bytes: a sums the bytes, b sums the running values of a
+	struct rolling_sum
+	{
+		std::uint32_t a = 0;
+		std::uint32_t b = 0;
+		std::uint32_t n = 0;
+
+		void init(const unsigned char* p, std::uint32_t size) {
+			a = b = 0;
+			n = size;
+			for(std::uint32_t i = 0; i < size; i++) {
+				a += p[i];
+				b += a;
+			}
+		}
+
+		void roll(unsigned char out, unsigned char in) {
+			a += in - out;
+			b += a - n * out;
+		}
+
+		std::uint32_t value() const { return (a & 0xFFFF) | (b << 16); }
+	};
+
+	struct delta_stats
+	{
+		std::uint64_t literal = 0;
+		std::uint64_t copied = 0;
+	};
+
+	std::string encode_delta(const std::string& oldData, const std::string& newData, std::uint32_t blockSize, delta_stats& stats) {
+		const auto oldBytes = reinterpret_cast<const unsigned char*>(oldData.data());
+		const auto newBytes = reinterpret_cast<const unsigned char*>(newData.data());
+		const std::uint64_t newSize = newData.size();
+
+		// Index the whole blocks of the old file. Built back to front so each chain runs in file order
+		const auto blockCount = static_cast<std::uint32_t>(oldData.size() / blockSize);
+		std::unordered_map<std::uint32_t, std::uint32_t> heads;
+		heads.reserve(blockCount);
+		std::vector<std::uint32_t> next(blockCount, NO_BLOCK);
+		std::vector<std::uint64_t> strong(blockCount);
+		for(auto i = blockCount; i-- > 0;) {
+			const auto p = oldBytes + static_cast<std::uint64_t>(i) * blockSize;
+			rolling_sum sum;
+			sum.init(p, blockSize);
+			strong[i] = xxh64::hash(p, blockSize);
+			auto [it, inserted] = heads.try_emplace(sum.value(), i);
+			if(!inserted) {
+				next[i] = it->second;
+				it->second = i;
+			}
+		}
+
+		std::string out;
+		put(out, blockSize);
+
+		// Adjacent matching blocks are merged into one copy, which is held back until something else follows
+		std::uint64_t literalStart = 0;
+		std::uint64_t copyOffset = 0;
+		std::uint64_t copyLength = 0;
+		auto flush_copy = [&]() {
+			if(!copyLength)
+				return;
+			out.push_back(static_cast<char>(DELTA_COPY));
+			put(out, copyOffset);
+			put(out, static_cast<std::uint32_t>(copyLength));
+			stats.copied += copyLength;
+			copyLength = 0;
+		};
+		auto flush_literal = [&](std::uint64_t end) {
+			if(literalStart < end)
+				flush_copy();
+			while(literalStart < end) {
+				const auto n = std::min(end - literalStart, MAX_OP_LENGTH);
+				out.push_back(static_cast<char>(DELTA_LITERAL));
+				put(out, static_cast<std::uint32_t>(n));
+				out.append(newData, literalStart, n);
+				stats.literal += n;
+				literalStart += n;
+			}
+		};
+
+		rolling_sum sum;
+		bool primed = false;
+		std::uint64_t pos = 0;
+		while(blockCount && pos + blockSize <= newSize) {
+			if(!primed) {
+				sum.init(newBytes + pos, blockSize);
+				primed = true;
+			}
+
+			auto match = NO_BLOCK;
+			if(auto it = heads.find(sum.value()); it != heads.end()) {
+				const auto hash = xxh64::hash(newBytes + pos, blockSize);
+				for(auto k = it->second; k != NO_BLOCK; k = next[k]) {
+					const auto p = oldBytes + static_cast<std::uint64_t>(k) * blockSize;
+					if(strong[k] == hash && !std::memcmp(p, newBytes + pos, blockSize)) {
+						match = k;
+						break;
+					}
+				}
+			}
+
+			if(match == NO_BLOCK) {
+				if(pos + blockSize < newSize)
+					sum.roll(newBytes[pos], newBytes[pos + blockSize]);
+				pos++;
+				continue;
+			}
+
+			flush_literal(pos);
+			const auto offset = static_cast<std::uint64_t>(match) * blockSize;
+			if(copyLength && copyOffset + copyLength == offset && copyLength + blockSize <= MAX_OP_LENGTH)
+				copyLength += blockSize;
+			else {
+				flush_copy();
+				copyOffset = offset;
+				copyLength = blockSize;
+			}
+			pos += blockSize;
+			literalStart = pos;
+			primed = false;
+		}
+		flush_literal(newSize);
+		flush_copy();
+		return out;
+	}
+
+	// Rebuilds a file from a delta, reading the copies from the base file in the target
+	// Walks the ops of a delta without applying them and adds up the size they produce. False if an op is malformed
+	// or copies from outside the base, so the output buffer is never sized from an unchecked header field
+	bool delta_output_size(std::uint64_t baseSize, const std::string& delta, std::uint64_t& size) {
+		if(delta.size() < sizeof(std::uint32_t))
+			return false;
+		const char* p = delta.data() + sizeof(std::uint32_t);
+		const char* end = delta.data() + delta.size();
+		size = 0;
+		while(p < end) {
+			const auto op = static_cast<std::uint8_t>(*p++);
+			if(op == DELTA_COPY) {
+				if(end - p < 12)
+					return false;
+				const auto offset = get<std::uint64_t>(p);
+				const auto length = get<std::uint32_t>(p + 8);
+				p += 12;
+				if(offset > baseSize || length > baseSize - offset)
+					return false;
+				size += length;
+			}
+			else if(op == DELTA_LITERAL) {
+				if(end - p < 4)
+					return false;
+				const auto length = get<std::uint32_t>(p);
+				p += 4;
+				if(static_cast<std::uint64_t>(end - p) < length)
+					return false;
+				p += length;
+				size += length;
+			}
+			else
+				return false;
+		}
+		return true;
+	}
+
+	bool apply_delta(vpk_archive& target, vpk_file_handle base, std::uint64_t baseSize, const std::string& delta,
+		std::string& out, delta_stats& stats) {
+		if(delta.size() < sizeof(std::uint32_t))
+			return false;
+		const char* p = delta.data() + sizeof(std::uint32_t);
+		const char* end = delta.data() + delta.size();
+		std::uint64_t written = 0;
+		while(p < end) {
+			const auto op = static_cast<std::uint8_t>(*p++);
+			if(op == DELTA_COPY) {
+				if(end - p < 12)
+					return false;
+				const auto offset = get<std::uint64_t>(p);
+				const auto length = get<std::uint32_t>(p + 8);
+				p += 12;
+				if(offset > baseSize || length > baseSize - offset || length > out.size() - written)
+					return false;
+				if(target.read_file_range(base, offset, out.data() + written, length) != length)
+					return false;
+				stats.copied += length;
+				written += length;
+			}
+			else if(op == DELTA_LITERAL) {
+				if(end - p < 4)
+					return false;
+				const auto length = get<std::uint32_t>(p);
+				p += 4;
+				if(static_cast<std::uint64_t>(end - p) < length || length > out.size() - written)
+					return false;
+				std::memcpy(out.data() + written, p, length);
+				p += length;
+				stats.literal += length;
+				written += length;
+			}
+			else
+				return false;
+		}
+		return written == out.size();
+	}
+
+	struct built_entry
+	{
+		entry_header header = {};
+		std::string payload;
+		delta_stats stats;
+	};
+
+	bool build_entry(vpk_archive& oldArchive, vpk_archive& newArchive, const vpk_diff_entry& e,
+		const vpk_patch_options& options, built_entry& out) {
+		auto& h = out.header;
+		h.name_length = static_cast<std::uint32_t>(e.name.size());
+
+		if(e.type != vpk_diff_entry::kind::added) {
+			h.base_size = e.old_size;
+			h.base_crc = oldArchive.get_file_crc32(e.old_handle);
+		}
+		if(e.type == vpk_diff_entry::kind::removed) {
+			h.op = OP_REMOVE;
+			return true;
+		}
+
+		// The CRC is computed rather than copied, the directory may not have one
+		if(!read_whole(newArchive, e.new_handle, out.payload, e.new_size))
+			return false;
+		h.size = e.new_size;
+		h.crc = crc32(out.payload.data(), out.payload.size());
+		h.op = e.type == vpk_diff_entry::kind::added ? OP_ADD : OP_REPLACE;
+
+		const auto blockSize = options.block_size ? options.block_size : pick_block_size(e.new_size);
+		if(h.op == OP_REPLACE && e.new_size >= options.delta_min_size && e.old_size >= blockSize) {
+			std::string oldData;
+			if(!read_whole(oldArchive, e.old_handle, oldData, e.old_size))
+				return false;
+			delta_stats stats;
+			auto delta = encode_delta(oldData, out.payload, blockSize, stats);
+			if(delta.size() < out.payload.size()) {
+				h.op = OP_DELTA;
+				out.payload = std::move(delta);
+				out.stats = stats;
+			}
+		}
+		if(h.op != OP_DELTA)
+			out.stats.literal = out.payload.size();
+		h.payload_size = out.payload.size();
+		return true;
+	}
+
+	// Entries are processed in batches of about limit bytes, and at least one entry
+	template<class Cost>
+	std::size_t batch_end(std::size_t first, std::size_t count, std::uint64_t limit, Cost&& cost) {
+		std::size_t last = first;
+		std::uint64_t bytes = 0;
+		while(last < count) {
+			const auto c = cost(last);
+			if(last > first && bytes + c > limit)
+				break;
+			bytes += c;
+			last++;
+		}
+		return last;
+	}
+
+}
+
+vpk_patch_result vpklib::create_patch(vpk_archive& oldArchive, vpk_archive& newArchive, const std::filesystem::path& path,
+	const vpk_patch_options& options) {
+	const auto start = std::chrono::steady_clock::now();
+
+	vpk_patch_result result;
+	auto fail = [&](std::string error) {
+		result.ok = false;
+		result.error = std::move(error);
+		return result;
+	};
+
+	vpk_diff_options diffOptions;
+	diffOptions.threads = options.threads;
+	const auto diff = diff_archives(oldArchive, newArchive, diffOptions);
+	if(!diff.ok)
+		return fail(diff.error);
+	const auto& entries = diff.entries;
+	if(entries.size() > std::numeric_limits<std::uint32_t>::max())
+		return fail("too many changes for one patch");
+
+	const auto tmp = path.string() + ".tmp";
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(fd < 0)
+		return fail("failed to create '" + tmp + "': " + strerror(errno));
+	auto abandon = [&](std::string error) {
+		close(fd);
+		unlink(tmp.c_str());
+		return fail(std::move(error));
+	};
+
+	patch_header header = {};
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.entry_count = static_cast<std::uint32_t>(entries.size());
+	if(!write_all(fd, &header, sizeof(header)))
+		return abandon("failed to write '" + tmp + "'");
+	result.patch_bytes = sizeof(header);
+
+	for(std::size_t first = 0; first < entries.size();) {
+		const auto last = batch_end(first, entries.size(), options.memory_limit, [&](std::size_t i) {
+			return entries[i].old_size + entries[i].new_size;
+		});
+
+		// Build the batch in parallel, write it in order
+		std::vector<built_entry> built(last - first);
+		std::atomic<bool> readError = false;
+		parallel_for(built.size(), [&](std::size_t i) {
+			if(!build_entry(oldArchive, newArchive, entries[first + i], options, built[i]))
+				readError.store(true, std::memory_order_relaxed);
+		}, options.threads, 1);
+		if(readError)
+			return abandon("failed to read file data");
+
+		for(std::size_t i = 0; i < built.size(); i++) {
+			const auto& b = built[i];
+			const auto& name = entries[first + i].name;
+			if(!write_all(fd, &b.header, sizeof(b.header)) || !write_all(fd, name.data(), name.size())
+				|| !write_all(fd, b.payload.data(), b.payload.size()))
+				return abandon("failed to write '" + tmp + "'");
+			result.patch_bytes += sizeof(b.header) + name.size() + b.payload.size();
+
+			switch(b.header.op) {
+				case OP_ADD: result.added++; break;
+				case OP_REPLACE: result.replaced++; break;
+				case OP_DELTA: result.deltas++; break;
+				case OP_REMOVE: result.removed++; break;
+			}
+			result.literal_bytes += b.stats.literal;
+			result.copied_bytes += b.stats.copied;
+		}
+		first = last;
+	}
+
+	if(close(fd) != 0) {
+		unlink(tmp.c_str());
+		return fail("failed to write '" + tmp + "'");
+	}
+	if(rename(tmp.c_str(), path.c_str()) != 0) {
+		unlink(tmp.c_str());
+		return fail("failed to rename '" + tmp + "': " + strerror(errno));
+	}
+
+	result.ok = true;
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
+
+vpk_patch_result vpklib::apply_patch(vpk_archive& target, const std::filesystem::path& path, const vpk_patch_options& options) {
+	const auto start = std::chrono::steady_clock::now();
+
+	vpk_patch_result result;
+	auto fail = [&](std::string error) {
+		result.ok = false;
+		result.error = std::move(error);
+		return result;
+	};
+
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if(fd < 0)
+		return fail("failed to open '" + path.string() + "': " + strerror(errno));
+	struct fd_closer
+	{
+		int fd;
+		~fd_closer() { close(fd); }
+	} closer = {fd};
+
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+		return fail("failed to stat '" + path.string() + "'");
+	const std::uint64_t fileSize = st.st_size;
+	result.patch_bytes = fileSize;
+
+	patch_header header;
+	if(fileSize < sizeof(header) || !pread_all(fd, &header, sizeof(header), 0) || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)))
+		return fail("not a patch file");
+	if(header.version != VERSION)
+		return fail("unsupported patch version " + std::to_string(header.version));
+
+	// Check every entry against the target before changing anything
+	struct pending
+	{
+		entry_header header;
+		std::string name;
+		std::uint64_t payload_offset;
+	};
+	std::vector<pending> entries;
+	std::uint64_t offset = sizeof(header);
+	for(std::uint32_t i = 0; i < header.entry_count; i++) {
+		pending p;
+		auto& h = p.header;
+		if(fileSize - offset < sizeof(h) || !pread_all(fd, &h, sizeof(h), offset))
+			return fail("patch is truncated");
+		offset += sizeof(h);
+		if(fileSize - offset < h.name_length)
+			return fail("patch is truncated");
+		p.name.resize(h.name_length);
+		if(!pread_all(fd, p.name.data(), h.name_length, offset))
+			return fail("failed to read the patch");
+		offset += h.name_length;
+		// Names go into the target's tree as is, so only take ones the reader can load back
+		if(p.name.empty() || p.name.find('\0') != std::string::npos)
+			return fail("patch entry " + std::to_string(i) + " has an invalid name");
+		tree::name_parts parts;
+		std::string nameError;
+		if(!tree::split_name(p.name, parts, &nameError))
+			return fail("patch entry " + nameError);
+		if(fileSize - offset < h.payload_size)
+			return fail("patch is truncated");
+		p.payload_offset = offset;
+		offset += h.payload_size;
+
+		if(h.op < OP_ADD || h.op > OP_REMOVE)
+			return fail("patch entry for '" + p.name + "' is corrupt");
+		if((h.op == OP_ADD || h.op == OP_REPLACE) && h.payload_size != h.size)
+			return fail("patch entry for '" + p.name + "' is corrupt");
+		// VPK entries can't hold more, and it keeps a corrupt size from turning into a huge allocation
+		if(h.op != OP_REMOVE && h.size > 0xFFFFFFFFull)
+			return fail("patch entry for '" + p.name + "' is corrupt");
+
+		const auto handle = target.find_file(p.name);
+		const bool exists = handle != INVALID_HANDLE;
+		const auto size = exists ? target.get_file_size(handle) : 0;
+		const auto crc = exists ? target.get_file_crc32(handle) : 0;
+		if(h.op == OP_REMOVE ? !exists : exists && size == h.size && crc == h.crc) {
+			result.skipped++;
+			continue;
+		}
+		if(h.op == OP_ADD && exists)
+			return fail("'" + p.name + "' already exists in the target");
+		if(h.op != OP_ADD && !exists)
+			return fail("'" + p.name + "' is missing from the target");
+		if(h.op != OP_ADD && (size != h.base_size || crc != h.base_crc))
+			return fail("'" + p.name + "' doesn't match the version the patch was made from");
+		entries.push_back(std::move(p));
+	}
+	if(offset != fileSize)
+		return fail("patch has trailing data");
+
+	for(std::size_t first = 0; first < entries.size();) {
+		const auto last = batch_end(first, entries.size(), options.memory_limit, [&](std::size_t i) {
+			return entries[i].header.size + entries[i].header.payload_size;
+		});
+
+		// Handles change with every save, so look the bases up again
+		std::vector<vpk_file_handle> bases(last - first);
+		for(std::size_t i = first; i < last; i++)
+			bases[i - first] = target.find_file(entries[i].name);
+
+		std::vector<std::string> data(last - first);
+		std::vector<std::string> errors(last - first);
+		std::vector<delta_stats> stats(last - first);
+		std::atomic<bool> failed = false;
+		parallel_for(data.size(), [&](std::size_t i) {
+			const auto& e = entries[first + i];
+			const auto& h = e.header;
+			if(h.op == OP_REMOVE)
+				return;
+
+			std::string payload;
+			payload.resize(h.payload_size);
+			bool ok = pread_all(fd, payload.data(), payload.size(), e.payload_offset);
+			if(!ok)
+				errors[i] = "failed to read the patch";
+			else if(h.op == OP_DELTA) {
+				std::uint64_t size = 0;
+				ok = delta_output_size(h.base_size, payload, size) && size == h.size;
+				if(!ok)
+					errors[i] = "patch entry for '" + e.name + "' is corrupt";
+				else {
+					data[i].resize(h.size);
+					ok = apply_delta(target, bases[i], h.base_size, payload, data[i], stats[i]);
+					if(!ok)
+						errors[i] = "failed to rebuild '" + e.name + "' from its delta";
+				}
+			}
+			else {
+				data[i] = std::move(payload);
+				stats[i].literal = h.size;
+			}
+			if(ok && crc32(data[i].data(), data[i].size()) != h.crc) {
+				errors[i] = "CRC mismatch for '" + e.name + "'";
+				ok = false;
+			}
+			if(!ok)
+				failed.store(true, std::memory_order_relaxed);
+		}, options.threads, 1);
+		if(failed) {
+			for(const auto& error : errors) {
+				if(!error.empty())
+					return fail(error);
+			}
+		}
+
+		for(std::size_t i = 0; i < data.size(); i++) {
+			const auto& e = entries[first + i];
+			std::string error;
+			if(e.header.op == OP_REMOVE) {
+				target.remove_file(e.name);
+				result.removed++;
+				continue;
+			}
+			if(!target.set_file_data(e.name, data[i].data(), data[i].size(), &error))
+				return fail(error);
+			data[i] = {};
+			switch(e.header.op) {
+				case OP_ADD: result.added++; break;
+				case OP_REPLACE: result.replaced++; break;
+				case OP_DELTA: result.deltas++; break;
+			}
+			result.literal_bytes += stats[i].literal;
+			result.copied_bytes += stats[i].copied;
+		}
+
+		std::string error;
+		if(target.is_dirty() && !target.save(options.update, &error))
+			return fail(error);
+		first = last;
+	}
+
+	result.ok = true;
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "vpk.hpp"
+
+namespace vpklib
+{
+	struct vpk_patch_options
+	{
+		unsigned threads = 0;							// 0 for all cores
+		std::uint64_t delta_min_size = 64 << 10;		// Changed files at least this big are stored as block deltas
+		std::uint32_t block_size = 0;					// Delta block size, 0 to pick one per file from its size
+		std::uint64_t memory_limit = 256 << 20;			// File data held in memory at once. Applying saves each time it's reached
+		vpk_update_options update;						// Used by apply_patch when saving the target
+	};
+
+	struct vpk_patch_result
+	{
+		bool ok = false;
+		std::string error;				// Set when !ok
+
+		std::uint64_t added = 0;		// Files stored whole because they are new
+		std::uint64_t replaced = 0;		// Changed files stored whole
+		std::uint64_t deltas = 0;		// Changed files stored as block deltas
+		std::uint64_t removed = 0;
+		std::uint64_t skipped = 0;		// apply_patch: entries the target already matched
+
+		std::uint64_t literal_bytes = 0;	// Data carried in the patch
+		std::uint64_t copied_bytes = 0;		// Data the deltas take from the old files
+		std::uint64_t patch_bytes = 0;		// Size of the patch file
+		double seconds = 0;
+	};
+
+	/**
+	 * @brief Writes a patch that turns oldArchive into newArchive.
+	 *
+	 * Only the entries diff_archives reports are stored. Added files and small changed files are stored whole.
+	 * Changed files of at least delta_min_size are stored as a block delta: the old file is cut into blocks
+	 * indexed by a rolling checksum (confirmed with XXH64 and a byte compare), the new file is scanned one byte
+	 * at a time for them, and the result is a list of copies from the old file and literal data. A delta that
+	 * comes out no smaller than the file is stored whole instead. Every entry records the size and CRC32 it
+	 * expects to find and the ones it produces. Payloads are built in parallel, memory_limit bytes of files at a time.
+	 * @param oldArchive Version the patch applies to
+	 * @param newArchive Version the patch produces
+	 * @param path Patch file to write. Written under a temporary name and renamed into place
+	 * @param options Threading, delta and memory options
+	 * @return vpk_patch_result
+	 */
+	vpk_patch_result create_patch(vpk_archive& oldArchive, vpk_archive& newArchive, const std::filesystem::path& path,
+		const vpk_patch_options& options = {});
+
+	/**
+	 * @brief Applies a patch from create_patch to an archive in place.
+	 *
+	 * Every entry is checked against the target before anything is written: files to change or remove must have
+	 * the size and CRC32 the patch was made from, and files to add must not exist. Entries the target already
+	 * matches after the patch are skipped, so an interrupted apply can simply be run again. The files are then
+	 * rebuilt in parallel, reading delta copies straight from the target's archives, and each result is checked
+	 * against the CRC32 in the patch before it is handed to set_file_data. The target is saved whenever
+	 * memory_limit bytes are pending and at the end; each save is atomic (see vpk_archive::save).
+	 * @param target Archive to update
+	 * @param path Patch file
+	 * @param options Threading, memory and save options
+	 * @return vpk_patch_result On failure, the target holds the batches saved before the failing one
+	 */
+	vpk_patch_result apply_patch(vpk_archive& target, const std::filesystem::path& path, const vpk_patch_options& options = {});
+}
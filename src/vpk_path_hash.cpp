@@ -0,0 +1,170 @@
+// Folded path hashing and the hash index
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "vpk_path_hash.hpp"
+
+#if defined(__SSE2__)
+#define VPK_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+using namespace vpklib;
+
+namespace {
+
+	constexpr std::uint64_t P1 = 0x9E3779B185EBCA87ull;
+	constexpr std::uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+	constexpr std::uint64_t P3 = 0x165667B19E3779F9ull;
+
+	// 16 folded bytes, the unit both functions work in
+	struct lane
+	{
+		std::uint64_t lo, hi;
+	};
+
+#ifdef VPK_HAVE_SSE2
+
+	inline __m128i fold16(__m128i v) {
+		// Bytes >= 0x80 compare as negative, so they never count as upper case
+		const auto upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+		v = _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+		const auto backslash = _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'));
+		return _mm_xor_si128(v, _mm_and_si128(backslash, _mm_set1_epi8('\\' ^ '/')));
+	}
+
+	inline __m128i load16(const char* p) {
+		return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+	}
+
+	inline lane to_lane(__m128i v) {
+		lane l;
+		std::memcpy(&l, &v, sizeof(l));
+		return l;
+	}
+
+	inline lane fold_lane(const char* p) {
+		return to_lane(fold16(load16(p)));
+	}
+
+#else
+
+	inline lane fold_lane(const char* p) {
+		char folded[16];
+		for(int i = 0; i < 16; i++)
+			folded[i] = fold_path_char(p[i]);
+		lane l;
+		std::memcpy(&l, folded, sizeof(l));
+		return l;
+	}
+
+#endif
+
+	// A path shorter than a lane, zero padded. Copied out so we never read past the end of the string
+	inline lane fold_tail(const char* p, std::size_t size) {
+		char buffer[16] = {};
+		std::memcpy(buffer, p, size);
+		return fold_lane(buffer);
+	}
+
+	inline std::uint64_t mix(std::uint64_t h, lane l) {
+		h ^= std::rotl(l.lo * P2, 31) * P1;
+		h = std::rotl(h, 27) * P1 + P3;
+		h ^= std::rotl(l.hi * P2, 31) * P1;
+		return std::rotl(h, 27) * P1 + P3;
+	}
+
+}
+
+std::uint64_t vpklib::path_hash(std::string_view path) {
+	// The length goes in first so zero padding can't make two paths collide
+	auto h = P3 ^ (path.size() * P1);
+	auto p = path.data();
+	auto size = path.size();
+	while(size >= 16) {
+		h = mix(h, fold_lane(p));
+		p += 16;
+		size -= 16;
+	}
+	// Past the first lane, the tail is the last 16 bytes (overlapping the previous lane) rather than a padded copy
+	if(size)
+		h = mix(h, path.size() >= 16 ? fold_lane(path.data() + path.size() - 16) : fold_tail(p, size));
+
+	// XXH64 avalanche
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+bool vpklib::path_equal_nocase(std::string_view a, std::string_view b) {
+	if(a.size() != b.size())
+		return false;
+	auto pa = a.data();
+	auto pb = b.data();
+	auto size = a.size();
+	while(size >= 16) {
+#ifdef VPK_HAVE_SSE2
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(fold16(load16(pa)), fold16(load16(pb)))) != 0xFFFF)
+			return false;
+#else
+		const auto la = fold_lane(pa), lb = fold_lane(pb);
+		if(la.lo != lb.lo || la.hi != lb.hi)
+			return false;
+#endif
+		pa += 16;
+		pb += 16;
+		size -= 16;
+	}
+	// Short tails are cheaper byte by byte than through a padded copy
+	for(std::size_t i = 0; i < size; i++) {
+		if(fold_path_char(pa[i]) != fold_path_char(pb[i]))
+			return false;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------//
+
+void path_index::reset(std::size_t expected) {
+	// At most half full, so probe sequences stay short
+	m_slots.assign(std::bit_ceil(std::max<std::size_t>(expected * 2, 16)), Slot{0, EMPTY});
+	m_used = 0;
+}
+
+void path_index::grow() {
+	auto old = std::move(m_slots);
+	reset(old.size());
+	for(const auto& slot : old) {
+		if(slot.handle != EMPTY && slot.handle != ERASED)
+			insert(slot.hash, slot.handle);
+	}
+}
+
+void path_index::insert(std::uint64_t hash, std::uint64_t handle) {
+	if((m_used + 1) * 2 > m_slots.size())
+		grow();
+	// Always append at the end of the probe sequence, which keeps equal hashes in insertion order
+	const auto mask = m_slots.size() - 1;
+	auto i = static_cast<std::size_t>(hash) & mask;
+	while(m_slots[i].handle != EMPTY)
+		i = (i + 1) & mask;
+	m_slots[i] = {hash, handle};
+	m_used++;
+}
+
+bool path_index::erase(std::uint64_t hash, std::uint64_t handle) {
+	if(m_slots.empty())
+		return false;
+	const auto mask = m_slots.size() - 1;
+	for(auto i = static_cast<std::size_t>(hash) & mask; m_slots[i].handle != EMPTY; i = (i + 1) & mask) {
+		if(m_slots[i].hash == hash && m_slots[i].handle == handle) {
+			m_slots[i].handle = ERASED; // Tombstone, later entries of the sequence must stay reachable
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace vpklib
+{
+	/**
+	 * @brief Folds a path character the way Source compares paths: ASCII lowercase, backslash to slash
+	 */
+	constexpr char fold_path_char(char c) {
+		if(c >= 'A' && c <= 'Z')
+			return static_cast<char>(c + ('a' - 'A'));
+		return c == '\\' ? '/' : c;
+	}
+
+	/**
+	 * @brief Hashes a path as if it had been folded with fold_path_char, without making a folded copy.
+	 * Folding and hashing run 16 bytes at a time (SSE2 where available). Paths that differ only in case or
+	 * slash direction hash the same, so the one hash serves both exact and case-insensitive lookups.
+	 */
+	std::uint64_t path_hash(std::string_view path);
+
+	/**
+	 * @brief Compares two paths after folding both with fold_path_char, without copying them
+	 */
+	bool path_equal_nocase(std::string_view a, std::string_view b);
+
+	/**
+	 * @brief Open addressing table from path_hash values to file handles.
+	 * Only hashes are stored, so a lookup walks the probe sequence for its hash and lets the caller confirm
+	 * each candidate against the real name, with whatever comparison it needs. Several handles may share a
+	 * hash (case variants of a name, or collisions); they are returned in insertion order.
+	 */
+	class path_index
+	{
+	private:
+		struct Slot
+		{
+			std::uint64_t hash;
+			std::uint64_t handle;	// EMPTY when unused
+		};
+		static constexpr std::uint64_t EMPTY = ~0ull;
+		static constexpr std::uint64_t ERASED = ~0ull - 1;
+
+		std::vector<Slot> m_slots;
+		std::size_t m_used = 0;	// Live plus erased slots
+
+		void grow();
+
+	public:
+		void clear() {
+			m_slots.clear();
+			m_used = 0;
+		}
+
+		/**
+		 * @brief Sizes the table for a number of entries, dropping the current ones
+		 */
+		void reset(std::size_t expected);
+
+		void insert(std::uint64_t hash, std::uint64_t handle);
+
+		/**
+		 * @brief Removes one handle, returns false if it wasn't there
+		 */
+		bool erase(std::uint64_t hash, std::uint64_t handle);
+
+		/**
+		 * @brief Returns the first handle stored under hash for which match(handle) is true
+		 * @return std::uint64_t The handle, or ~0 if there is none
+		 */
+		template<class F>
+		std::uint64_t find(std::uint64_t hash, F&& match) const {
+			if(m_slots.empty())
+				return EMPTY;
+			const auto mask = m_slots.size() - 1;
+			for(auto i = static_cast<std::size_t>(hash) & mask;; i = (i + 1) & mask) {
+				const auto& slot = m_slots[i];
+				if(slot.handle == EMPTY)
+					return EMPTY;
+				if(slot.hash == hash && slot.handle != ERASED && match(slot.handle))
+					return slot.handle;
+			}
+		}
+	};
+}
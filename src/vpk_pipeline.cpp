@@ -0,0 +1,141 @@
+// Chunked, bounded-memory read pipeline
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <semaphore>
+#include <thread>
+
+#include "vpk_pipeline.hpp"
+#include "vpk_queue.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	constexpr std::size_t SENTINEL = ~0ull;
+
+	struct Job
+	{
+		vpk_chunk chunk;
+		std::size_t buffer;
+	};
+
+	struct Lane
+	{
+		bounded_queue<Job> queue;
+		std::counting_semaphore<> ready{0};
+
+		explicit Lane(std::size_t capacity) : queue(capacity) {};
+	};
+
+}
+
+void vpk_read_pipeline::sort_physical(vpk_archive* archive, std::vector<vpk_file_handle>& handles) {
+	std::vector<std::pair<std::uint64_t, vpk_file_handle>> keys;
+	keys.reserve(handles.size());
+	for(auto h : handles) {
+		std::uint64_t key = (static_cast<std::uint64_t>(archive->get_file_archive_index(h)) << 48) | archive->get_file_offset(h);
+		keys.push_back({key, h});
+	}
+	std::sort(keys.begin(), keys.end());
+	for(std::size_t i = 0; i < keys.size(); i++)
+		handles[i] = keys[i].second;
+}
+
+bool vpk_read_pipeline::run(vpk_archive* archive, const std::vector<vpk_file_handle>& handles, const consumer_t& consumer) {
+	const auto chunkSize = std::max<std::size_t>(m_options.chunk_size, 1);
+	const auto bufferCount = std::max<std::size_t>(m_options.buffer_count, 1);
+	const auto readerCount = std::max(m_options.readers, 1u);
+	const auto laneCount = std::max(m_options.lanes, 1u);
+
+	// Fixed buffer pool. Free buffers sit in a queue, the semaphore blocks readers while all of them are in flight
+	auto storage = std::make_unique<byte[]>(chunkSize * bufferCount);
+	bounded_queue<std::size_t> freeBuffers(bufferCount);
+	std::counting_semaphore<> freeCount(static_cast<std::ptrdiff_t>(bufferCount));
+	for(std::size_t i = 0; i < bufferCount; i++)
+		freeBuffers.push(i);
+
+	// No more than bufferCount chunks (plus the sentinel) are ever in flight, so lane pushes can't fail
+	std::vector<std::unique_ptr<Lane>> lanes;
+	for(unsigned i = 0; i < laneCount; i++)
+		lanes.push_back(std::make_unique<Lane>(bufferCount + 1));
+
+	std::atomic<std::size_t> next = 0;
+	std::atomic<bool> failed = false;
+
+	auto releaseBuffer = [&](std::size_t buffer) {
+		freeBuffers.push(buffer);
+		freeCount.release();
+	};
+
+	auto reader = [&]() {
+		while(!failed.load(std::memory_order_relaxed)) {
+			auto item = next.fetch_add(1, std::memory_order_relaxed);
+			if(item >= handles.size())
+				break;
+
+			const auto handle = handles[item];
+			const std::uint64_t fileSize = archive->get_file_size(handle);
+			auto& lane = *lanes[item % laneCount];
+
+			std::uint64_t offset = 0;
+			do {
+				freeCount.acquire();
+				const auto buffer = freeBuffers.pop_claimed();
+
+				auto data = storage.get() + buffer * chunkSize;
+				auto size = static_cast<std::size_t>(std::min<std::uint64_t>(chunkSize, fileSize - offset));
+				if(size && archive->read_file_range(handle, offset, data, size) != size) {
+					releaseBuffer(buffer);
+					failed = true;
+					return;
+				}
+
+				Job job;
+				job.buffer = buffer;
+				job.chunk = {item, handle, offset, fileSize, data, size, offset + size >= fileSize};
+				lane.queue.push(job);
+				lane.ready.release();
+
+				offset += size;
+			} while(offset < fileSize);
+		}
+	};
+
+	auto writer = [&](unsigned index) {
+		auto& lane = *lanes[index];
+		while(true) {
+			lane.ready.acquire();
+			const auto job = lane.queue.pop_claimed();
+			if(job.chunk.item == SENTINEL)
+				break;
+
+			// Keep draining after a failure so readers blocked on the pool get their buffers back
+			if(!failed.load(std::memory_order_relaxed) && !consumer(index, job.chunk))
+				failed = true;
+			releaseBuffer(job.buffer);
+		}
+	};
+
+	std::vector<std::thread> writers;
+	for(unsigned i = 0; i < laneCount; i++)
+		writers.emplace_back(writer, i);
+
+	std::vector<std::thread> readers;
+	for(unsigned i = 0; i < readerCount; i++)
+		readers.emplace_back(reader);
+	for(auto& t : readers)
+		t.join();
+
+	for(auto& lane : lanes) {
+		Job job;
+		job.buffer = SENTINEL;
+		job.chunk.item = SENTINEL;
+		lane->queue.push(job);
+		lane->ready.release();
+	}
+	for(auto& t : writers)
+		t.join();
+
+	return !failed;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "vpk.hpp"
+
+namespace vpklib
+{
+	/**
+	 * @brief A piece of a file's data handed to a pipeline consumer
+	 */
+	struct vpk_chunk
+	{
+		std::size_t item;			// Index into the handle list passed to run()
+		vpk_file_handle handle;
+		std::uint64_t offset;		// Offset of this chunk within the file
+		std::uint64_t file_size;	// Total size of the file, including preload data
+		const byte* data;
+		std::size_t size;
+		bool last;					// Last chunk of this file
+	};
+
+	/**
+	 * @brief Streams file data out of an archive through a fixed pool of buffers.
+	 * Reader threads walk the files in physical order and read them in chunks, writer lanes hand the
+	 * chunks to a consumer. The stages are connected by bounded lock-free queues, so read and write I/O
+	 * overlap and memory use is chunk_size * buffer_count no matter how large the files are.
+	 *
+	 * Every chunk of a given file goes to the same lane, in order. With a single lane (and a single reader)
+	 * the consumer sees all chunks in physical order.
+	 */
+	class vpk_read_pipeline
+	{
+	public:
+		struct Options
+		{
+			std::size_t chunk_size = 1 << 20;
+			std::size_t buffer_count = 16;
+			unsigned readers = 2;
+			unsigned lanes = 2;
+		};
+
+		/**
+		 * @brief Consumer called from the lane threads. Lanes run concurrently, a single lane is sequential.
+		 * Returning false aborts the pipeline.
+		 */
+		using consumer_t = std::function<bool(unsigned lane, const vpk_chunk& chunk)>;
+
+		vpk_read_pipeline() = default;
+		explicit vpk_read_pipeline(const Options& options) : m_options(options) {};
+
+		/**
+		 * @brief Sorts handles into physical read order (archive index, then offset)
+		 * @param archive Archive the handles belong to
+		 * @param handles Handles to sort in place
+		 */
+		static void sort_physical(vpk_archive* archive, std::vector<vpk_file_handle>& handles);
+
+		/**
+		 * @brief Reads all of the files and feeds them to the consumer.
+		 * Files are read in the order given, call sort_physical first for sequential I/O.
+		 * @param archive Archive to read from
+		 * @param handles Files to read
+		 * @param consumer Chunk consumer
+		 * @return bool False if a read failed or the consumer aborted
+		 */
+		bool run(vpk_archive* archive, const std::vector<vpk_file_handle>& handles, const consumer_t& consumer);
+
+	private:
+		Options m_options;
+	};
+}
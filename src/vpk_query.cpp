@@ -0,0 +1,491 @@
+// Query language over the file index
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "vpk_query.hpp"
+#include "vpk_match.hpp"
+#include "vpk_thread.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	// One bit per handle
+	using bitmask = std::vector<std::uint64_t>;
+
+	std::size_t mask_words(std::size_t n) {
+		return (n + 63) / 64;
+	}
+
+	void set_range(bitmask& m, std::size_t begin, std::size_t end) {
+		for(auto i = begin; i < end; i++)
+			m[i / 64] |= 1ull << (i % 64);
+	}
+
+	// Clears the bits past the last row, so NOT doesn't select phantom rows
+	void trim(bitmask& m, std::size_t n) {
+		if(n % 64)
+			m.back() &= (1ull << (n % 64)) - 1;
+	}
+
+	enum class column_t
+	{
+		SIZE,
+		PRELOAD,
+		ARCHIVE,
+		CRC,
+	};
+
+	enum class op_t
+	{
+		EQ,
+		NE,
+		LT,
+		LE,
+		GT,
+		GE,
+	};
+
+	// Compares a whole column against a constant, 64 rows per output word.
+	// The inner loop is branch-free so the compiler can vectorize it
+	template<class T>
+	void compare_column(const std::vector<T>& col, op_t op, std::uint64_t value, bitmask& out) {
+		const auto n = col.size();
+		const T* data = col.data();
+		auto run = [&](auto cmp) {
+			for(std::size_t w = 0; w < out.size(); w++) {
+				const auto base = w * 64;
+				const auto count = std::min<std::size_t>(64, n - base);
+				std::uint64_t bits = 0;
+				for(std::size_t j = 0; j < count; j++)
+					bits |= static_cast<std::uint64_t>(cmp(static_cast<std::uint64_t>(data[base + j]))) << j;
+				out[w] = bits;
+			}
+		};
+		switch(op) {
+		case op_t::EQ: run([value](std::uint64_t x) { return x == value; }); break;
+		case op_t::NE: run([value](std::uint64_t x) { return x != value; }); break;
+		case op_t::LT: run([value](std::uint64_t x) { return x < value; }); break;
+		case op_t::LE: run([value](std::uint64_t x) { return x <= value; }); break;
+		case op_t::GT: run([value](std::uint64_t x) { return x > value; }); break;
+		case op_t::GE: run([value](std::uint64_t x) { return x >= value; }); break;
+		}
+	}
+
+	bool has_wildcards(const std::string& s) {
+		return s.find_first_of("*?[{") != std::string::npos;
+	}
+
+}
+
+//---------------------------------------------------------------------------//
+
+struct vpk_query::Node
+{
+	enum type_t
+	{
+		AND,
+		OR,
+		NOT,
+		EXT,
+		DIR,
+		MATCH,
+		SUBSTRING,
+		COMPARE,
+	};
+
+	type_t type;
+	std::vector<std::unique_ptr<Node>> children;
+
+	std::vector<std::string> strings;		// EXT list, DIR prefix, SUBSTRING text
+	std::unique_ptr<vpk_path_matcher> matcher;
+	column_t column = column_t::SIZE;
+	op_t op = op_t::EQ;
+	std::uint64_t value = 0;
+
+	explicit Node(type_t t) : type(t) {};
+
+	// Group-level predicates, true if the whole extension/directory group matches
+	bool group_matches(const vpk_directory_group& g) const {
+		if(type == EXT)
+			return std::find(strings.begin(), strings.end(), g.extension) != strings.end();
+
+		// DIR: the directory or anything below it
+		const auto& prefix = strings[0];
+		if(prefix.empty())
+			return true;
+		if(!g.directory.starts_with(prefix))
+			return false;
+		return g.directory.size() == prefix.size() || g.directory[prefix.size()] == '/';
+	}
+
+	bitmask eval(const vpk_archive* archive, const vpk_index_columns& cols) const {
+		const auto n = cols.size.size();
+		bitmask out(mask_words(n), 0);
+
+		switch(type) {
+		case AND:
+		case OR: {
+			out = children[0]->eval(archive, cols);
+			for(std::size_t c = 1; c < children.size(); c++) {
+				auto other = children[c]->eval(archive, cols);
+				for(std::size_t w = 0; w < out.size(); w++)
+					out[w] = type == AND ? (out[w] & other[w]) : (out[w] | other[w]);
+			}
+			break;
+		}
+		case NOT:
+			out = children[0]->eval(archive, cols);
+			for(auto& w : out)
+				w = ~w;
+			trim(out, n);
+			break;
+		case EXT:
+		case DIR: {
+			for(const auto& g : archive->get_directory_groups()) {
+				if(group_matches(g))
+					set_range(out, g.first, g.first + g.count);
+			}
+			break;
+		}
+		case MATCH:
+		case SUBSTRING: {
+			// Each task fills whole words, so no two threads write the same one
+			const auto& names = archive->get_file_names();
+			parallel_for(out.size(), [&](std::size_t w) {
+				std::uint64_t bits = 0;
+				const auto end = std::min<std::size_t>(w * 64 + 64, n);
+				for(auto i = w * 64; i < end; i++) {
+					bool hit = type == MATCH ? matcher->matches(names[i]) : names[i].find(strings[0]) != std::string::npos;
+					bits |= static_cast<std::uint64_t>(hit) << (i - w * 64);
+				}
+				out[w] = bits;
+			}, 0, 64);
+			break;
+		}
+		case COMPARE:
+			switch(column) {
+			case column_t::SIZE: compare_column(cols.size, op, value, out); break;
+			case column_t::PRELOAD: compare_column(cols.preload_size, op, value, out); break;
+			case column_t::ARCHIVE: compare_column(cols.archive_index, op, value, out); break;
+			case column_t::CRC: compare_column(cols.crc, op, value, out); break;
+			}
+			break;
+		}
+		return out;
+	}
+};
+
+namespace {
+
+	using Node = vpk_query::Node;
+
+	class query_parser
+	{
+	private:
+		std::vector<std::string> m_tokens;
+		std::size_t m_pos = 0;
+
+		static bool is_or(const std::string& t) {
+			return t == "or" || t == "OR" || t == "|";
+		}
+
+		// Splits on whitespace, peeling grouping parentheses off the ends of words. A '!' or '-' right before a
+		// '(' is a token of its own, so !(a or b) negates the group
+		void tokenize(const std::string& text) {
+			std::size_t i = 0;
+			while(i < text.size()) {
+				if(std::isspace(static_cast<unsigned char>(text[i]))) {
+					i++;
+					continue;
+				}
+				auto end = i;
+				while(end < text.size() && !std::isspace(static_cast<unsigned char>(text[end])))
+					end++;
+				std::string word = text.substr(i, end - i);
+				i = end;
+
+				while(!word.empty()) {
+					if(word.front() == '(')
+						m_tokens.push_back("(");
+					else if((word.front() == '!' || word.front() == '-') && word.size() > 1 && word[1] == '(')
+						m_tokens.push_back(word.substr(0, 1));
+					else
+						break;
+					word.erase(0, 1);
+				}
+				// Only trailing ')' that aren't balanced inside the word close a group, re:(a|b) keeps its own
+				int closing = 0;
+				while(!word.empty() && word.back() == ')' &&
+					std::count(word.begin(), word.end(), ')') > std::count(word.begin(), word.end(), '(')) {
+					word.pop_back();
+					closing++;
+				}
+				if(!word.empty())
+					m_tokens.push_back(word);
+				for(int c = 0; c < closing; c++)
+					m_tokens.push_back(")");
+			}
+		}
+
+		static std::uint64_t parse_number(const std::string& text, bool allowUnits) {
+			if(text.empty())
+				throw std::invalid_argument("missing value");
+			// Decimal, or hex with an explicit 0x. No sign, and a leading 0 doesn't mean octal
+			const bool hex = text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X');
+			const char* digits = text.c_str() + (hex ? 2 : 0);
+			if(!(hex ? std::isxdigit(static_cast<unsigned char>(*digits)) : std::isdigit(static_cast<unsigned char>(*digits))))
+				throw std::invalid_argument("invalid number '" + text + "'");
+			char* end = nullptr;
+			errno = 0;
+			auto v = std::strtoull(digits, &end, hex ? 16 : 10);
+			if(errno)
+				throw std::invalid_argument("invalid number '" + text + "'");
+
+			std::string unit = end;
+			std::transform(unit.begin(), unit.end(), unit.begin(), [](unsigned char c) { return std::toupper(c); });
+			if(unit.empty())
+				return v;
+			if(allowUnits) {
+				int shift = 0;
+				if(unit == "K" || unit == "KB" || unit == "KIB") shift = 10;
+				else if(unit == "M" || unit == "MB" || unit == "MIB") shift = 20;
+				else if(unit == "G" || unit == "GB" || unit == "GIB") shift = 30;
+				if(shift && v > (~0ull >> shift))
+					throw std::invalid_argument("number '" + text + "' is too large");
+				if(shift)
+					return v << shift;
+			}
+			throw std::invalid_argument("invalid number '" + text + "'");
+		}
+
+		// Splits on commas. Empty items are kept, ext:,txt uses one for files without an extension
+		static std::vector<std::string> split_list(const std::string& text) {
+			std::vector<std::string> out;
+			std::size_t start = 0;
+			while(true) {
+				auto comma = text.find(',', start);
+				out.push_back(text.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+				if(comma == std::string::npos)
+					break;
+				start = comma + 1;
+			}
+			return out;
+		}
+
+		static std::unique_ptr<Node> make_matcher(const std::string& pattern, vpk_path_matcher::syntax type) {
+			auto node = std::make_unique<Node>(Node::MATCH);
+			node->matcher = std::make_unique<vpk_path_matcher>();
+			std::string error;
+			if(!node->matcher->add_pattern(pattern, type, &error))
+				throw std::invalid_argument("invalid pattern '" + pattern + "': " + error);
+			return node;
+		}
+
+		std::unique_ptr<Node> parse_term(const std::string& token) {
+			auto opPos = token.find_first_of(":=<>!");
+			if(opPos == std::string::npos || opPos == 0) {
+				// Bare word
+				if(has_wildcards(token))
+					return make_matcher(token, vpk_path_matcher::syntax::glob);
+				auto node = std::make_unique<Node>(Node::SUBSTRING);
+				node->strings.push_back(token);
+				return node;
+			}
+
+			const auto key = token.substr(0, opPos);
+			std::string opText;
+			auto valuePos = opPos;
+			while(valuePos < token.size() && std::strchr(":=<>!", token[valuePos]) && opText.size() < 2)
+				opText.push_back(token[valuePos++]);
+			const auto value = token.substr(valuePos);
+
+			if(key == "ext" || key == "dir" || key == "name" || key == "re") {
+				if(opText != ":" && opText != "=")
+					throw std::invalid_argument("'" + key + "' only supports ':'");
+				if(key == "name")
+					return make_matcher(value, vpk_path_matcher::syntax::glob);
+				if(key == "re")
+					return make_matcher(value, vpk_path_matcher::syntax::regex);
+
+				auto node = std::make_unique<Node>(key == "ext" ? Node::EXT : Node::DIR);
+				if(key == "ext") {
+					for(auto e : split_list(value)) {
+						if(!e.empty() && e.front() == '.')
+							e.erase(0, 1);
+						node->strings.push_back(e);
+					}
+				}
+				else {
+					auto dir = value;
+					while(!dir.empty() && dir.back() == '/')
+						dir.pop_back();
+					node->strings.push_back(dir);
+				}
+				return node;
+			}
+
+			auto node = std::make_unique<Node>(Node::COMPARE);
+			if(key == "size")
+				node->column = column_t::SIZE;
+			else if(key == "preload")
+				node->column = column_t::PRELOAD;
+			else if(key == "archive")
+				node->column = column_t::ARCHIVE;
+			else if(key == "crc")
+				node->column = column_t::CRC;
+			else
+				throw std::invalid_argument("unknown field '" + key + "'");
+
+			if(opText == ":" || opText == "=" || opText == "==") node->op = op_t::EQ;
+			else if(opText == "!=") node->op = op_t::NE;
+			else if(opText == "<") node->op = op_t::LT;
+			else if(opText == "<=") node->op = op_t::LE;
+			else if(opText == ">") node->op = op_t::GT;
+			else if(opText == ">=") node->op = op_t::GE;
+			else throw std::invalid_argument("invalid operator '" + opText + "'");
+
+			if(node->column == column_t::ARCHIVE && value == "dir")
+				node->value = 0x7FFF;
+			else
+				node->value = parse_number(value, node->column == column_t::SIZE || node->column == column_t::PRELOAD);
+			return node;
+		}
+
+		// A group or a single term
+		std::unique_ptr<Node> parse_primary() {
+			if(m_pos >= m_tokens.size())
+				throw std::invalid_argument("unexpected end of query");
+			auto token = m_tokens[m_pos++];
+
+			if(token == "(") {
+				auto n = parse_or();
+				if(m_pos >= m_tokens.size() || m_tokens[m_pos++] != ")")
+					throw std::invalid_argument("missing ')'");
+				return n;
+			}
+			if(token == ")")
+				throw std::invalid_argument("unexpected ')'");
+			return parse_term(token);
+		}
+
+		std::unique_ptr<Node> parse_unary() {
+			if(m_pos >= m_tokens.size())
+				throw std::invalid_argument("unexpected end of query");
+			const auto& token = m_tokens[m_pos];
+
+			if(token.size() > 1 && (token.front() == '!' || token.front() == '-')) {
+				auto n = std::make_unique<Node>(Node::NOT);
+				n->children.push_back(parse_term(m_tokens[m_pos++].substr(1)));
+				return n;
+			}
+			if(token == "!" || token == "-" || token == "not" || token == "NOT") {
+				m_pos++;
+				auto n = std::make_unique<Node>(Node::NOT);
+				n->children.push_back(parse_unary());
+				return n;
+			}
+			return parse_primary();
+		}
+
+		std::unique_ptr<Node> parse_and() {
+			auto n = std::make_unique<Node>(Node::AND);
+			while(m_pos < m_tokens.size() && m_tokens[m_pos] != ")" && !is_or(m_tokens[m_pos]))
+				n->children.push_back(parse_unary());
+			if(n->children.empty())
+				throw std::invalid_argument("empty expression");
+			if(n->children.size() == 1)
+				return std::move(n->children[0]);
+			return n;
+		}
+
+		std::unique_ptr<Node> parse_or() {
+			auto n = std::make_unique<Node>(Node::OR);
+			n->children.push_back(parse_and());
+			while(m_pos < m_tokens.size() && is_or(m_tokens[m_pos])) {
+				m_pos++;
+				n->children.push_back(parse_and());
+			}
+			if(n->children.size() == 1)
+				return std::move(n->children[0]);
+			return n;
+		}
+
+	public:
+		std::unique_ptr<Node> parse(const std::string& text) {
+			tokenize(text);
+			if(m_tokens.empty())
+				return nullptr;
+			auto n = parse_or();
+			if(m_pos != m_tokens.size())
+				throw std::invalid_argument("unexpected '" + m_tokens[m_pos] + "'");
+			return n;
+		}
+	};
+
+}
+
+//---------------------------------------------------------------------------//
+
+vpk_index_columns vpk_index_columns::build(const vpk_archive* archive) {
+	vpk_index_columns cols;
+	const auto n = archive->get_file_count();
+	cols.size.resize(n);
+	cols.preload_size.resize(n);
+	cols.archive_index.resize(n);
+	cols.crc.resize(n);
+
+	for(std::size_t i = 0; i < n; i++) {
+		cols.size[i] = archive->get_file_size(i);
+		cols.preload_size[i] = archive->get_file_preload_size(i);
+		cols.archive_index[i] = archive->get_file_archive_index(i);
+		cols.crc[i] = archive->get_file_crc32(i);
+	}
+	return cols;
+}
+
+vpk_query::vpk_query() = default;
+vpk_query::~vpk_query() = default;
+
+bool vpk_query::parse(const std::string& text, std::string* error) {
+	try {
+		m_root = query_parser().parse(text);
+	}
+	catch(std::exception& e) {
+		m_root = nullptr;
+		if(error)
+			*error = e.what();
+		return false;
+	}
+	return true;
+}
+
+std::vector<vpk_file_handle> vpk_query::select(const vpk_archive* archive, const vpk_index_columns& columns) const {
+	const auto n = columns.size.size();
+	std::vector<vpk_file_handle> result;
+
+	bitmask mask;
+	if(m_root) {
+		mask = m_root->eval(archive, columns);
+	}
+	else {
+		mask.assign(mask_words(n), ~0ull);
+		trim(mask, n);
+	}
+
+	for(std::size_t w = 0; w < mask.size(); w++) {
+		auto bits = mask[w];
+		while(bits) {
+			result.push_back(w * 64 + __builtin_ctzll(bits));
+			bits &= bits - 1;
+		}
+	}
+	return result;
+}
+
+std::vector<vpk_file_handle> vpk_query::select(const vpk_archive* archive) const {
+	return select(archive, vpk_index_columns::build(archive));
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vpk.hpp"
+
+namespace vpklib
+{
+	/**
+	 * @brief Column-oriented copy of an archive's index, one entry per handle.
+	 * Queries scan these arrays instead of chasing per-file pointers. Path components (extension and directory)
+	 * are evaluated per vpk_directory_group rather than per file.
+	 */
+	struct vpk_index_columns
+	{
+		std::vector<std::uint64_t> size;			// Total size including preload data
+		std::vector<std::uint32_t> preload_size;
+		std::vector<std::uint16_t> archive_index;	// 0x7FFF for data stored in _dir.vpk
+		std::vector<std::uint32_t> crc;
+
+		/**
+		 * @brief Builds the columns for every file in the archive
+		 */
+		static vpk_index_columns build(const vpk_archive* archive);
+	};
+
+	/**
+	 * @brief Selects files with a small query language.
+	 *
+	 * A query is a list of terms that must all match. `or` between terms, `(...)` grouping and a
+	 * `!` or `-` prefix for negation are also supported. Terms:
+	 *
+	 *     ext:vtf,vmt        Extension is one of the list. An empty item stands for none, ext:,txt
+	 *     dir:materials/     File is in that directory or below it
+	 *     name:*.vtf         Full path matches a glob (see vpk_path_matcher)
+	 *     re:.*_normal\.vtf  Full path matches a regex
+	 *     size>1M            Compare total size. Operators are : = != < <= > >=, K/M/G suffixes are powers of 1024
+	 *     preload>0          Compare preload size
+	 *     archive:3          Compare archive index, archive:dir selects data stored in _dir.vpk
+	 *     crc:0x1234ABCD     Compare the stored CRC32
+	 *     word               Anything else: a glob against the full path if it has wildcards, a substring otherwise
+	 */
+	class vpk_query
+	{
+	public:
+		struct Node;
+
+		vpk_query();
+		~vpk_query();
+
+		/**
+		 * @brief Parses a query, replacing any previous one
+		 * @param text Query text
+		 * @param error If not null, receives a description of the problem on failure
+		 * @return bool False if the query is invalid
+		 */
+		bool parse(const std::string& text, std::string* error = nullptr);
+
+		/**
+		 * @brief Returns every matching file, in handle order. An empty query matches everything
+		 * @param archive Archive to search
+		 * @param columns Columns built from the same archive
+		 * @return std::vector<vpk_file_handle> Matching handles
+		 */
+		std::vector<vpk_file_handle> select(const vpk_archive* archive, const vpk_index_columns& columns) const;
+		std::vector<vpk_file_handle> select(const vpk_archive* archive) const;
+
+	private:
+		std::unique_ptr<Node> m_root;
+	};
+}
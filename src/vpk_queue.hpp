@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <thread>
+
+namespace vpklib
+{
+	/**
+	 * @brief Bounded lock-free multi-producer/multi-consumer FIFO.
+	 * This is the classic sequence-numbered ring: each slot carries a sequence counter that tells
+	 * producers and consumers whose turn it is, so neither side ever takes a lock.
+	 * push/pop never block, they return false when the queue is full/empty.
+	 */
+	template<class T>
+	class bounded_queue
+	{
+	private:
+		struct alignas(64) Slot
+		{
+			std::atomic<std::size_t> seq;
+			T value;
+		};
+
+		std::unique_ptr<Slot[]> m_slots;
+		std::size_t m_mask;
+
+		alignas(64) std::atomic<std::size_t> m_head = 0;
+		alignas(64) std::atomic<std::size_t> m_tail = 0;
+
+	public:
+		/**
+		 * @param capacity Minimum capacity, rounded up to a power of two
+		 */
+		explicit bounded_queue(std::size_t capacity) {
+			std::size_t size = 2;
+			while(size < capacity)
+				size <<= 1;
+			m_slots = std::make_unique<Slot[]>(size);
+			m_mask = size - 1;
+			for(std::size_t i = 0; i < size; i++)
+				m_slots[i].seq.store(i, std::memory_order_relaxed);
+		}
+
+		bounded_queue(const bounded_queue&) = delete;
+		bounded_queue& operator=(const bounded_queue&) = delete;
+
+		std::size_t capacity() const { return m_mask + 1; };
+
+		bool push(T value) {
+			auto pos = m_tail.load(std::memory_order_relaxed);
+			while(true) {
+				auto& slot = m_slots[pos & m_mask];
+				auto seq = slot.seq.load(std::memory_order_acquire);
+				auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+				if(diff == 0) {
+					if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						slot.value = std::move(value);
+						slot.seq.store(pos + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if(diff < 0) {
+					return false; // Full
+				}
+				else {
+					pos = m_tail.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		bool pop(T& out) {
+			auto pos = m_head.load(std::memory_order_relaxed);
+			while(true) {
+				auto& slot = m_slots[pos & m_mask];
+				auto seq = slot.seq.load(std::memory_order_acquire);
+				auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+				if(diff == 0) {
+					if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+						out = std::move(slot.value);
+						slot.seq.store(pos + m_mask + 1, std::memory_order_release);
+						return true;
+					}
+				}
+				else if(diff < 0) {
+					return false; // Empty
+				}
+				else {
+					pos = m_head.load(std::memory_order_relaxed);
+				}
+			}
+		}
+
+		/**
+		 * @brief Pops an item known to be on its way, ex: after acquiring a semaphore its producer releases after push.
+		 * With several producers, pop can still fail for a moment: the head slot may belong to a producer that
+		 * claimed it before the one that released, and hasn't published it yet. This waits that out.
+		 * @return T The item
+		 */
+		T pop_claimed() {
+			T out;
+			while(!pop(out))
+				std::this_thread::yield();
+			return out;
+		}
+	};
+}
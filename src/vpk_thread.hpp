@@ -0,0 +1,105 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vpklib
+{
+	/**
+	 * @brief Returns the number of worker threads to use for parallel operations
+	 * @return unsigned Thread count, always at least 1
+	 */
+	inline unsigned hardware_threads() {
+		auto n = std::thread::hardware_concurrency();
+		return n ? n : 1;
+	}
+
+	/**
+	 * @brief Runs fn(i) for every i in [0, count) across a set of threads.
+	 * Work is handed out in small batches from a shared counter so uneven items balance out.
+	 * The calling thread participates, so threads == 1 runs everything inline.
+	 * @param count Number of items
+	 * @param fn Callable taking a std::size_t index
+	 * @param threads Number of threads to use, 0 for hardware_threads()
+	 * @param grain Number of items claimed per batch
+	 */
+	template<class F>
+	void parallel_for(std::size_t count, F&& fn, unsigned threads = 0, std::size_t grain = 16) {
+		if(!threads)
+			threads = hardware_threads();
+		grain = std::max<std::size_t>(grain, 1);
+		threads = static_cast<unsigned>(std::min<std::size_t>(threads, (count + grain - 1) / grain));
+
+		if(threads <= 1) {
+			for(std::size_t i = 0; i < count; i++)
+				fn(i);
+			return;
+		}
+
+		std::atomic<std::size_t> next = 0;
+		auto worker = [&]() {
+			while(true) {
+				auto begin = next.fetch_add(grain, std::memory_order_relaxed);
+				if(begin >= count)
+					break;
+				auto end = std::min(begin + grain, count);
+				for(auto i = begin; i < end; i++)
+					fn(i);
+			}
+		};
+
+		std::vector<std::thread> pool;
+		pool.reserve(threads - 1);
+		for(unsigned i = 0; i < threads - 1; i++)
+			pool.emplace_back(worker);
+		worker();
+		for(auto& t : pool)
+			t.join();
+	}
+
+	/**
+	 * @brief Caps the combined throughput of several threads.
+	 * Each caller books the next free slot on a shared schedule and sleeps until it comes up, so
+	 * the total never runs ahead of the rate no matter how many threads share the limiter.
+	 */
+	class rate_limiter
+	{
+	public:
+		/**
+		 * @param bytesPerSecond Rate limit, 0 for none
+		 */
+		explicit rate_limiter(std::uint64_t bytesPerSecond = 0) : m_rate(bytesPerSecond) {}
+
+		/**
+		 * @brief Blocks until the caller may transfer the given number of bytes
+		 */
+		void acquire(std::uint64_t bytes) {
+			if(!m_rate)
+				return;
+			const auto cost = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(double(bytes) / m_rate));
+
+			clock::time_point slot;
+			{
+				std::lock_guard<std::mutex> lock(m_lock);
+				slot = std::max(m_next, clock::now());
+				m_next = slot + cost;
+			}
+			std::this_thread::sleep_until(slot);
+		}
+
+		bool enabled() const { return m_rate != 0; }
+
+	private:
+		using clock = std::chrono::steady_clock;
+
+		std::uint64_t m_rate;
+		std::mutex m_lock;
+		clock::time_point m_next = {};
+	};
+}
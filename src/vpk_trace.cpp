@@ -0,0 +1,185 @@
+// Access trace recording
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <fstream>
+
+#include "vpk.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	constexpr const char TRACE_HEADER[] = "# vpktrace 1";
+
+}
+
+access_trace::access_trace(std::size_t capacity) {
+	capacity = std::bit_ceil(std::max<std::size_t>(capacity, 2));
+	m_slots = std::make_unique<Slot[]>(capacity);
+	m_mask = capacity - 1;
+	m_start = std::chrono::steady_clock::now();
+}
+
+std::vector<vpk_trace_record> access_trace::snapshot() const {
+	const auto end = m_next.load(std::memory_order_acquire);
+	const auto begin = end > capacity() ? end - capacity() : 0;
+
+	std::vector<vpk_trace_record> records;
+	records.reserve(end - begin);
+	for(auto n = begin; n < end; n++) {
+		const auto& slot = m_slots[n & m_mask];
+		if(slot.sequence.load(std::memory_order_acquire) != 2 * n + 2)
+			continue; // Not written yet or already overwritten
+		vpk_trace_record r;
+		r.handle = slot.handle.load(std::memory_order_relaxed);
+		r.offset = slot.offset.load(std::memory_order_relaxed);
+		r.length = slot.length.load(std::memory_order_relaxed);
+		r.timestamp = slot.timestamp.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if(slot.sequence.load(std::memory_order_relaxed) != 2 * n + 2)
+			continue; // Overwritten while we were copying it
+		records.push_back(r);
+	}
+	return records;
+}
+
+void access_trace::clear() {
+	for(std::size_t i = 0; i <= m_mask; i++)
+		m_slots[i].sequence.store(0, std::memory_order_relaxed);
+	m_next.store(0, std::memory_order_relaxed);
+	m_start = std::chrono::steady_clock::now();
+}
+
+bool vpklib::read_trace(const std::filesystem::path& path, std::vector<vpk_trace_entry>& out, std::string* error) {
+	std::ifstream in(path);
+	std::string line;
+	if(!in || !std::getline(in, line) || line.rfind(TRACE_HEADER, 0) != 0) {
+		if(error)
+			*error = "'" + path.string() + "' is not an access trace";
+		return false;
+	}
+
+	out.clear();
+	for(std::size_t lineNumber = 2; std::getline(in, line); lineNumber++) {
+		if(!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if(line.empty() || line[0] == '#')
+			continue;
+
+		// timestamp, offset, length, then the name which may itself contain tabs
+		vpk_trace_entry e;
+		char* end = line.data();
+		std::uint64_t* fields[3] = {&e.timestamp, &e.offset, &e.length};
+		bool valid = true;
+		for(auto field : fields) {
+			*field = std::strtoull(end, &end, 10);
+			if(*end != '\t') {
+				valid = false;
+				break;
+			}
+			end++;
+		}
+		if(!valid) {
+			if(error)
+				*error = "malformed record on line " + std::to_string(lineNumber) + " of '" + path.string() + "'";
+			return false;
+		}
+		e.name.assign(end, line.data() + line.size());
+		out.push_back(std::move(e));
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------//
+
+void vpk_archive::start_trace(std::size_t capacity) {
+	m_trace = std::make_unique<access_trace>(capacity);
+}
+
+void vpk_archive::stop_trace() {
+	m_trace.reset();
+}
+
+std::vector<vpk_trace_record> vpk_archive::get_trace() const {
+	return m_trace ? m_trace->snapshot() : std::vector<vpk_trace_record>();
+}
+
+std::uint64_t vpk_archive::get_trace_dropped() const {
+	if(!m_trace)
+		return 0;
+	const auto total = m_trace->total();
+	return total > m_trace->capacity() ? total - m_trace->capacity() : 0;
+}
+
+bool vpk_archive::write_trace(const std::filesystem::path& path, std::string* error) const {
+	std::ofstream out(path, std::ios::trunc);
+	if(!out) {
+		if(error)
+			*error = "failed to create '" + path.string() + "': " + strerror(errno);
+		return false;
+	}
+
+	// Names rather than handles, handles only mean something for this exact _dir
+	out << TRACE_HEADER << "\n# timestamp_ns\toffset\tlength\tname\n";
+	for(const auto& r : get_trace()) {
+		if(r.handle >= m_fileNames.size())
+			continue;
+		out << r.timestamp << '\t' << r.offset << '\t' << r.length << '\t' << m_fileNames[r.handle] << '\n';
+	}
+
+	out.flush();
+	if(!out) {
+		if(error)
+			*error = "failed to write '" + path.string() + "'";
+		return false;
+	}
+	return true;
+}
+
+bool vpk_archive::read_trace_order(const std::filesystem::path& path, std::vector<vpk_file_handle>& order, std::size_t* unknown, std::string* error) {
+	std::vector<vpk_trace_entry> reads;
+	if(!read_trace(path, reads, error))
+		return false;
+
+	// First touch order: a file goes where it was first needed, which keeps files loaded together next to each other
+	struct first_access
+	{
+		std::uint64_t timestamp;
+		std::size_t read;
+		vpk_file_handle handle;
+	};
+	std::vector<first_access> files;
+	std::vector<std::size_t> slot(m_files.size(), SIZE_MAX);
+	std::size_t missing = 0;
+
+	for(std::size_t i = 0; i < reads.size(); i++) {
+		const auto handle = find_file(reads[i].name);
+		if(handle == INVALID_HANDLE) {
+			missing++;
+			continue;
+		}
+		if(slot[handle] == SIZE_MAX) {
+			slot[handle] = files.size();
+			files.push_back({reads[i].timestamp, i, handle});
+		}
+		else {
+			auto& f = files[slot[handle]];
+			f.timestamp = std::min<std::uint64_t>(f.timestamp, reads[i].timestamp);
+		}
+	}
+
+	// Records from several threads may be slightly out of order in the file
+	std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+		return std::tie(a.timestamp, a.read) < std::tie(b.timestamp, b.read);
+	});
+
+	order.clear();
+	for(const auto& f : files)
+		order.push_back(f.handle);
+	if(unknown)
+		*unknown = missing;
+	return true;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vpklib
+{
+	/**
+	 * @brief One read recorded by an access trace
+	 */
+	struct vpk_trace_record
+	{
+		std::uint64_t handle;		// File that was read
+		std::uint64_t offset;		// Offset of the read within the file
+		std::uint64_t length;		// Bytes requested
+		std::uint64_t timestamp;	// Nanoseconds since the trace started
+	};
+
+	/**
+	 * @brief One read as stored in a trace file, see vpk_archive::write_trace
+	 */
+	struct vpk_trace_entry
+	{
+		std::uint64_t timestamp;
+		std::uint64_t offset;
+		std::uint64_t length;
+		std::string name;
+	};
+
+	/**
+	 * @brief Loads a trace file written by vpk_archive::write_trace
+	 * @param path Trace file
+	 * @param out Receives the reads in file order
+	 * @param error If not null, receives a description of the problem on failure
+	 * @return bool False if the file can't be read or isn't a trace
+	 */
+	bool read_trace(const std::filesystem::path& path, std::vector<vpk_trace_entry>& out, std::string* error = nullptr);
+
+	/**
+	 * @brief Fixed size ring buffer of reads, written from any number of threads without locking.
+	 * Each writer claims a slot with a single atomic increment and publishes it with a sequence number,
+	 * so snapshot() can run alongside the writers and simply skips slots that are mid-update.
+	 * Once full, the oldest records are overwritten.
+	 */
+	class access_trace
+	{
+	private:
+		struct Slot
+		{
+			std::atomic<std::uint64_t> sequence{0};	// 0 when empty, 2n+1 while record n is written, 2n+2 when done
+			std::atomic<std::uint64_t> handle{0};
+			std::atomic<std::uint64_t> offset{0};
+			std::atomic<std::uint64_t> length{0};
+			std::atomic<std::uint64_t> timestamp{0};
+		};
+
+		std::unique_ptr<Slot[]> m_slots;
+		std::size_t m_mask;
+		std::atomic<std::uint64_t> m_next{0};
+		std::chrono::steady_clock::time_point m_start;
+
+	public:
+		/**
+		 * @param capacity Number of records kept, rounded up to a power of two
+		 */
+		explicit access_trace(std::size_t capacity);
+
+		void record(std::uint64_t handle, std::uint64_t offset, std::uint64_t length) {
+			const auto n = m_next.fetch_add(1, std::memory_order_relaxed);
+			auto& slot = m_slots[n & m_mask];
+			const auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count();
+			slot.sequence.store(2 * n + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			slot.handle.store(handle, std::memory_order_relaxed);
+			slot.offset.store(offset, std::memory_order_relaxed);
+			slot.length.store(length, std::memory_order_relaxed);
+			slot.timestamp.store(static_cast<std::uint64_t>(now), std::memory_order_relaxed);
+			slot.sequence.store(2 * n + 2, std::memory_order_release);
+		}
+
+		/**
+		 * @brief Returns the records still in the buffer, oldest first
+		 */
+		std::vector<vpk_trace_record> snapshot() const;
+
+		/**
+		 * @brief Drops all records and restarts the clock. Not thread safe
+		 */
+		void clear();
+
+		std::size_t capacity() const { return m_mask + 1; };
+
+		/**
+		 * @brief Returns the number of reads recorded since the start, including overwritten ones
+		 */
+		std::uint64_t total() const { return m_next.load(std::memory_order_relaxed); };
+	};
+}
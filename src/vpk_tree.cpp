@@ -0,0 +1,120 @@
+// Directory file construction
+#include <algorithm>
+#include <cstring>
+
+#include "vpk_tree.hpp"
+#include "vpk_md5.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	template<class T>
+	void append(std::string& out, const T& value) {
+		out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+
+	// Empty components are stored as a single space
+	void append_component(std::string& out, const std::string& s) {
+		out += s.empty() ? " " : s;
+		out += '\0';
+	}
+
+}
+
+bool tree::split_name(const std::string& name, name_parts& out, std::string* error) {
+	auto fail = [&](const std::string& why) {
+		if(error)
+			*error = "'" + name + "': " + why;
+		return false;
+	};
+
+	std::string path = name;
+	std::replace(path.begin(), path.end(), '\\', '/');
+	while(path.starts_with("./"))
+		path.erase(0, 2);
+	while(path.starts_with("/"))
+		path.erase(0, 1);
+
+	if(path.find('\0') != std::string::npos)
+		return fail("contains a NUL character");
+
+	const auto slash = path.rfind('/');
+	out.directory = slash == std::string::npos ? "" : path.substr(0, slash);
+	const auto file = slash == std::string::npos ? path : path.substr(slash + 1);
+
+	const auto dot = file.rfind('.');
+	out.file = dot == std::string::npos ? file : file.substr(0, dot);
+	out.extension = dot == std::string::npos ? "" : file.substr(dot + 1);
+
+	if(out.file.empty())
+		return fail("file names need a stem before the extension");
+	if(out.extension.size() > MAX_NAME_COMPONENT || out.directory.size() > MAX_NAME_COMPONENT || out.file.size() > MAX_NAME_COMPONENT)
+		return fail("path components are limited to " + std::to_string(MAX_NAME_COMPONENT) + " bytes");
+	if(out.file == " " || out.extension == " " || out.directory == " ")
+		return fail("a single space is reserved for empty path components");
+	return true;
+}
+
+std::string tree::join_name(const name_parts& parts) {
+	auto name = parts.directory.empty() ? parts.file : parts.directory + "/" + parts.file;
+	if(!parts.extension.empty())
+		name += "." + parts.extension;
+	return name;
+}
+
+std::string tree::serialize(const std::vector<node>& nodes) {
+	// Each level is a list of strings closed by an empty one
+	std::string out;
+	for(std::size_t i = 0; i < nodes.size();) {
+		const auto& ext = nodes[i].parts->extension;
+		append_component(out, ext);
+		while(i < nodes.size() && nodes[i].parts->extension == ext) {
+			const auto& dir = nodes[i].parts->directory;
+			append_component(out, dir);
+			for(; i < nodes.size() && nodes[i].parts->extension == ext && nodes[i].parts->directory == dir; i++) {
+				out += nodes[i].parts->file;
+				out += '\0';
+				auto entry = nodes[i].entry;
+				entry.terminator = DIRECTORY_TERMINATOR;
+				append(out, entry);
+				if(entry.preload_bytes)
+					out.append(nodes[i].preload, entry.preload_bytes);
+			}
+			out += '\0';
+		}
+		out += '\0';
+	}
+	out += '\0';
+	return out;
+}
+
+std::string tree::build_dir(std::uint32_t version, std::string_view tree, std::string_view fileData, std::string_view md5Section) {
+	std::string dir;
+	vpk::Header header = {VPK_SIGNATURE, version, static_cast<std::uint32_t>(tree.size())};
+	append(dir, header);
+	if(version == 2) {
+		vpk2::HeaderExt ext = {};
+		ext.file_data_section_size = static_cast<std::uint32_t>(fileData.size());
+		ext.archive_md5_section_size = static_cast<std::uint32_t>(md5Section.size());
+		ext.other_md5_section_size = sizeof(vpk2::OtherMD5Section);
+		ext.signature_section_size = 0;
+		append(dir, ext);
+	}
+	dir += tree;
+	dir += fileData;
+	if(version != 2)
+		return dir;
+
+	dir += md5Section;
+
+	// The last checksum covers everything before it
+	vpk2::OtherMD5Section other = {};
+	md5::hash(tree.data(), tree.size(), reinterpret_cast<std::uint8_t*>(other.tree_checksum));
+	md5::hash(md5Section.data(), md5Section.size(), reinterpret_cast<std::uint8_t*>(other.archive_md5_section_checksum));
+	dir.append(other.tree_checksum, sizeof(other.tree_checksum));
+	dir.append(other.archive_md5_section_checksum, sizeof(other.archive_md5_section_checksum));
+	md5::hash(dir.data(), dir.size(), reinterpret_cast<std::uint8_t*>(other.unknown));
+	dir.append(other.unknown, sizeof(other.unknown));
+	return dir;
+}
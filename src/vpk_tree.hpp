@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+#include "vpk.hpp"
+
+// Building blocks for writing directory files, shared by vpk_writer and in-place updates
+namespace vpklib::tree
+{
+	/**
+	 * @brief Path components as stored in the three levels of the tree. Empty means none
+	 */
+	struct name_parts
+	{
+		std::string extension;
+		std::string directory;
+		std::string file;
+
+		bool operator<(const name_parts& other) const {
+			return std::tie(extension, directory, file) < std::tie(other.extension, other.directory, other.file);
+		}
+	};
+
+	/**
+	 * @brief Splits a path inside the archive into tree components
+	 * @param name Path, ex: materials/foo/bar.vtf. Backslashes are accepted
+	 * @param out Receives the components
+	 * @param error If not null, receives a description of the problem on failure
+	 * @return bool False if the name can't be stored in a VPK
+	 */
+	bool split_name(const std::string& name, name_parts& out, std::string* error = nullptr);
+
+	/**
+	 * @brief Joins components back into the path the reader reports for them
+	 */
+	std::string join_name(const name_parts& parts);
+
+	struct node
+	{
+		const name_parts* parts;
+		vpk2::DirectoryEntry entry;	// terminator is filled in by serialize
+		const byte* preload;		// entry.preload_bytes bytes
+	};
+
+	/**
+	 * @brief Serializes the extension -> directory -> file tree
+	 * @param nodes Files, sorted by their name_parts
+	 * @return std::string Tree bytes, tree_size in the header
+	 */
+	std::string serialize(const std::vector<node>& nodes);
+
+	/**
+	 * @brief Assembles a complete _dir.vpk: header, tree, embedded file data and, for VPK2, the
+	 * archive MD5 section and OtherMD5Section. No signature section is written.
+	 * @param version 1 or 2
+	 * @param tree Output of serialize
+	 * @param fileData Data of the files stored in _dir (archive index 0x7FFF)
+	 * @param md5Section Packed vpk2::ArchiveMD5SectionEntry records, ignored for VPK1
+	 * @return std::string File contents
+	 */
+	std::string build_dir(std::uint32_t version, std::string_view tree, std::string_view fileData, std::string_view md5Section);
+}
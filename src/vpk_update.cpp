@@ -0,0 +1,263 @@
+// In-place updates
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_crc.hpp"
+#include "vpk_md5.hpp"
+#include "vpk_tree.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	bool pwrite_all(int fd, const void* data, std::size_t size, std::uint64_t offset) {
+		auto p = static_cast<const char*>(data);
+		while(size > 0) {
+			auto n = pwrite(fd, p, size, offset);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			p += n;
+			size -= n;
+			offset += n;
+		}
+		return true;
+	}
+
+	std::string archive_path(const std::string& base, std::uint32_t index) {
+		char num[16] = {};
+		snprintf(num, sizeof(num), "_%03u.vpk", index);
+		return base + num;
+	}
+
+}
+
+bool vpk_archive::set_file_data(const std::string& name, const void* data, std::size_t size, std::string* error) {
+	tree::name_parts parts;
+	if(!tree::split_name(name, parts, error))
+		return false;
+	if(size > 0xFFFFFFFFull) {
+		if(error)
+			*error = "'" + name + "': files must be smaller than 4 GiB";
+		return false;
+	}
+
+	const auto key = tree::join_name(parts);
+	auto handle = find_file(key);
+	if(handle == INVALID_HANDLE) {
+		handle = m_files.size();
+		m_files.push_back(std::make_unique<File>());
+		m_fileNames.push_back(key);
+		const auto hash = path_hash(key);
+		m_index.insert(hash, handle);
+		m_filter.insert(hash);
+		if(m_filter.overfull())
+			rebuild_filter();
+	}
+
+	auto& file = m_files[handle];
+	file->pending_data = std::make_unique<byte[]>(std::max<std::size_t>(size, 1));
+	std::memcpy(file->pending_data.get(), data, size);
+	file->length = static_cast<std::uint32_t>(size);
+	file->crc = crc32(data, size);
+	file->preload_size = 0;
+	file->preload_data.reset();
+	file->dirty = true;
+	m_dirty = true;
+	return true;
+}
+
+bool vpk_archive::remove_file(const std::string& name) {
+	auto handle = find_file(name);
+	if(handle == INVALID_HANDLE)
+		return false;
+
+	auto& file = m_files[handle];
+	file->removed = true;
+	file->dirty = true;
+	file->pending_data.reset();
+	file->preload_size = 0;
+	file->preload_data.reset();
+	file->length = 0;
+	file->crc = 0;
+	m_index.erase(path_hash(name), handle);
+	m_dirty = true;
+	return true;
+}
+
+bool vpk_archive::save(const vpk_update_options& options, std::string* error) {
+	if(!m_dirty)
+		return true;
+
+	auto fail = [&](std::string why) {
+		if(error)
+			*error = std::move(why);
+		return false;
+	};
+
+	const std::uint64_t maxArchive = std::clamp<std::uint64_t>(options.max_archive_size, 1, 0xFFFFFFFFull);
+	const std::uint32_t chunkSize = std::max<std::uint32_t>(options.md5_chunk_size, 4096);
+
+	// Append the new data after the end of the last archive, moving on to fresh archives once it is full
+	std::uint32_t archiveIndex = m_maxPakIndex;
+	std::error_code ec;
+	std::uint64_t archiveEnd = std::filesystem::file_size(archive_path(m_baseArchiveName, archiveIndex), ec);
+	if(ec)
+		archiveEnd = 0;
+
+	int fd = -1;
+	std::int64_t fdArchive = -1;
+	std::string md5Added;
+	md5 chunk;
+	vpk2::ArchiveMD5SectionEntry chunkEntry = {};
+
+	auto finishChunk = [&]() {
+		if(!chunkEntry.count)
+			return;
+		chunk.final(reinterpret_cast<std::uint8_t*>(chunkEntry.checksum));
+		md5Added.append(reinterpret_cast<const char*>(&chunkEntry), sizeof(chunkEntry));
+		chunk = md5();
+		chunkEntry.count = 0;
+	};
+	auto closeArchive = [&]() {
+		finishChunk();
+		bool ok = fd < 0 || (fsync(fd) == 0 && close(fd) == 0);
+		fd = -1;
+		return ok;
+	};
+
+	for(auto& file : m_files) {
+		if(!file->pending_data || file->removed)
+			continue;
+
+		if(archiveEnd && archiveEnd + file->length > maxArchive) {
+			archiveIndex++;
+			archiveEnd = 0;
+		}
+		if(archiveIndex >= 0x7FFF)
+			return fail("too many archives, raise the maximum archive size");
+
+		if(fdArchive != archiveIndex) {
+			if(!closeArchive())
+				return fail("failed to write '" + archive_path(m_baseArchiveName, fdArchive) + "'");
+			// A fresh archive may be left over from a failed save, nothing references it
+			const auto flags = O_WRONLY | O_CREAT | O_CLOEXEC | (archiveEnd ? 0 : O_TRUNC);
+			fd = open(archive_path(m_baseArchiveName, archiveIndex).c_str(), flags, 0644);
+			if(fd < 0)
+				return fail("failed to open '" + archive_path(m_baseArchiveName, archiveIndex) + "': " + strerror(errno));
+			fdArchive = archiveIndex;
+		}
+
+		if(!pwrite_all(fd, file->pending_data.get(), file->length, archiveEnd)) {
+			closeArchive();
+			return fail("failed to write '" + archive_path(m_baseArchiveName, archiveIndex) + "': " + strerror(errno));
+		}
+
+		// MD5 entries cover the appended range in chunkSize pieces
+		for(std::uint32_t done = 0; done < file->length;) {
+			if(!chunkEntry.count) {
+				chunkEntry.archive_index = archiveIndex;
+				chunkEntry.start_offset = static_cast<std::uint32_t>(archiveEnd + done);
+			}
+			const auto n = std::min(file->length - done, chunkSize - chunkEntry.count);
+			chunk.update(file->pending_data.get() + done, n);
+			chunkEntry.count += n;
+			done += n;
+			if(chunkEntry.count == chunkSize)
+				finishChunk();
+		}
+
+		file->archive_index = archiveIndex;
+		file->offset = static_cast<std::uint32_t>(archiveEnd);
+		archiveEnd += file->length;
+	}
+	if(!closeArchive())
+		return fail("failed to write '" + archive_path(m_baseArchiveName, fdArchive) + "'");
+
+	std::string md5Section;
+	if(version == 2) {
+		md5Section.assign(reinterpret_cast<const char*>(m_archiveSectionEntries.data()), m_archiveSectionEntries.size() * sizeof(vpk2::ArchiveMD5SectionEntry));
+		md5Section += md5Added;
+	}
+	return publish(md5Section, error);
+}
+
+bool vpk_archive::publish(const std::string& md5Section, std::string* error, bool* committed) {
+	if(committed)
+		*committed = false;
+
+	auto fail = [&](std::string why) {
+		if(error)
+			*error = std::move(why);
+		return false;
+	};
+
+	// Tree components of the files that came from disk are known from their group
+	std::vector<tree::name_parts> parts(m_files.size());
+	std::vector<bool> known(m_files.size(), false);
+	for(const auto& group : m_groups) {
+		const auto prefix = group.directory.empty() ? 0 : group.directory.size() + 1;
+		const auto suffix = group.extension.empty() ? 0 : group.extension.size() + 1;
+		for(auto h = group.first; h < group.first + group.count; h++) {
+			const auto& name = m_fileNames[h];
+			parts[h] = {group.extension, group.directory, name.substr(prefix, name.size() - prefix - suffix)};
+			known[h] = true;
+		}
+	}
+
+	std::vector<tree::node> nodes;
+	for(vpk_file_handle h = 0; h < m_files.size(); h++) {
+		const auto& file = m_files[h];
+		if(file->removed)
+			continue;
+		if(!known[h])
+			tree::split_name(m_fileNames[h], parts[h]);
+
+		tree::node n = {&parts[h], {}, file->preload_data.get()};
+		n.entry.crc = file->crc;
+		n.entry.preload_bytes = file->preload_size;
+		n.entry.archive_index = static_cast<std::uint16_t>(file->archive_index);
+		// Offsets of data in _dir are stored relative to the end of the tree
+		n.entry.entry_offset = file->archive_index == 0x7FFF ? static_cast<std::uint32_t>(file->offset - m_dataOffset) : file->offset;
+		n.entry.entry_length = file->length;
+		nodes.push_back(n);
+	}
+	std::sort(nodes.begin(), nodes.end(), [](const tree::node& a, const tree::node& b) { return *a.parts < *b.parts; });
+
+	// The data stored in _dir is carried over as is
+	std::string fileData(m_dataSize, '\0');
+	if(m_dataSize && !read_archive_range(0x7FFF, m_dataOffset, fileData.data(), fileData.size()))
+		return fail("failed to read the file data in '" + m_baseArchiveName + "_dir.vpk'");
+
+	const auto dir = tree::build_dir(version, tree::serialize(nodes), fileData, md5Section);
+
+	// Publish with a rename, so readers see either the old archive or the new one
+	const auto dirPath = m_baseArchiveName + "_dir.vpk";
+	const auto dirTmp = dirPath + ".tmp";
+	int fd = open(dirTmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	bool ok = fd >= 0 && pwrite_all(fd, dir.data(), dir.size(), 0) && fsync(fd) == 0;
+	ok = fd >= 0 && close(fd) == 0 && ok;
+	if(!ok) {
+		unlink(dirTmp.c_str());
+		return fail("failed to write '" + dirPath + "': " + strerror(errno));
+	}
+	if(rename(dirTmp.c_str(), dirPath.c_str()) != 0) {
+		unlink(dirTmp.c_str());
+		return fail("failed to write '" + dirPath + "': " + strerror(errno));
+	}
+	if(committed)
+		*committed = true;
+
+	const bool verifyOnRead = get_verify_on_read();
+	reset();
+	if(!load(dirPath))
+		return fail("failed to reload '" + dirPath + "'");
+	set_verify_on_read(verifyOnRead);
+	return true;
+}
@@ -0,0 +1,462 @@
+// Integrity checks
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "vpk.hpp"
+#include "vpk_crc.hpp"
+#include "vpk_md5.hpp"
+#include "vpk_pipeline.hpp"
+#include "vpk_thread.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	enum scan_kind : std::uint32_t { SCAN_CRC = 1, SCAN_MD5 = 2 };
+
+	// Identifies the archive a checkpoint belongs to: names, locations and checksums of every file plus the MD5 section.
+	// A scan over a subset of the files also covers the selection, so a checkpoint is never resumed for different files
+	std::uint64_t archive_fingerprint(const vpk_archive* archive, const std::vector<vpk_file_handle>* selection = nullptr) {
+		std::uint32_t crc = 0;
+		const auto& names = archive->get_file_names();
+		for(vpk_file_handle h = 0; h < names.size(); h++) {
+			const std::uint32_t fields[4] = {
+				archive->get_file_crc32(h), static_cast<std::uint32_t>(archive->get_file_size(h)),
+				static_cast<std::uint32_t>(archive->get_file_archive_index(h)), static_cast<std::uint32_t>(archive->get_file_offset(h))
+			};
+			crc = crc32(names[h].data(), names[h].size(), crc);
+			crc = crc32(fields, sizeof(fields), crc);
+		}
+		const auto& entries = archive->get_archive_md5_entries();
+		crc = crc32(entries.data(), entries.size() * sizeof(entries[0]), crc);
+		if(selection)
+			crc = crc32(selection->data(), selection->size() * sizeof(vpk_file_handle), crc);
+		return (static_cast<std::uint64_t>(names.size()) << 32) | crc;
+	}
+
+	/**
+	 * Shared bookkeeping for a scan over a fixed set of items (files or MD5 chunks): totals, failures and
+	 * which items are done. With a checkpoint path, the state is loaded on construction, saved every few
+	 * seconds while workers report in, and removed once the scan finishes.
+	 *
+	 * Checkpoint layout: checkpoint_header, header.record_count records, then the done bitmap.
+	 */
+	class scan_progress
+	{
+	public:
+		struct record
+		{
+			std::uint32_t item;
+			std::uint32_t a, b, c;	// Scan specific
+		};
+
+		scan_progress(const vpk_verify_options& options, scan_kind kind, std::uint64_t fingerprint, std::size_t items)
+			: m_path(options.checkpoint), m_interval(options.checkpoint_interval), m_done((items + 7) / 8, 0) {
+			m_header.kind = kind;
+			m_header.fingerprint = fingerprint;
+			m_header.items = items;
+			if(!m_path.empty())
+				load();
+			m_resumed = m_header.done_items;
+			m_lastSave = std::chrono::steady_clock::now();
+		}
+
+		bool done(std::size_t item) const { return m_done[item / 8] & (1u << (item % 8)); }
+
+		// Marks an item finished. Thread safe
+		void complete(std::size_t item, std::uint64_t bytes, const record* failure = nullptr) {
+			std::lock_guard<std::mutex> lock(m_lock);
+			m_done[item / 8] |= 1u << (item % 8);
+			m_header.done_items++;
+			m_header.bytes += bytes;
+			if(failure)
+				m_records.push_back(*failure);
+
+			if(!m_path.empty()) {
+				const auto now = std::chrono::steady_clock::now();
+				if(std::chrono::duration<double>(now - m_lastSave).count() >= m_interval) {
+					save(std::chrono::duration<double>(now - m_start).count());
+					m_lastSave = now;
+				}
+			}
+		}
+
+		// Ends the scan, returns the total time spent across every run
+		double finish() {
+			if(!m_path.empty())
+				std::remove(m_path.c_str());
+			return m_header.seconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+		}
+
+		std::uint64_t done_items() const { return m_header.done_items; }
+		std::uint64_t bytes() const { return m_header.bytes; }
+		std::uint64_t resumed() const { return m_resumed; }
+		const std::vector<record>& records() const { return m_records; }
+
+	private:
+		struct checkpoint_header
+		{
+			char magic[8] = {'V', 'P', 'K', 'S', 'C', 'A', 'N', '1'};
+			std::uint32_t kind = 0;
+			std::uint32_t reserved = 0;
+			std::uint64_t fingerprint = 0;
+			std::uint64_t items = 0;
+			std::uint64_t done_items = 0;
+			std::uint64_t bytes = 0;
+			double seconds = 0;
+			std::uint64_t record_count = 0;
+		};
+
+		// Leaves the state untouched unless the file is a complete checkpoint of the same scan
+		void load() {
+			auto fp = fopen(m_path.c_str(), "rb");
+			if(!fp)
+				return;
+
+			checkpoint_header header;
+			const checkpoint_header expected = m_header;
+			std::vector<record> records;
+			std::vector<std::uint8_t> bitmap(m_done.size());
+			bool ok = fread(&header, sizeof(header), 1, fp) == 1
+				&& !std::memcmp(header.magic, expected.magic, sizeof(header.magic))
+				&& header.kind == expected.kind && header.fingerprint == expected.fingerprint && header.items == expected.items
+				&& header.record_count <= header.items;
+			if(ok) {
+				records.resize(header.record_count);
+				ok = (records.empty() || fread(records.data(), sizeof(record), records.size(), fp) == records.size())
+					&& fread(bitmap.data(), 1, bitmap.size(), fp) == bitmap.size();
+			}
+			fclose(fp);
+
+			if(!ok) {
+				fprintf(stderr, "WARNING: Ignoring checkpoint '%s', it is damaged or belongs to a different scan\n", m_path.c_str());
+				return;
+			}
+			m_header = header;
+			m_records = std::move(records);
+			m_done = std::move(bitmap);
+		}
+
+		// Writes a temporary file and renames it over the checkpoint, so a crash never leaves a torn one
+		void save(double elapsed) {
+			auto header = m_header;
+			header.seconds += elapsed;
+			header.record_count = m_records.size();
+
+			const auto tmp = m_path + ".tmp";
+			auto fp = fopen(tmp.c_str(), "wb");
+			if(!fp)
+				return;
+			bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+				&& (m_records.empty() || fwrite(m_records.data(), sizeof(record), m_records.size(), fp) == m_records.size())
+				&& fwrite(m_done.data(), 1, m_done.size(), fp) == m_done.size();
+			ok = fclose(fp) == 0 && ok;
+			if(!ok || std::rename(tmp.c_str(), m_path.c_str()) != 0)
+				std::remove(tmp.c_str());
+		}
+
+		std::string m_path;
+		double m_interval;
+		checkpoint_header m_header;
+		std::vector<record> m_records;
+		std::vector<std::uint8_t> m_done;
+		std::uint64_t m_resumed = 0;
+
+		std::mutex m_lock;
+		std::chrono::steady_clock::time_point m_start = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point m_lastSave;
+	};
+
+}
+
+vpk_verify_result vpk_archive::verify(const vpk_verify_options& options) {
+	std::vector<vpk_file_handle> handles(m_files.size());
+	for(std::size_t i = 0; i < handles.size(); i++)
+		handles[i] = i;
+	return verify(std::move(handles), options);
+}
+
+vpk_verify_result vpk_archive::verify(std::vector<vpk_file_handle> handles, const vpk_verify_options& options) {
+	const auto bufferSize = std::max<std::size_t>(options.buffer_size, 4096);
+
+	// The selection in a canonical order, for the checkpoint fingerprint
+	std::erase_if(handles, [&](auto handle) { return handle >= m_files.size(); });
+	std::sort(handles.begin(), handles.end());
+	handles.erase(std::unique(handles.begin(), handles.end()), handles.end());
+
+	scan_progress progress(options, SCAN_CRC, archive_fingerprint(this, &handles), m_files.size());
+	std::erase_if(handles, [&](auto handle) { return progress.done(handle); });
+
+	// Threads claim files in physical order, so the archives are still read front to back
+	vpk_read_pipeline::sort_physical(this, handles);
+
+	rate_limiter limiter(options.max_bytes_per_second);
+	std::atomic<std::size_t> next = 0;
+
+	auto worker = [&]() {
+		auto buffer = std::make_unique<byte[]>(bufferSize);
+
+		while(true) {
+			auto i = next.fetch_add(1, std::memory_order_relaxed);
+			if(i >= handles.size())
+				break;
+
+			const auto handle = handles[i];
+			const std::uint64_t size = get_file_size(handle);
+			std::uint32_t crc = 0;
+			bool readError = false;
+
+			for(std::uint64_t offset = 0; offset < size;) {
+				auto want = static_cast<std::size_t>(std::min<std::uint64_t>(bufferSize, size - offset));
+				limiter.acquire(want);
+				if(read_file_range(handle, offset, buffer.get(), want) != want) {
+					readError = true;
+					break;
+				}
+				crc = crc32(buffer.get(), want, crc);
+				offset += want;
+			}
+
+			const auto expected = get_file_crc32(handle);
+			if(readError || crc != expected) {
+				const scan_progress::record failure = {static_cast<std::uint32_t>(handle), expected, readError ? 0 : crc, readError};
+				progress.complete(handle, size, &failure);
+			}
+			else
+				progress.complete(handle, size);
+		}
+	};
+
+	const auto threadCount = std::max<std::size_t>(1, std::min<std::size_t>(options.threads ? options.threads : hardware_threads(), handles.size()));
+	std::vector<std::thread> threads;
+	for(std::size_t i = 1; i < threadCount; i++)
+		threads.emplace_back(worker);
+	worker();
+	for(auto& t : threads)
+		t.join();
+
+	vpk_verify_result result;
+	result.seconds = progress.finish();
+	result.files = progress.done_items();
+	result.bytes = progress.bytes();
+	result.resumed = progress.resumed();
+	for(const auto& r : progress.records())
+		result.failures.push_back({r.item, r.a, r.b, r.c != 0});
+	std::sort(result.failures.begin(), result.failures.end(), [](const auto& a, const auto& b) { return a.handle < b.handle; });
+	return result;
+}
+
+vpk_md5_result vpk_archive::verify_md5(const vpk_verify_options& options) {
+	const auto bufferSize = std::max<std::size_t>(options.buffer_size, 4096);
+
+	vpk_md5_result result;
+	if(version != 2)
+		return result;
+	result.has_checksums = true;
+
+	const auto& entries = m_archiveSectionEntries;
+	scan_progress progress(options, SCAN_MD5, archive_fingerprint(this), entries.size());
+	rate_limiter limiter(options.max_bytes_per_second);
+
+	// Hashes a range of one of the archive files through a bounded buffer
+	auto hashRange = [&](std::int32_t archiveIndex, std::uint64_t offset, std::uint64_t size,
+		byte* buffer, std::uint8_t digest[16]) -> bool {
+		md5 ctx;
+		while(size > 0) {
+			auto n = static_cast<std::size_t>(std::min<std::uint64_t>(size, bufferSize));
+			limiter.acquire(n);
+			if(!read_archive_range(archiveIndex, offset, buffer, n))
+				return false;
+			ctx.update(buffer, n);
+			offset += n;
+			size -= n;
+		}
+		ctx.final(digest);
+		return true;
+	};
+
+	// Data stored in _dir is addressed relative to the end of the tree
+	auto chunkOffset = [this](const vpk2::ArchiveMD5SectionEntry& e) -> std::uint64_t {
+		return e.archive_index == 0x7FFF ? m_dataOffset + e.start_offset : e.start_offset;
+	};
+
+	if(m_hasOtherMD5Section) {
+		auto buffer = std::make_unique<byte[]>(bufferSize);
+		std::uint8_t digest[16];
+		result.tree_ok = hashRange(0x7FFF, m_dataOffset - m_treeSize, m_treeSize, buffer.get(), digest)
+			&& !std::memcmp(digest, m_otherMD5Section.tree_checksum, sizeof(digest));
+		result.section_ok = hashRange(0x7FFF, m_archiveMD5Offset, m_archiveMD5Size, buffer.get(), digest)
+			&& !std::memcmp(digest, m_otherMD5Section.archive_md5_section_checksum, sizeof(digest));
+	}
+
+	std::vector<std::size_t> order;
+	for(std::size_t i = 0; i < entries.size(); i++) {
+		if(!progress.done(i))
+			order.push_back(i);
+	}
+	std::sort(order.begin(), order.end(), [&](auto a, auto b) {
+		return std::make_pair(entries[a].archive_index, entries[a].start_offset) < std::make_pair(entries[b].archive_index, entries[b].start_offset);
+	});
+
+	// Each thread reads a batch of chunks (one per MD5 lane) in physical order and hashes them together.
+	// Unusually large chunks are streamed through a normal MD5 instead of being buffered whole
+	const auto lanes = md5_lanes();
+	constexpr std::uint64_t MAX_BUFFERED_CHUNK = 64 << 20;
+	enum { CHUNK_MISMATCH, CHUNK_UNREADABLE };
+
+	std::atomic<std::size_t> next = 0;
+
+	auto worker = [&]() {
+		std::vector<std::unique_ptr<byte[]>> buffers(lanes);
+		std::vector<std::size_t> bufferSizes(lanes, 0);
+		auto streamBuffer = std::make_unique<byte[]>(bufferSize);
+		std::vector<std::uint8_t> digests(lanes * 16);
+
+		auto complete = [&](std::size_t entry, bool ok, int reason) {
+			const scan_progress::record failure = {static_cast<std::uint32_t>(entry), static_cast<std::uint32_t>(reason), 0, 0};
+			progress.complete(entry, entries[entry].count, ok ? nullptr : &failure);
+		};
+
+		while(true) {
+			const auto first = next.fetch_add(lanes, std::memory_order_relaxed);
+			if(first >= order.size())
+				break;
+			const auto last = std::min(first + lanes, order.size());
+
+			std::vector<md5_job> jobs;
+			std::vector<std::size_t> jobEntries;
+			for(auto i = first; i < last; i++) {
+				const auto& e = entries[order[i]];
+
+				if(e.count > MAX_BUFFERED_CHUNK) {
+					std::uint8_t digest[16];
+					if(!hashRange(e.archive_index, chunkOffset(e), e.count, streamBuffer.get(), digest))
+						complete(order[i], false, CHUNK_UNREADABLE);
+					else
+						complete(order[i], !std::memcmp(digest, e.checksum, sizeof(digest)), CHUNK_MISMATCH);
+					continue;
+				}
+
+				const auto slot = jobs.size();
+				if(bufferSizes[slot] < e.count) {
+					buffers[slot] = std::make_unique<byte[]>(e.count);
+					bufferSizes[slot] = e.count;
+				}
+				limiter.acquire(e.count);
+				if(!read_archive_range(e.archive_index, chunkOffset(e), buffers[slot].get(), e.count)) {
+					complete(order[i], false, CHUNK_UNREADABLE);
+					continue;
+				}
+				jobs.push_back({buffers[slot].get(), e.count, digests.data() + slot * 16});
+				jobEntries.push_back(order[i]);
+			}
+
+			md5_multi(jobs.data(), jobs.size());
+			for(std::size_t j = 0; j < jobs.size(); j++)
+				complete(jobEntries[j], !std::memcmp(jobs[j].digest, entries[jobEntries[j]].checksum, 16), CHUNK_MISMATCH);
+		}
+	};
+
+	const auto batches = (order.size() + lanes - 1) / lanes;
+	const auto threadCount = std::max<std::size_t>(1, std::min<std::size_t>(options.threads ? options.threads : hardware_threads(), batches));
+	std::vector<std::thread> threads;
+	for(std::size_t i = 1; i < threadCount; i++)
+		threads.emplace_back(worker);
+	worker();
+	for(auto& t : threads)
+		t.join();
+
+	result.seconds = progress.finish();
+	result.chunks = progress.done_items();
+	result.bytes = progress.bytes();
+	result.resumed = progress.resumed();
+	for(const auto& r : progress.records())
+		(r.a == CHUNK_UNREADABLE ? result.unreadable_chunks : result.failed_chunks).push_back(r.item);
+	std::sort(result.failed_chunks.begin(), result.failed_chunks.end());
+	std::sort(result.unreadable_chunks.begin(), result.unreadable_chunks.end());
+	return result;
+}
+
+void vpk_archive::set_verify_on_read(bool enable) {
+	if(enable && !m_chunkStates) {
+		m_chunkRefs.clear();
+		m_chunkRefs.reserve(m_archiveSectionEntries.size());
+		for(std::size_t i = 0; i < m_archiveSectionEntries.size(); i++) {
+			const auto& e = m_archiveSectionEntries[i];
+			const std::uint64_t begin = e.archive_index == 0x7FFF ? m_dataOffset + e.start_offset : e.start_offset;
+			m_chunkRefs.push_back({static_cast<std::uint16_t>(e.archive_index), begin, e.count, i});
+		}
+		std::sort(m_chunkRefs.begin(), m_chunkRefs.end(), [](const ChunkRef& a, const ChunkRef& b) {
+			return std::make_pair(a.archive_index, a.begin) < std::make_pair(b.archive_index, b.begin);
+		});
+
+		m_chunkStates = std::make_unique<std::atomic<std::uint8_t>[]>(m_chunkRefs.size());
+		for(std::size_t i = 0; i < m_chunkRefs.size(); i++)
+			m_chunkStates[i].store(CHUNK_UNKNOWN, std::memory_order_relaxed);
+	}
+	m_verifyOnRead.store(enable && !m_chunkRefs.empty(), std::memory_order_relaxed);
+}
+
+int vpk_archive::get_chunk_status(std::size_t entry) const {
+	if(!m_chunkStates || entry >= m_archiveSectionEntries.size())
+		return 0;
+	switch(m_chunkStates[entry].load(std::memory_order_acquire)) {
+		case CHUNK_GOOD: return 1;
+		case CHUNK_BAD: return -1;
+		default: return 0;
+	}
+}
+
+bool vpk_archive::check_chunks(std::int32_t archiveIndex, std::uint64_t offset, std::uint64_t size) {
+	const std::uint64_t end = offset + size;
+
+	// First chunk of this archive that ends after the start of the range
+	auto it = std::partition_point(m_chunkRefs.begin(), m_chunkRefs.end(), [&](const ChunkRef& c) {
+		return c.archive_index < archiveIndex || (c.archive_index == archiveIndex && c.begin + c.count <= offset);
+	});
+
+	std::unique_ptr<byte[]> buffer;
+	std::size_t bufferSize = 0;
+	for(; it != m_chunkRefs.end() && it->archive_index == archiveIndex && it->begin < end; ++it) {
+		auto& state = m_chunkStates[it->entry];
+
+		// Whoever moves the chunk out of UNKNOWN hashes it; everyone else waits for the verdict
+		auto current = state.load(std::memory_order_acquire);
+		if(current == CHUNK_GOOD || current == CHUNK_BAD)
+			m_io.chunk_cache_hits.fetch_add(1, std::memory_order_relaxed);
+		while(current == CHUNK_UNKNOWN || current == CHUNK_HASHING) {
+			if(current == CHUNK_HASHING) {
+				state.wait(CHUNK_HASHING, std::memory_order_acquire);
+				current = state.load(std::memory_order_acquire);
+				continue;
+			}
+			if(!state.compare_exchange_weak(current, CHUNK_HASHING, std::memory_order_acquire))
+				continue;
+
+			if(bufferSize < it->count) {
+				buffer = std::make_unique<byte[]>(it->count);
+				bufferSize = it->count;
+			}
+			std::uint8_t digest[16];
+			if(!read_archive_range(archiveIndex, it->begin, buffer.get(), it->count)) {
+				// Possibly transient, let the next reader try again
+				state.store(CHUNK_UNKNOWN, std::memory_order_release);
+				state.notify_all();
+				return false;
+			}
+			md5::hash(buffer.get(), it->count, digest);
+			m_io.chunk_hashes.fetch_add(1, std::memory_order_relaxed);
+			current = std::memcmp(digest, m_archiveSectionEntries[it->entry].checksum, sizeof(digest)) ? CHUNK_BAD : CHUNK_GOOD;
+			state.store(current, std::memory_order_release);
+			state.notify_all();
+		}
+		if(current == CHUNK_BAD)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,684 @@
+// Archive writer
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vpk_writer.hpp"
+#include "vpk_crc.hpp"
+#include "vpk_md5.hpp"
+#include "vpk_thread.hpp"
+#include "vpk_trace.hpp"
+#include "vpk_tree.hpp"
+#include "vpk_xxhash.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	bool pread_all(int fd, void* buffer, std::size_t size, std::uint64_t offset) {
+		auto p = static_cast<char*>(buffer);
+		while(size > 0) {
+			auto n = pread(fd, p, size, offset);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			p += n;
+			size -= n;
+			offset += n;
+		}
+		return true;
+	}
+
+	bool write_all(int fd, const void* data, std::size_t size) {
+		auto p = static_cast<const char*>(data);
+		while(size > 0) {
+			auto n = ::write(fd, p, size);
+			if(n < 0 && errno == EINTR)
+				continue;
+			if(n <= 0)
+				return false;
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	// A file as it will be laid out in the output
+	struct layout_file
+	{
+		const std::string* name;
+		tree::name_parts parts;
+		std::uint64_t size;
+		const vpk_writer::reader_t* reader;
+
+		std::uint16_t preload = 0;		// Leading bytes stored in the directory instead of the archive
+		std::string preload_data;
+
+		std::uint16_t archive_index = 0;
+		std::uint32_t offset = 0;
+		std::uint32_t crc = 0;
+		std::size_t first_segment = 0;
+		std::size_t segment_count = 0;
+	};
+
+	// The part of a file that falls into one block
+	struct segment
+	{
+		std::size_t file;
+		std::uint64_t file_offset;
+		std::uint32_t block_offset;
+		std::uint32_t size;
+		std::uint32_t crc = 0;
+	};
+
+	// One md5_chunk_size piece of an output archive, the unit the workers fill
+	struct block
+	{
+		std::uint16_t archive_index;
+		std::uint32_t offset;
+		std::uint32_t size;
+		std::size_t first_segment;
+		std::size_t segment_count;
+		std::uint8_t md5[16];
+	};
+
+	// Ring slot handing a block from a worker to the writer. turn is 2*b while the slot is free for
+	// block b, and 2*b+1 once block b is in it
+	struct block_slot
+	{
+		std::unique_ptr<byte[]> data;
+		std::atomic<std::uint64_t> turn;
+	};
+
+	void wait_turn(std::atomic<std::uint64_t>& turn, std::uint64_t want) {
+		auto current = turn.load(std::memory_order_acquire);
+		while(current != want) {
+			turn.wait(current, std::memory_order_acquire);
+			current = turn.load(std::memory_order_acquire);
+		}
+	}
+
+	std::string archive_path(const std::string& base, std::uint32_t index) {
+		char num[16] = {};
+		snprintf(num, sizeof(num), "_%03u.vpk", index);
+		return base + num;
+	}
+
+	// Removes <base>_NNN.vpk archives from an earlier pack that the new _dir.vpk no longer references
+	void remove_stale_archives(const std::string& base, std::uint32_t archiveCount) {
+		const std::filesystem::path basePath(base);
+		const auto prefix = basePath.filename().string() + "_";
+		auto parent = basePath.parent_path();
+		if(parent.empty())
+			parent = ".";
+
+		std::error_code ec;
+		for(const auto& entry : std::filesystem::directory_iterator(parent, ec)) {
+			const auto name = entry.path().filename().string();
+			if(name.size() < prefix.size() + 7 || !name.starts_with(prefix) || !name.ends_with(".vpk"))
+				continue;
+			const auto digits = name.substr(prefix.size(), name.size() - prefix.size() - 4);
+			if(digits.size() < 3 || digits.find_first_not_of("0123456789") != std::string::npos)
+				continue;
+			if(std::strtoul(digits.c_str(), nullptr, 10) >= archiveCount)
+				unlink(entry.path().c_str());
+		}
+	}
+
+	constexpr std::size_t DEDUP_BUFFER = 1 << 20;
+
+	// Bytes a loader reads first for formats that always start by probing their header
+	const std::unordered_map<std::string_view, std::uint32_t> PROBE_HEADERS = {
+		{"vtf", 80},	// VTFFileHeader (7.2)
+		{"mdl", 408},	// studiohdr_t
+		{"vvd", 64},	// vertexFileHeader_t
+		{"vtx", 36},	// OptimizedModel::FileHeader_t
+		{"phy", 16},	// phyheader_t
+		{"wav", 44},	// RIFF/WAVE with a plain fmt chunk
+		{"bsp", 1036},	// dheader_t with the lump directory
+	};
+
+	// Chooses preload sizes, spending at most budget bytes in total. Every stored copy of an entry carries its
+	// own preload data, so duplicates share their original's choice and cost accordingly
+	void choose_preload(std::vector<layout_file>& files, const std::vector<std::size_t>& canonical,
+		const std::vector<std::pair<std::string, std::uint64_t>>& hints, const vpk_writer_options& options) {
+		const std::uint64_t maxPreload = std::min<std::uint32_t>(options.preload_max_file, 0xFFFF);
+		std::vector<std::uint32_t> copies(files.size(), 0);
+		for(auto c : canonical)
+			copies[c]++;
+
+		std::uint64_t left = options.preload_budget;
+		auto take = [&](std::size_t i, std::uint64_t want) {
+			auto& f = files[canonical[i]];
+			want = std::min({want, f.size, maxPreload});
+			if(f.preload || !want)
+				return;
+			const auto cost = want * copies[canonical[i]];
+			if(cost > left)
+				return;
+			f.preload = static_cast<std::uint16_t>(want);
+			left -= cost;
+		};
+
+		if(!hints.empty()) {
+			std::unordered_map<std::string_view, std::size_t> byName;
+			for(std::size_t i = 0; i < files.size(); i++)
+				byName[*files[i].name] = i;
+			for(const auto& [name, bytes] : hints) {
+				auto it = byName.find(name);
+				if(it != byName.end())
+					take(it->second, bytes);
+			}
+		}
+
+		// Whole small files: a read of one never has to leave the directory
+		std::vector<std::size_t> small;
+		for(std::size_t i = 0; i < files.size(); i++) {
+			if(files[i].size && files[i].size <= maxPreload)
+				small.push_back(i);
+		}
+		std::stable_sort(small.begin(), small.end(), [&](std::size_t a, std::size_t b) { return files[a].size < files[b].size; });
+		for(auto i : small)
+			take(i, files[i].size);
+
+		if(options.preload_headers) {
+			for(std::size_t i = 0; i < files.size(); i++) {
+				auto it = PROBE_HEADERS.find(files[i].parts.extension);
+				if(it != PROBE_HEADERS.end())
+					take(i, it->second);
+			}
+		}
+	}
+
+	// Sets canonical[i] to the first file (in tree order) with the same contents as file i
+	bool find_duplicates(const std::vector<layout_file>& files, std::vector<std::size_t>& canonical, unsigned threads, std::string& error) {
+		std::mutex errorLock;
+		auto setError = [&](const std::string& name) {
+			std::lock_guard<std::mutex> lock(errorLock);
+			if(error.empty())
+				error = "failed to read '" + name + "'";
+		};
+
+		// Only files that share their size with another one can be duplicates
+		std::unordered_map<std::uint64_t, std::size_t> sizeCounts;
+		for(const auto& f : files) {
+			if(f.size)
+				sizeCounts[f.size]++;
+		}
+		std::vector<std::size_t> candidates;
+		for(std::size_t i = 0; i < files.size(); i++) {
+			if(files[i].size && sizeCounts[files[i].size] > 1)
+				candidates.push_back(i);
+		}
+
+		std::vector<std::uint64_t> hashes(files.size());
+		parallel_for(candidates.size(), [&](std::size_t c) {
+			const auto& f = files[candidates[c]];
+			auto buffer = std::make_unique<byte[]>(std::min<std::uint64_t>(f.size, DEDUP_BUFFER));
+			xxh64 state;
+			for(std::uint64_t offset = 0; offset < f.size;) {
+				auto n = static_cast<std::size_t>(std::min<std::uint64_t>(f.size - offset, DEDUP_BUFFER));
+				if(!(*f.reader)(offset, buffer.get(), n)) {
+					setError(*f.name);
+					return;
+				}
+				state.update(buffer.get(), n);
+				offset += n;
+			}
+			hashes[candidates[c]] = state.digest();
+		}, threads, 1);
+		if(!error.empty())
+			return false;
+
+		// Runs of equal (size, hash) in tree order
+		std::sort(candidates.begin(), candidates.end(), [&](std::size_t a, std::size_t b) {
+			return std::tie(files[a].size, hashes[a], a) < std::tie(files[b].size, hashes[b], b);
+		});
+		std::vector<std::pair<std::size_t, std::size_t>> groups;
+		for(std::size_t i = 0; i < candidates.size();) {
+			auto j = i + 1;
+			while(j < candidates.size() && files[candidates[j]].size == files[candidates[i]].size && hashes[candidates[j]] == hashes[candidates[i]])
+				j++;
+			if(j - i > 1)
+				groups.push_back({i, j - i});
+			i = j;
+		}
+
+		// Confirm byte by byte, a hash collision just starts another set of copies
+		auto same = [&](std::size_t a, std::size_t b, byte* bufA, byte* bufB) {
+			const auto size = files[a].size;
+			for(std::uint64_t offset = 0; offset < size;) {
+				auto n = static_cast<std::size_t>(std::min<std::uint64_t>(size - offset, DEDUP_BUFFER));
+				if(!(*files[a].reader)(offset, bufA, n)) {
+					setError(*files[a].name);
+					return false;
+				}
+				if(!(*files[b].reader)(offset, bufB, n)) {
+					setError(*files[b].name);
+					return false;
+				}
+				if(std::memcmp(bufA, bufB, n))
+					return false;
+				offset += n;
+			}
+			return true;
+		};
+
+		parallel_for(groups.size(), [&](std::size_t g) {
+			const auto [first, count] = groups[g];
+			const auto bufferSize = std::min<std::uint64_t>(files[candidates[first]].size, DEDUP_BUFFER);
+			auto bufA = std::make_unique<byte[]>(bufferSize);
+			auto bufB = std::make_unique<byte[]>(bufferSize);
+
+			std::vector<std::size_t> originals = {candidates[first]};
+			for(auto i = first + 1; i < first + count; i++) {
+				const auto file = candidates[i];
+				auto it = std::find_if(originals.begin(), originals.end(), [&](std::size_t o) { return same(o, file, bufA.get(), bufB.get()); });
+				if(it != originals.end())
+					canonical[file] = *it;
+				else
+					originals.push_back(file);
+			}
+		}, threads, 1);
+		return error.empty();
+	}
+
+}
+
+//---------------------------------------------------------------------------//
+
+bool vpk_writer::add(const std::string& name, std::uint64_t size, reader_t reader, std::string* error) {
+	tree::name_parts parts;
+	if(!tree::split_name(name, parts, error))
+		return false;
+	if(size > 0xFFFFFFFFull) {
+		if(error)
+			*error = "'" + name + "': files must be smaller than 4 GiB";
+		return false;
+	}
+
+	m_entries[tree::join_name(parts)] = Entry{size, std::move(reader)};
+	return true;
+}
+
+bool vpk_writer::add_file(const std::string& name, const std::filesystem::path& source, std::string* error) {
+	std::error_code ec;
+	auto size = std::filesystem::file_size(source, ec);
+	if(ec) {
+		if(error)
+			*error = "'" + source.string() + "': " + ec.message();
+		return false;
+	}
+
+	auto reader = [path = source.string()](std::uint64_t offset, void* buffer, std::size_t size) {
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fd < 0)
+			return false;
+		bool ok = pread_all(fd, buffer, size, offset);
+		close(fd);
+		return ok;
+	};
+	return add(name, size, std::move(reader), error);
+}
+
+bool vpk_writer::add_data(const std::string& name, const void* data, std::size_t size, std::string* error) {
+	auto copy = std::make_shared<std::vector<byte>>(static_cast<const byte*>(data), static_cast<const byte*>(data) + size);
+	auto reader = [copy](std::uint64_t offset, void* buffer, std::size_t size) {
+		if(offset + size > copy->size())
+			return false;
+		std::memcpy(buffer, copy->data() + offset, size);
+		return true;
+	};
+	return add(name, size, std::move(reader), error);
+}
+
+bool vpk_writer::add_preload_trace(const std::filesystem::path& path, std::string* error) {
+	std::vector<vpk_trace_entry> reads;
+	if(!read_trace(path, reads, error))
+		return false;
+
+	// How far reads from the start of each file reached, in first access order
+	std::unordered_map<std::string, std::size_t> index;
+	for(const auto& r : reads) {
+		auto [it, inserted] = index.insert({r.name, m_preloadHints.size()});
+		if(inserted)
+			m_preloadHints.push_back({r.name, 0});
+		auto& covered = m_preloadHints[it->second].second;
+		if(r.offset <= covered)
+			covered = std::max(covered, r.offset + r.length);
+	}
+	return true;
+}
+
+bool vpk_writer::add_directory(const std::filesystem::path& root, std::string* error) {
+	std::error_code ec;
+	std::filesystem::recursive_directory_iterator it(root, ec), end;
+	for(; !ec && it != end; it.increment(ec)) {
+		if(!it->is_regular_file())
+			continue;
+		auto name = std::filesystem::relative(it->path(), root, ec).generic_string();
+		if(ec)
+			break;
+		if(!add_file(name, it->path(), error))
+			return false;
+	}
+	if(ec) {
+		if(error)
+			*error = "'" + root.string() + "': " + ec.message();
+		return false;
+	}
+	return true;
+}
+
+vpk_writer_result vpk_writer::write(const std::filesystem::path& dirPath) {
+	const auto start = std::chrono::steady_clock::now();
+
+	vpk_writer_result result;
+	auto fail = [&](std::string error) {
+		result.ok = false;
+		result.error = std::move(error);
+		return result;
+	};
+
+	if(m_options.version != 1 && m_options.version != 2)
+		return fail("unsupported VPK version " + std::to_string(m_options.version));
+
+	auto base = dirPath.string();
+	const auto suffix = base.rfind("_dir.vpk");
+	if(suffix == std::string::npos || suffix + 8 != base.size())
+		return fail("output name must end in _dir.vpk");
+	base.erase(suffix);
+
+	std::error_code ec;
+	if(dirPath.has_parent_path())
+		std::filesystem::create_directories(dirPath.parent_path(), ec);
+	if(ec)
+		return fail("failed to create '" + dirPath.parent_path().string() + "': " + ec.message());
+
+	const std::uint64_t maxArchive = std::clamp<std::uint64_t>(m_options.max_archive_size, 1, 0xFFFFFFFFull);
+	const std::uint32_t chunkSize = std::max<std::uint32_t>(m_options.md5_chunk_size, 4096);
+
+	// Tree order: extension, then directory, then file name
+	std::vector<layout_file> files;
+	files.reserve(m_entries.size());
+	for(const auto& [name, entry] : m_entries) {
+		layout_file f;
+		f.name = &name;
+		tree::split_name(name, f.parts);
+		f.size = entry.size;
+		f.reader = &entry.reader;
+		files.push_back(std::move(f));
+	}
+	std::sort(files.begin(), files.end(), [](const layout_file& a, const layout_file& b) { return a.parts < b.parts; });
+
+	std::vector<std::size_t> canonical(files.size());
+	for(std::size_t i = 0; i < files.size(); i++)
+		canonical[i] = i;
+	if(m_options.deduplicate) {
+		const auto dedupStart = std::chrono::steady_clock::now();
+		std::string error;
+		if(!find_duplicates(files, canonical, m_options.threads, error))
+			return fail(error);
+		for(std::size_t i = 0; i < files.size(); i++) {
+			if(canonical[i] != i) {
+				result.duplicate_files++;
+				result.duplicate_bytes += files[i].size;
+			}
+		}
+		result.dedup_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - dedupStart).count();
+	}
+
+	if(m_options.preload_budget) {
+		choose_preload(files, canonical, m_preloadHints, m_options);
+
+		std::atomic<bool> readFailed = false;
+		parallel_for(files.size(), [&](std::size_t i) {
+			auto& f = files[i];
+			if(!f.preload || canonical[i] != i)
+				return;
+			f.preload_data.resize(f.preload);
+			if(!(*f.reader)(0, f.preload_data.data(), f.preload))
+				readFailed.store(true, std::memory_order_relaxed);
+		}, m_options.threads);
+		if(readFailed)
+			return fail("failed to read preload data");
+
+		for(std::size_t i = 0; i < files.size(); i++) {
+			files[i].preload = files[canonical[i]].preload;
+			if(files[i].preload) {
+				result.preload_files++;
+				result.preload_bytes += files[i].preload;
+				if(files[i].preload == files[i].size)
+					result.preload_whole++;
+			}
+		}
+	}
+
+	// Lay the data out back to back, starting a new archive when the current one would overflow.
+	// Duplicates take no space, they are pointed at their original afterwards
+	std::uint32_t archiveIndex = 0;
+	std::uint64_t used = 0;
+	for(std::size_t i = 0; i < files.size(); i++) {
+		auto& f = files[i];
+		if(canonical[i] != i)
+			continue;
+		const auto dataSize = f.size - f.preload;
+		if(dataSize && used && used + dataSize > maxArchive) {
+			archiveIndex++;
+			used = 0;
+		}
+		if(archiveIndex >= 0x7FFF)
+			return fail("too many archives, raise the maximum archive size");
+		f.archive_index = archiveIndex;
+		f.offset = static_cast<std::uint32_t>(used);
+		used += dataSize;
+	}
+	const std::uint32_t archiveCount = used ? archiveIndex + 1 : archiveIndex;
+
+	// Cut the archives into blocks and the files into the segments that fall in each block
+	std::vector<segment> segments;
+	std::vector<block> blocks;
+	for(std::size_t i = 0; i < files.size(); i++) {
+		auto& f = files[i];
+		if(canonical[i] != i)
+			continue;
+		f.first_segment = segments.size();
+		const auto dataSize = f.size - f.preload;
+		for(std::uint64_t done = 0; done < dataSize;) {
+			const std::uint64_t archiveOffset = f.offset + done;
+			const auto blockOffset = static_cast<std::uint32_t>(archiveOffset % chunkSize);
+			const auto n = static_cast<std::uint32_t>(std::min<std::uint64_t>(dataSize - done, chunkSize - blockOffset));
+
+			if(blocks.empty() || blocks.back().archive_index != f.archive_index || blocks.back().offset != archiveOffset - blockOffset) {
+				block b = {};
+				b.archive_index = f.archive_index;
+				b.offset = static_cast<std::uint32_t>(archiveOffset - blockOffset);
+				b.first_segment = segments.size();
+				blocks.push_back(b);
+			}
+			blocks.back().size = blockOffset + n;
+			blocks.back().segment_count++;
+			segments.push_back({i, f.preload + done, blockOffset, n});
+			done += n;
+		}
+		f.segment_count = segments.size() - f.first_segment;
+	}
+
+	// Workers fill blocks from the sources, checksumming as they go. The writer appends them in order
+	const auto slotCount = std::max<std::size_t>(m_options.buffer_count, 2);
+	auto slots = std::make_unique<block_slot[]>(slotCount);
+	for(std::size_t i = 0; i < slotCount; i++) {
+		slots[i].data = std::make_unique<byte[]>(chunkSize);
+		slots[i].turn.store(2 * i, std::memory_order_relaxed);
+	}
+
+	std::atomic<std::size_t> next = 0;
+	std::atomic<bool> failed = false;
+	std::mutex errorLock;
+	std::string firstError;
+	auto setError = [&](std::string error) {
+		std::lock_guard<std::mutex> lock(errorLock);
+		if(firstError.empty())
+			firstError = std::move(error);
+		failed.store(true, std::memory_order_relaxed);
+	};
+
+	auto worker = [&]() {
+		while(true) {
+			const auto b = next.fetch_add(1, std::memory_order_relaxed);
+			if(b >= blocks.size())
+				break;
+			auto& slot = slots[b % slotCount];
+			wait_turn(slot.turn, 2 * b);
+
+			// After a failure, blocks are still passed along so nobody waits forever, just not filled
+			auto& blk = blocks[b];
+			if(!failed.load(std::memory_order_relaxed)) {
+				for(std::size_t s = blk.first_segment; s < blk.first_segment + blk.segment_count; s++) {
+					auto& seg = segments[s];
+					auto data = slot.data.get() + seg.block_offset;
+					if(!(*files[seg.file].reader)(seg.file_offset, data, seg.size)) {
+						setError("failed to read '" + *files[seg.file].name + "'");
+						break;
+					}
+					seg.crc = crc32(data, seg.size);
+				}
+				if(m_options.version == 2)
+					md5::hash(slot.data.get(), blk.size, blk.md5);
+			}
+
+			slot.turn.store(2 * b + 1, std::memory_order_release);
+			slot.turn.notify_all();
+		}
+	};
+
+	const auto workerCount = std::max<std::size_t>(1, std::min<std::size_t>(m_options.threads ? m_options.threads : hardware_threads(), blocks.size()));
+	std::vector<std::thread> workers;
+	for(std::size_t i = 0; i < workerCount; i++)
+		workers.emplace_back(worker);
+
+	// Archives are written under temporary names and only renamed once all of them are complete
+	std::vector<std::string> written;
+	int fd = -1;
+	std::int64_t fdArchive = -1;
+	auto openArchive = [&](std::uint32_t index) {
+		if(fd >= 0 && (fsync(fd) != 0 || close(fd) != 0))
+			setError("failed to write '" + archive_path(base, fdArchive) + "'");
+		fd = open((archive_path(base, index) + ".tmp").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		fdArchive = index;
+		if(fd < 0)
+			setError("failed to create '" + archive_path(base, index) + "': " + strerror(errno));
+		else
+			written.push_back(archive_path(base, index));
+	};
+
+	for(std::size_t b = 0; b < blocks.size(); b++) {
+		auto& slot = slots[b % slotCount];
+		wait_turn(slot.turn, 2 * b + 1);
+
+		if(!failed.load(std::memory_order_relaxed)) {
+			if(blocks[b].archive_index != fdArchive)
+				openArchive(blocks[b].archive_index);
+			if(fd >= 0 && !write_all(fd, slot.data.get(), blocks[b].size))
+				setError("failed to write '" + archive_path(base, fdArchive) + "': " + strerror(errno));
+			result.bytes += blocks[b].size;
+		}
+
+		slot.turn.store(2 * (b + slotCount), std::memory_order_release);
+		slot.turn.notify_all();
+	}
+	for(auto& t : workers)
+		t.join();
+	if(fd >= 0 && (fsync(fd) != 0 || close(fd) != 0))
+		setError("failed to write '" + archive_path(base, fdArchive) + "'");
+
+	auto cleanup = [&]() {
+		for(const auto& path : written)
+			unlink((path + ".tmp").c_str());
+	};
+	if(failed) {
+		cleanup();
+		return fail(firstError);
+	}
+
+	// File CRCs are stitched together from the preload data and the segments
+	for(auto& f : files) {
+		std::uint32_t crc = f.preload_data.empty() ? 0 : crc32(f.preload_data.data(), f.preload_data.size());
+		for(std::size_t s = f.first_segment; s < f.first_segment + f.segment_count; s++)
+			crc = crc32_combine(crc, segments[s].crc, segments[s].size);
+		f.crc = crc;
+	}
+	for(std::size_t i = 0; i < files.size(); i++) {
+		const auto& original = files[canonical[i]];
+		files[i].archive_index = original.archive_index;
+		files[i].offset = original.offset;
+		files[i].crc = original.crc;
+	}
+
+	std::vector<tree::node> nodes;
+	nodes.reserve(files.size());
+	for(std::size_t i = 0; i < files.size(); i++) {
+		const auto& f = files[i];
+		tree::node n = {&f.parts, {}, files[canonical[i]].preload_data.data()};
+		n.entry.crc = f.crc;
+		n.entry.preload_bytes = f.preload;
+		n.entry.archive_index = f.archive_index;
+		n.entry.entry_offset = f.offset;
+		n.entry.entry_length = static_cast<std::uint32_t>(f.size - f.preload);
+		nodes.push_back(n);
+	}
+
+	std::string md5Section;
+	if(m_options.version == 2) {
+		for(const auto& blk : blocks) {
+			vpk2::ArchiveMD5SectionEntry entry = {};
+			entry.archive_index = blk.archive_index;
+			entry.start_offset = blk.offset;
+			entry.count = blk.size;
+			std::memcpy(entry.checksum, blk.md5, sizeof(entry.checksum));
+			md5Section.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		}
+	}
+	const auto dir = tree::build_dir(m_options.version, tree::serialize(nodes), {}, md5Section);
+
+	const auto dirTmp = dirPath.string() + ".tmp";
+	fd = open(dirTmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	bool ok = fd >= 0 && write_all(fd, dir.data(), dir.size()) && fsync(fd) == 0;
+	ok = fd >= 0 && close(fd) == 0 && ok;
+	if(!ok) {
+		unlink(dirTmp.c_str());
+		cleanup();
+		return fail("failed to write '" + dirPath.string() + "'");
+	}
+
+	// Data first, so the new _dir.vpk never points at archives that aren't there yet
+	for(const auto& path : written) {
+		if(rename((path + ".tmp").c_str(), path.c_str()) != 0) {
+			unlink(dirTmp.c_str());
+			cleanup();
+			return fail("failed to rename '" + path + "': " + strerror(errno));
+		}
+	}
+	if(rename(dirTmp.c_str(), dirPath.c_str()) != 0) {
+		unlink(dirTmp.c_str());
+		return fail("failed to rename '" + dirPath.string() + "': " + strerror(errno));
+	}
+	remove_stale_archives(base, archiveCount);
+
+	result.ok = true;
+	result.files = files.size();
+	result.archives = archiveCount;
+	result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return result;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "vpk.hpp"
+
+namespace vpklib
+{
+	struct vpk_writer_options
+	{
+		std::uint32_t version = 2;						// 1 or 2
+		std::uint64_t max_archive_size = 200 << 20;		// Largest _NNN.vpk to produce. Bigger files get an archive of their own
+		std::uint32_t md5_chunk_size = 1 << 20;			// Granularity of the VPK2 archive MD5 section, also the unit of work
+		unsigned threads = 0;							// 0 for all cores
+		std::size_t buffer_count = 16;					// Chunks in flight between the workers and the writer
+		bool deduplicate = true;						// Store byte-identical files once
+
+		std::uint64_t preload_budget = 0;				// Total preload bytes to store in the directory, 0 for none
+		std::uint32_t preload_max_file = 1024;			// Most preload bytes for one file (at most 65535)
+		bool preload_headers = true;					// Consider the headers of formats that are always probed first
+	};
+
+	struct vpk_writer_result
+	{
+		bool ok = false;
+		std::string error;			// Set when !ok
+		std::uint64_t files = 0;
+		std::uint64_t bytes = 0;	// File data written to the _NNN archives
+		std::uint32_t archives = 0;	// Number of _NNN archives
+		double seconds = 0;
+
+		std::uint64_t duplicate_files = 0;	// Files stored as references to an identical file
+		std::uint64_t duplicate_bytes = 0;	// Data those files would have taken
+		double dedup_seconds = 0;			// Part of seconds spent finding duplicates
+
+		std::uint64_t preload_files = 0;	// Files with preload data
+		std::uint64_t preload_bytes = 0;	// Preload data stored in the directory, at most preload_budget
+		std::uint64_t preload_whole = 0;	// Files entirely in the directory, which never touch the archives
+	};
+
+	/**
+	 * @brief Packs files into a new VPK1/VPK2 archive set (name_dir.vpk plus name_NNN.vpk).
+	 *
+	 * Files are laid out up front, then the data is assembled in md5_chunk_size pieces of the output
+	 * archives. Worker threads fill the pieces from the sources and compute the CRC32s and archive MD5s,
+	 * while a single writer appends the finished pieces to the archives in order. The _dir.vpk is written
+	 * last, to a temporary name that is renamed into place once everything else is on disk.
+	 *
+	 * With deduplicate set, files of equal size are hashed (XXH64) and equal hashes confirmed byte by byte
+	 * before layout. Each duplicate's directory entry then points at the data of the first identical file.
+	 *
+	 * With a preload budget, the first bytes of some files are stored inline in the directory as preload data,
+	 * so reading them doesn't touch the _NNN archives. Candidates are picked in this order until the budget
+	 * runs out: files read in an access trace (see add_preload_trace), in first access order; files no bigger
+	 * than preload_max_file, smallest first; then the headers of formats that are always probed first.
+	 */
+	class vpk_writer
+	{
+	public:
+		/**
+		 * @brief Reads size bytes of a source at offset into buffer. Called concurrently with different ranges
+		 */
+		using reader_t = std::function<bool(std::uint64_t offset, void* buffer, std::size_t size)>;
+
+		vpk_writer() = default;
+		explicit vpk_writer(const vpk_writer_options& options) : m_options(options) {};
+
+		/**
+		 * @brief Adds a file, replacing any earlier one with the same name
+		 * @param name Path inside the archive, ex: materials/foo/bar.vtf
+		 * @param size Size of the data in bytes
+		 * @param reader Source of the data
+		 * @param error If not null, receives a description of the problem on failure
+		 * @return bool False if the name can't be stored in a VPK
+		 */
+		bool add(const std::string& name, std::uint64_t size, reader_t reader, std::string* error = nullptr);
+
+		/**
+		 * @brief Adds a file from disk. The file is read during write()
+		 */
+		bool add_file(const std::string& name, const std::filesystem::path& source, std::string* error = nullptr);
+
+		/**
+		 * @brief Adds a file from memory. The data is copied
+		 */
+		bool add_data(const std::string& name, const void* data, std::size_t size, std::string* error = nullptr);
+
+		/**
+		 * @brief Adds every regular file below a directory, named by their path relative to it
+		 * @param root Directory to pack
+		 * @param error If not null, receives a description of the problem on failure
+		 * @return bool False if the directory can't be walked or a name is invalid
+		 */
+		bool add_directory(const std::filesystem::path& root, std::string* error = nullptr);
+
+		/**
+		 * @brief Uses an access trace to prioritize preload data. Each traced file gets as many leading bytes
+		 * as the reads from its start covered, up to preload_max_file. Only used with a preload budget
+		 * @param path Trace written by vpk_archive::write_trace
+		 * @param error If not null, receives a description of the problem on failure
+		 * @return bool False if the trace can't be read
+		 */
+		bool add_preload_trace(const std::filesystem::path& path, std::string* error = nullptr);
+
+		/**
+		 * @brief Returns the number of files added so far
+		 */
+		std::size_t get_file_count() const { return m_entries.size(); };
+
+		/**
+		 * @brief Writes the archive set
+		 * @param dirPath Path of the _dir.vpk to create, ex: out/pak01_dir.vpk
+		 * @return vpk_writer_result
+		 */
+		vpk_writer_result write(const std::filesystem::path& dirPath);
+
+	private:
+		struct Entry
+		{
+			std::uint64_t size;
+			reader_t reader;
+		};
+
+		vpk_writer_options m_options;
+		std::map<std::string, Entry> m_entries;
+		std::vector<std::pair<std::string, std::uint64_t>> m_preloadHints; // Name and bytes wanted, in trace order
+	};
+}
@@ -0,0 +1,123 @@
+// XXH64, after the reference implementation by Yann Collet
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include "vpk_xxhash.hpp"
+
+using namespace vpklib;
+
+namespace {
+
+	constexpr std::uint64_t P1 = 0x9E3779B185EBCA87ull;
+	constexpr std::uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+	constexpr std::uint64_t P3 = 0x165667B19E3779F9ull;
+	constexpr std::uint64_t P4 = 0x85EBCA77C2B2AE63ull;
+	constexpr std::uint64_t P5 = 0x27D4EB2F165667C5ull;
+
+	inline std::uint64_t load64(const std::uint8_t* p) {
+		std::uint64_t v = 0;
+		for(int i = 0; i < 8; i++)
+			v |= static_cast<std::uint64_t>(p[i]) << (8 * i);
+		return v;
+	}
+
+	inline std::uint32_t load32(const std::uint8_t* p) {
+		return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+	}
+
+	inline std::uint64_t round(std::uint64_t acc, std::uint64_t input) {
+		acc += input * P2;
+		acc = std::rotl(acc, 31);
+		return acc * P1;
+	}
+
+	inline std::uint64_t merge(std::uint64_t acc, std::uint64_t v) {
+		acc ^= round(0, v);
+		return acc * P1 + P4;
+	}
+
+	// Consumes whole 32 byte stripes, returns how many bytes were used
+	std::size_t stripes(std::uint64_t acc[4], const std::uint8_t* p, std::size_t size) {
+		std::size_t done = 0;
+		for(; done + 32 <= size; done += 32) {
+			acc[0] = round(acc[0], load64(p + done));
+			acc[1] = round(acc[1], load64(p + done + 8));
+			acc[2] = round(acc[2], load64(p + done + 16));
+			acc[3] = round(acc[3], load64(p + done + 24));
+		}
+		return done;
+	}
+
+}
+
+xxh64::xxh64(std::uint64_t seed) : m_seed(seed) {
+	m_acc[0] = seed + P1 + P2;
+	m_acc[1] = seed + P2;
+	m_acc[2] = seed;
+	m_acc[3] = seed - P1;
+}
+
+void xxh64::update(const void* data, std::size_t size) {
+	auto p = static_cast<const std::uint8_t*>(data);
+	m_length += size;
+
+	if(m_used) {
+		auto n = std::min(size, sizeof(m_buffer) - m_used);
+		std::memcpy(m_buffer + m_used, p, n);
+		m_used += n;
+		p += n;
+		size -= n;
+		if(m_used < sizeof(m_buffer))
+			return;
+		stripes(m_acc, m_buffer, sizeof(m_buffer));
+		m_used = 0;
+	}
+
+	auto done = stripes(m_acc, p, size);
+	std::memcpy(m_buffer, p + done, size - done);
+	m_used = size - done;
+}
+
+std::uint64_t xxh64::digest() const {
+	std::uint64_t h;
+	if(m_length >= 32) {
+		h = std::rotl(m_acc[0], 1) + std::rotl(m_acc[1], 7) + std::rotl(m_acc[2], 12) + std::rotl(m_acc[3], 18);
+		for(int i = 0; i < 4; i++)
+			h = merge(h, m_acc[i]);
+	}
+	else
+		h = m_seed + P5;
+	h += m_length;
+
+	// Tail of up to 31 bytes
+	const std::uint8_t* p = m_buffer;
+	std::size_t left = m_used;
+	for(; left >= 8; p += 8, left -= 8) {
+		h ^= round(0, load64(p));
+		h = std::rotl(h, 27) * P1 + P4;
+	}
+	if(left >= 4) {
+		h ^= static_cast<std::uint64_t>(load32(p)) * P1;
+		h = std::rotl(h, 23) * P2 + P3;
+		p += 4;
+		left -= 4;
+	}
+	for(; left; p++, left--) {
+		h ^= *p * P5;
+		h = std::rotl(h, 11) * P1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+std::uint64_t xxh64::hash(const void* data, std::size_t size, std::uint64_t seed) {
+	xxh64 state(seed);
+	state.update(data, size);
+	return state.digest();
+}
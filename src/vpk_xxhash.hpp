@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vpklib
+{
+	/**
+	 * @brief Incremental XXH64, a fast non-cryptographic hash. Output matches the reference implementation
+	 */
+	class xxh64
+	{
+	private:
+		std::uint64_t m_acc[4];
+		std::uint64_t m_seed;
+		std::uint64_t m_length = 0;
+		std::uint8_t m_buffer[32];
+		std::size_t m_used = 0;
+
+	public:
+		explicit xxh64(std::uint64_t seed = 0);
+
+		void update(const void* data, std::size_t size);
+
+		/**
+		 * @brief Returns the hash of everything passed to update() so far
+		 */
+		std::uint64_t digest() const;
+
+		/**
+		 * @brief Hashes a single buffer
+		 */
+		static std::uint64_t hash(const void* data, std::size_t size, std::uint64_t seed = 0);
+	};
+}
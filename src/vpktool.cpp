@@ -1,20 +1,260 @@
 
 #include <iostream>
 #include <chrono>
-#include <regex>
+#include <algorithm>
 #include <glob.h>
 #include <fstream>
 #include <iostream>
 #include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+#include <cstring>
+#include <cerrno>
+#include <mutex>
+#include <semaphore>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
 #include "vpk.hpp"
+#include "vpk_thread.hpp"
+#include "vpk_pipeline.hpp"
+#include "vpk_match.hpp"
+#include "vpk_query.hpp"
+#include "vpk_crc.hpp"
+#include "vpk_md5.hpp"
+#include "vpk_writer.hpp"
+#include "vpk_diff.hpp"
+#include "vpk_patch.hpp"
 
 #include "argparse.hpp"
 
-static bool vpk_process(const std::string& archivePath, argparse::ArgumentParser& parser);
-static void vpk_list(vpklib::vpk_archive* archive, bool details);
+class tar_writer;
+
+static bool vpk_process(const std::string& archivePath, argparse::ArgumentParser& parser, tar_writer* tar);
+static void vpk_list(vpklib::vpk_archive* archive, bool details, const vpklib::vpk_query* query);
 static void vpk_info(vpklib::vpk_archive* archive);
-static bool vpk_extract(vpklib::vpk_archive* archive, argparse::ArgumentParser& parser);
+static bool vpk_extract(vpklib::vpk_archive* archive, argparse::ArgumentParser& parser, const vpklib::vpk_query* query, tar_writer* tar, FILE* out, FILE* err);
+static std::unique_ptr<vpklib::vpk_query> parse_query(const std::string& text);
+static bool vpk_verify(vpklib::vpk_archive* archive, const vpklib::vpk_query* query, const vpklib::vpk_verify_options& options);
+static bool vpk_verify_md5(vpklib::vpk_archive* archive, const vpklib::vpk_verify_options& options);
+static bool verify_options(argparse::ArgumentParser& parser, vpklib::vpk_archive* archive, const char* scan, vpklib::vpk_verify_options& options);
+static bool parse_size(const std::string& text, std::uint64_t& out);
+static bool vpk_update(vpklib::vpk_archive* archive, argparse::ArgumentParser& parser);
+static bool vpk_pack(const std::string& source, const std::string& archivePath, argparse::ArgumentParser& parser);
+static bool vpk_compact(vpklib::vpk_archive* archive, argparse::ArgumentParser& parser);
+static bool vpk_diff(const std::string& oldPath, const std::string& newPath, argparse::ArgumentParser& parser);
+static bool vpk_make_patch(const std::string& patchPath, const std::string& oldPath, const std::string& newPath);
+static bool vpk_apply_patch(const std::string& patchPath, const std::string& archivePath);
+static bool changed_since(vpklib::vpk_archive* archive, const std::string& sincePath, std::vector<vpklib::vpk_file_handle>& out, FILE* log);
+static bool vpk_extract_tar(vpklib::vpk_archive* archive, std::vector<vpklib::vpk_file_handle>& selected, tar_writer* tar, FILE* err);
+static bool write_all(int fd, const void* data, std::size_t size);
+static bool vpk_process_all(const std::vector<std::string>& archives, argparse::ArgumentParser& parser, unsigned jobs);
+static bool extract_dirs_overlap(const std::vector<std::string>& archives, argparse::ArgumentParser& parser);
+static void vpk_stats(const vpklib::vpk_archive* archive, const std::string& archivePath, FILE* out);
+
+// Where everything below main prints. Workers processing several archives at once point these at buffers of their own
+static thread_local FILE* g_out = stdout;
+static thread_local FILE* g_err = stderr;
+
+// Caps how many archives are opened, verified, extracted or rewritten at the same time. Unset when there's only one worker
+static std::unique_ptr<std::counting_semaphore<>> g_ioSlots;
+// Threads for each archive's own parallel work, split between the --jobs workers. 0 for all cores
+static unsigned g_archiveThreads = 0;
+// --stats: print each archive's I/O counters once it's done with
+static bool g_stats = false;
+
+// Holds one of the I/O slots for its lifetime
+struct io_slot
+{
+	io_slot() { if(g_ioSlots) g_ioSlots->acquire(); }
+	~io_slot() { if(g_ioSlots) g_ioSlots->release(); }
+	io_slot(const io_slot&) = delete;
+	io_slot& operator=(const io_slot&) = delete;
+};
+
+// Streams a POSIX (ustar) tar archive to a file descriptor through a large write buffer.
+// Names that don't fit the ustar name/prefix fields get a pax extended header.
+class tar_writer
+{
+private:
+	static constexpr std::size_t BLOCK = 512;
+	static constexpr std::size_t BUFFER_SIZE = 4 << 20;
+
+	int m_fd = -1;
+	bool m_ownsFd = false;
+	bool m_ok = true;
+	std::unique_ptr<char[]> m_buffer = std::make_unique<char[]>(BUFFER_SIZE);
+	std::size_t m_used = 0;
+	std::uint64_t m_total = 0; // Bytes emitted so far, buffered or not
+
+	struct Header
+	{
+		char name[100];
+		char mode[8];
+		char uid[8];
+		char gid[8];
+		char size[12];
+		char mtime[12];
+		char chksum[8];
+		char typeflag;
+		char linkname[100];
+		char magic[6];
+		char version[2];
+		char uname[32];
+		char gname[32];
+		char devmajor[8];
+		char devminor[8];
+		char prefix[155];
+		char pad[12];
+	};
+	static_assert(sizeof(Header) == BLOCK);
+
+	static void octal(char* field, std::size_t width, std::uint64_t value) {
+		snprintf(field, width, "%0*llo", static_cast<int>(width - 1), static_cast<unsigned long long>(value));
+	}
+
+	// Splits name into the ustar prefix and name fields, returns false if it can't be done
+	static bool split_name(const std::string& name, Header& h) {
+		if(name.size() < sizeof(h.name)) {
+			memcpy(h.name, name.data(), name.size());
+			return true;
+		}
+		for(auto slash = name.find('/'); slash != std::string::npos; slash = name.find('/', slash + 1)) {
+			if(slash > sizeof(h.prefix))
+				break;
+			if(name.size() - slash - 1 <= sizeof(h.name)) {
+				memcpy(h.prefix, name.data(), slash);
+				memcpy(h.name, name.data() + slash + 1, name.size() - slash - 1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void put_header(const std::string& name, char type, std::uint64_t size, std::uint64_t mtime) {
+		Header h = {};
+		if(!split_name(name, h)) {
+			// pax extended header carrying the full path. Record length includes its own digits
+			std::string record = " path=" + name + "\n";
+			auto len = record.size() + 1;
+			while(std::to_string(len).size() + record.size() != len)
+				len++;
+			record = std::to_string(len) + record;
+			put_header("PaxHeader", 'x', record.size(), mtime);
+			put_data(record.data(), record.size());
+			end_entry();
+			memcpy(h.name, name.data(), sizeof(h.name) - 1);
+		}
+		octal(h.mode, sizeof(h.mode), type == '5' ? 0755 : 0644);
+		octal(h.uid, sizeof(h.uid), 0);
+		octal(h.gid, sizeof(h.gid), 0);
+		octal(h.size, sizeof(h.size), size);
+		octal(h.mtime, sizeof(h.mtime), mtime);
+		h.typeflag = type;
+		memcpy(h.magic, "ustar", 6);
+		memcpy(h.version, "00", 2);
+
+		memset(h.chksum, ' ', sizeof(h.chksum));
+		unsigned sum = 0;
+		for(std::size_t i = 0; i < BLOCK; i++)
+			sum += reinterpret_cast<const unsigned char*>(&h)[i];
+		snprintf(h.chksum, sizeof(h.chksum), "%06o", sum);
+
+		put_data(&h, BLOCK);
+	}
+
+	void put_data(const void* data, std::size_t size) {
+		auto p = static_cast<const char*>(data);
+		m_total += size;
+		// Big pieces bypass the buffer entirely once it's been drained
+		if(size >= BUFFER_SIZE) {
+			flush();
+			m_ok = m_ok && write_all(m_fd, p, size);
+			return;
+		}
+		while(size > 0) {
+			auto n = std::min(size, BUFFER_SIZE - m_used);
+			memcpy(m_buffer.get() + m_used, p, n);
+			m_used += n;
+			p += n;
+			size -= n;
+			if(m_used == BUFFER_SIZE)
+				flush();
+		}
+	}
+
+	void pad_to_block() {
+		static const char zeros[BLOCK] = {};
+		auto rem = m_total % BLOCK;
+		if(rem)
+			put_data(zeros, BLOCK - rem);
+	}
+
+public:
+	~tar_writer() {
+		if(m_ownsFd && m_fd >= 0)
+			close(m_fd);
+	}
+
+	/**
+	 * @brief Opens the output
+	 * @param path Output file, or "-" for stdout
+	 * @return bool
+	 */
+	bool open(const std::string& path) {
+		if(path == "-") {
+			m_fd = STDOUT_FILENO;
+			return true;
+		}
+		m_fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		m_ownsFd = true;
+		return m_fd >= 0;
+	}
+
+	bool to_stdout() const { return m_fd == STDOUT_FILENO; };
+	bool good() const { return m_ok; };
+
+	/**
+	 * @brief Starts a new regular file entry. Exactly `size` bytes must follow via write()
+	 */
+	bool begin_file(const std::string& name, std::uint64_t size, std::uint64_t mtime) {
+		put_header(name, '0', size, mtime);
+		return m_ok;
+	}
+
+	bool write(const void* data, std::size_t size) {
+		put_data(data, size);
+		return m_ok;
+	}
+
+	/**
+	 * @brief Pads the current entry out to the block size
+	 */
+	bool end_entry() {
+		pad_to_block();
+		return m_ok;
+	}
+
+	bool flush() {
+		if(m_used) {
+			m_ok = m_ok && write_all(m_fd, m_buffer.get(), m_used);
+			m_used = 0;
+		}
+		return m_ok;
+	}
+
+	/**
+	 * @brief Writes the two zero blocks that terminate a tar archive and flushes
+	 */
+	bool finish() {
+		static const char zeros[BLOCK * 2] = {};
+		put_data(zeros, sizeof(zeros));
+		return flush();
+	}
+};
 
 int main(int argc, const char** argv)
 {
@@ -36,6 +276,24 @@ int main(int argc, const char** argv)
 		.help("Display help text")
 		.implicit_value(true)
 		.default_value(false);
+	parser.add_argument("--verify")
+		.help("Check the CRC32 of every file (or every file matching --query) against the directory")
+		.implicit_value(true)
+		.default_value(false);
+	parser.add_argument("--verify-md5")
+		.help("Check the VPK2 MD5 sections: every archive chunk, the tree and the section itself")
+		.implicit_value(true)
+		.default_value(false);
+	parser.add_argument("--checkpoint")
+		.help("Directory to keep verification checkpoints in, so an interrupted --verify/--verify-md5 resumes on the next run")
+		.nargs(1);
+	parser.add_argument("--io-limit")
+		.help("Cap verification reads to this many bytes per second (K/M/G suffixes allowed)")
+		.nargs(1);
+	parser.add_argument("--verify-on-read")
+		.help("Check the VPK2 MD5 chunks behind every read while extracting, and fail on corrupt data")
+		.implicit_value(true)
+		.default_value(false);
 	parser.add_argument("-x", "--extract")
 		.help("Extract the entire archive, or a specified file. Matches via regexp")
 		.implicit_value(true)
@@ -44,12 +302,91 @@ int main(int argc, const char** argv)
 		.help("Regexp patterns to match files against when extracting")
 		.default_value(std::vector<std::string>{})
 		.nargs(argparse::nargs_pattern::at_least_one);
+	parser.add_argument("-g", "--glob")
+		.help("Glob patterns to match files against when extracting. ** crosses directories")
+		.default_value(std::vector<std::string>{})
+		.nargs(argparse::nargs_pattern::at_least_one);
 	parser.add_argument("-o", "--outdir")
 		.help("Output directory to place the extracted files in")
 		.nargs(1);
+	parser.add_argument("--tar")
+		.help("When extracting, stream a POSIX tar of the selected files to this path instead. Use - for stdout")
+		.nargs(1);
+	parser.add_argument("--pack")
+		.help("Pack the contents of this directory into the archive named on the command line (ex: out/pak01_dir.vpk)")
+		.nargs(1);
+	parser.add_argument("--vpk-version")
+		.help("VPK version to write with --pack, 1 or 2")
+		.default_value(2)
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("--max-archive-size")
+		.help("Largest _NNN.vpk to write with --pack (K/M/G suffixes allowed)")
+		.default_value(std::string("200M"))
+		.nargs(1);
+	parser.add_argument("--no-dedup")
+		.help("With --pack, store identical files separately instead of sharing their data")
+		.implicit_value(true)
+		.default_value(false);
+	parser.add_argument("--preload-budget")
+		.help("With --pack, store up to this many bytes (K/M/G suffixes allowed) of small files and headers in the _dir as preload data")
+		.nargs(1);
+	parser.add_argument("--preload-trace")
+		.help("With --pack and --preload-budget, give preload priority to what this access trace read first")
+		.nargs(1);
+	parser.add_argument("--add")
+		.help("Add or replace files in the archive in place, from a directory laid out like the archive. Can be repeated")
+		.append()
+		.nargs(1);
+	parser.add_argument("--remove")
+		.help("Remove a file from the archive in place. Can be repeated")
+		.append()
+		.nargs(1);
+	parser.add_argument("--compact")
+		.help("Rewrite the archive's _NNN.vpk files in place so they hold only live data, grouped by directory")
+		.implicit_value(true)
+		.default_value(false);
+	parser.add_argument("--compact-order")
+		.help("With --compact, lay out these files first: either one name per line, or an access trace from --trace")
+		.nargs(1);
+	parser.add_argument("--trace")
+		.help("Record every file read (listing, verification, extraction) and write the access trace to this file")
+		.nargs(1);
+	parser.add_argument("--diff")
+		.help("Compare two archives given as old_dir.vpk new_dir.vpk, listing added (A), removed (D) and changed (M) files")
+		.implicit_value(true)
+		.default_value(false);
+	parser.add_argument("--make-patch")
+		.help("Write a patch to this file that turns the first archive (old_dir.vpk) into the second (new_dir.vpk)")
+		.nargs(1);
+	parser.add_argument("--apply-patch")
+		.help("Apply a patch from --make-patch to the archive in place")
+		.nargs(1);
+	parser.add_argument("--since")
+		.help("When extracting, only write files added or changed since this previous version: an old _dir.vpk or a snapshot from --save-snapshot")
+		.nargs(1);
+	parser.add_argument("--save-snapshot")
+		.help("Save the name, size and CRC of every file to this file, for a later --since")
+		.nargs(1);
+	parser.add_argument("-j", "--jobs")
+		.help("Process this many archives at once, 0 for one per core. Output still comes out in command line order")
+		.default_value(0)
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("--io-jobs")
+		.help("With --jobs, at most this many archives read or write data at the same time (default: all of them)")
+		.scan<'i', int>()
+		.nargs(1);
+	parser.add_argument("--stats")
+		.help("After processing each archive, print its lookup, read and cache counters")
+		.implicit_value(true)
+		.default_value(false);
+	parser.add_argument("-q", "--query")
+		.help("Only list or extract files matching a query, ex: \"ext:vtf size>1M dir:materials/\"")
+		.nargs(1);
 	parser.add_argument("-f", "--find")
-		.help("Find a file in the archive")
-		.nargs(argparse::nargs_pattern::at_least_one);
+		.help("Find files in the archive matching a query, ex: \"ext:vtf size>1M archive:3\"")
+		.nargs(1);
 	parser.add_argument("files")
 		.remaining()
 		.help("VPK archives to process")
@@ -73,123 +410,987 @@ int main(int argc, const char** argv)
 		usage(1);
 		return 1;
 	}
+	g_stats = parser.get<bool>("--stats");
 
 	auto archives = parser.get<std::vector<std::string>>("files");
 
 	// Missing archive name
 	if(archives.size() < 1) {
-		fprintf(stderr, "ERROR: Expected archive name\n");
+		fprintf(g_err, "ERROR: Expected archive name\n");
 		usage(1);
 		return 1;
 	}
 
+	if(parser.is_used("--pack")) {
+		if(archives.size() != 1) {
+			fprintf(g_err, "ERROR: --pack takes exactly one output archive\n");
+			return 1;
+		}
+		return vpk_pack(parser.get<std::string>("--pack"), archives[0], parser) ? 0 : 1;
+	}
+
+	if(parser.get<bool>("--diff")) {
+		if(archives.size() != 2) {
+			fprintf(g_err, "ERROR: --diff takes exactly two archives, old and new\n");
+			return 1;
+		}
+		return vpk_diff(archives[0], archives[1], parser) ? 0 : 1;
+	}
+
+	if(parser.is_used("--make-patch")) {
+		if(archives.size() != 2) {
+			fprintf(g_err, "ERROR: --make-patch takes exactly two archives, old and new\n");
+			return 1;
+		}
+		return vpk_make_patch(parser.get<std::string>("--make-patch"), archives[0], archives[1]) ? 0 : 1;
+	}
+
+	if(parser.is_used("--apply-patch")) {
+		if(archives.size() != 1) {
+			fprintf(g_err, "ERROR: --apply-patch takes exactly one archive\n");
+			return 1;
+		}
+		return vpk_apply_patch(parser.get<std::string>("--apply-patch"), archives[0]) ? 0 : 1;
+	}
+
+	if(parser.is_used("--trace") && archives.size() != 1) {
+		fprintf(g_err, "ERROR: --trace takes exactly one archive\n");
+		return 1;
+	}
+
+	if((parser.is_used("--since") || parser.is_used("--save-snapshot")) && archives.size() != 1) {
+		fprintf(g_err, "ERROR: --since and --save-snapshot take exactly one archive\n");
+		return 1;
+	}
+
+	// A single tar stream covers every archive on the command line
+	std::unique_ptr<tar_writer> tar;
+	if(parser.is_used("--tar")) {
+		tar = std::make_unique<tar_writer>();
+		auto tarPath = parser.get<std::string>("--tar");
+		if(!tar->open(tarPath)) {
+			fprintf(g_err, "ERROR: Failed to open tar output '%s'\n", tarPath.c_str());
+			return 1;
+		}
+	}
+
+	// One tar stream can't take entries from several archives at once
+	auto jobs = parser.get<int>("--jobs");
+	if(jobs < 0) {
+		fprintf(g_err, "ERROR: Invalid job count %d\n", jobs);
+		return 1;
+	}
+	if(!jobs)
+		jobs = vpklib::hardware_threads();
+	if(tar || archives.size() == 1)
+		jobs = 1;
+	// Archives extracting into the same directory would race on the files they share, and the last one on the
+	// command line has to win, so those run one at a time
+	if(jobs > 1 && parser.is_used("-x") && extract_dirs_overlap(archives, parser))
+		jobs = 1;
+
+	if(jobs > 1)
+		return vpk_process_all(archives, parser, jobs) ? 0 : 1;
+
 	for (auto& pak : archives) {
-		if (!vpk_process(pak, parser))
+		if (!vpk_process(pak, parser, tar.get()))
 			return 1;
 	}
+
+	if(tar && !tar->finish()) {
+		fprintf(g_err, "ERROR: Failed to write tar output\n");
+		return 1;
+	}
 	
 	return 0;
 }
 
-static bool vpk_process(const std::string& archivePath, argparse::ArgumentParser& parser) {
-	// Open the archive
-	auto archive = vpklib::vpk_archive::read_from_disk(archivePath.c_str());
-	
-	if(!archive) {
-		fprintf(stderr, "ERROR: Failed to open archive '%s'\n", archivePath.c_str());
-		return false;
+static bool vpk_process(const std::string& archivePath, argparse::ArgumentParser& parser, tar_writer* tar) {
+	vpklib::vpk_archive* archive;
+	{
+		io_slot slot;
+
+		// Open the archive
+		archive = vpklib::vpk_archive::read_from_disk(archivePath.c_str());
+		
+		if(!archive) {
+			fprintf(g_err, "ERROR: Failed to open archive '%s'\n", archivePath.c_str());
+			return false;
+		}
+		
+		if((parser.is_used("--add") || parser.is_used("--remove")) && !vpk_update(archive, parser)) {
+			delete archive;
+			return false;
+		}
+
+		if(parser.get<bool>("--compact") && !vpk_compact(archive, parser)) {
+			delete archive;
+			return false;
+		}
 	}
-	
+
 	bool detailed = parser.get<bool>("--details");
+	archive->set_verify_on_read(parser.get<bool>("--verify-on-read"));
+	if(parser.is_used("--trace"))
+		archive->start_trace(1 << 20);
+
+	std::unique_ptr<vpklib::vpk_query> query;
+	if(parser.is_used("--query")) {
+		query = parse_query(parser.get<std::string>("--query"));
+		if(!query) {
+			delete archive;
+			return false;
+		}
+	}
 	
 	bool ok = true;
 	if(parser.get<bool>("--list")) {
-		vpk_list(archive, detailed);
+		vpk_list(archive, detailed, query.get());
+	}
+
+	if(parser.is_used("--find")) {
+		auto find = parse_query(parser.get<std::string>("--find"));
+		if(!find) {
+			delete archive;
+			return false;
+		}
+		vpk_list(archive, detailed, find.get());
 	}
 	
 	if(parser.get<bool>("--info")) {
 		vpk_info(archive);
 	}
 	
-	if(parser.is_used("-x")) {
+	if(parser.get<bool>("--verify")) {
+		io_slot slot;
+		vpklib::vpk_verify_options options;
+		ok = verify_options(parser, archive, "crc", options) && vpk_verify(archive, query.get(), options) && ok;
+	}
+
+	if(parser.get<bool>("--verify-md5")) {
+		io_slot slot;
+		vpklib::vpk_verify_options options;
+		ok = verify_options(parser, archive, "md5", options) && vpk_verify_md5(archive, options) && ok;
+	}
+	
+	if(ok && parser.is_used("-x")) {
+		io_slot slot;
 		auto start = std::chrono::steady_clock::now();
-		ok = vpk_extract(archive, parser);
+		ok = vpk_extract(archive, parser, query.get(), tar, g_out, g_err);
 		auto end = std::chrono::steady_clock::now();
-		printf("Processed %s in %.2f seconds\n", archivePath.c_str(), 
+		// Keep stdout clean when it's carrying the tar stream
+		fprintf(tar && tar->to_stdout() ? g_err : g_out, "Processed %s in %.2f seconds\n", archivePath.c_str(), 
 			std::chrono::duration_cast<std::chrono::milliseconds>(end-start).count() / 1000.f );
 	}
 
+	if(parser.is_used("--trace")) {
+		auto tracePath = parser.get<std::string>("--trace");
+		std::string error;
+		if(!archive->write_trace(tracePath, &error)) {
+			fprintf(g_err, "ERROR: Failed to write trace: %s\n", error.c_str());
+			ok = false;
+		}
+		else if(auto dropped = archive->get_trace_dropped()) {
+			fprintf(g_err, "Trace buffer full, the %llu oldest reads were dropped\n", static_cast<unsigned long long>(dropped));
+		}
+	}
+
+	if(ok && parser.is_used("--save-snapshot")) {
+		auto snapshotPath = parser.get<std::string>("--save-snapshot");
+		std::string error;
+		if(!vpklib::write_snapshot(*archive, snapshotPath, &error)) {
+			fprintf(g_err, "ERROR: Failed to save snapshot: %s\n", error.c_str());
+			ok = false;
+		}
+	}
+
+	if(g_stats)
+		vpk_stats(archive, archivePath, tar && tar->to_stdout() ? g_err : g_out);
+
 	delete archive;
 	return ok;
 }
 
-// List files in the VPK, optionally with extra detail
-static void vpk_list(vpklib::vpk_archive* archive, bool details) {
+static std::unique_ptr<vpklib::vpk_query> parse_query(const std::string& text) {
+	auto query = std::make_unique<vpklib::vpk_query>();
+	std::string error;
+	if(!query->parse(text, &error)) {
+		fprintf(g_err, "ERROR: Invalid query '%s': %s\n", text.c_str(), error.c_str());
+		return nullptr;
+	}
+	return query;
+}
+
+// List files in the VPK, optionally with extra detail. Only lists files matching query, if there is one
+static void vpk_list(vpklib::vpk_archive* archive, bool details, const vpklib::vpk_query* query) {
 	
-	auto search = archive->get_all_files();
-	for(const auto& [fh, name] : search) {
-		printf("%s\n", name.c_str());
+	std::vector<vpklib::vpk_file_handle> handles;
+	if(query) {
+		handles = query->select(archive);
+	}
+	else {
+		for(const auto& [fh, name] : archive->get_all_files())
+			handles.push_back(fh);
+	}
+
+	for(auto fh : handles) {
+		fprintf(g_out, "%s\n", archive->get_file_name(fh).c_str());
 		if(details) {
-			printf("  Size: %ld\n", archive->get_file_size(fh));
-			printf("  Preload size: %ld\n", archive->get_file_preload_size(fh));
-			printf("  Archive index: %ld\n", archive->get_file_archive_index(fh));
-			printf("  CRC32: 0x%X\n", archive->get_file_crc32(fh));
+			fprintf(g_out, "  Size: %ld\n", archive->get_file_size(fh));
+			fprintf(g_out, "  Preload size: %ld\n", archive->get_file_preload_size(fh));
+			fprintf(g_out, "  Archive index: %ld\n", archive->get_file_archive_index(fh));
+			fprintf(g_out, "  CRC32: 0x%X\n", archive->get_file_crc32(fh));
 		}
 	}
 	
 }
 
+// Applies --add and --remove, then writes the changes back in place
+static bool vpk_update(vpklib::vpk_archive* archive, argparse::ArgumentParser& parser) {
+	std::string error;
+	std::uint64_t added = 0, bytes = 0;
+	for(const auto& dir : parser.get<std::vector<std::string>>("--add")) {
+		std::error_code ec;
+		for(std::filesystem::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+			if(!it->is_regular_file())
+				continue;
+			std::ifstream in(it->path(), std::ios::binary);
+			std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			auto name = std::filesystem::relative(it->path(), dir).generic_string();
+			if(!in.good() && !in.eof()) {
+				fprintf(g_err, "ERROR: Failed to read '%s'\n", it->path().c_str());
+				return false;
+			}
+			if(!archive->set_file_data(name, data.data(), data.size(), &error)) {
+				fprintf(g_err, "ERROR: Failed to add %s\n", error.c_str());
+				return false;
+			}
+			added++;
+			bytes += data.size();
+		}
+		if(ec) {
+			fprintf(g_err, "ERROR: Failed to read '%s': %s\n", dir.c_str(), ec.message().c_str());
+			return false;
+		}
+	}
+
+	std::uint64_t removed = 0;
+	for(const auto& name : parser.get<std::vector<std::string>>("--remove")) {
+		if(!archive->remove_file(name)) {
+			fprintf(g_err, "ERROR: No file named '%s' in the archive\n", name.c_str());
+			return false;
+		}
+		removed++;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	if(!archive->save({}, &error)) {
+		fprintf(g_err, "ERROR: Failed to update '%s': %s\n", archive->base_archive_name().c_str(), error.c_str());
+		return false;
+	}
+	auto end = std::chrono::steady_clock::now();
+	fprintf(g_out, "Updated %s: %llu files added or replaced (%.1f MiB), %llu removed in %.2f seconds\n",
+		archive->base_archive_name().c_str(), static_cast<unsigned long long>(added), bytes / (1024.0 * 1024.0),
+		static_cast<unsigned long long>(removed), std::chrono::duration<double>(end - start).count());
+	return true;
+}
+
+// Rewrites the archives without dead space, optionally in the order of a list of names
+static bool vpk_compact(vpklib::vpk_archive* archive, argparse::ArgumentParser& parser) {
+	vpklib::vpk_compact_options options;
+	auto maxSize = parser.get<std::string>("--max-archive-size");
+	if(!parse_size(maxSize, options.max_archive_size)) {
+		fprintf(g_err, "ERROR: Invalid archive size '%s'\n", maxSize.c_str());
+		return false;
+	}
+
+	if(parser.is_used("--compact-order")) {
+		auto orderPath = parser.get<std::string>("--compact-order");
+		std::ifstream in(orderPath);
+		std::string line;
+		if(!in) {
+			fprintf(g_err, "ERROR: Failed to open '%s'\n", orderPath.c_str());
+			return false;
+		}
+		std::size_t unknown = 0;
+		std::string error;
+		if(std::getline(in, line) && line.rfind("# vpktrace", 0) == 0) {
+			if(!archive->read_trace_order(orderPath, options.order, &unknown, &error)) {
+				fprintf(g_err, "ERROR: Failed to read trace: %s\n", error.c_str());
+				return false;
+			}
+		}
+		else {
+			// Plain list of names
+			in.clear();
+			in.seekg(0);
+			while(std::getline(in, line)) {
+				if(!line.empty() && line.back() == '\r')
+					line.pop_back();
+				if(line.empty())
+					continue;
+				auto h = archive->find_file_nocase(line);
+				if(h == vpklib::INVALID_HANDLE)
+					unknown++;
+				else
+					options.order.push_back(h);
+			}
+		}
+		if(unknown)
+			fprintf(g_out, "Ignoring %zu names from '%s' that aren't in the archive\n", unknown, orderPath.c_str());
+	}
+
+	auto result = archive->compact(options);
+	if(!result.ok) {
+		fprintf(g_err, "ERROR: Failed to compact '%s': %s\n", archive->base_archive_name().c_str(), result.error.c_str());
+		return false;
+	}
+
+	const double mib = 1024.0 * 1024.0;
+	fprintf(g_out, "Compacted %s into %u archives in %.2f seconds: %.1f MiB -> %.1f MiB (%.1f MiB reclaimed, %.1f MiB live)\n",
+		archive->base_archive_name().c_str(), result.archives_after, result.seconds, result.bytes_before / mib,
+		result.bytes_after / mib, (static_cast<double>(result.bytes_before) - result.bytes_after) / mib, result.live_bytes / mib);
+	fprintf(g_out, "Fragmentation %.1f%% -> %.1f%%\n", result.fragmentation_before * 100, result.fragmentation_after * 100);
+	return true;
+}
+
+// Returns true if two of the archives would extract into the same output directory. Mirrors the -o default in
+// vpk_extract: the _dir.vpk file name minus the suffix, relative to the working directory.
+static bool extract_dirs_overlap(const std::vector<std::string>& archives, argparse::ArgumentParser& parser) {
+	if(parser.is_used("-o"))
+		return archives.size() > 1;
+
+	std::unordered_set<std::string> dirs;
+	for(const auto& pak : archives) {
+		auto name = std::filesystem::path(pak).filename().string();
+		auto dirSubStr = name.find("_dir.vpk");
+		if(dirSubStr != std::string::npos)
+			name.erase(dirSubStr);
+		if(!dirs.insert(name).second)
+			return true;
+	}
+	return false;
+}
+
+// Runs vpk_process on several archives at once. Each archive prints into buffers of its own, which are copied to
+// stdout and stderr in command line order as soon as it and every archive before it are done. As when running one
+// at a time, nothing past the first failure is started or printed.
+static bool vpk_process_all(const std::vector<std::string>& archives, argparse::ArgumentParser& parser, unsigned jobs) {
+	struct job_output
+	{
+		char* out = nullptr;
+		std::size_t outSize = 0;
+		char* err = nullptr;
+		std::size_t errSize = 0;
+		bool done = false;
+		bool ok = false;
+	};
+	std::vector<job_output> outputs(archives.size());
+
+	unsigned ioJobs = jobs;
+	if(parser.is_used("--io-jobs"))
+		ioJobs = static_cast<unsigned>(std::clamp(parser.get<int>("--io-jobs"), 1, static_cast<int>(jobs)));
+	g_ioSlots = std::make_unique<std::counting_semaphore<>>(ioJobs);
+	g_archiveThreads = std::max(1u, vpklib::hardware_threads() / jobs);
+
+	std::mutex lock;
+	std::size_t nextToPrint = 0;
+	bool ok = true;
+	std::atomic<bool> failed = false;
+	vpklib::parallel_for(archives.size(), [&](std::size_t i) {
+		auto& o = outputs[i];
+		if(!failed.load(std::memory_order_relaxed)) {
+			auto out = open_memstream(&o.out, &o.outSize);
+			auto err = open_memstream(&o.err, &o.errSize);
+			g_out = out ? out : stdout;
+			g_err = err ? err : stderr;
+			o.ok = vpk_process(archives[i], parser, nullptr);
+			if(out)
+				fclose(out);
+			if(err)
+				fclose(err);
+			g_out = stdout;
+			g_err = stderr;
+			if(!o.ok)
+				failed.store(true, std::memory_order_relaxed);
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		o.done = true;
+		for(; nextToPrint < outputs.size() && outputs[nextToPrint].done; nextToPrint++) {
+			auto& ready = outputs[nextToPrint];
+			if(ok) {
+				fwrite(ready.out, 1, ready.outSize, stdout);
+				fflush(stdout);
+				fwrite(ready.err, 1, ready.errSize, stderr);
+				ok = ready.ok;
+			}
+			free(ready.out);
+			free(ready.err);
+			ready.out = ready.err = nullptr;
+		}
+	}, jobs, 1);
+
+	g_ioSlots.reset();
+	g_archiveThreads = 0;
+	return ok;
+}
+
+// Lists the differences between two archives
+static bool vpk_diff(const std::string& oldPath, const std::string& newPath, argparse::ArgumentParser& parser) {
+	std::unique_ptr<vpklib::vpk_archive> oldArchive(vpklib::vpk_archive::read_from_disk(oldPath));
+	if(!oldArchive) {
+		fprintf(g_err, "ERROR: Failed to open archive '%s'\n", oldPath.c_str());
+		return false;
+	}
+	std::unique_ptr<vpklib::vpk_archive> newArchive(vpklib::vpk_archive::read_from_disk(newPath));
+	if(!newArchive) {
+		fprintf(g_err, "ERROR: Failed to open archive '%s'\n", newPath.c_str());
+		return false;
+	}
+
+	auto result = vpklib::diff_archives(*oldArchive, *newArchive);
+	if(g_stats) {
+		vpk_stats(oldArchive.get(), oldPath, g_out);
+		vpk_stats(newArchive.get(), newPath, g_out);
+	}
+	if(!result.ok) {
+		fprintf(g_err, "ERROR: Failed to compare archives: %s\n", result.error.c_str());
+		return false;
+	}
+
+	const bool details = parser.get<bool>("--details");
+	for(const auto& e : result.entries) {
+		switch(e.type) {
+			case vpklib::vpk_diff_entry::kind::added:
+				fprintf(g_out, "A %s", e.name.c_str());
+				break;
+			case vpklib::vpk_diff_entry::kind::removed:
+				fprintf(g_out, "D %s", e.name.c_str());
+				break;
+			case vpklib::vpk_diff_entry::kind::changed:
+				fprintf(g_out, "M %s", e.name.c_str());
+				break;
+		}
+		if(details && e.type == vpklib::vpk_diff_entry::kind::changed)
+			fprintf(g_out, " (%llu -> %llu bytes)", static_cast<unsigned long long>(e.old_size), static_cast<unsigned long long>(e.new_size));
+		else if(details)
+			fprintf(g_out, " (%llu bytes)", static_cast<unsigned long long>(e.old_size + e.new_size));
+		fprintf(g_out, "\n");
+	}
+
+	const double mib = 1024.0 * 1024.0;
+	fprintf(g_out, "%llu added (%.1f MiB), %llu removed (%.1f MiB), %llu changed (%.1f MiB -> %.1f MiB), %llu unchanged in %.2f seconds\n",
+		static_cast<unsigned long long>(result.added), result.added_bytes / mib,
+		static_cast<unsigned long long>(result.removed), result.removed_bytes / mib,
+		static_cast<unsigned long long>(result.changed), result.changed_old_bytes / mib, result.changed_new_bytes / mib,
+		static_cast<unsigned long long>(result.unchanged), result.seconds);
+	if(result.bodies_compared) {
+		fprintf(g_out, "Compared the data of %llu files without CRCs (%.1f MiB read)\n",
+			static_cast<unsigned long long>(result.bodies_compared), result.bytes_compared / mib);
+	}
+	return true;
+}
+
+// Collects the files added or changed since a previous version, given as a _dir.vpk or a snapshot. Sorted by handle
+static bool changed_since(vpklib::vpk_archive* archive, const std::string& sincePath, std::vector<vpklib::vpk_file_handle>& out, FILE* log) {
+	vpklib::vpk_diff_result result;
+	if(std::filesystem::path(sincePath).extension() == ".vpk") {
+		std::unique_ptr<vpklib::vpk_archive> previous(vpklib::vpk_archive::read_from_disk(sincePath));
+		if(!previous) {
+			fprintf(g_err, "ERROR: Failed to open archive '%s'\n", sincePath.c_str());
+			return false;
+		}
+		result = vpklib::diff_archives(*previous, *archive);
+	}
+	else {
+		std::vector<vpklib::vpk_snapshot_entry> snapshot;
+		std::string error;
+		if(!vpklib::read_snapshot(sincePath, snapshot, &error)) {
+			fprintf(g_err, "ERROR: Failed to read snapshot: %s\n", error.c_str());
+			return false;
+		}
+		result = vpklib::diff_snapshot(snapshot, *archive);
+	}
+	if(!result.ok) {
+		fprintf(g_err, "ERROR: Failed to compare with '%s': %s\n", sincePath.c_str(), result.error.c_str());
+		return false;
+	}
+
+	out.clear();
+	for(const auto& e : result.entries) {
+		if(e.type != vpklib::vpk_diff_entry::kind::removed)
+			out.push_back(e.new_handle);
+	}
+	std::sort(out.begin(), out.end());
+	fprintf(log, "Since '%s': %llu added, %llu changed, %llu removed, %llu unchanged and skipped\n", sincePath.c_str(),
+		static_cast<unsigned long long>(result.added), static_cast<unsigned long long>(result.changed),
+		static_cast<unsigned long long>(result.removed), static_cast<unsigned long long>(result.unchanged));
+	return true;
+}
+
+// Writes a patch between two versions of an archive
+static bool vpk_make_patch(const std::string& patchPath, const std::string& oldPath, const std::string& newPath) {
+	std::unique_ptr<vpklib::vpk_archive> oldArchive(vpklib::vpk_archive::read_from_disk(oldPath));
+	if(!oldArchive) {
+		fprintf(g_err, "ERROR: Failed to open archive '%s'\n", oldPath.c_str());
+		return false;
+	}
+	std::unique_ptr<vpklib::vpk_archive> newArchive(vpklib::vpk_archive::read_from_disk(newPath));
+	if(!newArchive) {
+		fprintf(g_err, "ERROR: Failed to open archive '%s'\n", newPath.c_str());
+		return false;
+	}
+
+	auto result = vpklib::create_patch(*oldArchive, *newArchive, patchPath);
+	if(g_stats) {
+		vpk_stats(oldArchive.get(), oldPath, g_out);
+		vpk_stats(newArchive.get(), newPath, g_out);
+	}
+	if(!result.ok) {
+		fprintf(g_err, "ERROR: Failed to write patch '%s': %s\n", patchPath.c_str(), result.error.c_str());
+		return false;
+	}
+
+	const double mib = 1024.0 * 1024.0;
+	fprintf(g_out, "Wrote '%s' (%.1f MiB): %llu added, %llu replaced, %llu delta, %llu removed in %.2f seconds\n",
+		patchPath.c_str(), result.patch_bytes / mib,
+		static_cast<unsigned long long>(result.added), static_cast<unsigned long long>(result.replaced),
+		static_cast<unsigned long long>(result.deltas), static_cast<unsigned long long>(result.removed), result.seconds);
+	fprintf(g_out, "%.1f MiB of new data, %.1f MiB reused from the old files\n", result.literal_bytes / mib, result.copied_bytes / mib);
+	return true;
+}
+
+// Applies a patch to an archive in place
+static bool vpk_apply_patch(const std::string& patchPath, const std::string& archivePath) {
+	std::unique_ptr<vpklib::vpk_archive> archive(vpklib::vpk_archive::read_from_disk(archivePath));
+	if(!archive) {
+		fprintf(g_err, "ERROR: Failed to open archive '%s'\n", archivePath.c_str());
+		return false;
+	}
+
+	auto result = vpklib::apply_patch(*archive, patchPath);
+	if(g_stats)
+		vpk_stats(archive.get(), archivePath, g_out);
+	if(!result.ok) {
+		fprintf(g_err, "ERROR: Failed to apply patch '%s': %s\n", patchPath.c_str(), result.error.c_str());
+		return false;
+	}
+
+	fprintf(g_out, "Patched '%s': %llu added, %llu replaced, %llu delta, %llu removed, %llu already up to date in %.2f seconds\n",
+		archivePath.c_str(),
+		static_cast<unsigned long long>(result.added), static_cast<unsigned long long>(result.replaced),
+		static_cast<unsigned long long>(result.deltas), static_cast<unsigned long long>(result.removed),
+		static_cast<unsigned long long>(result.skipped), result.seconds);
+	return true;
+}
+
+// Packs a directory into a new archive set
+static bool vpk_pack(const std::string& source, const std::string& archivePath, argparse::ArgumentParser& parser) {
+	vpklib::vpk_writer_options options;
+	options.version = parser.get<int>("--vpk-version");
+	options.deduplicate = !parser.get<bool>("--no-dedup");
+
+	auto maxSize = parser.get<std::string>("--max-archive-size");
+	if(!parse_size(maxSize, options.max_archive_size)) {
+		fprintf(g_err, "ERROR: Invalid archive size '%s'\n", maxSize.c_str());
+		return false;
+	}
+
+	if(parser.is_used("--preload-budget")) {
+		auto budget = parser.get<std::string>("--preload-budget");
+		if(!parse_size(budget, options.preload_budget)) {
+			fprintf(g_err, "ERROR: Invalid preload budget '%s'\n", budget.c_str());
+			return false;
+		}
+	}
+
+	vpklib::vpk_writer writer(options);
+	std::string error;
+	if(!writer.add_directory(source, &error)) {
+		fprintf(g_err, "ERROR: Failed to add files: %s\n", error.c_str());
+		return false;
+	}
+	if(parser.is_used("--preload-trace") && !writer.add_preload_trace(parser.get<std::string>("--preload-trace"), &error)) {
+		fprintf(g_err, "ERROR: Failed to read trace: %s\n", error.c_str());
+		return false;
+	}
+
+	auto result = writer.write(archivePath);
+	if(!result.ok) {
+		fprintf(g_err, "ERROR: Failed to write '%s': %s\n", archivePath.c_str(), result.error.c_str());
+		return false;
+	}
+
+	const double mib = result.bytes / (1024.0 * 1024.0);
+	fprintf(g_out, "Packed %llu files, %.1f MiB into %u archives in %.2f seconds (%.1f MiB/s)\n",
+		static_cast<unsigned long long>(result.files), mib, result.archives, result.seconds,
+		result.seconds > 0 ? mib / result.seconds : 0.0);
+	if(options.deduplicate) {
+		const double stored = static_cast<double>(result.bytes);
+		fprintf(g_out, "Deduplicated %llu files, %.1f MiB saved (ratio %.2f) in %.2f seconds\n",
+			static_cast<unsigned long long>(result.duplicate_files), result.duplicate_bytes / (1024.0 * 1024.0),
+			stored > 0 ? (stored + result.duplicate_bytes) / stored : 1.0, result.dedup_seconds);
+	}
+	if(options.preload_budget) {
+		fprintf(g_out, "Preloaded %.1f KiB from %llu files (%llu entirely in the directory)\n", result.preload_bytes / 1024.0,
+			static_cast<unsigned long long>(result.preload_files), static_cast<unsigned long long>(result.preload_whole));
+	}
+	return true;
+}
+
+// Parses a byte count with an optional K/M/G (powers of 1024) suffix
+static bool parse_size(const std::string& text, std::uint64_t& out) {
+	char* end = nullptr;
+	auto value = strtod(text.c_str(), &end);
+	if(end == text.c_str())
+		return false;
+	switch(*end) {
+		case 'g': case 'G': value *= 1024;
+		[[fallthrough]];
+		case 'm': case 'M': value *= 1024;
+		[[fallthrough]];
+		case 'k': case 'K': value *= 1024; end++;
+		default: break;
+	}
+	if(*end || value < 1)
+		return false;
+	out = static_cast<std::uint64_t>(value);
+	return true;
+}
+
+// Fills in the checkpoint and rate limit options for one scan of one archive
+static bool verify_options(argparse::ArgumentParser& parser, vpklib::vpk_archive* archive, const char* scan, vpklib::vpk_verify_options& options) {
+	options.threads = g_archiveThreads;
+	if(parser.is_used("--io-limit")) {
+		auto text = parser.get<std::string>("--io-limit");
+		if(!parse_size(text, options.max_bytes_per_second)) {
+			fprintf(g_err, "ERROR: Invalid IO limit '%s'\n", text.c_str());
+			return false;
+		}
+	}
+
+	if(parser.is_used("--checkpoint")) {
+		std::filesystem::path dir = parser.get<std::string>("--checkpoint");
+		std::error_code ec;
+		std::filesystem::create_directories(dir, ec);
+		if(ec) {
+			fprintf(g_err, "ERROR: Failed to create checkpoint directory '%s': %s\n", dir.c_str(), ec.message().c_str());
+			return false;
+		}
+		auto name = std::filesystem::path(archive->base_archive_name()).filename().string();
+		options.checkpoint = (dir / (name + "." + scan + ".ckpt")).string();
+	}
+	return true;
+}
+
+// Check file CRCs and report any mismatches
+static bool vpk_verify(vpklib::vpk_archive* archive, const vpklib::vpk_query* query, const vpklib::vpk_verify_options& options) {
+	auto result = query ? archive->verify(query->select(archive), options) : archive->verify(options);
+	if(result.resumed)
+		fprintf(g_out, "Resumed from checkpoint, %llu files already checked\n", static_cast<unsigned long long>(result.resumed));
+
+	for(const auto& f : result.failures) {
+		auto name = archive->get_file_name(f.handle);
+		if(f.read_error)
+			fprintf(g_out, "READ ERROR: %s\n", name.c_str());
+		else
+			fprintf(g_out, "CRC MISMATCH: %s (expected 0x%08X, got 0x%08X)\n", name.c_str(), f.expected, f.actual);
+	}
+
+	const double mib = result.bytes / (1024.0 * 1024.0);
+	fprintf(g_out, "Verified %llu files, %.1f MiB in %.2f seconds (%.1f MiB/s, crc32: %s)\n",
+		static_cast<unsigned long long>(result.files), mib, result.seconds,
+		result.seconds > 0 ? mib / result.seconds : 0.0, vpklib::crc32_kernel_name());
+
+	if(!result.ok()) {
+		fprintf(g_err, "ERROR: %zu of %llu files in '%s' failed verification\n", result.failures.size(),
+			static_cast<unsigned long long>(result.files), archive->base_archive_name().c_str());
+		return false;
+	}
+	return true;
+}
+
+// Check the archive MD5 sections
+static bool vpk_verify_md5(vpklib::vpk_archive* archive, const vpklib::vpk_verify_options& options) {
+	auto result = archive->verify_md5(options);
+	if(!result.has_checksums) {
+		fprintf(g_out, "No MD5 sections in VPK%d archive\n", archive->get_version());
+		return true;
+	}
+	if(result.resumed)
+		fprintf(g_out, "Resumed from checkpoint, %llu chunks already checked\n", static_cast<unsigned long long>(result.resumed));
+
+	const auto& entries = archive->get_archive_md5_entries();
+	auto printChunk = [&](const char* what, std::size_t i) {
+		fprintf(g_out, "%s: archive %u, offset 0x%X, %u bytes\n", what, entries[i].archive_index, entries[i].start_offset, entries[i].count);
+	};
+	for(auto i : result.failed_chunks)
+		printChunk("CHUNK MISMATCH", i);
+	for(auto i : result.unreadable_chunks)
+		printChunk("CHUNK READ ERROR", i);
+
+	fprintf(g_out, "Tree checksum: %s\n", result.tree_ok ? "OK" : "MISMATCH");
+	fprintf(g_out, "Archive MD5 section checksum: %s\n", result.section_ok ? "OK" : "MISMATCH");
+
+	const double mib = result.bytes / (1024.0 * 1024.0);
+	fprintf(g_out, "Verified %llu chunks, %.1f MiB in %.2f seconds (%.1f MiB/s, md5: %s)\n",
+		static_cast<unsigned long long>(result.chunks), mib, result.seconds,
+		result.seconds > 0 ? mib / result.seconds : 0.0, vpklib::md5_kernel_name());
+
+	if(!result.ok()) {
+		fprintf(g_err, "ERROR: MD5 validation of '%s' failed\n", archive->base_archive_name().c_str());
+		return false;
+	}
+	return true;
+}
+
 // Display general info about the VPK
 static void vpk_info(vpklib::vpk_archive* archive) {
-	printf("Version: %d\n", archive->get_version());
-	printf("File count: %ld\n", archive->get_file_count());
-	printf("Base archive name: %s\n", archive->base_archive_name().c_str());
+	fprintf(g_out, "Version: %d\n", archive->get_version());
+	fprintf(g_out, "File count: %ld\n", archive->get_file_count());
+	fprintf(g_out, "Base archive name: %s\n", archive->base_archive_name().c_str());
 	
 	auto sigsize = archive->get_signature_size();
-	printf("Signature size: %ld\n", sigsize);
+	fprintf(g_out, "Signature size: %ld\n", sigsize);
 	if(sigsize == 0) {
-		printf("Signature: No signature\n");
+		fprintf(g_out, "Signature: No signature\n");
 	}
 	else {
-		printf("Signature: ");
+		fprintf(g_out, "Signature: ");
 		auto s = static_cast<char*>(archive->get_signature());
 		for(auto i = 0; i < sigsize; i++) {
-			printf("0x%X ", s[i] & 0xFF);
+			fprintf(g_out, "0x%X ", s[i] & 0xFF);
 		}
-		puts("\n");
+		fputs("\n\n", g_out);
 	}
 	
 	auto pubsize = archive->get_pubkey_size();
-	printf("Pubkey size: %ld\n", pubsize);
+	fprintf(g_out, "Pubkey size: %ld\n", pubsize);
 	if(pubsize == 0) {
-		printf("Pubkey: No public key\n");
+		fprintf(g_out, "Pubkey: No public key\n");
 	}
 	else {
-		printf("Pubkey: ");
+		fprintf(g_out, "Pubkey: ");
 		auto k = static_cast<char*>(archive->get_pubkey());
 		for(auto i = 0; i < pubsize; i++) {
-			printf("0x%X ", k[i] & 0xFF);
+			fprintf(g_out, "0x%X ", k[i] & 0xFF);
+		}
+		fputs("\n\n", g_out);
+	}
+}
+
+// Prints the I/O counters of an archive, for --stats
+static void vpk_stats(const vpklib::vpk_archive* archive, const std::string& archivePath, FILE* out) {
+	const auto stats = archive->get_io_stats();
+	const double mib = 1024.0 * 1024.0;
+	auto u = [](std::uint64_t v) { return static_cast<unsigned long long>(v); };
+
+	fprintf(out, "Stats for %s:\n", archivePath.c_str());
+	fprintf(out, "  Lookups: %llu (%llu hits, %llu misses)\n", u(stats.lookups), u(stats.lookup_hits), u(stats.lookup_misses));
+	fprintf(out, "  File reads: %llu (%llu from preload data only, %llu from unsaved changes), %.1f MiB of preload data\n",
+		u(stats.file_reads), u(stats.preload_only_reads), u(stats.pending_reads), stats.preload_bytes / mib);
+	fprintf(out, "  Archive reads: %.1f MiB in %.3f seconds, %llu syscalls, %llu opens, %llu open handle reuses\n",
+		stats.bytes_read / mib, stats.read_seconds, u(stats.syscalls), u(stats.opens), u(stats.handle_cache_hits));
+	if(stats.chunk_hashes || stats.chunk_cache_hits) {
+		fprintf(out, "  Verify-on-read: %llu chunks hashed, %llu checks answered from earlier hashes\n",
+			u(stats.chunk_hashes), u(stats.chunk_cache_hits));
+	}
+	fprintf(out, "  Directory parse: %.3f seconds\n", stats.parse_seconds);
+	for(const auto& a : stats.archives) {
+		if(a.archive_index == 0x7FFF)
+			fprintf(out, "  _dir: %llu reads, %.1f MiB\n", u(a.reads), a.bytes / mib);
+		else
+			fprintf(out, "  _%03d: %llu reads, %.1f MiB\n", a.archive_index, u(a.reads), a.bytes / mib);
+	}
+}
+
+// Writes the entire buffer to fd, retrying on short writes
+static bool write_all(int fd, const void* data, std::size_t size) {
+	auto p = static_cast<const char*>(data);
+	while(size > 0) {
+		auto n = write(fd, p, size);
+		if(n < 0) {
+			if(errno == EINTR)
+				continue;
+			return false;
 		}
-		puts("\n");
+		p += n;
+		size -= n;
 	}
+	return true;
 }
 
+// Output directory cache used while extracting.
+// The unique directory set is computed from the selected names and created once, one depth
+// level at a time in parallel, with mkdirat() relative to the parent's fd. Output files are then
+// opened relative to their directory's cached fd, so nothing is re-resolved or stat'ed per file.
+class extract_dir_cache
+{
+private:
+	static constexpr std::size_t ROOT = ~0ull;
+
+	// Keep some descriptors free for archive handles and output files
+	static constexpr rlim_t RESERVED_FDS = 256;
+
+	struct Dir
+	{
+		std::string path;		// Relative to the output root
+		std::size_t parent;		// Index of the parent dir, or ROOT
+		std::size_t depth;
+		int fd = -1;
+	};
+
+	int m_rootFd = -1;
+	std::vector<Dir> m_dirs;
+	std::unordered_map<std::string, std::size_t> m_index;
+
+	// Registers a directory and all of its ancestors, returns its index
+	std::size_t add(const std::string& path) {
+		if(path.empty())
+			return ROOT;
+		auto it = m_index.find(path);
+		if(it != m_index.end())
+			return it->second;
+
+		auto slash = path.rfind('/');
+		auto parent = slash == std::string::npos ? ROOT : add(path.substr(0, slash));
+
+		Dir d;
+		d.path = path;
+		d.parent = parent;
+		d.depth = parent == ROOT ? 0 : m_dirs[parent].depth + 1;
+		m_dirs.push_back(std::move(d));
+		m_index.insert({path, m_dirs.size() - 1});
+		return m_dirs.size() - 1;
+	}
+
+	// Returns the fd and relative path to use for an entry inside directory `dir`
+	std::pair<int, std::string> resolve(std::size_t dir, const std::string& leaf) const {
+		if(dir == ROOT)
+			return {m_rootFd, leaf};
+		if(m_dirs[dir].fd >= 0)
+			return {m_dirs[dir].fd, leaf};
+		// Ran out of descriptors for this one, fall back to a path relative to the root
+		return {m_rootFd, m_dirs[dir].path + "/" + leaf};
+	}
+
+	static std::size_t max_cached_fds() {
+		rlimit lim;
+		if(getrlimit(RLIMIT_NOFILE, &lim) != 0)
+			return 0;
+		// Large trees have many thousands of directories, so ask for everything we're allowed
+		if(lim.rlim_cur < lim.rlim_max) {
+			lim.rlim_cur = lim.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &lim);
+			getrlimit(RLIMIT_NOFILE, &lim);
+		}
+		return lim.rlim_cur > RESERVED_FDS ? lim.rlim_cur - RESERVED_FDS : 0;
+	}
+
+public:
+	~extract_dir_cache() {
+		for(auto& d : m_dirs) {
+			if(d.fd >= 0)
+				close(d.fd);
+		}
+		if(m_rootFd >= 0)
+			close(m_rootFd);
+	}
+
+	/**
+	 * @brief Creates the output root and every directory needed by names
+	 * @param root Output directory
+	 * @param names Relative file names that will be extracted
+	 * @param err Where errors are reported, from whichever thread hits them
+	 * @return bool False if any directory could not be created
+	 */
+	bool create(const std::filesystem::path& root, const std::vector<std::string>& names, FILE* err) {
+		std::error_code ec;
+		std::filesystem::create_directories(root, ec);
+		m_rootFd = open(root.empty() ? "." : root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if(m_rootFd < 0) {
+			fprintf(err, "ERROR: Failed to open output directory '%s'\n", root.c_str());
+			return false;
+		}
+
+		for(const auto& name : names) {
+			auto slash = name.rfind('/');
+			if(slash != std::string::npos)
+				add(name.substr(0, slash));
+		}
+
+		// Parents always need to exist before their children, so go level by level
+		std::vector<std::vector<std::size_t>> levels;
+		for(std::size_t i = 0; i < m_dirs.size(); i++) {
+			if(m_dirs[i].depth >= levels.size())
+				levels.resize(m_dirs[i].depth + 1);
+			levels[m_dirs[i].depth].push_back(i);
+		}
+
+		const auto fdBudget = max_cached_fds();
+		std::atomic<std::size_t> fdsUsed = 0;
+		std::atomic<bool> ok = true;
+
+		for(const auto& level : levels) {
+			vpklib::parallel_for(level.size(), [&](std::size_t i) {
+				auto& d = m_dirs[level[i]];
+				auto slash = d.path.rfind('/');
+				auto [fd, rel] = resolve(d.parent, slash == std::string::npos ? d.path : d.path.substr(slash + 1));
+
+				if(mkdirat(fd, rel.c_str(), 0755) != 0 && errno != EEXIST) {
+					fprintf(err, "ERROR: Failed to create directory '%s': %s\n", d.path.c_str(), strerror(errno));
+					ok = false;
+					return;
+				}
+
+				if(fdsUsed.fetch_add(1, std::memory_order_relaxed) < fdBudget)
+					d.fd = openat(fd, rel.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			});
+			if(!ok)
+				return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Opens (creating or truncating) the output file for an extracted entry
+	 * @param name Relative file name, its directory must have been passed to create()
+	 * @return int File descriptor, or -1 on error
+	 */
+	int open_file(const std::string& name) const {
+		auto slash = name.rfind('/');
+		std::size_t dir = ROOT;
+		if(slash != std::string::npos) {
+			auto it = m_index.find(name.substr(0, slash));
+			if(it == m_index.end())
+				return -1;
+			dir = it->second;
+		}
+		auto [fd, rel] = resolve(dir, slash == std::string::npos ? name : name.substr(slash + 1));
+		return openat(fd, rel.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+};
+
 // Extract some files from a VPK
-static bool vpk_extract(vpklib::vpk_archive* archive, argparse::ArgumentParser& parser) {
+// Worker threads don't see the caller's thread_local g_out/g_err, so everything printed goes through out and err
+static bool vpk_extract(vpklib::vpk_archive* archive, argparse::ArgumentParser& parser, const vpklib::vpk_query* query, tar_writer* tar, FILE* out, FILE* err) {
 
-	// Build list of regexp 
-	std::vector<std::string> searches = parser.get<std::vector<std::string>>("-p");
-	std::vector<std::regex> expressions;
-	try {
-		for(const auto& s : searches) {
-			expressions.push_back(
-				std::regex(s.c_str(), std::regex_constants::ECMAScript)
-			);
+	// Build the matcher from the regexp and glob patterns
+	vpklib::vpk_path_matcher matcher;
+	for(const auto& s : parser.get<std::vector<std::string>>("-p")) {
+		std::string error;
+		if(!matcher.add_pattern(s, vpklib::vpk_path_matcher::syntax::regex, &error)) {
+			fprintf(err, "ERROR: regular expression invalid: %s\n", error.c_str());
+			return false;
 		}
 	}
-	catch(std::regex_error& e) {
-		printf("ERROR: regular expression invalid: %s\n", e.what());
-		return false;
+	for(const auto& s : parser.get<std::vector<std::string>>("-g")) {
+		std::string error;
+		if(!matcher.add_pattern(s, vpklib::vpk_path_matcher::syntax::glob, &error)) {
+			fprintf(err, "ERROR: glob pattern invalid: %s\n", error.c_str());
+			return false;
+		}
 	}
 
 	// Grab the destination directory 
@@ -203,52 +1404,97 @@ static bool vpk_extract(vpklib::vpk_archive* archive, argparse::ArgumentParser&
 		outDirPath = parser.get<std::string>("-o");
 	}
 
-	auto extractFile = [archive, &outDirPath](vpklib::vpk_file_handle x) -> bool {
-		auto data = archive->get_file_data(x);
-
-		if (!std::get<0>(data))
+	// Stage 1: filter the index. Done up front so the directory set only covers what we actually write
+	auto selected = matcher.select(archive);
+	if(query) {
+		// Both are in handle order
+		auto queried = query->select(archive);
+		std::vector<vpklib::vpk_file_handle> both;
+		std::set_intersection(selected.begin(), selected.end(), queried.begin(), queried.end(), std::back_inserter(both));
+		selected = std::move(both);
+	}
+	if(parser.is_used("--since")) {
+		// Only what changed. Nothing is read or stat'ed for the rest
+		std::vector<vpklib::vpk_file_handle> changed, both;
+		if(!changed_since(archive, parser.get<std::string>("--since"), changed, tar && tar->to_stdout() ? err : out))
 			return false;
-		
-		// Get a full name of the file
-		std::filesystem::path name = archive->get_file_name(x);
-		
-		std::filesystem::create_directories(outDirPath / name.parent_path());
+		std::set_intersection(selected.begin(), selected.end(), changed.begin(), changed.end(), std::back_inserter(both));
+		selected = std::move(both);
+	}
 
-		auto outDir = outDirPath / name;
+	vpklib::vpk_read_pipeline::sort_physical(archive, selected);
 
-		std::ofstream stream(outDir, std::ios::binary);
-		if (!stream.good())
-			return false;
+	if(tar)
+		return vpk_extract_tar(archive, selected, tar, err);
 
-		stream.write(static_cast<const char*>(std::get<0>(data)), std::get<1>(data));
-		stream.close();
+	std::vector<std::string> names;
+	names.reserve(selected.size());
+	for(auto fh : selected)
+		names.push_back(archive->get_file_name(fh));
 
-		std::cout << name << " -> " << outDir << "\n";
+	extract_dir_cache dirs;
+	if(!dirs.create(outDirPath, names, err))
+		return false;
 
-		return true;
-	};
-	
-	// Wow this is trash! Nested loops and regexp everywhere, ugh
-	auto search = archive->get_all_files();
-	bool hasRegex = expressions.size();
-	for(auto [fh, name] : search) {
-
-		// Standard processing w/o regexp
-		if (!hasRegex) {
-			if (!extractFile(fh))
-				return false;
-			continue;
+	// Stages 2 and 3: archive reads and output writes, overlapped through the pipeline's buffer pool.
+	// Each file's chunks arrive in order on one lane, so its fd is only ever touched by one thread.
+	std::vector<int> fds(selected.size(), -1);
+	vpklib::vpk_read_pipeline pipeline;
+	bool ok = pipeline.run(archive, selected, [&](unsigned, const vpklib::vpk_chunk& chunk) -> bool {
+		auto& fd = fds[chunk.item];
+		const auto& name = names[chunk.item];
+		if(chunk.offset == 0)
+			fd = dirs.open_file(name);
+
+		if(fd < 0 || !write_all(fd, chunk.data, chunk.size)) {
+			fprintf(err, "ERROR: Failed to write '%s'\n", name.c_str());
+			return false;
 		}
 
-		// Regexp processing
-		for(auto& r : expressions) {
-			if(!std::regex_match(name, r))
-				continue;
-			if (!extractFile(fh))
-					return false;
-			break;
+		if(chunk.last) {
+			close(fd);
+			fd = -1;
+			fprintf(out, "\"%s\" -> \"%s\"\n", name.c_str(), (outDirPath / name).c_str());
 		}
+		return true;
+	});
+
+	// Anything left open was cut short by an error
+	for(auto fd : fds) {
+		if(fd >= 0)
+			close(fd);
+	}
+
+	if(!ok)
+		fprintf(err, "ERROR: Extraction of '%s' failed\n", archive->base_archive_name().c_str());
+	return ok;
+}
+
+// Stream the selected files into a tar. A single reader and lane keep the chunks in physical order,
+// which is also the order the entries land in the tar.
+static bool vpk_extract_tar(vpklib::vpk_archive* archive, std::vector<vpklib::vpk_file_handle>& selected, tar_writer* tar, FILE* err) {
+	// Stamp every entry with the _dir.vpk mtime so the same archive always produces the same stream
+	std::uint64_t mtime = 0;
+	struct stat st;
+	if(stat((archive->base_archive_name() + "_dir.vpk").c_str(), &st) == 0)
+		mtime = st.st_mtime;
+
+	vpklib::vpk_read_pipeline::Options options;
+	options.readers = 1;
+	options.lanes = 1;
+	vpklib::vpk_read_pipeline pipeline(options);
+
+	bool ok = pipeline.run(archive, selected, [&](unsigned, const vpklib::vpk_chunk& chunk) -> bool {
+		if(chunk.offset == 0 && !tar->begin_file(archive->get_file_name(chunk.handle), chunk.file_size, mtime))
+			return false;
+		if(!tar->write(chunk.data, chunk.size))
+			return false;
+		return !chunk.last || tar->end_entry();
+	});
+
+	if(!ok || !tar->good()) {
+		fprintf(err, "ERROR: Failed to write tar stream for '%s'\n", archive->base_archive_name().c_str());
+		return false;
 	}
-	
 	return true;
 }
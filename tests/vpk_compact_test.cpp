@@ -0,0 +1,178 @@
+// Compacts an archive with dead space and empty files, and checks that nothing is lost, every entry points at an
+// archive that still exists, and the requested layout order is followed
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_corpus.hpp"
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const std::string& what) {
+		if(!condition) {
+			fprintf(stderr, "FAILED: %s\n", what.c_str());
+			failures++;
+		}
+	}
+
+	std::string read_all(vpklib::vpk_archive* archive, const std::string& name) {
+		auto [data, size] = archive->get_file_data(name);
+		std::string out(static_cast<const char*>(data), data ? size : 0);
+		free(data);
+		return out;
+	}
+
+	std::map<std::string, std::string> contents_of(vpklib::vpk_archive* archive) {
+		std::map<std::string, std::string> out;
+		for(vpklib::vpk_file_handle h = 0; h < archive->get_file_count(); h++) {
+			const auto name = archive->get_file_name(h);
+			out[name] = read_all(archive, name);
+		}
+		return out;
+	}
+
+	std::filesystem::path archive_path(const std::filesystem::path& dir, std::uint32_t index) {
+		char num[16];
+		snprintf(num, sizeof(num), "_%03u.vpk", index);
+		return dir / (std::string("pak01") + num);
+	}
+
+	// Every entry, empty or not, must point at _dir or at an archive on disk
+	bool archives_exist(vpklib::vpk_archive* archive, const std::filesystem::path& dir) {
+		for(vpklib::vpk_file_handle h = 0; h < archive->get_file_count(); h++) {
+			const auto index = archive->get_file_archive_index(h);
+			if(index != 0x7FFF && !std::filesystem::exists(archive_path(dir, index)))
+				return false;
+		}
+		return true;
+	}
+
+	void compact_and_check(std::unique_ptr<vpklib::vpk_archive>& archive, const std::filesystem::path& path,
+		const std::map<std::string, std::string>& expected, const vpklib::vpk_compact_options& options, const std::string& label) {
+		auto result = archive->compact(options);
+		check(result.ok, label + ": compact failed: " + result.error);
+		if(!result.ok)
+			return;
+		check(result.fragmentation_after == 0, label + ": the compacted archive is still fragmented");
+		check(result.bytes_after == result.live_bytes, label + ": the new archives hold more than the live data");
+
+		// Once as compact() left it, once fresh from disk
+		for(int pass = 0; pass < 2 && archive; pass++) {
+			const auto what = label + (pass ? " (reloaded)" : "");
+			check(contents_of(archive.get()) == expected, what + ": contents changed");
+			check(archives_exist(archive.get(), path.parent_path()), what + ": an entry points at a deleted archive");
+			check(archive->verify().ok(), what + ": verify failed");
+			check(archive->verify_md5().ok(), what + ": verify_md5 failed");
+			if(!pass)
+				archive.reset(vpklib::vpk_archive::read_from_disk(path));
+		}
+		check(archive != nullptr, label + ": reloading the compacted archive failed");
+	}
+
+}
+
+int main()
+{
+	const auto dir = std::filesystem::temp_directory_path() / ("vpk_compact_test_" + std::to_string(getpid()));
+	const auto path = dir / "pak01_dir.vpk";
+
+	vpklib::vpk_corpus_options corpus;
+	corpus.file_count = 400;
+	corpus.distribution = vpklib::vpk_corpus_options::size_distribution::uniform;
+	corpus.size_min = 0;
+	corpus.size_max = 4096;
+	corpus.max_archive_size = 64 << 10;
+	corpus.md5_chunk_size = 4096;
+	corpus.embedded_ratio = 0.05;
+	auto generated = vpklib::generate_corpus(path, corpus);
+	if(!generated.ok) {
+		fprintf(stderr, "FAILED: generating the archive: %s\n", generated.error.c_str());
+		return 1;
+	}
+
+	std::unique_ptr<vpklib::vpk_archive> archive(vpklib::vpk_archive::read_from_disk(path));
+	if(!archive) {
+		fprintf(stderr, "FAILED: opening '%s'\n", path.c_str());
+		std::filesystem::remove_all(dir);
+		return 1;
+	}
+	auto expected = contents_of(archive.get());
+
+	// Leave dead space behind: remove every fifth file, empty every seventh and add a few empty ones
+	for(vpklib::vpk_file_handle h = 0; h < archive->get_file_count(); h++) {
+		const auto name = archive->get_file_name(h);
+		if(h % 5 == 0) {
+			archive->remove_file(name);
+			expected.erase(name);
+		}
+		else if(h % 7 == 0) {
+			archive->set_file_data(name, "", 0);
+			expected[name] = "";
+		}
+	}
+	for(int i = 0; i < 5; i++) {
+		const auto name = "empty/e" + std::to_string(i) + ".txt";
+		archive->set_file_data(name, "", 0);
+		expected[name] = "";
+	}
+	vpklib::vpk_update_options update;
+	update.max_archive_size = 64 << 10;
+	std::string error;
+	check(archive->save(update, &error), "saving the changes: " + error);
+
+	vpklib::vpk_compact_options options;
+	options.max_archive_size = 64 << 10;
+	options.md5_chunk_size = 4096;
+
+	auto before = archive->compact(options);
+	check(before.ok && before.fragmentation_before > 0, "removed files should show up as fragmentation");
+	check(before.ok && before.bytes_after < before.bytes_before, "compacting reclaimed nothing");
+	archive.reset(vpklib::vpk_archive::read_from_disk(path));
+	check(archive && contents_of(archive.get()) == expected, "contents changed by the first compaction");
+
+	// A compacted archive scores 0, and compacting again moves everything to a fresh index range
+	if(archive) {
+		auto again = archive->compact(options);
+		check(again.ok && again.fragmentation_before == 0, "a compacted archive should not be fragmented");
+		archive.reset(vpklib::vpk_archive::read_from_disk(path));
+	}
+	if(archive)
+		compact_and_check(archive, path, expected, options, "second compaction");
+
+	// The requested files come first, in the requested order
+	if(archive) {
+		std::vector<std::string> names;
+		for(auto h = archive->get_file_count(); h-- > 0 && names.size() < 20;) {
+			if(archive->get_file_archive_index(h) != 0x7FFF && archive->get_file_size(h) > archive->get_file_preload_size(h))
+				names.push_back(archive->get_file_name(h));
+		}
+		options.order.clear();
+		for(const auto& name : names)
+			options.order.push_back(archive->find_file(name));
+		compact_and_check(archive, path, expected, options, "ordered compaction");
+
+		std::tuple<int, std::uint64_t> prev = {-1, 0};
+		for(std::size_t i = 0; archive && i < names.size(); i++) {
+			const std::tuple<int, std::uint64_t> place = {archive->get_file_archive_index(names[i]), archive->get_file_offset(names[i])};
+			check(i == 0 ? std::get<1>(place) == 0 : prev < place, "'" + names[i] + "' isn't laid out in the requested order");
+			prev = place;
+		}
+	}
+
+	archive.reset();
+	std::filesystem::remove_all(dir);
+	if(!failures)
+		printf("All compact checks passed\n");
+	return failures ? 1 : 0;
+}
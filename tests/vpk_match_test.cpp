@@ -0,0 +1,88 @@
+// Checks that vpk_path_matcher::select, which skips whole directory groups, agrees with matching every name
+
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_corpus.hpp"
+#include "vpk_match.hpp"
+
+int main()
+{
+	const auto dir = std::filesystem::temp_directory_path() / ("vpk_match_test_" + std::to_string(getpid()));
+	const auto path = dir / "pak01_dir.vpk";
+
+	// Half the files have no extension, like readme or Makefile
+	vpklib::vpk_corpus_options options;
+	options.file_count = 2000;
+	options.size_median = 64;
+	options.size_max = 1024;
+	options.extensions = {{"", 1}, {"txt", 1}};
+	auto corpus = vpklib::generate_corpus(path, options);
+	if(!corpus.ok) {
+		fprintf(stderr, "FAILED: generating the archive: %s\n", corpus.error.c_str());
+		return 1;
+	}
+
+	std::unique_ptr<vpklib::vpk_archive> archive(vpklib::vpk_archive::read_from_disk(path));
+	if(!archive) {
+		fprintf(stderr, "FAILED: opening '%s'\n", path.c_str());
+		std::filesystem::remove_all(dir);
+		return 1;
+	}
+
+	struct check
+	{
+		const char* pattern;
+		bool extensionless;	// Must match at least one file without an extension
+	};
+	const check checks[] = {
+		{"**/*a", true},
+		{"**/f*0", true},
+		{"**/f00000001", true},
+		{"*.txt", false},
+		{"materials/**", true},
+		{"**", true},
+	};
+
+	int failures = 0;
+	const auto& names = archive->get_file_names();
+	for(const auto& c : checks) {
+		vpklib::vpk_path_matcher matcher;
+		std::string error;
+		if(!matcher.add_pattern(c.pattern, vpklib::vpk_path_matcher::syntax::glob, &error)) {
+			fprintf(stderr, "FAILED: pattern '%s': %s\n", c.pattern, error.c_str());
+			failures++;
+			continue;
+		}
+
+		std::vector<vpklib::vpk_file_handle> expected;
+		bool extensionless = false;
+		for(vpklib::vpk_file_handle h = 0; h < names.size(); h++) {
+			if(matcher.matches(names[h])) {
+				expected.push_back(h);
+				extensionless |= names[h].find('.') == std::string::npos;
+			}
+		}
+
+		if(matcher.select(archive.get()) != expected) {
+			fprintf(stderr, "FAILED: select and matches disagree for '%s'\n", c.pattern);
+			failures++;
+		}
+		if(c.extensionless && !extensionless) {
+			fprintf(stderr, "FAILED: '%s' matched no file without an extension\n", c.pattern);
+			failures++;
+		}
+	}
+
+	archive.reset();
+	std::filesystem::remove_all(dir);
+	if(!failures)
+		printf("All %zu patterns passed\n", std::size(checks));
+	return failures ? 1 : 0;
+}
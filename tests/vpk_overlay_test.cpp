@@ -0,0 +1,112 @@
+// Mounts archives with overlapping files into a vpk_overlay and checks which one wins each path, before and
+// after unmounting and remounting
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_overlay.hpp"
+#include "vpk_writer.hpp"
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const std::string& what) {
+		if(!condition) {
+			fprintf(stderr, "FAILED: %s\n", what.c_str());
+			failures++;
+		}
+	}
+
+	std::unique_ptr<vpklib::vpk_archive> pack(const std::filesystem::path& path, const std::map<std::string, std::string>& files) {
+		vpklib::vpk_writer writer;
+		for(const auto& [name, data] : files)
+			writer.add_data(name, data.data(), data.size());
+		if(!writer.write(path).ok)
+			return nullptr;
+		return std::unique_ptr<vpklib::vpk_archive>(vpklib::vpk_archive::read_from_disk(path));
+	}
+
+	// Contents of the file a path resolves to, or "" if it doesn't resolve
+	std::string resolve(const vpklib::vpk_overlay& overlay, const std::string& name) {
+		auto entry = overlay.find_file(name);
+		if(!entry)
+			return "";
+		auto [data, size] = entry.archive->get_file_data(entry.handle);
+		std::string out(static_cast<const char*>(data), data ? size : 0);
+		free(data);
+		return out;
+	}
+
+}
+
+int main()
+{
+	const auto dir = std::filesystem::temp_directory_path() / ("vpk_overlay_test_" + std::to_string(getpid()));
+
+	auto base = pack(dir / "base_dir.vpk", {
+		{"materials/a.vmt", "base a"},
+		{"materials/b.vmt", "base b"},
+		{"sound/x.wav", "base x"},
+	});
+	auto dlc = pack(dir / "dlc_dir.vpk", {
+		{"materials/a.vmt", "dlc a"},
+		{"Materials/C.vmt", "dlc c"},
+	});
+	auto mod = pack(dir / "mod_dir.vpk", {
+		{"materials/b.vmt", "mod b"},
+	});
+	if(!base || !dlc || !mod) {
+		fprintf(stderr, "FAILED: packing the archives\n");
+		std::filesystem::remove_all(dir);
+		return 1;
+	}
+
+	vpklib::vpk_overlay overlay;
+	check(overlay.mount(base.get(), 0), "mounting base");
+	check(overlay.mount(dlc.get(), 10), "mounting dlc");
+	check(overlay.mount(mod.get(), 0), "mounting mod");
+	check(!overlay.mount(mod.get(), 5), "mounting the same archive twice");
+
+	// Higher priority wins, the later mount breaks ties, and case and slashes don't matter
+	check(resolve(overlay, "materials/a.vmt") == "dlc a", "a higher priority archive should win");
+	check(resolve(overlay, "materials/b.vmt") == "mod b", "the later mount should win a tie");
+	check(resolve(overlay, "sound/x.wav") == "base x", "a path only one archive has");
+	check(resolve(overlay, "MATERIALS\\A.VMT") == "dlc a", "lookups should ignore case and slash direction");
+	check(resolve(overlay, "materials/c.vmt") == "dlc c", "a path spelled differently in the archive");
+	check(!overlay.find_file("materials/missing.vmt"), "a path no archive has");
+	check(overlay.get_file_count() == 4, "wrong number of distinct paths");
+	check(overlay.get_mounts() == std::vector<vpklib::vpk_archive*>{dlc.get(), mod.get(), base.get()}, "mounts in the wrong order");
+
+	// Unmounting hands the paths back to the best remaining archive
+	check(overlay.unmount(dlc.get()), "unmounting dlc");
+	check(!overlay.unmount(dlc.get()), "unmounting an archive that isn't mounted");
+	check(resolve(overlay, "materials/a.vmt") == "base a", "a path should fall back after unmounting its winner");
+	check(!overlay.find_file("materials/c.vmt"), "a path only the unmounted archive had");
+	check(overlay.get_file_count() == 3, "wrong number of paths after unmounting");
+
+	check(overlay.unmount(mod.get()), "unmounting mod");
+	check(resolve(overlay, "materials/b.vmt") == "base b", "a tie should fall back to the remaining archive");
+
+	// Remounting below base only adds what base doesn't have
+	check(overlay.mount(dlc.get(), -1), "remounting dlc");
+	check(resolve(overlay, "materials/a.vmt") == "base a", "a lower priority archive shouldn't win");
+	check(resolve(overlay, "materials/c.vmt") == "dlc c", "a remounted archive's own paths");
+	check(overlay.get_mounts() == std::vector<vpklib::vpk_archive*>{base.get(), dlc.get()}, "mounts in the wrong order after remounting");
+
+	base.reset();
+	dlc.reset();
+	mod.reset();
+	std::filesystem::remove_all(dir);
+	if(!failures)
+		printf("All overlay checks passed\n");
+	return failures ? 1 : 0;
+}
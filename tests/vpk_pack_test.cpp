@@ -0,0 +1,109 @@
+// Packs files with vpk_writer and checks that they read back and pass both verifications, for VPK1 and VPK2
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_writer.hpp"
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const std::string& what) {
+		if(!condition) {
+			fprintf(stderr, "FAILED: %s\n", what.c_str());
+			failures++;
+		}
+	}
+
+	std::string random_bytes(std::mt19937_64& rng, std::size_t size) {
+		std::string out(size, '\0');
+		for(auto& c : out)
+			c = static_cast<char>(rng());
+		return out;
+	}
+
+	std::string read_all(vpklib::vpk_archive* archive, const std::string& name) {
+		auto [data, size] = archive->get_file_data(name);
+		std::string out(static_cast<const char*>(data), data ? size : 0);
+		free(data);
+		return out;
+	}
+
+	void pack_and_check(const std::filesystem::path& dir, std::uint32_t version) {
+		const auto label = "VPK" + std::to_string(version) + ": ";
+		std::mt19937_64 rng(version);
+
+		// Small files, a duplicate pair, an empty file, one without an extension and enough data for several archives
+		std::map<std::string, std::string> files;
+		files["materials/a.vmt"] = "\"LightmappedGeneric\" { \"$basetexture\" \"a\" }";
+		files["materials/copy/b.vmt"] = files["materials/a.vmt"];
+		files["empty.txt"] = "";
+		files["README"] = "no extension";
+		files["materials/big.vtf"] = random_bytes(rng, 300 << 10);
+		for(int i = 0; i < 40; i++)
+			files["sound/s" + std::to_string(i) + ".wav"] = random_bytes(rng, 1 + rng() % (20 << 10));
+
+		vpklib::vpk_writer_options options;
+		options.version = version;
+		options.max_archive_size = 128 << 10;
+		options.md5_chunk_size = 4096;
+		options.preload_budget = 4096;
+		vpklib::vpk_writer writer(options);
+		for(const auto& [name, data] : files) {
+			std::string error;
+			check(writer.add_data(name, data.data(), data.size(), &error), label + "adding '" + name + "': " + error);
+		}
+
+		const auto path = dir / ("v" + std::to_string(version) + "_dir.vpk");
+		auto written = writer.write(path);
+		check(written.ok, label + "writing the archive: " + written.error);
+		check(written.duplicate_files == 1, label + "the duplicate wasn't stored once");
+		check(written.archives > 1, label + "the data should span several archives");
+		if(!written.ok)
+			return;
+
+		std::unique_ptr<vpklib::vpk_archive> archive(vpklib::vpk_archive::read_from_disk(path));
+		if(!archive) {
+			check(false, label + "opening the packed archive");
+			return;
+		}
+		check(archive->get_file_count() == files.size(), label + "wrong number of files");
+		for(const auto& [name, data] : files)
+			check(read_all(archive.get(), name) == data, label + "'" + name + "' didn't read back");
+		check(archive->get_file_archive_index("materials/a.vmt") == archive->get_file_archive_index("materials/copy/b.vmt")
+			&& archive->get_file_offset("materials/a.vmt") == archive->get_file_offset("materials/copy/b.vmt"),
+			label + "the duplicates don't share their data");
+
+		auto crc = archive->verify();
+		check(crc.ok() && crc.files == files.size(), label + "verify failed");
+		auto md5 = archive->verify_md5();
+		check(md5.ok(), label + "verify_md5 failed");
+		check(md5.has_checksums == (version == 2), label + "MD5 sections present on the wrong version");
+		if(version == 2)
+			check(md5.chunks > 0, label + "no MD5 chunks were checked");
+	}
+
+}
+
+int main()
+{
+	const auto dir = std::filesystem::temp_directory_path() / ("vpk_pack_test_" + std::to_string(getpid()));
+	std::filesystem::create_directories(dir);
+
+	pack_and_check(dir, 1);
+	pack_and_check(dir, 2);
+
+	std::filesystem::remove_all(dir);
+	if(!failures)
+		printf("All pack checks passed\n");
+	return failures ? 1 : 0;
+}
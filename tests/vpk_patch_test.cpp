@@ -0,0 +1,143 @@
+// Makes a patch between two versions of an archive, applies it to a copy of the old one and checks that
+// diff_archives then finds no difference. Also checks reapplying and applying to the wrong version
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_corpus.hpp"
+#include "vpk_diff.hpp"
+#include "vpk_patch.hpp"
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const std::string& what) {
+		if(!condition) {
+			fprintf(stderr, "FAILED: %s\n", what.c_str());
+			failures++;
+		}
+	}
+
+	std::string read_all(vpklib::vpk_archive* archive, vpklib::vpk_file_handle handle) {
+		auto [data, size] = archive->get_file_data(handle);
+		std::string out(static_cast<const char*>(data), data ? size : 0);
+		free(data);
+		return out;
+	}
+
+	std::unique_ptr<vpklib::vpk_archive> open_copy(const std::filesystem::path& from, const std::filesystem::path& to) {
+		std::filesystem::create_directories(to);
+		std::filesystem::copy(from, to, std::filesystem::copy_options::recursive | std::filesystem::copy_options::overwrite_existing);
+		return std::unique_ptr<vpklib::vpk_archive>(vpklib::vpk_archive::read_from_disk(to / "pak01_dir.vpk"));
+	}
+
+	bool same_files(vpklib::vpk_archive& a, vpklib::vpk_archive& b) {
+		auto diff = vpklib::diff_archives(a, b);
+		return diff.ok && diff.entries.empty();
+	}
+
+}
+
+int main()
+{
+	const auto dir = std::filesystem::temp_directory_path() / ("vpk_patch_test_" + std::to_string(getpid()));
+	const auto oldDir = dir / "old";
+
+	vpklib::vpk_corpus_options corpus;
+	corpus.file_count = 150;
+	corpus.size_median = 2048;
+	corpus.size_max = 64 << 10;
+	corpus.md5_chunk_size = 4096;
+	auto generated = vpklib::generate_corpus(oldDir / "pak01_dir.vpk", corpus);
+	if(!generated.ok) {
+		fprintf(stderr, "FAILED: generating the archive: %s\n", generated.error.c_str());
+		return 1;
+	}
+
+	auto oldArchive = open_copy(oldDir, dir / "old_ro");
+	auto newArchive = open_copy(oldDir, dir / "new");
+	if(!oldArchive || !newArchive) {
+		fprintf(stderr, "FAILED: opening the copies\n");
+		std::filesystem::remove_all(dir);
+		return 1;
+	}
+
+	// The new version: a small edit inside the biggest file (a delta), a small file replaced, one added, one removed
+	vpklib::vpk_file_handle biggest = 0, smallest = 0;
+	for(vpklib::vpk_file_handle h = 0; h < newArchive->get_file_count(); h++) {
+		if(newArchive->get_file_size(h) > newArchive->get_file_size(biggest))
+			biggest = h;
+		if(newArchive->get_file_size(h) && newArchive->get_file_size(h) < newArchive->get_file_size(smallest))
+			smallest = h;
+	}
+	const auto biggestName = newArchive->get_file_name(biggest);
+	const auto smallestName = newArchive->get_file_name(smallest);
+	const auto removedName = newArchive->get_file_name(biggest == 1 || smallest == 1 ? 2 : 1);
+
+	auto edited = read_all(newArchive.get(), biggest);
+	check(edited.size() >= 16 << 10, "the corpus has no file big enough for a delta");
+	edited.replace(edited.size() / 2, 5, "EDIT!");
+	edited += "appended";
+	check(newArchive->set_file_data(biggestName, edited.data(), edited.size()), "editing the biggest file");
+	check(newArchive->set_file_data(smallestName, "replaced", 8), "replacing the smallest file");
+	check(newArchive->set_file_data("added/new.txt", "added", 5), "adding a file");
+	check(newArchive->remove_file(removedName), "removing a file");
+	std::string error;
+	check(newArchive->save({}, &error), "saving the new version: " + error);
+
+	vpklib::vpk_patch_options options;
+	options.delta_min_size = 4096;
+	options.block_size = 512;
+	options.update.md5_chunk_size = 4096;
+	const auto patchPath = dir / "update.patch";
+	auto created = vpklib::create_patch(*oldArchive, *newArchive, patchPath, options);
+	check(created.ok, "creating the patch: " + created.error);
+	check(created.added == 1 && created.removed == 1 && created.deltas == 1 && created.replaced == 1,
+		"the patch doesn't hold one of each kind of change");
+	check(created.copied_bytes > created.literal_bytes, "the delta copied less than it carried");
+
+	// Old copy + patch == new
+	auto target = open_copy(oldDir, dir / "target");
+	if(target) {
+		auto applied = vpklib::apply_patch(*target, patchPath, options);
+		check(applied.ok && applied.skipped == 0, "applying the patch: " + applied.error);
+		target.reset(vpklib::vpk_archive::read_from_disk(dir / "target" / "pak01_dir.vpk"));
+	}
+	check(target && same_files(*target, *newArchive), "the patched archive differs from the new version");
+	check(target && target->verify().ok() && target->verify_md5().ok(), "the patched archive doesn't verify");
+
+	// Applying again finds everything done already
+	if(target) {
+		auto again = vpklib::apply_patch(*target, patchPath, options);
+		check(again.ok && again.skipped == 4 && !target->is_dirty(), "reapplying the patch should skip every entry");
+		check(same_files(*target, *newArchive), "reapplying the patch changed the archive");
+	}
+
+	// A target that doesn't hold the version the patch was made from is refused and left alone
+	auto other = open_copy(oldDir, dir / "other");
+	if(other) {
+		check(other->set_file_data(biggestName, "diverged", 8) && other->save({}, &error), "preparing a diverged copy");
+		other.reset(vpklib::vpk_archive::read_from_disk(dir / "other" / "pak01_dir.vpk"));
+		auto reference = open_copy(dir / "other", dir / "other_before");
+		auto refused = other ? vpklib::apply_patch(*other, patchPath, options) : vpklib::vpk_patch_result{};
+		check(!refused.ok && !refused.error.empty(), "a patch for a different version was applied");
+		other.reset(vpklib::vpk_archive::read_from_disk(dir / "other" / "pak01_dir.vpk"));
+		check(other && reference && same_files(*other, *reference), "a refused patch changed the target");
+	}
+
+	oldArchive.reset();
+	newArchive.reset();
+	target.reset();
+	other.reset();
+	std::filesystem::remove_all(dir);
+	if(!failures)
+		printf("All patch checks passed\n");
+	return failures ? 1 : 0;
+}
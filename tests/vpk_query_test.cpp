@@ -0,0 +1,132 @@
+// Checks vpk_query against predicates evaluated file by file, including negated groups and extensionless files,
+// and that malformed queries are rejected
+
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_corpus.hpp"
+#include "vpk_query.hpp"
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const std::string& what) {
+		if(!condition) {
+			fprintf(stderr, "FAILED: %s\n", what.c_str());
+			failures++;
+		}
+	}
+
+	std::string extension(const std::string& name) {
+		const auto slash = name.rfind('/');
+		const auto dot = name.rfind('.');
+		return dot == std::string::npos || (slash != std::string::npos && dot < slash) ? "" : name.substr(dot + 1);
+	}
+
+	bool contains(const std::string& s, char c) {
+		return s.find(c) != std::string::npos;
+	}
+
+}
+
+int main()
+{
+	const auto dir = std::filesystem::temp_directory_path() / ("vpk_query_test_" + std::to_string(getpid()));
+	const auto path = dir / "pak01_dir.vpk";
+
+	vpklib::vpk_corpus_options options;
+	options.file_count = 1000;
+	options.size_median = 1024;
+	options.size_max = 16 << 10;
+	options.extensions = {{"", 1}, {"txt", 1}, {"vtf", 1}};
+	options.preload_ratio = 0.2;
+	options.embedded_ratio = 0.1;
+	auto corpus = vpklib::generate_corpus(path, options);
+	if(!corpus.ok) {
+		fprintf(stderr, "FAILED: generating the archive: %s\n", corpus.error.c_str());
+		return 1;
+	}
+
+	std::unique_ptr<vpklib::vpk_archive> archive(vpklib::vpk_archive::read_from_disk(path));
+	if(!archive) {
+		fprintf(stderr, "FAILED: opening '%s'\n", path.c_str());
+		std::filesystem::remove_all(dir);
+		return 1;
+	}
+
+	const auto* a = archive.get();
+	auto ext = [&](vpklib::vpk_file_handle h) { return extension(a->get_file_name(h)); };
+	auto size = [&](vpklib::vpk_file_handle h) { return a->get_file_size(h); };
+	auto under = [&](vpklib::vpk_file_handle h, const std::string& d) { return a->get_file_name(h).starts_with(d + "/"); };
+	const auto someCrc = a->get_file_crc32(5);
+	const auto someSize = a->get_file_size(5);
+	char crcText[32], sizeText[32];
+	snprintf(crcText, sizeof(crcText), "crc:0x%08X", someCrc);
+	snprintf(sizeText, sizeof(sizeText), "size:0x%llx", static_cast<unsigned long long>(someSize));
+
+	struct query_check
+	{
+		std::string query;
+		std::function<bool(vpklib::vpk_file_handle)> expected;
+	};
+	const query_check checks[] = {
+		{"", [](auto) { return true; }},
+		{"ext:vtf", [&](auto h) { return ext(h) == "vtf"; }},
+		{"ext:.vtf", [&](auto h) { return ext(h) == "vtf"; }},
+		{"ext:", [&](auto h) { return ext(h).empty(); }},
+		{"ext:,txt", [&](auto h) { return ext(h).empty() || ext(h) == "txt"; }},
+		{"!(ext:vtf)", [&](auto h) { return ext(h) != "vtf"; }},
+		{"!( ext:vtf )", [&](auto h) { return ext(h) != "vtf"; }},
+		{"-(ext:vtf or ext:txt)", [&](auto h) { return ext(h).empty(); }},
+		{"not (ext:vtf or size>1K)", [&](auto h) { return ext(h) != "vtf" && size(h) <= 1024; }},
+		{"!ext:txt", [&](auto h) { return ext(h) != "txt"; }},
+		{"!(!(ext:txt))", [&](auto h) { return ext(h) == "txt"; }},
+		{"dir:materials", [&](auto h) { return under(h, "materials"); }},
+		{"dir:materials/ size>=1K", [&](auto h) { return under(h, "materials") && size(h) >= 1024; }},
+		{"(dir:materials or dir:sound) !ext:txt", [&](auto h) { return (under(h, "materials") || under(h, "sound")) && ext(h) != "txt"; }},
+		{"size<100 or preload>0", [&](auto h) { return size(h) < 100 || a->get_file_preload_size(h) > 0; }},
+		{sizeText, [&](auto h) { return size(h) == someSize; }},
+		{"archive:dir", [&](auto h) { return a->get_file_archive_index(h) == 0x7FFF; }},
+		{"archive!=dir size>0", [&](auto h) { return a->get_file_archive_index(h) != 0x7FFF && size(h) > 0; }},
+		{"name:**/*.vtf", [&](auto h) { return ext(h) == "vtf"; }},
+		{"!(re:.*(a|b).*)", [&](auto h) { return !contains(a->get_file_name(h), 'a') && !contains(a->get_file_name(h), 'b'); }},
+		{crcText, [&](auto h) { return a->get_file_crc32(h) == someCrc; }},
+		{"f0000000", [&](auto h) { return a->get_file_name(h).find("f0000000") != std::string::npos; }},
+	};
+
+	for(const auto& c : checks) {
+		vpklib::vpk_query query;
+		std::string error;
+		if(!query.parse(c.query, &error)) {
+			check(false, "'" + c.query + "' didn't parse: " + error);
+			continue;
+		}
+		std::vector<vpklib::vpk_file_handle> expected;
+		for(vpklib::vpk_file_handle h = 0; h < archive->get_file_count(); h++) {
+			if(c.expected(h))
+				expected.push_back(h);
+		}
+		check(query.select(archive.get()) == expected, "'" + c.query + "' selected the wrong files");
+		check(!expected.empty(), "'" + c.query + "' should match something in the corpus");
+	}
+
+	for(const auto* bad : {"(ext:vtf", "ext:vtf)", "!(", "()", "or", "bogus:1", "size>abc", "size>-1", "size>1Q", "dir<x"}) {
+		vpklib::vpk_query query;
+		std::string error;
+		check(!query.parse(bad, &error) && !error.empty(), std::string("'") + bad + "' should be rejected");
+	}
+
+	archive.reset();
+	std::filesystem::remove_all(dir);
+	if(!failures)
+		printf("All query checks passed\n");
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,140 @@
+// Checks in-place updates: names the reader can't hold are refused, and saved changes survive a reload
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_corpus.hpp"
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const std::string& what) {
+		if(!condition) {
+			fprintf(stderr, "FAILED: %s\n", what.c_str());
+			failures++;
+		}
+	}
+
+	std::string read_all(vpklib::vpk_archive* archive, const std::string& name) {
+		auto [data, size] = archive->get_file_data(name);
+		std::string out(static_cast<const char*>(data), data ? size : 0);
+		free(data);
+		return out;
+	}
+
+	// Every file and its contents, as the archive reads now
+	std::map<std::string, std::string> contents_of(vpklib::vpk_archive* archive) {
+		std::map<std::string, std::string> out;
+		for(vpklib::vpk_file_handle h = 0; h < archive->get_file_count(); h++) {
+			const auto name = archive->get_file_name(h);
+			out[name] = read_all(archive, name);
+		}
+		return out;
+	}
+
+	// Saves, reloads and compares against what the archive should now hold
+	void save_and_check(std::unique_ptr<vpklib::vpk_archive>& archive, const std::filesystem::path& path,
+		const std::map<std::string, std::string>& expected, const std::string& label) {
+		vpklib::vpk_update_options options;
+		options.max_archive_size = 64 << 10;
+		options.md5_chunk_size = 4096;
+		std::string error;
+		check(archive->save(options, &error), label + ": save failed: " + error);
+		check(!archive->is_dirty(), label + ": still dirty after saving");
+
+		archive.reset(vpklib::vpk_archive::read_from_disk(path));
+		if(!archive) {
+			check(false, label + ": reloading the saved archive failed");
+			return;
+		}
+		check(contents_of(archive.get()) == expected, label + ": the reloaded archive doesn't hold what was saved");
+		check(archive->verify().ok(), label + ": verify failed after saving");
+		check(archive->verify_md5().ok(), label + ": verify_md5 failed after saving");
+	}
+
+}
+
+int main()
+{
+	const auto dir = std::filesystem::temp_directory_path() / ("vpk_update_test_" + std::to_string(getpid()));
+	const auto path = dir / "pak01_dir.vpk";
+
+	vpklib::vpk_corpus_options options;
+	options.file_count = 200;
+	options.size_median = 256;
+	options.size_max = 4096;
+	auto corpus = vpklib::generate_corpus(path, options);
+	if(!corpus.ok) {
+		fprintf(stderr, "FAILED: generating the archive: %s\n", corpus.error.c_str());
+		return 1;
+	}
+
+	std::unique_ptr<vpklib::vpk_archive> archive(vpklib::vpk_archive::read_from_disk(path));
+	if(!archive) {
+		fprintf(stderr, "FAILED: opening '%s'\n", path.c_str());
+		std::filesystem::remove_all(dir);
+		return 1;
+	}
+	auto expected = contents_of(archive.get());
+
+	// One past the longest component the reader can hold, in each of the three tree levels
+	const std::string tooLong(vpklib::MAX_NAME_COMPONENT + 1, 'a');
+	const std::string longest(vpklib::MAX_NAME_COMPONENT, 'b');
+	const std::string contents = "contents";
+	for(const auto& name : {tooLong + "/f.txt", "d/" + tooLong + ".txt", "d/f." + tooLong, std::string(600, 'c') + "/f.txt"}) {
+		std::string error;
+		check(!archive->set_file_data(name, contents.data(), contents.size(), &error), "an oversized component was accepted");
+		check(!error.empty(), "an oversized component was refused without an error");
+	}
+	check(!archive->is_dirty(), "a refused name left the archive dirty");
+
+	// The longest components that fit are stored and read back
+	const auto fits = longest + "/" + longest + "." + longest;
+	check(archive->set_file_data(fits, contents.data(), contents.size()), "the longest components were refused");
+	expected[fits] = contents;
+	save_and_check(archive, path, expected, "longest names");
+	if(!archive) {
+		std::filesystem::remove_all(dir);
+		return 1;
+	}
+
+	// Replace, add (enough to start new archives), remove and add an empty file, all in one save
+	const auto replaced = archive->get_file_name(0);
+	const auto removed = archive->get_file_name(1);
+	const std::string bigName = "added/big.bin";
+	std::string big(200 << 10, '\0');
+	for(std::size_t i = 0; i < big.size(); i++)
+		big[i] = static_cast<char>(i * 2654435761u >> 24);
+
+	check(archive->set_file_data(replaced, contents.data(), contents.size()), "replacing a file");
+	check(archive->set_file_data(bigName, big.data(), big.size()), "adding a file");
+	check(archive->set_file_data("added/empty", "", 0), "adding an empty file");
+	check(archive->remove_file(removed), "removing a file");
+	check(!archive->remove_file("no/such/file.txt"), "removing a file that isn't there");
+	check(archive->is_dirty(), "changes didn't mark the archive dirty");
+	check(read_all(archive.get(), replaced) == contents, "the replacement isn't visible before saving");
+	check(read_all(archive.get(), bigName) == big, "the added file isn't visible before saving");
+
+	expected[replaced] = contents;
+	expected[bigName] = big;
+	expected["added/empty"] = "";
+	expected.erase(removed);
+	save_and_check(archive, path, expected, "mixed changes");
+	if(archive)
+		check(archive->find_file(removed) == vpklib::INVALID_HANDLE, "the removed file is still there after reloading");
+
+	archive.reset();
+	std::filesystem::remove_all(dir);
+	if(!failures)
+		printf("All update checks passed\n");
+	return failures ? 1 : 0;
+}
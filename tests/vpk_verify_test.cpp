@@ -0,0 +1,157 @@
+// Checks verify and verify_md5: clean archives pass, an interrupted scan resumes from its checkpoint,
+// and a flipped byte is reported against the right file and chunk
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "vpk.hpp"
+#include "vpk_corpus.hpp"
+
+namespace {
+
+	int failures = 0;
+
+	void check(bool condition, const std::string& what) {
+		if(!condition) {
+			fprintf(stderr, "FAILED: %s\n", what.c_str());
+			failures++;
+		}
+	}
+
+	// Runs a rate limited scan and keeps a copy of the first checkpoint it writes, standing in for an
+	// interrupted run. Returns false if the scan finished before one was seen
+	bool interrupted_checkpoint(const std::function<void()>& scan, const std::filesystem::path& checkpoint, const std::filesystem::path& copy) {
+		std::atomic<bool> finished = false;
+		std::thread worker([&]() {
+			scan();
+			finished = true;
+		});
+
+		bool copied = false;
+		while(!copied && !finished) {
+			std::error_code ec;
+			copied = std::filesystem::copy_file(checkpoint, copy, std::filesystem::copy_options::overwrite_existing, ec) && !ec;
+			if(!copied)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		worker.join();
+		return copied;
+	}
+
+}
+
+int main()
+{
+	const auto dir = std::filesystem::temp_directory_path() / ("vpk_verify_test_" + std::to_string(getpid()));
+	const auto path = dir / "pak01_dir.vpk";
+
+	vpklib::vpk_corpus_options corpus;
+	corpus.file_count = 64;
+	corpus.distribution = vpklib::vpk_corpus_options::size_distribution::fixed;
+	corpus.size_median = 4096;
+	corpus.preload_ratio = 0;
+	corpus.embedded_ratio = 0;
+	corpus.md5_chunk_size = 4096;
+	auto generated = vpklib::generate_corpus(path, corpus);
+	if(!generated.ok) {
+		fprintf(stderr, "FAILED: generating the archive: %s\n", generated.error.c_str());
+		return 1;
+	}
+
+	std::unique_ptr<vpklib::vpk_archive> archive(vpklib::vpk_archive::read_from_disk(path));
+	if(!archive) {
+		fprintf(stderr, "FAILED: opening '%s'\n", path.c_str());
+		std::filesystem::remove_all(dir);
+		return 1;
+	}
+	const auto files = archive->get_file_count();
+	const auto chunks = archive->get_archive_md5_entries().size();
+
+	auto crc = archive->verify();
+	check(crc.ok() && crc.files == files && crc.resumed == 0, "verify of a clean archive");
+	auto md5 = archive->verify_md5();
+	check(md5.ok() && md5.chunks == chunks && md5.resumed == 0, "verify_md5 of a clean archive");
+
+	// About half a second per scan, so the first checkpoint is written well before the end
+	vpklib::vpk_verify_options slow;
+	slow.threads = 1;
+	slow.buffer_size = 4096;
+	slow.max_bytes_per_second = generated.bytes * 2;
+	slow.checkpoint = (dir / "scan.checkpoint").string();
+	slow.checkpoint_interval = 0;
+	const auto saved = dir / "saved.checkpoint";
+
+	vpklib::vpk_verify_options resume;
+	resume.checkpoint = slow.checkpoint;
+
+	if(interrupted_checkpoint([&]() { archive->verify(slow); }, slow.checkpoint, saved)) {
+		check(!std::filesystem::exists(slow.checkpoint), "verify left its checkpoint behind");
+		std::filesystem::copy_file(saved, slow.checkpoint);
+		crc = archive->verify(resume);
+		check(crc.ok() && crc.files == files, "verify resumed from a checkpoint");
+		check(crc.resumed > 0 && crc.resumed < files, "verify didn't pick up the checkpoint");
+
+		// The same checkpoint doesn't apply to a different selection of files
+		std::filesystem::copy_file(saved, slow.checkpoint, std::filesystem::copy_options::overwrite_existing);
+		crc = archive->verify({0, 1, 2}, resume);
+		check(crc.ok() && crc.files == 3 && crc.resumed == 0, "verify resumed a checkpoint of a different selection");
+	}
+	else
+		check(false, "verify finished before writing a checkpoint");
+
+	if(interrupted_checkpoint([&]() { archive->verify_md5(slow); }, slow.checkpoint, saved)) {
+		std::filesystem::copy_file(saved, slow.checkpoint, std::filesystem::copy_options::overwrite_existing);
+		md5 = archive->verify_md5(resume);
+		check(md5.ok() && md5.chunks == chunks, "verify_md5 resumed from a checkpoint");
+		check(md5.resumed > 0 && md5.resumed < chunks, "verify_md5 didn't pick up the checkpoint");
+	}
+	else
+		check(false, "verify_md5 finished before writing a checkpoint");
+
+	// Flip one byte in the middle of a file's data
+	const vpklib::vpk_file_handle victim = files / 2;
+	const auto index = archive->get_file_archive_index(victim);
+	const auto offset = archive->get_file_offset(victim) + archive->get_file_size(victim) / 2;
+	char num[16];
+	snprintf(num, sizeof(num), "_%03u.vpk", index);
+	const auto archivePath = dir / (std::string("pak01") + num);
+	archive.reset();
+
+	int fd = open(archivePath.c_str(), O_RDWR);
+	char byte = 0;
+	bool flipped = fd >= 0 && pread(fd, &byte, 1, offset) == 1;
+	byte ^= 0x5A;
+	flipped = flipped && pwrite(fd, &byte, 1, offset) == 1;
+	if(fd >= 0)
+		close(fd);
+	check(flipped, "corrupting '" + archivePath.string() + "'");
+
+	archive.reset(vpklib::vpk_archive::read_from_disk(path));
+	if(archive && flipped) {
+		crc = archive->verify();
+		check(crc.failures.size() == 1 && crc.failures[0].handle == victim && !crc.failures[0].read_error,
+			"verify didn't report exactly the corrupted file");
+		md5 = archive->verify_md5();
+		check(md5.failed_chunks.size() == 1 && md5.unreadable_chunks.empty(), "verify_md5 didn't report exactly one chunk");
+		if(md5.failed_chunks.size() == 1) {
+			const auto& e = archive->get_archive_md5_entries()[md5.failed_chunks[0]];
+			check(e.archive_index == index && e.start_offset <= offset && offset < e.start_offset + e.count,
+				"verify_md5 blamed the wrong chunk");
+		}
+	}
+
+	archive.reset();
+	std::filesystem::remove_all(dir);
+	if(!failures)
+		printf("All verify checks passed\n");
+	return failures ? 1 : 0;
+}